@@ -1,4 +1,5 @@
 QT -= gui
+QT += network
 CONFIG += c++11 console
 CONFIG -= app_bundle
 
@@ -6,34 +7,14 @@ CONFIG -= app_bundle
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-INCLUDEPATH += \
-	$${PWD}/deps/ffmpeg/include \
-	$${PWD}/deps/x264/include 
-
-LIBS += \
-	-L$${PWD}/deps/ffmpeg/lib \
-	-L$${PWD}/deps/x264/lib \
-	-lavcodec \
-	-lavdevice \
-	-lavfilter \
-	-lavformat \
-	-lavutil \
-	-lswresample \
-	-lswscale \
-	-lx264 \
-	-ldl
+include( recorder.pri )
 
 HEADERS += \
-	decklink/DeckLinkAPI.h \
-	ffmpegutils.h \
-	decklinkmanager.h \
-	recorder.h
+	controlserver.h
 
 SOURCES += \
-	decklink/DeckLinkAPIDispatch.cpp \
-	decklinkmanager.cpp \
-	main.cpp \
-	recorder.cpp
+	controlserver.cpp \
+	main.cpp
 
 # Default rules for deployment.
 #qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,161 @@
+#include "alignedframeallocator.h"
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <QMutex>
+
+#include "emulator/emulatedframe.h"
+
+///@cond INTERNAL
+
+class AlignedFrameAllocator::PrivateClass
+{
+public:
+	struct Buffer
+	{
+		void *data;
+		uint64_t bytes;
+		bool used;
+	};
+
+	std::atomic<ULONG> mRefCount;
+	mutable QMutex mMutex;
+	// a handful of frames, a linear search is cheaper than anything else
+	std::vector<Buffer> mBuffers;
+
+	PrivateClass()
+	{
+		mRefCount = 1;
+	}
+};
+
+///@endcond INTERNAL
+
+AlignedFrameAllocator::AlignedFrameAllocator()
+{
+	d = new AlignedFrameAllocator::PrivateClass();
+}
+
+AlignedFrameAllocator::~AlignedFrameAllocator()
+{
+	for ( const PrivateClass::Buffer &buffer : d->mBuffers )
+	{
+		free( buffer.data );
+	}
+	delete d;
+	d = nullptr;
+}
+
+uint64_t AlignedFrameAllocator::PageAligned( uint64_t bytes )
+{
+	return ( bytes + PageBytes - 1 ) & ~( uint64_t )( PageBytes - 1 );
+}
+
+uint64_t AlignedFrameAllocator::ReadableBytes( const void *buffer ) const
+{
+	QMutexLocker locker( &d->mMutex );
+	for ( const PrivateClass::Buffer &candidate : d->mBuffers )
+	{
+		if ( candidate.data == buffer )
+		{
+			return candidate.bytes;
+		}
+	}
+	return 0;
+}
+
+HRESULT AlignedFrameAllocator::QueryInterface( REFIID iid, LPVOID *ppv )
+{
+	if ( !ppv )
+	{
+		return E_POINTER;
+	}
+	if ( IsSameInterface( iid, IID_IUnknown ) || IsSameInterface( iid, IID_IDeckLinkMemoryAllocator ) )
+	{
+		*ppv = static_cast<IDeckLinkMemoryAllocator *>( this );
+		AddRef();
+		return S_OK;
+	}
+	*ppv = nullptr;
+	return E_NOINTERFACE;
+}
+
+ULONG AlignedFrameAllocator::AddRef( void )
+{
+	return ++d->mRefCount;
+}
+
+ULONG AlignedFrameAllocator::Release( void )
+{
+	ULONG refCount = --d->mRefCount;
+	if ( refCount == 0 )
+	{
+		delete this;
+	}
+	return refCount;
+}
+
+HRESULT AlignedFrameAllocator::AllocateBuffer( uint32_t bufferSize, void **allocatedBuffer )
+{
+	if ( !allocatedBuffer )
+	{
+		return E_POINTER;
+	}
+	uint64_t bytes = PageAligned( bufferSize );
+	QMutexLocker locker( &d->mMutex );
+	for ( PrivateClass::Buffer &buffer : d->mBuffers )
+	{
+		if ( !buffer.used && buffer.bytes == bytes )
+		{
+			buffer.used = true;
+			*allocatedBuffer = buffer.data;
+			return S_OK;
+		}
+	}
+	void *data = nullptr;
+	if ( posix_memalign( &data, PageBytes, bytes ) != 0 )
+	{
+		*allocatedBuffer = nullptr;
+		return E_OUTOFMEMORY;
+	}
+	// the card fills bufferSize bytes, the padding is written to disk as it is left here
+	memset( ( uint8_t * )data + bufferSize, 0, bytes - bufferSize );
+	d->mBuffers.push_back( { data, bytes, true } );
+	*allocatedBuffer = data;
+	return S_OK;
+}
+
+HRESULT AlignedFrameAllocator::ReleaseBuffer( void *buffer )
+{
+	QMutexLocker locker( &d->mMutex );
+	for ( PrivateClass::Buffer &candidate : d->mBuffers )
+	{
+		if ( candidate.data == buffer )
+		{
+			candidate.used = false;
+			return S_OK;
+		}
+	}
+	return E_INVALIDARG;
+}
+
+HRESULT AlignedFrameAllocator::Commit( void )
+{
+	return S_OK;
+}
+
+HRESULT AlignedFrameAllocator::Decommit( void )
+{
+	QMutexLocker locker( &d->mMutex );
+	for ( size_t i = d->mBuffers.size(); i-- > 0; )
+	{
+		if ( !d->mBuffers[i].used )
+		{
+			free( d->mBuffers[i].data );
+			d->mBuffers.erase( d->mBuffers.begin() + i );
+		}
+	}
+	return S_OK;
+}
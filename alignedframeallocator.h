@@ -0,0 +1,43 @@
+#ifndef ALIGNEDFRAMEALLOCATOR_H
+#define ALIGNEDFRAMEALLOCATOR_H
+
+#include <stdint.h>
+
+#include "decklink/DeckLinkAPI.h"
+
+// frame buffers for the DeckLink input that start on a page and are padded (zeroed) to whole pages, so a
+// captured frame can be written with O_DIRECT from the card's buffer itself. Released buffers are kept and handed
+// out again; Decommit frees the idle ones. Reference counted, the driver holds it while input is enabled.
+class AlignedFrameAllocator : public IDeckLinkMemoryAllocator
+{
+public:
+	static const uint32_t PageBytes = 4096;
+
+	AlignedFrameAllocator();
+
+	// bytes that may be read from a buffer of this allocator (its size up to the next page), 0 for other memory
+	uint64_t ReadableBytes( const void *buffer ) const;
+	static uint64_t PageAligned( uint64_t bytes );
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override;
+	ULONG STDMETHODCALLTYPE AddRef( void ) override;
+	ULONG STDMETHODCALLTYPE Release( void ) override;
+
+	// IDeckLinkMemoryAllocator
+	HRESULT STDMETHODCALLTYPE AllocateBuffer( uint32_t bufferSize, void **allocatedBuffer ) override;
+	HRESULT STDMETHODCALLTYPE ReleaseBuffer( void *buffer ) override;
+	HRESULT STDMETHODCALLTYPE Commit( void ) override;
+	HRESULT STDMETHODCALLTYPE Decommit( void ) override;
+
+private:
+	// the last Release deletes it
+	virtual ~AlignedFrameAllocator();
+	AlignedFrameAllocator( const AlignedFrameAllocator & ) = delete;
+	AlignedFrameAllocator &operator=( const AlignedFrameAllocator & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // ALIGNEDFRAMEALLOCATOR_H
@@ -0,0 +1,244 @@
+#include "allocationtracker.h"
+
+#if __ALLOC_INSTRUMENTATION__
+#include <atomic>
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavutil/buffer.h"
+
+void *__libc_malloc( size_t size );
+void __libc_free( void *ptr );
+void *__libc_calloc( size_t count, size_t size );
+void *__libc_realloc( void *ptr, size_t size );
+void *__libc_memalign( size_t alignment, size_t size );
+}
+
+///@cond INTERNAL
+
+namespace
+{
+
+struct AtomicCounters
+{
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> frees;
+	std::atomic<uint64_t> allocatedBytes;
+	std::atomic<uint64_t> freedBytes;
+	std::atomic<uint64_t> bufferAllocations;
+};
+
+// zero initialized before any constructor runs, so allocations made during static init are counted safely
+AtomicCounters gCounters[AllocationTracker::SlotCount];
+std::atomic<int64_t> gLiveBytes;
+
+// initial-exec keeps it in the static TLS block also when the executable is compiled as position independent
+// code (as Qt wants it), so accessing it never goes through __tls_get_addr, which may allocate
+__attribute__( ( tls_model( "initial-exec" ) ) ) thread_local int tStage = AllocationTracker::OtherStage;
+
+void CountAllocation( void *ptr )
+{
+	if ( !ptr )
+	{
+		return;
+	}
+
+	size_t size = malloc_usable_size( ptr );
+	AtomicCounters &counters = gCounters[tStage];
+	counters.allocations.fetch_add( 1, std::memory_order_relaxed );
+	counters.allocatedBytes.fetch_add( size, std::memory_order_relaxed );
+	gLiveBytes.fetch_add( ( int64_t )size, std::memory_order_relaxed );
+}
+
+void CountFree( size_t size )
+{
+	AtomicCounters &counters = gCounters[tStage];
+	counters.frees.fetch_add( 1, std::memory_order_relaxed );
+	counters.freedBytes.fetch_add( size, std::memory_order_relaxed );
+	gLiveBytes.fetch_sub( ( int64_t )size, std::memory_order_relaxed );
+}
+
+void CountBufferAllocation()
+{
+	gCounters[tStage].bufferAllocations.fetch_add( 1, std::memory_order_relaxed );
+}
+
+template <typename Function>
+Function NextSymbol( const char *name )
+{
+	return ( Function )dlsym( RTLD_NEXT, name );
+}
+
+}
+
+///@endcond INTERNAL
+
+// the executable's definitions interpose glibc's allocator for the whole process (FFmpeg libraries included)
+extern "C" {
+
+void *malloc( size_t size )
+{
+	void *ptr = __libc_malloc( size );
+	CountAllocation( ptr );
+	return ptr;
+}
+
+void free( void *ptr )
+{
+	if ( ptr )
+	{
+		CountFree( malloc_usable_size( ptr ) );
+		__libc_free( ptr );
+	}
+}
+
+void *calloc( size_t count, size_t size )
+{
+	void *ptr = __libc_calloc( count, size );
+	CountAllocation( ptr );
+	return ptr;
+}
+
+void *realloc( void *ptr, size_t size )
+{
+	size_t oldSize = ptr ? malloc_usable_size( ptr ) : 0;
+	void *result = __libc_realloc( ptr, size );
+	if ( result || size == 0 )
+	{
+		if ( ptr )
+		{
+			CountFree( oldSize );
+		}
+		CountAllocation( result );
+	}
+	return result;
+}
+
+void *memalign( size_t alignment, size_t size )
+{
+	void *ptr = __libc_memalign( alignment, size );
+	CountAllocation( ptr );
+	return ptr;
+}
+
+void *aligned_alloc( size_t alignment, size_t size )
+{
+	return memalign( alignment, size );
+}
+
+int posix_memalign( void **memptr, size_t alignment, size_t size )
+{
+	if ( alignment < sizeof( void * ) || ( alignment & ( alignment - 1 ) ) != 0 )
+	{
+		return EINVAL;
+	}
+
+	void *ptr = memalign( alignment, size );
+	if ( !ptr )
+	{
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+// FFmpeg links its libraries with -Bsymbolic, so only calls crossing library boundaries (e.g. libavcodec => libavutil) are seen here
+AVBufferRef *av_buffer_alloc( size_t size )
+{
+	static auto next = NextSymbol<AVBufferRef *( * )( size_t )>( "av_buffer_alloc" );
+	CountBufferAllocation();
+	return next( size );
+}
+
+AVBufferRef *av_buffer_allocz( size_t size )
+{
+	static auto next = NextSymbol<AVBufferRef *( * )( size_t )>( "av_buffer_allocz" );
+	CountBufferAllocation();
+	return next( size );
+}
+
+AVBufferRef *av_buffer_create( uint8_t *data, size_t size, void ( *freeFunction )( void *opaque, uint8_t *data ), void *opaque, int flags )
+{
+	static auto next = NextSymbol<AVBufferRef *( * )( uint8_t *, size_t, void ( * )( void *, uint8_t * ), void *, int )>( "av_buffer_create" );
+	CountBufferAllocation();
+	return next( data, size, freeFunction, opaque, flags );
+}
+
+}
+
+bool AllocationTracker::IsEnabled()
+{
+	return true;
+}
+
+int AllocationTracker::EnterStage( int stage )
+{
+	int previousStage = tStage;
+	tStage = stage;
+	return previousStage;
+}
+
+void AllocationTracker::LeaveStage( int previousStage )
+{
+	tStage = previousStage;
+}
+
+AllocationTracker::Snapshot AllocationTracker::TakeSnapshot()
+{
+	Snapshot snapshot;
+	for ( int i = 0; i < SlotCount; i++ )
+	{
+		snapshot.slots[i].allocations = gCounters[i].allocations;
+		snapshot.slots[i].frees = gCounters[i].frees;
+		snapshot.slots[i].allocatedBytes = gCounters[i].allocatedBytes;
+		snapshot.slots[i].freedBytes = gCounters[i].freedBytes;
+		snapshot.slots[i].bufferAllocations = gCounters[i].bufferAllocations;
+	}
+	snapshot.liveBytes = gLiveBytes;
+	return snapshot;
+}
+
+#else
+
+bool AllocationTracker::IsEnabled()
+{
+	return false;
+}
+
+int AllocationTracker::EnterStage( int /*stage*/ )
+{
+	return OtherStage;
+}
+
+void AllocationTracker::LeaveStage( int /*previousStage*/ )
+{
+}
+
+AllocationTracker::Snapshot AllocationTracker::TakeSnapshot()
+{
+	return Snapshot();
+}
+
+#endif // __ALLOC_INSTRUMENTATION__
+
+AllocationTracker::Counters AllocationTracker::Difference( const Counters &later, const Counters &earlier )
+{
+	Counters result;
+	result.allocations = later.allocations - earlier.allocations;
+	result.frees = later.frees - earlier.frees;
+	result.allocatedBytes = later.allocatedBytes - earlier.allocatedBytes;
+	result.freedBytes = later.freedBytes - earlier.freedBytes;
+	result.bufferAllocations = later.bufferAllocations - earlier.bufferAllocations;
+	return result;
+}
+
+const char *AllocationTracker::SlotName( int slot )
+{
+	if ( slot == OtherStage )
+	{
+		return "other";
+	}
+	return StageProfiler::StageName( ( StageProfiler::Stage )slot );
+}
@@ -0,0 +1,49 @@
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+
+#include <stdint.h>
+
+#include "stageprofiler.h"
+
+// heap accounting is compiled in only by the instrumentation build (qmake CONFIG+=alloc_instrumentation)
+#ifndef __ALLOC_INSTRUMENTATION__
+#define __ALLOC_INSTRUMENTATION__ 0
+#endif
+
+class AllocationTracker
+{
+public:
+	enum
+	{
+		// allocations made outside of any profiled stage
+		OtherStage = StageProfiler::StageCount,
+		SlotCount
+	};
+
+	struct Counters
+	{
+		uint64_t allocations = 0;
+		uint64_t frees = 0;
+		uint64_t allocatedBytes = 0;
+		uint64_t freedBytes = 0;
+		uint64_t bufferAllocations = 0; // AVBuffers created (av_buffer_alloc/allocz/create)
+	};
+
+	struct Snapshot
+	{
+		Counters slots[SlotCount];
+		int64_t liveBytes = 0;
+	};
+
+	static bool IsEnabled();
+
+	// attributes allocations of the calling thread to stage, returns the stage to restore afterwards
+	static int EnterStage( int stage );
+	static void LeaveStage( int previousStage );
+
+	static Snapshot TakeSnapshot();
+	static Counters Difference( const Counters &later, const Counters &earlier );
+	static const char *SlotName( int slot );
+};
+
+#endif // ALLOCATIONTRACKER_H
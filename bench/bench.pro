@@ -0,0 +1,20 @@
+# stage microbenchmarks: qmake && make && ./RecorderBench --output results.json
+QT -= gui
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = RecorderBench
+
+include( ../recorder.pri )
+
+HEADERS += \
+	../emulator/patterngenerator.h \
+	recorderbenchmark.h
+
+SOURCES += \
+	../emulator/patterngenerator.cpp \
+	main.cpp \
+	recorderbenchmark.cpp
+
+# suppres gcc 9 Qt annoying warning QVariant deprecated copy
+QMAKE_CXXFLAGS += -Wno-deprecated-copy
@@ -0,0 +1,184 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QThread>
+
+#include "../decklink/DeckLinkAPI.h"
+#include "../emulator/displaymodes.h"
+#include "../encoderbackend.h"
+#include "recorderbenchmark.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/avutil.h"
+}
+
+static QString CpuModel()
+{
+	QFile cpuinfo( "/proc/cpuinfo" );
+	if ( cpuinfo.open( QIODevice::ReadOnly ) )
+	{
+		for ( QByteArray line = cpuinfo.readLine(); !line.isEmpty(); line = cpuinfo.readLine() )
+		{
+			if ( line.startsWith( "model name" ) )
+			{
+				return QString::fromLatin1( line.mid( line.indexOf( ':' ) + 1 ) ).trimmed();
+			}
+		}
+	}
+	return QString();
+}
+
+static uint32_t FourCC( const QString &code )
+{
+	QByteArray bytes = code.toLatin1();
+	if ( bytes.size() != 4 )
+	{
+		return 0;
+	}
+	return ( ( uint8_t )bytes[0] << 24 ) | ( ( uint8_t )bytes[1] << 16 ) | ( ( uint8_t )bytes[2] << 8 ) | ( uint8_t )bytes[3];
+}
+
+int main( int argc, char *argv[] )
+{
+	QCoreApplication a( argc, argv );
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription( "Times the recorder stages (capture copy, decode, conversion, encode, write) in isolation" );
+	parser.addHelpOption();
+	QCommandLineOption iterationsOption( "iterations", "Timed iterations per benchmark (default 200).", "count", "200" );
+	parser.addOption( iterationsOption );
+	QCommandLineOption warmupOption( "warmup", "Untimed iterations before measuring (default 10).", "count", "10" );
+	parser.addOption( warmupOption );
+	QCommandLineOption modesOption( "modes", "Comma separated display mode four character codes (default Hp50,4k50).", "fourccs", "Hp50,4k50" );
+	parser.addOption( modesOption );
+	QCommandLineOption pixelFormatsOption( "pixel-formats", "Comma separated input pixel formats, uyvy and/or v210 (default uyvy,v210).", "formats", "uyvy,v210" );
+	parser.addOption( pixelFormatsOption );
+	QCommandLineOption profilesOption( "profiles", QString( "Comma separated codec profiles to encode: %1 (default all)." ).arg( EncoderBackend::Profiles().join( ", " ) ),
+									   "profiles", EncoderBackend::Profiles().join( "," ) );
+	parser.addOption( profilesOption );
+	QCommandLineOption directoryOption( "directory", "Directory the write benchmark muxes into, tmpfs keeps disk out of the numbers (default /dev/shm).", "path", "/dev/shm" );
+	parser.addOption( directoryOption );
+	QCommandLineOption outputOption( "output", "Write JSON results to <file> instead of stdout.", "file" );
+	parser.addOption( outputOption );
+	parser.process( a );
+
+	int iterations = parser.value( iterationsOption ).toInt();
+	int warmupIterations = parser.value( warmupOption ).toInt();
+	if ( iterations <= 0 || warmupIterations < 0 )
+	{
+		fprintf( stderr, "Invalid iteration count\n" );
+		return 1;
+	}
+
+	QVector<const DisplayModeInfo *> modes;
+	for ( const QString &code : parser.value( modesOption ).split( ',', QString::SkipEmptyParts ) )
+	{
+		const DisplayModeInfo *mode = FindDisplayMode( ( BMDDisplayMode )FourCC( code ) );
+		if ( !mode )
+		{
+			fprintf( stderr, "Unknown display mode '%s'\n", qUtf8Printable( code ) );
+			return 1;
+		}
+		modes.append( mode );
+	}
+
+	QVector<BMDPixelFormat> pixelFormats;
+	for ( const QString &name : parser.value( pixelFormatsOption ).split( ',', QString::SkipEmptyParts ) )
+	{
+		if ( name == "uyvy" )
+		{
+			pixelFormats.append( bmdFormat8BitYUV );
+		}
+		else if ( name == "v210" )
+		{
+			pixelFormats.append( bmdFormat10BitYUV );
+		}
+		else
+		{
+			fprintf( stderr, "Unknown pixel format '%s'\n", qUtf8Printable( name ) );
+			return 1;
+		}
+	}
+
+	QStringList profiles = parser.value( profilesOption ).split( ',', QString::SkipEmptyParts );
+	for ( const QString &name : profiles )
+	{
+		if ( !EncoderBackend::Profiles().contains( name ) )
+		{
+			fprintf( stderr, "Unknown codec profile '%s'\n", qUtf8Printable( name ) );
+			return 1;
+		}
+	}
+
+	fprintf( stderr, "%-12s %-10s %-5s %-12s %12s %12s %12s %8s %12s %8s\n",
+			 "benchmark", "mode", "input", "profile", "mean ns/fr", "median ns", "stddev ns", "cv%", "cpu ns/fr", "GB/s" );
+
+	RecorderBenchmark benchmark( iterations, warmupIterations, parser.value( directoryOption ) );
+	for ( const DisplayModeInfo *mode : modes )
+	{
+		for ( BMDPixelFormat pixelFormat : pixelFormats )
+		{
+			for ( int i = 0; i < profiles.size(); i++ )
+			{
+				if ( !benchmark.Run( mode, pixelFormat, profiles[i], i == 0 ) )
+				{
+					fprintf( stderr, "Benchmark of %s failed\n", mode->name );
+					return 1;
+				}
+			}
+		}
+	}
+
+	// enough context to compare runs across servers and builds
+	QJsonObject machine;
+	machine["host"] = QSysInfo::machineHostName();
+	machine["cpu"] = CpuModel();
+	machine["threads"] = QThread::idealThreadCount();
+	machine["kernel"] = QSysInfo::kernelVersion();
+
+	QJsonObject build;
+	build["compiler"] = __VERSION__;
+	build["ffmpeg"] = av_version_info();
+	build["libavcodec"] = LIBAVCODEC_IDENT;
+#ifdef QT_NO_DEBUG
+	build["type"] = "release";
+#else
+	build["type"] = "debug";
+#endif
+
+	QJsonArray results;
+	for ( const RecorderBenchmark::Result &result : benchmark.Results() )
+	{
+		results.append( result.ToJson() );
+	}
+
+	QJsonObject root;
+	root["timestamp"] = QDateTime::currentDateTimeUtc().toString( Qt::ISODate );
+	root["iterations"] = iterations;
+	root["warmup_iterations"] = warmupIterations;
+	root["machine"] = machine;
+	root["build"] = build;
+	root["results"] = results;
+	QByteArray json = QJsonDocument( root ).toJson();
+
+	if ( parser.isSet( outputOption ) )
+	{
+		QFile file( parser.value( outputOption ) );
+		if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) || file.write( json ) != json.size() )
+		{
+			fprintf( stderr, "Could not write '%s'\n", qUtf8Printable( file.fileName() ) );
+			return 1;
+		}
+	}
+	else
+	{
+		fwrite( json.constData(), 1, json.size(), stdout );
+	}
+	return 0;
+}
@@ -0,0 +1,375 @@
+#include "recorderbenchmark.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include <QFile>
+
+#include "../downscalepyramid.h"
+#include "../emulator/emulatedframe.h"
+#include "../emulator/patterngenerator.h"
+#include "../recorder.h"
+#include "../recorder_p.h"
+#include "../recordersettings.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+// distinct input pictures cycled through, so caches do not see the same frame every iteration
+const int INPUT_FRAMES = 8;
+
+uint64_t ClockNs( clockid_t clock )
+{
+	struct timespec ts;
+	clock_gettime( clock, &ts );
+	return ( uint64_t )ts.tv_sec * 1000000000ull + ( uint64_t )ts.tv_nsec;
+}
+
+const char *PixelFormatName( BMDPixelFormat pixelFormat )
+{
+	return pixelFormat == bmdFormat10BitYUV ? "v210" : "uyvy";
+}
+
+}
+
+class RecorderBenchmark::PrivateClass : public EmulatedVideoFrame::Owner
+{
+public:
+	int mIterations;
+	int mWarmupIterations;
+	QString mOutputDirectory;
+	QVector<Result> mResults;
+
+	// input frames are recycled by the benchmark itself
+	void FrameReleased( EmulatedVideoFrame * ) override {}
+
+	// runs body warm-up + iterations times, only body is timed; between runs untimed after each call.
+	// untimed stages only run often enough to feed the next one
+	Result Measure( const QString &name, double bytes, bool timed, const std::function<void( int )> &body, const std::function<void( int )> &between );
+};
+
+RecorderBenchmark::Result RecorderBenchmark::PrivateClass::Measure( const QString &name, double bytes, bool timed,
+		const std::function<void( int )> &body, const std::function<void( int )> &between )
+{
+	int warmupIterations = timed ? mWarmupIterations : 0;
+	int iterations = timed ? mIterations : INPUT_FRAMES;
+	std::vector<double> samples;
+	samples.reserve( iterations );
+	double cpuNs = 0.0;
+	for ( int i = 0; i < warmupIterations + iterations; i++ )
+	{
+		uint64_t cpuBegin = ClockNs( CLOCK_PROCESS_CPUTIME_ID );
+		uint64_t begin = ClockNs( CLOCK_MONOTONIC );
+		body( i );
+		uint64_t end = ClockNs( CLOCK_MONOTONIC );
+		uint64_t cpuEnd = ClockNs( CLOCK_PROCESS_CPUTIME_ID );
+		between( i );
+		if ( timed && i >= warmupIterations )
+		{
+			samples.push_back( ( double )( end - begin ) );
+			cpuNs += ( double )( cpuEnd - cpuBegin );
+		}
+	}
+
+	Result result;
+	result.benchmark = name;
+	result.iterations = samples.size();
+	result.bytes = bytes;
+	if ( samples.empty() )
+	{
+		return result;
+	}
+
+	double sum = 0.0;
+	for ( double sample : samples )
+	{
+		sum += sample;
+	}
+	result.meanNs = sum / samples.size();
+	result.cpuMeanNs = cpuNs / samples.size();
+	double squares = 0.0;
+	for ( double sample : samples )
+	{
+		squares += ( sample - result.meanNs ) * ( sample - result.meanNs );
+	}
+	result.stddevNs = sqrt( squares / samples.size() );
+
+	std::sort( samples.begin(), samples.end() );
+	result.minNs = samples.front();
+	result.maxNs = samples.back();
+	result.medianNs = samples[samples.size() / 2];
+	return result;
+}
+
+///@endcond INTERNAL
+
+double RecorderBenchmark::Result::GigabytesPerSecond() const
+{
+	return meanNs > 0.0 ? bytes / meanNs : 0.0;
+}
+
+QJsonObject RecorderBenchmark::Result::ToJson() const
+{
+	QJsonObject object;
+	object["benchmark"] = benchmark;
+	object["mode"] = mode;
+	object["pixel_format"] = pixelFormat;
+	object["profile"] = profile;
+	object["iterations"] = iterations;
+	object["bytes_per_frame"] = bytes;
+	object["ns_per_frame_mean"] = meanNs;
+	object["ns_per_frame_median"] = medianNs;
+	object["ns_per_frame_min"] = minNs;
+	object["ns_per_frame_max"] = maxNs;
+	object["ns_per_frame_stddev"] = stddevNs;
+	object["ns_per_frame_variance"] = stddevNs * stddevNs;
+	object["cpu_ns_per_frame_mean"] = cpuMeanNs;
+	object["gb_per_s"] = GigabytesPerSecond();
+	return object;
+}
+
+RecorderBenchmark::RecorderBenchmark( int iterations, int warmupIterations, const QString &outputDirectory )
+{
+	d = new RecorderBenchmark::PrivateClass();
+	d->mIterations = iterations;
+	d->mWarmupIterations = warmupIterations;
+	d->mOutputDirectory = outputDirectory;
+}
+
+RecorderBenchmark::~RecorderBenchmark()
+{
+	delete d;
+	d = nullptr;
+}
+
+bool RecorderBenchmark::Run( const DisplayModeInfo *mode, BMDPixelFormat pixelFormat, const QString &codec, bool inputStages )
+{
+	PatternGenerator pattern;
+	if ( !pattern.Init( mode->width, mode->height, pixelFormat ) )
+	{
+		return false;
+	}
+
+	RecorderSettings settings;
+	settings.outputFile = d->mOutputDirectory + "/recorder-bench.mov";
+	settings.videoCodec = codec;
+	settings.logFrames = false;
+
+	Recorder *recorder = new Recorder();
+	recorder->AddRef();
+	recorder->SetSettings( settings );
+	if ( !recorder->Init( mode->frameDuration, mode->timeScale, mode->width, mode->height, pixelFormat ) )
+	{
+		delete recorder;
+		return false;
+	}
+	// Init has opened the output for settings.outputFile already
+	Recorder::PrivateClass *p = recorder->d;
+	// the capture stage only queues while a take is capturing
+	p->mCaptureActive = true;
+
+	// every stage consumes what the previous one produced, the queues are drained outside of the timed region
+	std::vector<std::vector<uint8_t>> pictures( INPUT_FRAMES, std::vector<uint8_t>( pattern.FrameBytes() ) );
+	for ( int i = 0; i < INPUT_FRAMES; i++ )
+	{
+		pattern.Render( pictures[i].data(), i * 7 );
+	}
+	EmulatedVideoFrame inputFrame( d );
+	// the handles return their structs to the recorder's pools, they are cleared before the recorder goes
+	std::vector<PacketHandle> capturedPackets;
+	std::vector<FrameHandle> decodedFrames;
+	std::vector<PacketHandle> encodedPackets;
+
+	auto drainPackets = [&]( StageQueue<PacketHandle> &queue, std::vector<PacketHandle> &keep )
+	{
+		PacketHandle packet;
+		while ( queue.TryPop( packet ) )
+		{
+			if ( keep.size() < ( size_t )INPUT_FRAMES )
+			{
+				keep.push_back( std::move( packet ) );
+			}
+		}
+	};
+	auto drainFrames = [&]()
+	{
+		FrameHandle frame;
+		while ( p->mFrameQueue.TryPop( frame ) )
+		{
+			if ( decodedFrames.size() < ( size_t )INPUT_FRAMES )
+			{
+				decodedFrames.push_back( std::move( frame ) );
+			}
+		}
+	};
+
+	QVector<Result> results;
+	double frameBytes = pattern.FrameBytes();
+
+	results.append( d->Measure( "capture_copy", frameBytes, inputStages, [&]( int i )
+	{
+		inputFrame.Setup( pictures[i % INPUT_FRAMES].data(), mode->width, mode->height, pattern.RowBytes(), pixelFormat, bmdFrameFlagDefault );
+		inputFrame.SetTiming( i, mode->frameDuration, mode->timeScale, 0 );
+		p->HandleVideoFrame( &inputFrame );
+		inputFrame.Release();
+	}, [&]( int )
+	{
+		drainPackets( p->mDecodePacketQueue, capturedPackets );
+	} ) );
+
+	if ( p->mNativeEncoder )
+	{
+		// nothing between capture and the native encoder, it encodes the captured packets
+		results.append( d->Measure( "encode", frameBytes, true, [&]( int i )
+		{
+			p->EncodeAndEnqueueCaptured( capturedPackets[i % capturedPackets.size()].get() );
+		}, [&]( int )
+		{
+			drainPackets( p->mPacketQueue, encodedPackets );
+		} ) );
+	}
+	else
+	{
+		results.append( d->Measure( "decode", frameBytes, inputStages, [&]( int i )
+		{
+			p->DecodeAndEnqueue( capturedPackets[i % capturedPackets.size()].get() );
+		}, [&]( int )
+		{
+			drainFrames();
+		} ) );
+
+		if ( decodedFrames.empty() )
+		{
+			fprintf( stderr, "Benchmark input could not be decoded\n" );
+			capturedPackets.clear();
+			delete recorder;
+			return false;
+		}
+		double decodedBytes = av_image_get_buffer_size( ( AVPixelFormat )decodedFrames[0]->format, decodedFrames[0]->width, decodedFrames[0]->height, 1 );
+
+		results.append( d->Measure( "conversion", decodedBytes, inputStages, [&]( int i )
+		{
+			p->FillVideoFrame( decodedFrames[i % decodedFrames.size()].get() );
+		}, []( int ) {} ) );
+
+		// half, quarter and eighth size of the converted picture: one pass of the pyramid against one sws_scale per size
+		AVFrame *converted = p->mVideoEncodingFrame;
+		AVPixelFormat convertedFormat = ( AVPixelFormat )converted->format;
+		DownscalePyramid pyramid;
+		if ( pyramid.Init( convertedFormat, converted->width, converted->height, 3 ) )
+		{
+			double convertedBytes = av_image_get_buffer_size( convertedFormat, converted->width, converted->height, 1 );
+			results.append( d->Measure( "pyramid", convertedBytes, inputStages, [&]( int i )
+			{
+				pyramid.Process( converted, i, 1 );
+			}, []( int ) {} ) );
+
+			std::vector<SwsContext *> scalers;
+			std::vector<AVFrame *> ladder;
+			bool ladderOk = true;
+			for ( int level = 1; level <= pyramid.Levels(); level++ )
+			{
+				int width = converted->width >> level;
+				int height = converted->height >> level;
+				// area averaging is what the pyramid does
+				scalers.push_back( sws_getContext( converted->width, converted->height, convertedFormat, width, height, convertedFormat,
+												   SWS_AREA, nullptr, nullptr, nullptr ) );
+				ladder.push_back( AllocateVideoFrame( convertedFormat, width, height ) );
+				ladderOk &= scalers.back() && ladder.back();
+			}
+			if ( ladderOk )
+			{
+				results.append( d->Measure( "sws_ladder", convertedBytes, inputStages, [&]( int )
+				{
+					for ( size_t level = 0; level < scalers.size(); level++ )
+					{
+						sws_scale( scalers[level], converted->data, converted->linesize, 0, converted->height, ladder[level]->data, ladder[level]->linesize );
+					}
+				}, []( int ) {} ) );
+			}
+			for ( size_t level = 0; level < scalers.size(); level++ )
+			{
+				sws_freeContext( scalers[level] );
+				av_frame_free( &ladder[level] );
+			}
+		}
+
+		// conversion is part of EncodeAndEnqueueFrame, encode numbers include it
+		results.append( d->Measure( "encode", decodedBytes, true, [&]( int i )
+		{
+			p->EncodeAndEnqueueFrame( decodedFrames[i % decodedFrames.size()].get() );
+		}, [&]( int i )
+		{
+			decodedFrames[( i + 1 ) % decodedFrames.size()]->pts = ( i + 1 ) * mode->frameDuration;
+			drainPackets( p->mPacketQueue, encodedPackets );
+		} ) );
+		p->Flush( p->mVideoCodecContext, p->mVideoStream->index );
+		drainPackets( p->mPacketQueue, encodedPackets );
+	}
+
+	if ( !encodedPackets.empty() )
+	{
+		AVPacket *packet = av_packet_clone( encodedPackets[0].get() );
+		double packetBytes = 0.0;
+		for ( const PacketHandle &encodedPacket : encodedPackets )
+		{
+			packetBytes += encodedPacket->size;
+		}
+		packetBytes /= encodedPackets.size();
+
+		results.append( d->Measure( "write", packetBytes, true, [&]( int )
+		{
+			p->InterleaveFrameIntoFile( packet );
+		}, [&]( int i )
+		{
+			av_packet_free( &packet );
+			packet = av_packet_clone( encodedPackets[( i + 1 ) % encodedPackets.size()].get() );
+			packet->pts = packet->dts = ( i + 1 ) * mode->frameDuration;
+			packet->duration = mode->frameDuration;
+			packet->stream_index = p->mVideoStream->index;
+		} ) );
+		av_packet_free( &packet );
+	}
+
+	capturedPackets.clear();
+	decodedFrames.clear();
+	encodedPackets.clear();
+	recorder->CleanUp();
+	delete recorder;
+	QFile::remove( settings.outputFile );
+
+	for ( Result &result : results )
+	{
+		if ( result.iterations == 0 )
+		{
+			continue;
+		}
+		bool inputStage = result.benchmark == "capture_copy" || result.benchmark == "decode" || result.benchmark == "conversion"
+						  || result.benchmark == "pyramid" || result.benchmark == "sws_ladder";
+		result.mode = mode->name;
+		result.pixelFormat = PixelFormatName( pixelFormat );
+		result.profile = inputStage ? QString() : codec;
+		d->mResults.append( result );
+		PrintResult( result, stderr );
+	}
+	return true;
+}
+
+const QVector<RecorderBenchmark::Result> &RecorderBenchmark::Results() const
+{
+	return d->mResults;
+}
+
+void RecorderBenchmark::PrintResult( const Result &result, FILE *stream )
+{
+	fprintf( stream, "%-12s %-10s %-5s %-12s %12.0f %12.0f %12.0f %8.2f %12.0f %8.3f\n",
+			 qUtf8Printable( result.benchmark ), qUtf8Printable( result.mode ), qUtf8Printable( result.pixelFormat ),
+			 result.profile.isEmpty() ? "-" : qUtf8Printable( result.profile ),
+			 result.meanNs, result.medianNs, result.stddevNs, result.meanNs > 0.0 ? 100.0 * result.stddevNs / result.meanNs : 0.0,
+			 result.cpuMeanNs, result.GigabytesPerSecond() );
+}
@@ -0,0 +1,52 @@
+#ifndef RECORDERBENCHMARK_H
+#define RECORDERBENCHMARK_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+#include "../decklink/DeckLinkAPI.h"
+#include "../emulator/displaymodes.h"
+
+// times the recorder stage functions in isolation on synthetic frames
+class RecorderBenchmark
+{
+public:
+	struct Result
+	{
+		QString benchmark;
+		QString mode;
+		QString pixelFormat;
+		QString profile;
+		int iterations = 0;
+		double bytes = 0.0;
+		double meanNs = 0.0;
+		double medianNs = 0.0;
+		double minNs = 0.0;
+		double maxNs = 0.0;
+		double stddevNs = 0.0;
+		// CPU time of all threads of the process per iteration, encoders with threads of their own use more than the wall time
+		double cpuMeanNs = 0.0;
+
+		double GigabytesPerSecond() const;
+		QJsonObject ToJson() const;
+	};
+
+	RecorderBenchmark( int iterations, int warmupIterations, const QString &outputDirectory );
+	~RecorderBenchmark();
+
+	// capture copy, decode and conversion only depend on the input, they are measured when inputStages is set
+	bool Run( const DisplayModeInfo *mode, BMDPixelFormat pixelFormat, const QString &codec, bool inputStages );
+
+	const QVector<Result> &Results() const;
+	static void PrintResult( const Result &result, FILE *stream );
+
+private:
+	RecorderBenchmark( const RecorderBenchmark & ) = delete;
+	RecorderBenchmark &operator=( const RecorderBenchmark & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // RECORDERBENCHMARK_H
@@ -0,0 +1,30 @@
+#ifndef CAPTURESOURCE_H
+#define CAPTURESOURCE_H
+
+#include <stdint.h>
+
+class IDeckLinkMemoryAllocator;
+
+// something that delivers frames to an IDeckLinkInputCallback: a DeckLink device or a replayed recording
+class CaptureSource
+{
+public:
+	virtual ~CaptureSource() {}
+
+	// BMDDisplayMode and BMDPixelFormat to deliver, must be set before Init
+	virtual void SetDisplayMode( uint32_t displayMode ) = 0;
+	virtual void SetPixelFormat( uint32_t pixelFormat ) = 0;
+
+	// buffers to capture into, valid until Start; sources that do not own capture buffers ignore it
+	virtual void SetFrameAllocator( IDeckLinkMemoryAllocator * /*allocator*/ ) {}
+
+	virtual bool Init() = 0;
+	virtual bool Start() = 0;
+	virtual bool Stop() = 0;
+	virtual void CleanUp() = 0;
+
+	virtual bool GetTimeBase( int &num, int &den ) = 0;
+	virtual bool GetVideoSize( int &width, int &height ) = 0;
+};
+
+#endif // CAPTURESOURCE_H
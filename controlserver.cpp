@@ -0,0 +1,169 @@
+#include "controlserver.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include "recorder.h"
+#include "recorderstats.h"
+
+///@cond INTERNAL
+
+class ControlServer::PrivateClass
+{
+public:
+	Recorder *mRecorder;
+	QString mOutputFile;
+	QLocalServer mServer;
+	int mTakeNumber = 0;
+	QString mTakeFile;
+	uint64_t mTakeStartPackets = 0;
+
+	PrivateClass( Recorder *recorder, const QString &outputFile )
+		: mRecorder( recorder )
+		, mOutputFile( outputFile )
+	{
+	}
+
+	QString TakeFileName( int take ) const;
+	QString HandleCommand( const QString &line );
+	QString StartTake( const QString &file );
+	QString StopTake();
+	void AcceptConnection();
+};
+
+// /tmp/testing.mov => /tmp/testing_take0003.mov
+QString ControlServer::PrivateClass::TakeFileName( int take ) const
+{
+	QFileInfo info( mOutputFile );
+	QString name = QString( "%1_take%2" ).arg( info.completeBaseName() ).arg( take, 4, 10, QChar( '0' ) );
+	if ( !info.suffix().isEmpty() )
+	{
+		name += "." + info.suffix();
+	}
+	return info.dir().filePath( name );
+}
+
+QString ControlServer::PrivateClass::StartTake( const QString &file )
+{
+	if ( mRecorder->IsRecording() )
+	{
+		return QString( "error take %1 is still recording into %2" ).arg( mTakeNumber ).arg( mTakeFile );
+	}
+
+	RecorderStats stats;
+	mRecorder->GetStats( stats );
+	QString takeFile = file.isEmpty() ? TakeFileName( mTakeNumber + 1 ) : file;
+	if ( !mRecorder->StartTake( takeFile ) )
+	{
+		return QString( "error could not start a take into %1" ).arg( takeFile );
+	}
+	mTakeNumber++;
+	mTakeFile = takeFile;
+	mTakeStartPackets = stats.writtenPackets;
+	return QString( "ok take %1 recording into %2" ).arg( mTakeNumber ).arg( mTakeFile );
+}
+
+QString ControlServer::PrivateClass::StopTake()
+{
+	if ( mTakeNumber == 0 )
+	{
+		return "error no take was started";
+	}
+
+	// a take that reached its frame limit has already finished by itself
+	mRecorder->Stop();
+	RecorderStats stats;
+	mRecorder->GetStats( stats );
+	return QString( "ok take %1 finished %2 packets %3 start-to-first-frame-ms %4 stop-ms %5" )
+		   .arg( mTakeNumber ).arg( mTakeFile ).arg( stats.writtenPackets - mTakeStartPackets ).arg( stats.lastStartLatencyNs / 1e6, 0, 'f', 2 )
+		   .arg( stats.lastStopLatencyNs / 1e6, 0, 'f', 2 );
+}
+
+QString ControlServer::PrivateClass::HandleCommand( const QString &line )
+{
+	QStringList arguments = line.split( ' ', QString::SkipEmptyParts );
+	if ( arguments.isEmpty() )
+	{
+		return "error empty command";
+	}
+
+	QString command = arguments.takeFirst();
+	if ( command == "start" )
+	{
+		return StartTake( arguments.join( ' ' ) );
+	}
+	else if ( command == "stop" )
+	{
+		return StopTake();
+	}
+	else if ( command == "status" )
+	{
+		RecorderStats stats;
+		mRecorder->GetStats( stats );
+		if ( mRecorder->IsRecording() )
+		{
+			return QString( "ok recording take %1 into %2 packets %3" ).arg( mTakeNumber ).arg( mTakeFile ).arg( stats.writtenPackets - mTakeStartPackets );
+		}
+		return QString( "ok idle takes %1 dropped-frames %2" ).arg( stats.takes ).arg( stats.droppedFrames );
+	}
+	else if ( command == "quit" )
+	{
+		// main stops the running take once the event loop returns
+		qApp->quit();
+		return "ok";
+	}
+	return QString( "error unknown command '%1'" ).arg( command );
+}
+
+void ControlServer::PrivateClass::AcceptConnection()
+{
+	while ( QLocalSocket *socket = mServer.nextPendingConnection() )
+	{
+		QObject::connect( socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater );
+		QObject::connect( socket, &QLocalSocket::readyRead, socket, [this, socket]()
+		{
+			while ( socket->canReadLine() )
+			{
+				QString line = QString::fromUtf8( socket->readLine() ).trimmed();
+				QString reply = HandleCommand( line );
+				fprintf( stdout, "Control: %s => %s\n", qUtf8Printable( line ), qUtf8Printable( reply ) );
+				socket->write( reply.toUtf8() + "\n" );
+				socket->flush();
+			}
+		} );
+	}
+}
+
+///@endcond INTERNAL
+
+ControlServer::ControlServer( Recorder *recorder, const QString &outputFile )
+{
+	d = new ControlServer::PrivateClass( recorder, outputFile );
+	QObject::connect( &d->mServer, &QLocalServer::newConnection, [this]()
+	{
+		d->AcceptConnection();
+	} );
+}
+
+ControlServer::~ControlServer()
+{
+	d->mServer.close();
+	delete d;
+	d = nullptr;
+}
+
+bool ControlServer::Listen( const QString &socketPath )
+{
+	// a socket file left behind by a crashed daemon would make listen fail
+	QLocalServer::removeServer( socketPath );
+	d->mServer.setSocketOptions( QLocalServer::UserAccessOption );
+	if ( !d->mServer.listen( socketPath ) )
+	{
+		fprintf( stderr, "Could not listen on control socket '%s': %s\n", qUtf8Printable( socketPath ), qUtf8Printable( d->mServer.errorString() ) );
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,30 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QString>
+
+class Recorder;
+
+// line based control of a long running recorder over a local socket:
+//   start [file]  begin a take (default: output file with the take number appended)
+//   stop          finish the running take
+//   status        report whether a take is running
+//   quit          finish the running take and leave the event loop
+// every command is answered with one line starting with "ok" or "error"
+class ControlServer
+{
+public:
+	ControlServer( Recorder *recorder, const QString &outputFile );
+	~ControlServer();
+
+	bool Listen( const QString &socketPath );
+
+private:
+	ControlServer( const ControlServer & ) = delete;
+	ControlServer &operator=( const ControlServer & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // CONTROLSERVER_H
@@ -1,8 +1,13 @@
 #include "decklinkmanager.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
 
 #include "decklink/DeckLinkAPI.h"
+#include "startupprofile.h"
 
 ///@cond INTERNAL
 
@@ -14,19 +19,31 @@ public:
 	int mAudioChannelsCount = 2;
 	int mAudioSampleDepth = 16;
 	BMDDisplayMode mDesiredDisplayMode = bmdModeHD1080p50;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
 
 	IDeckLinkIterator *mDeckLinkIterator = nullptr;
 	IDeckLink *mDeckLink = nullptr;
 	IDeckLinkInput *mDeckLinkInput = nullptr;
+	IDeckLinkMemoryAllocator *mFrameAllocator = nullptr;
 	//IDeckLinkConfiguration *mDeckLinkConfiguration = nullptr;
 	IDeckLinkDisplayMode *mDecklinkDisplayMode = nullptr;
 
+	// geometry of the display mode, from the device or from the mode cache
+	std::string mModelName;
+	long mWidth = 0;
+	long mHeight = 0;
+	BMDTimeValue mFrameDuration = 0;
+	BMDTimeScale mTimeScale = 0;
+
 	IDeckLinkInputCallback *mDelegate;
 
 	PrivateClass( IDeckLinkInputCallback *delegate );
 
 	void SetupDecklinkConnections();
 	bool GetDisplayMode();
+	bool LookupCachedDisplayMode();
+	void StoreCachedDisplayMode();
+	static std::string CachePath();
 };
 
 DecklinkManager::PrivateClass::PrivateClass( IDeckLinkInputCallback *delegate )
@@ -114,7 +131,82 @@ bool DecklinkManager::PrivateClass::GetDisplayMode()
 		displayModeIterator->Release();
 	}
 
-	return ( mDecklinkDisplayMode != nullptr );
+	if ( mDecklinkDisplayMode == nullptr )
+	{
+		fprintf( stderr, "Display mode %08x is not supported by the device\n", mDesiredDisplayMode );
+		return false;
+	}
+	mWidth = mDecklinkDisplayMode->GetWidth();
+	mHeight = mDecklinkDisplayMode->GetHeight();
+	return mDecklinkDisplayMode->GetFrameRate( &mFrameDuration, &mTimeScale ) == S_OK;
+}
+
+std::string DecklinkManager::PrivateClass::CachePath()
+{
+	const char *cacheHome = getenv( "XDG_CACHE_HOME" );
+	const char *home = getenv( "HOME" );
+	if ( cacheHome && *cacheHome )
+	{
+		return std::string( cacheHome ) + "/decklink-recorder-modes";
+	}
+	if ( home && *home )
+	{
+		return std::string( home ) + "/.cache/decklink-recorder-modes";
+	}
+	return std::string();
+}
+
+// one line per model and mode the model was seen to support: model<TAB>mode width height duration scale
+bool DecklinkManager::PrivateClass::LookupCachedDisplayMode()
+{
+	std::string path = CachePath();
+	FILE *cache = path.empty() ? nullptr : fopen( path.c_str(), "r" );
+	if ( !cache )
+	{
+		return false;
+	}
+
+	bool found = false;
+	char line[512];
+	while ( !found && fgets( line, sizeof( line ), cache ) )
+	{
+		char *tab = strrchr( line, '\t' );
+		if ( !tab )
+		{
+			continue;
+		}
+		*tab = '\0';
+		unsigned int mode = 0;
+		long width = 0, height = 0, duration = 0, scale = 0;
+		if ( mModelName == line && sscanf( tab + 1, "%x %ld %ld %ld %ld", &mode, &width, &height, &duration, &scale ) == 5
+				&& mode == ( unsigned int )mDesiredDisplayMode && width > 0 && height > 0 && duration > 0 && scale > 0 )
+		{
+			mWidth = width;
+			mHeight = height;
+			mFrameDuration = duration;
+			mTimeScale = scale;
+			found = true;
+		}
+	}
+	fclose( cache );
+	return found;
+}
+
+void DecklinkManager::PrivateClass::StoreCachedDisplayMode()
+{
+	std::string path = CachePath();
+	if ( path.empty() )
+	{
+		return;
+	}
+	mkdir( path.substr( 0, path.rfind( '/' ) ).c_str(), 0755 );
+	FILE *cache = fopen( path.c_str(), "a" );
+	if ( !cache )
+	{
+		return;
+	}
+	fprintf( cache, "%s\t%08x %ld %ld %ld %ld\n", mModelName.c_str(), ( unsigned int )mDesiredDisplayMode, mWidth, mHeight, ( long )mFrameDuration, ( long )mTimeScale );
+	fclose( cache );
 }
 
 ///@endcond INTERNAL
@@ -130,8 +222,25 @@ DecklinkManager::~DecklinkManager()
 	d = nullptr;
 }
 
+void DecklinkManager::SetDisplayMode( uint32_t displayMode )
+{
+	d->mDesiredDisplayMode = ( BMDDisplayMode )displayMode;
+}
+
+void DecklinkManager::SetPixelFormat( uint32_t pixelFormat )
+{
+	d->mPixelFormat = ( BMDPixelFormat )pixelFormat;
+}
+
+void DecklinkManager::SetFrameAllocator( IDeckLinkMemoryAllocator *allocator )
+{
+	// the input takes its own reference when it is enabled
+	d->mFrameAllocator = allocator;
+}
+
 bool DecklinkManager::Init()
 {
+	StartupProfile::Step step( "device open" );
 	d->mDeckLinkIterator = CreateDeckLinkIteratorInstance();
 	if ( !d->mDeckLinkIterator )
 	{
@@ -168,11 +277,28 @@ bool DecklinkManager::Init()
 
 	d->SetupDecklinkConnections();
 
+	const char *modelName = nullptr;
+	if ( d->mDeckLink->GetModelName( &modelName ) == S_OK && modelName )
+	{
+		d->mModelName = modelName;
+		free( ( void * )modelName );
+	}
+
+	// walking the display mode iterator is only needed the first time a model is asked for a mode
+	StartupProfile::Step modeStep( "display mode" );
+	if ( !d->mModelName.empty() && d->LookupCachedDisplayMode() )
+	{
+		return true;
+	}
 	bool displayModeOk = d->GetDisplayMode();
 	if ( !displayModeOk )
 	{
 		return displayModeOk;
 	}
+	if ( !d->mModelName.empty() )
+	{
+		d->StoreCachedDisplayMode();
+	}
 
 	return true;
 }
@@ -180,8 +306,13 @@ bool DecklinkManager::Init()
 bool DecklinkManager::Start()
 {
 	d->mDeckLinkInput->SetCallback( d->mDelegate );
+	if ( d->mFrameAllocator && d->mDeckLinkInput->SetVideoInputFrameMemoryAllocator( d->mFrameAllocator ) != S_OK )
+	{
+		// frames then arrive in the driver's buffers and are copied once on their way to disk
+		fprintf( stderr, "Failed to set the frame allocator of the input\n" );
+	}
 
-	HRESULT result = d->mDeckLinkInput->EnableVideoInput( d->mDesiredDisplayMode, bmdFormat8BitYUV, 0 );
+	HRESULT result = d->mDeckLinkInput->EnableVideoInput( d->mDesiredDisplayMode, d->mPixelFormat, 0 );
 	if ( result != S_OK )
 	{
 		fprintf( stderr, "Failed to enable video input. Is another application using the card?\n" );
@@ -248,10 +379,22 @@ void DecklinkManager::CleanUp()
 
 bool DecklinkManager::GetTimeBase( int &num, int &den )
 {
-	BMDTimeValue frameRateDuration;
-	BMDTimeScale frameRateScale;
-	HRESULT result = d->mDecklinkDisplayMode->GetFrameRate( &frameRateDuration, &frameRateScale );
-	num = frameRateDuration;
-	den = frameRateScale;
-	return ( result == S_OK );
+	if ( d->mFrameDuration <= 0 || d->mTimeScale <= 0 )
+	{
+		return false;
+	}
+	num = d->mFrameDuration;
+	den = d->mTimeScale;
+	return true;
+}
+
+bool DecklinkManager::GetVideoSize( int &width, int &height )
+{
+	if ( d->mWidth <= 0 || d->mHeight <= 0 )
+	{
+		return false;
+	}
+	width = d->mWidth;
+	height = d->mHeight;
+	return true;
 }
@@ -1,19 +1,27 @@
 #ifndef DECKLINKMANAGER_H
 #define DECKLINKMANAGER_H
 
+#include "capturesource.h"
+
 class IDeckLinkInputCallback;
-class DecklinkManager
+class DecklinkManager : public CaptureSource
 {
 public:
 	DecklinkManager( IDeckLinkInputCallback *delegate );
 	~DecklinkManager();
 
-	bool Init();
-	bool Start();
-	bool Stop();
-	void CleanUp();
+	// defaults: bmdModeHD1080p50, bmdFormat8BitYUV
+	void SetDisplayMode( uint32_t displayMode ) override;
+	void SetPixelFormat( uint32_t pixelFormat ) override;
+	void SetFrameAllocator( IDeckLinkMemoryAllocator *allocator ) override;
+
+	bool Init() override;
+	bool Start() override;
+	bool Stop() override;
+	void CleanUp() override;
 
-	bool GetTimeBase( int &num, int &den );
+	bool GetTimeBase( int &num, int &den ) override;
+	bool GetVideoSize( int &width, int &height ) override;
 
 private:
 	class PrivateClass;
@@ -0,0 +1,416 @@
+#include "downscalepyramid.h"
+
+#include <stdio.h>
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+#include "deps/ffmpeg/include/libavutil/buffer.h"
+#include "deps/ffmpeg/include/libavutil/common.h"
+#include "deps/ffmpeg/include/libavutil/pixdesc.h"
+}
+
+///@cond INTERNAL
+
+namespace
+{
+
+const int MAX_LEVELS = 8;
+const int MAX_PLANES = 4;
+// rows start on a cache line, the level pictures are also handed to libswscale and encoders
+const int LINE_ALIGN = 64;
+
+// dst[x] is the rounded mean of the 2x2 block at 2x in rows a and b, which hold at least 2 * width samples
+void HalveRow8( const uint8_t *a, const uint8_t *b, uint8_t *dst, int width )
+{
+	int x = 0;
+#if defined( __SSE2__ )
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16( 1 );
+	const __m128i two = _mm_set1_epi32( 2 );
+	for ( ; x + 8 <= width; x += 8 )
+	{
+		__m128i rowA = _mm_loadu_si128( ( const __m128i * )( a + 2 * x ) );
+		__m128i rowB = _mm_loadu_si128( ( const __m128i * )( b + 2 * x ) );
+		// vertical sums in 16 bit, adjacent pairs of them summed into 32 bit by madd
+		__m128i low = _mm_add_epi16( _mm_unpacklo_epi8( rowA, zero ), _mm_unpacklo_epi8( rowB, zero ) );
+		__m128i high = _mm_add_epi16( _mm_unpackhi_epi8( rowA, zero ), _mm_unpackhi_epi8( rowB, zero ) );
+		low = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( low, ones ), two ), 2 );
+		high = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( high, ones ), two ), 2 );
+		__m128i result = _mm_packus_epi16( _mm_packs_epi32( low, high ), zero );
+		_mm_storel_epi64( ( __m128i * )( dst + x ), result );
+	}
+#endif
+	for ( ; x < width; x++ )
+	{
+		dst[x] = ( uint8_t )( ( a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2 ) >> 2 );
+	}
+}
+
+// simd requires samples of at most 14 bits, the sums of two fit a signed 16 bit lane
+void HalveRow16( const uint16_t *a, const uint16_t *b, uint16_t *dst, int width, bool simd )
+{
+	int x = 0;
+#if defined( __SSE2__ )
+	if ( simd )
+	{
+		const __m128i ones = _mm_set1_epi16( 1 );
+		const __m128i two = _mm_set1_epi32( 2 );
+		for ( ; x + 8 <= width; x += 8 )
+		{
+			__m128i low = _mm_add_epi16( _mm_loadu_si128( ( const __m128i * )( a + 2 * x ) ), _mm_loadu_si128( ( const __m128i * )( b + 2 * x ) ) );
+			__m128i high = _mm_add_epi16( _mm_loadu_si128( ( const __m128i * )( a + 2 * x + 8 ) ), _mm_loadu_si128( ( const __m128i * )( b + 2 * x + 8 ) ) );
+			low = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( low, ones ), two ), 2 );
+			high = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( high, ones ), two ), 2 );
+			_mm_storeu_si128( ( __m128i * )( dst + x ), _mm_packs_epi32( low, high ) );
+		}
+	}
+#else
+	( void )simd;
+#endif
+	for ( ; x < width; x++ )
+	{
+		dst[x] = ( uint16_t )( ( a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2 ) >> 2 );
+	}
+}
+
+
+// packed 4:2:2 (U Y V Y): two macropixels of each row become one, chroma averaged with chroma, luma pairs with luma
+void HalveRowUyvy( const uint8_t *a, const uint8_t *b, uint8_t *dst, int width )
+{
+	int x = 0;
+#if defined( __SSE2__ )
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16( 2 );
+	const __m128i chromaMask = _mm_set_epi16( 0, 0, 0, 0, 0, -1, 0, -1 );
+	const __m128i luma0Mask = _mm_set_epi16( 0, 0, 0, 0, 0, 0, -1, 0 );
+	const __m128i luma1Mask = _mm_set_epi16( 0, 0, 0, 0, -1, 0, 0, 0 );
+	for ( ; x + 2 <= width; x += 2 )
+	{
+		__m128i rowA = _mm_loadu_si128( ( const __m128i * )( a + 8 * x ) );
+		__m128i rowB = _mm_loadu_si128( ( const __m128i * )( b + 8 * x ) );
+		__m128i halves[2] = { _mm_add_epi16( _mm_unpacklo_epi8( rowA, zero ), _mm_unpacklo_epi8( rowB, zero ) ),
+							  _mm_add_epi16( _mm_unpackhi_epi8( rowA, zero ), _mm_unpackhi_epi8( rowB, zero ) ) };
+		for ( int i = 0; i < 2; i++ )
+		{
+			// U0 Y0 V0 Y1 U1 Y2 V1 Y3: chroma pairs are 4 samples apart, luma pairs 2
+			__m128i chroma = _mm_add_epi16( halves[i], _mm_srli_si128( halves[i], 8 ) );
+			__m128i luma = _mm_add_epi16( halves[i], _mm_srli_si128( halves[i], 4 ) );
+			halves[i] = _mm_or_si128( _mm_and_si128( chroma, chromaMask ),
+									  _mm_or_si128( _mm_and_si128( luma, luma0Mask ), _mm_and_si128( _mm_srli_si128( luma, 4 ), luma1Mask ) ) );
+		}
+		__m128i sums = _mm_unpacklo_epi64( halves[0], halves[1] );
+		__m128i result = _mm_srli_epi16( _mm_add_epi16( sums, two ), 2 );
+		_mm_storel_epi64( ( __m128i * )( dst + 4 * x ), _mm_packus_epi16( result, zero ) );
+	}
+#endif
+	for ( ; x < width; x++ )
+	{
+		const uint8_t *s = a + 8 * x;
+		const uint8_t *t = b + 8 * x;
+		uint8_t *d = dst + 4 * x;
+		d[0] = ( uint8_t )( ( s[0] + s[4] + t[0] + t[4] + 2 ) >> 2 );
+		d[1] = ( uint8_t )( ( s[1] + s[3] + t[1] + t[3] + 2 ) >> 2 );
+		d[2] = ( uint8_t )( ( s[2] + s[6] + t[2] + t[6] + 2 ) >> 2 );
+		d[3] = ( uint8_t )( ( s[5] + s[7] + t[5] + t[7] + 2 ) >> 2 );
+	}
+}
+
+}
+
+class DownscalePyramid::PrivateClass
+{
+public:
+	AVPixelFormat mFormat = AV_PIX_FMT_NONE;
+	// bytes of a sample, or of a U Y V Y macropixel when packed
+	int mBytesPerSample = 1;
+	bool mPackedUyvy = false;
+	bool mSimd16 = false;
+	int mPlanes = 0;
+	int mLevels = 0;
+
+	// index 0 is the source picture; plane widths count macropixels when packed
+	int mPictureWidth[MAX_LEVELS + 1] = {};
+	int mPictureHeight[MAX_LEVELS + 1] = {};
+	int mWidth[MAX_LEVELS + 1][MAX_PLANES] = {};
+	int mHeight[MAX_LEVELS + 1][MAX_PLANES] = {};
+	int mLineSize[MAX_LEVELS + 1][MAX_PLANES] = {};
+	uint8_t *mData[MAX_LEVELS + 1][MAX_PLANES] = {};
+	AVBufferPool *mPools[MAX_LEVELS + 1][MAX_PLANES] = {};
+	AVFrame *mFrames[MAX_LEVELS + 1] = {};
+
+	~PrivateClass();
+
+	void Reset();
+	bool InitLevels( AVPixelFormat format, const AVPixFmtDescriptor *desc, int width, int height, int levels );
+	bool AcquireLevel( int level, const AVFrame *src, int64_t pts, int64_t duration );
+	// row of the level below is complete, makes the row of level it completes and goes on upwards
+	void RowDone( int level, int plane, int row );
+};
+
+DownscalePyramid::PrivateClass::~PrivateClass()
+{
+	Reset();
+}
+
+void DownscalePyramid::PrivateClass::Reset()
+{
+	for ( int level = 0; level <= MAX_LEVELS; level++ )
+	{
+		av_frame_free( &mFrames[level] );
+		for ( int plane = 0; plane < MAX_PLANES; plane++ )
+		{
+			// buffers still referenced by consumers outlive the pool
+			av_buffer_pool_uninit( &mPools[level][plane] );
+		}
+	}
+	mLevels = 0;
+	mPlanes = 0;
+}
+
+bool DownscalePyramid::PrivateClass::InitLevels( AVPixelFormat format, const AVPixFmtDescriptor *desc, int width, int height, int levels )
+{
+	mFormat = format;
+	for ( int level = 0; level <= FFMIN( levels, MAX_LEVELS ); level++ )
+	{
+		int levelWidth = ( width >> level ) & ( mPackedUyvy ? ~1 : ~0 );
+		int levelHeight = height >> level;
+		if ( levelWidth < 2 || levelHeight < 2 )
+		{
+			break;
+		}
+		mLevels = level;
+		mPictureWidth[level] = levelWidth;
+		mPictureHeight[level] = levelHeight;
+		for ( int plane = 0; plane < mPlanes; plane++ )
+		{
+			// chroma planes of subsampled formats, alpha has the luma size
+			bool chroma = !mPackedUyvy && ( plane == 1 || plane == 2 );
+			if ( mPackedUyvy )
+			{
+				mWidth[level][plane] = levelWidth / 2;
+			}
+			else
+			{
+				mWidth[level][plane] = chroma ? AV_CEIL_RSHIFT( levelWidth, desc->log2_chroma_w ) : levelWidth;
+			}
+			mHeight[level][plane] = chroma ? AV_CEIL_RSHIFT( levelHeight, desc->log2_chroma_h ) : levelHeight;
+			mLineSize[level][plane] = FFALIGN( mWidth[level][plane] * mBytesPerSample, LINE_ALIGN );
+			if ( level > 0 )
+			{
+				mPools[level][plane] = av_buffer_pool_init( mLineSize[level][plane] * mHeight[level][plane] + LINE_ALIGN, nullptr );
+				if ( !mPools[level][plane] )
+				{
+					fprintf( stderr, "Could not allocate pyramid buffer pool\n" );
+					Reset();
+					return false;
+				}
+			}
+		}
+		if ( level > 0 )
+		{
+			mFrames[level] = av_frame_alloc();
+			if ( !mFrames[level] )
+			{
+				fprintf( stderr, "Failed to allocate frame\n" );
+				Reset();
+				return false;
+			}
+		}
+	}
+	return mLevels > 0;
+}
+
+bool DownscalePyramid::PrivateClass::AcquireLevel( int level, const AVFrame *src, int64_t pts, int64_t duration )
+{
+	AVFrame *frame = mFrames[level];
+	// the previous picture stays with whoever took a reference to it
+	av_frame_unref( frame );
+	frame->format = mFormat;
+	frame->width = mPictureWidth[level];
+	frame->height = mPictureHeight[level];
+	for ( int plane = 0; plane < mPlanes; plane++ )
+	{
+		frame->buf[plane] = av_buffer_pool_get( mPools[level][plane] );
+		if ( !frame->buf[plane] )
+		{
+			fprintf( stderr, "Could not allocate pyramid level %d\n", level );
+			av_frame_unref( frame );
+			return false;
+		}
+		frame->data[plane] = frame->buf[plane]->data;
+		frame->linesize[plane] = mLineSize[level][plane];
+		mData[level][plane] = frame->data[plane];
+	}
+	frame->pts = pts;
+	frame->pkt_duration = duration;
+	frame->sample_aspect_ratio = src->sample_aspect_ratio;
+	frame->interlaced_frame = src->interlaced_frame;
+	frame->top_field_first = src->top_field_first;
+	frame->color_range = src->color_range;
+	frame->color_primaries = src->color_primaries;
+	frame->color_trc = src->color_trc;
+	frame->colorspace = src->colorspace;
+	frame->chroma_location = src->chroma_location;
+	return true;
+}
+
+void DownscalePyramid::PrivateClass::RowDone( int level, int plane, int row )
+{
+	int sourceHeight = mHeight[level - 1][plane];
+	// a row pair is complete, or the last row of an odd height stands alone
+	if ( level > mLevels || ( row % 2 == 0 && row != sourceHeight - 1 ) )
+	{
+		return;
+	}
+	int dstRow = row / 2;
+	if ( dstRow >= mHeight[level][plane] )
+	{
+		return;
+	}
+
+	int sourceWidth = mWidth[level - 1][plane];
+	int dstWidth = mWidth[level][plane];
+	// rounding up the chroma width of an odd luma width leaves a last column without a right neighbour
+	int fullWidth = FFMIN( dstWidth, sourceWidth / 2 );
+	const uint8_t *a = mData[level - 1][plane] + ( size_t )( 2 * dstRow ) * mLineSize[level - 1][plane];
+	const uint8_t *b = 2 * dstRow + 1 < sourceHeight ? a + mLineSize[level - 1][plane] : a;
+	uint8_t *dst = mData[level][plane] + ( size_t )dstRow * mLineSize[level][plane];
+	if ( mPackedUyvy )
+	{
+		// level widths are even, every macropixel has a right neighbour
+		HalveRowUyvy( a, b, dst, fullWidth );
+	}
+	else if ( mBytesPerSample == 1 )
+	{
+		HalveRow8( a, b, dst, fullWidth );
+		if ( fullWidth < dstWidth )
+		{
+			dst[fullWidth] = ( uint8_t )( ( a[sourceWidth - 1] + b[sourceWidth - 1] + 1 ) >> 1 );
+		}
+	}
+	else
+	{
+		const uint16_t *a16 = ( const uint16_t * )a;
+		const uint16_t *b16 = ( const uint16_t * )b;
+		uint16_t *dst16 = ( uint16_t * )dst;
+		HalveRow16( a16, b16, dst16, fullWidth, mSimd16 );
+		if ( fullWidth < dstWidth )
+		{
+			dst16[fullWidth] = ( uint16_t )( ( a16[sourceWidth - 1] + b16[sourceWidth - 1] + 1 ) >> 1 );
+		}
+	}
+
+	RowDone( level + 1, plane, dstRow );
+}
+
+///@endcond INTERNAL
+
+DownscalePyramid::DownscalePyramid()
+{
+	d = new DownscalePyramid::PrivateClass();
+}
+
+DownscalePyramid::~DownscalePyramid()
+{
+	delete d;
+	d = nullptr;
+}
+
+bool DownscalePyramid::Init( AVPixelFormat format, int width, int height, int levels )
+{
+	d->Reset();
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( format );
+	if ( format == AV_PIX_FMT_UYVY422 )
+	{
+		// the 8 bit capture format, one plane of macropixels
+		d->mPackedUyvy = true;
+		d->mBytesPerSample = 4;
+		d->mPlanes = 1;
+		return d->InitLevels( format, desc, width & ~1, height, levels );
+	}
+	int unsupportedFlags = AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT;
+	if ( !desc || !( desc->flags & AV_PIX_FMT_FLAG_PLANAR ) || ( desc->flags & unsupportedFlags ) || desc->comp[0].depth > 16 )
+	{
+		fprintf( stderr, "Pixel format %s cannot be downscaled by the pyramid\n", av_get_pix_fmt_name( format ) );
+		return false;
+	}
+	int bytesPerSample = desc->comp[0].depth > 8 ? 2 : 1;
+	for ( int i = 0; i < desc->nb_components; i++ )
+	{
+		// one component per plane, no padding bits: NV12 and the like are left to libswscale
+		if ( desc->comp[i].step != bytesPerSample || desc->comp[i].shift != 0 || desc->comp[i].offset != 0 || desc->comp[i].depth != desc->comp[0].depth )
+		{
+			fprintf( stderr, "Pixel format %s cannot be downscaled by the pyramid\n", av_get_pix_fmt_name( format ) );
+			return false;
+		}
+	}
+
+	d->mPackedUyvy = false;
+	d->mBytesPerSample = bytesPerSample;
+	d->mSimd16 = desc->comp[0].depth <= 14;
+	d->mPlanes = av_pix_fmt_count_planes( format );
+	return d->InitLevels( format, desc, width, height, levels );
+}
+
+bool DownscalePyramid::Process( const AVFrame *src, int64_t pts, int64_t duration )
+{
+	if ( !src || d->mLevels == 0 || src->format != d->mFormat || src->width != d->mPictureWidth[0] || src->height != d->mPictureHeight[0] )
+	{
+		return false;
+	}
+	for ( int level = 1; level <= d->mLevels; level++ )
+	{
+		if ( !d->AcquireLevel( level, src, pts, duration ) )
+		{
+			return false;
+		}
+	}
+	for ( int plane = 0; plane < d->mPlanes; plane++ )
+	{
+		d->mData[0][plane] = src->data[plane];
+		d->mLineSize[0][plane] = src->linesize[plane];
+		// every source row is read once, the rows it completes on the levels above are made while it is in cache
+		for ( int row = 0; row < d->mHeight[0][plane]; row++ )
+		{
+			d->RowDone( 1, plane, row );
+		}
+	}
+	return true;
+}
+
+int DownscalePyramid::Levels() const
+{
+	return d->mLevels;
+}
+
+AVFrame *DownscalePyramid::Level( int level ) const
+{
+	return level >= 1 && level <= d->mLevels ? d->mFrames[level] : nullptr;
+}
+
+uint64_t DownscalePyramid::FrameBytes() const
+{
+	uint64_t bytes = 0;
+	for ( int level = 1; level <= d->mLevels; level++ )
+	{
+		for ( int plane = 0; plane < d->mPlanes; plane++ )
+		{
+			bytes += ( uint64_t )d->mLineSize[level][plane] * d->mHeight[level][plane];
+		}
+	}
+	return bytes;
+}
+
+int DownscalePyramid::LevelForDivisor( int divisor )
+{
+	int level = 0;
+	while ( divisor > 1 && divisor % 2 == 0 && level < MAX_LEVELS )
+	{
+		divisor /= 2;
+		level++;
+	}
+	return divisor == 1 ? level : 0;
+}
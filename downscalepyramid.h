@@ -0,0 +1,44 @@
+#ifndef DOWNSCALEPYRAMID_H
+#define DOWNSCALEPYRAMID_H
+
+#include <stdint.h>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavutil/frame.h"
+#include "deps/ffmpeg/include/libavutil/pixfmt.h"
+}
+
+// half, quarter, ... size copies of a planar picture, all made in one pass over the source rows: every pair of
+// rows is averaged into the next level while it is still in cache, and that level's rows into the one after.
+// 2x2 box filter, SSE2 where available. Every Process fills new reference counted level frames taken from buffer
+// pools, so a consumer may keep a reference to a level (no copy) while the next picture is processed.
+class DownscalePyramid
+{
+public:
+	DownscalePyramid();
+	~DownscalePyramid();
+
+	// planar YUV or gray, 8 to 16 bits per sample in native byte order, or packed UYVY; levels are limited to a
+	// 2x2 smallest picture
+	bool Init( AVPixelFormat format, int width, int height, int levels );
+	// src must have the format and size given to Init
+	bool Process( const AVFrame *src, int64_t pts, int64_t duration );
+
+	int Levels() const;
+	// 1 is half size, 2 quarter size, ...; valid until the next Process, take a reference to keep it longer
+	AVFrame *Level( int level ) const;
+	// bytes of one picture on every level
+	uint64_t FrameBytes() const;
+
+	// level whose size is the source size divided by divisor, 0 if divisor is no power of two or beyond the levels
+	static int LevelForDivisor( int divisor );
+
+private:
+	DownscalePyramid( const DownscalePyramid & ) = delete;
+	DownscalePyramid &operator=( const DownscalePyramid & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // DOWNSCALEPYRAMID_H
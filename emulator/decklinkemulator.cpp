@@ -0,0 +1,919 @@
+/*
+ * Drop-in replacement of libDeckLinkAPI.so delivering synthetic frames, so the recorder can be run and benchmarked
+ * without a card: LD_LIBRARY_PATH=<dir of this library> ./Recorder
+ *
+ * Configuration (environment):
+ *   DECKLINK_EMULATOR_DEVICES           number of emulated devices (default 1)
+ *   DECKLINK_EMULATOR_RATE              "realtime" (default), "max" (deliver as soon as the callback returns) or frames per second
+ *   DECKLINK_EMULATOR_BUFFERS           driver side frame buffers, frames held by the consumer occupy them (default 8)
+ *   DECKLINK_EMULATOR_QUEUE             frames queued for a late callback before the driver starts dropping (default 2)
+ *   DECKLINK_EMULATOR_NO_SIGNAL_FRAMES  first frames flagged bmdFrameHasNoInputSource (default 0)
+ *
+ * Like real hardware, frames the consumer was too slow to accept are dropped and show up as gaps in stream time.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "../decklink/DeckLinkAPI.h"
+#include "displaymodes.h"
+#include "emulatedframe.h"
+#include "patterngenerator.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+const BMDTimeScale AUDIO_SAMPLE_RATE = 48000;
+
+long EnvironmentInt( const char *name, long defaultValue )
+{
+	const char *value = getenv( name );
+	return ( value && *value ) ? strtol( value, nullptr, 10 ) : defaultValue;
+}
+
+uint64_t MonotonicNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+class EmulatorDisplayMode final : public IDeckLinkDisplayMode
+{
+public:
+	explicit EmulatorDisplayMode( const DisplayModeInfo *info )
+		: mInfo( info )
+	{
+		mRefCount = 1;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID, LPVOID *ppv ) override
+	{
+		if ( ppv )
+		{
+			*ppv = nullptr;
+		}
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return ++mRefCount;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		ULONG refCount = --mRefCount;
+		if ( refCount == 0 )
+		{
+			delete this;
+		}
+		return refCount;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetName( const char **name ) override
+	{
+		if ( !name )
+		{
+			return E_POINTER;
+		}
+		*name = strdup( mInfo->name );
+		return S_OK;
+	}
+	BMDDisplayMode STDMETHODCALLTYPE GetDisplayMode( void ) override
+	{
+		return mInfo->mode;
+	}
+	long STDMETHODCALLTYPE GetWidth( void ) override
+	{
+		return mInfo->width;
+	}
+	long STDMETHODCALLTYPE GetHeight( void ) override
+	{
+		return mInfo->height;
+	}
+	HRESULT STDMETHODCALLTYPE GetFrameRate( BMDTimeValue *frameDuration, BMDTimeScale *timeScale ) override
+	{
+		if ( !frameDuration || !timeScale )
+		{
+			return E_POINTER;
+		}
+		*frameDuration = mInfo->frameDuration;
+		*timeScale = mInfo->timeScale;
+		return S_OK;
+	}
+	BMDFieldDominance STDMETHODCALLTYPE GetFieldDominance( void ) override
+	{
+		return mInfo->fieldDominance;
+	}
+	BMDDisplayModeFlags STDMETHODCALLTYPE GetFlags( void ) override
+	{
+		return bmdDisplayModeColorspaceRec709;
+	}
+
+private:
+	const DisplayModeInfo *mInfo;
+	std::atomic<ULONG> mRefCount;
+};
+
+class EmulatorDisplayModeIterator final : public IDeckLinkDisplayModeIterator
+{
+public:
+	EmulatorDisplayModeIterator()
+	{
+		mRefCount = 1;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID, LPVOID *ppv ) override
+	{
+		if ( ppv )
+		{
+			*ppv = nullptr;
+		}
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return ++mRefCount;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		ULONG refCount = --mRefCount;
+		if ( refCount == 0 )
+		{
+			delete this;
+		}
+		return refCount;
+	}
+
+	HRESULT STDMETHODCALLTYPE Next( IDeckLinkDisplayMode **displayMode ) override
+	{
+		if ( !displayMode )
+		{
+			return E_POINTER;
+		}
+		if ( mIndex >= DisplayModeCount() )
+		{
+			*displayMode = nullptr;
+			return S_FALSE;
+		}
+		*displayMode = new EmulatorDisplayMode( DisplayModeAt( mIndex++ ) );
+		return S_OK;
+	}
+
+private:
+	std::atomic<ULONG> mRefCount;
+	size_t mIndex = 0;
+};
+
+class EmulatorInput final : public IDeckLinkInput, public EmulatedVideoFrame::Owner, public EmulatedAudioPacket::Owner
+{
+public:
+	explicit EmulatorInput( int deviceIndex )
+		: mDeviceIndex( deviceIndex )
+	{
+		mRefCount = 1;
+		mRunning = false;
+		mDelivered = 0;
+		mDropped = 0;
+	}
+
+	~EmulatorInput()
+	{
+		StopStreams();
+		DisableVideoInput();
+		DisableAudioInput();
+		SetVideoInputFrameMemoryAllocator( nullptr );
+	}
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override
+	{
+		if ( !ppv )
+		{
+			return E_POINTER;
+		}
+		if ( IsSameInterface( iid, IID_IUnknown ) || IsSameInterface( iid, IID_IDeckLinkInput ) )
+		{
+			*ppv = static_cast<IDeckLinkInput *>( this );
+			AddRef();
+			return S_OK;
+		}
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return ++mRefCount;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		ULONG refCount = --mRefCount;
+		if ( refCount == 0 )
+		{
+			delete this;
+		}
+		return refCount;
+	}
+
+	// IDeckLinkInput
+	HRESULT STDMETHODCALLTYPE DoesSupportVideoMode( BMDVideoConnection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat,
+													BMDVideoInputConversionMode, BMDSupportedVideoModeFlags, BMDDisplayMode *actualMode, bool *supported ) override
+	{
+		if ( !supported )
+		{
+			return E_POINTER;
+		}
+		*supported = FindDisplayMode( requestedMode ) != nullptr
+					 && ( requestedPixelFormat == bmdFormat8BitYUV || requestedPixelFormat == bmdFormat10BitYUV || requestedPixelFormat == bmdFormatUnspecified );
+		if ( actualMode )
+		{
+			*actualMode = *supported ? requestedMode : ( BMDDisplayMode )bmdModeUnknown;
+		}
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE GetDisplayMode( BMDDisplayMode displayMode, IDeckLinkDisplayMode **resultDisplayMode ) override
+	{
+		if ( !resultDisplayMode )
+		{
+			return E_POINTER;
+		}
+		const DisplayModeInfo *info = FindDisplayMode( displayMode );
+		*resultDisplayMode = info ? new EmulatorDisplayMode( info ) : nullptr;
+		return info ? S_OK : E_INVALIDARG;
+	}
+	HRESULT STDMETHODCALLTYPE GetDisplayModeIterator( IDeckLinkDisplayModeIterator **iterator ) override
+	{
+		if ( !iterator )
+		{
+			return E_POINTER;
+		}
+		*iterator = new EmulatorDisplayModeIterator();
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE SetScreenPreviewCallback( IDeckLinkScreenPreviewCallback * ) override
+	{
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE EnableVideoInput( BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags ) override;
+	HRESULT STDMETHODCALLTYPE DisableVideoInput( void ) override;
+	HRESULT STDMETHODCALLTYPE GetAvailableVideoFrameCount( uint32_t *availableFrameCount ) override
+	{
+		if ( !availableFrameCount )
+		{
+			return E_POINTER;
+		}
+		*availableFrameCount = 0;
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE SetVideoInputFrameMemoryAllocator( IDeckLinkMemoryAllocator *allocator ) override
+	{
+		if ( mVideoEnabled )
+		{
+			return E_ACCESSDENIED;
+		}
+		if ( allocator )
+		{
+			allocator->AddRef();
+		}
+		if ( mAllocator )
+		{
+			mAllocator->Release();
+		}
+		mAllocator = allocator;
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE EnableAudioInput( BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount ) override;
+	HRESULT STDMETHODCALLTYPE DisableAudioInput( void ) override;
+	HRESULT STDMETHODCALLTYPE GetAvailableAudioSampleFrameCount( uint32_t *availableSampleFrameCount ) override
+	{
+		if ( !availableSampleFrameCount )
+		{
+			return E_POINTER;
+		}
+		*availableSampleFrameCount = 0;
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE StartStreams( void ) override;
+	HRESULT STDMETHODCALLTYPE StopStreams( void ) override;
+	HRESULT STDMETHODCALLTYPE PauseStreams( void ) override
+	{
+		return StopStreams();
+	}
+	HRESULT STDMETHODCALLTYPE FlushStreams( void ) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE SetCallback( IDeckLinkInputCallback *callback ) override
+	{
+		std::lock_guard<std::mutex> locker( mCallbackMutex );
+		if ( callback )
+		{
+			callback->AddRef();
+		}
+		if ( mCallback )
+		{
+			mCallback->Release();
+		}
+		mCallback = callback;
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetHardwareReferenceClock( BMDTimeScale desiredTimeScale, BMDTimeValue *hardwareTime, BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame ) override
+	{
+		if ( !hardwareTime || !timeInFrame || !ticksPerFrame || desiredTimeScale <= 0 || !mMode )
+		{
+			return E_INVALIDARG;
+		}
+		BMDTimeValue now = ( BMDTimeValue )( ( __int128 )MonotonicNs() * desiredTimeScale / 1000000000 );
+		*ticksPerFrame = mMode->frameDuration * desiredTimeScale / mMode->timeScale;
+		*hardwareTime = now;
+		*timeInFrame = *ticksPerFrame > 0 ? now % *ticksPerFrame : 0;
+		return S_OK;
+	}
+
+	// EmulatedVideoFrame::Owner & EmulatedAudioPacket::Owner
+	void FrameReleased( EmulatedVideoFrame *frame ) override
+	{
+		{
+			std::lock_guard<std::mutex> locker( mPoolMutex );
+			mFreeFrames.push_back( frame );
+		}
+		mPoolCondition.notify_one();
+	}
+	void PacketReleased( EmulatedAudioPacket *packet ) override
+	{
+		{
+			std::lock_guard<std::mutex> locker( mPoolMutex );
+			mFreePackets.push_back( packet );
+		}
+		mPoolCondition.notify_one();
+	}
+
+private:
+	void StreamThreadFunction();
+	EmulatedVideoFrame *AcquireFrame( bool wait );
+	EmulatedAudioPacket *AcquirePacket();
+	void FillAudio( EmulatedAudioPacket *packet, int64_t frameIndex );
+	void ReleasePools();
+
+	int mDeviceIndex;
+	std::atomic<ULONG> mRefCount;
+
+	IDeckLinkMemoryAllocator *mAllocator = nullptr;
+
+	std::mutex mCallbackMutex;
+	IDeckLinkInputCallback *mCallback = nullptr;
+
+	const DisplayModeInfo *mMode = nullptr;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+	bool mVideoEnabled = false;
+	PatternGenerator mPattern;
+
+	bool mAudioEnabled = false;
+	BMDAudioSampleType mAudioSampleType = bmdAudioSampleType16bitInteger;
+	uint32_t mAudioChannels = 2;
+	size_t mAudioPacketBytes = 0;
+	std::vector<int32_t> mToneTable;
+
+	std::mutex mPoolMutex;
+	std::condition_variable mPoolCondition;
+	std::vector<EmulatedVideoFrame *> mFrames;
+	std::vector<EmulatedVideoFrame *> mFreeFrames;
+	std::vector<void *> mFrameBuffers;
+	std::vector<EmulatedAudioPacket *> mPackets;
+	std::vector<EmulatedAudioPacket *> mFreePackets;
+	std::vector<uint8_t *> mPacketBuffers;
+
+	std::thread mStreamThread;
+	std::atomic_bool mRunning;
+	std::atomic<uint64_t> mDelivered;
+	std::atomic<uint64_t> mDropped;
+};
+
+HRESULT EmulatorInput::EnableVideoInput( BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags )
+{
+	if ( mRunning || mVideoEnabled )
+	{
+		return E_ACCESSDENIED;
+	}
+
+	const DisplayModeInfo *info = FindDisplayMode( displayMode );
+	if ( !info )
+	{
+		fprintf( stderr, "DeckLink emulator: display mode %08x is not emulated\n", displayMode );
+		return E_INVALIDARG;
+	}
+	if ( !mPattern.Init( info->width, info->height, pixelFormat ) )
+	{
+		fprintf( stderr, "DeckLink emulator: pixel format %08x is not emulated\n", pixelFormat );
+		return E_INVALIDARG;
+	}
+
+	long bufferCount = EnvironmentInt( "DECKLINK_EMULATOR_BUFFERS", 8 );
+	if ( mAllocator )
+	{
+		mAllocator->Commit();
+	}
+	for ( long i = 0; i < bufferCount; i++ )
+	{
+		void *buffer = nullptr;
+		if ( mAllocator )
+		{
+			mAllocator->AllocateBuffer( ( uint32_t )mPattern.FrameBytes(), &buffer );
+		}
+		else if ( posix_memalign( &buffer, 4096, mPattern.FrameBytes() ) != 0 )
+		{
+			buffer = nullptr;
+		}
+		if ( !buffer )
+		{
+			fprintf( stderr, "DeckLink emulator: could not allocate frame buffer\n" );
+			ReleasePools();
+			return E_OUTOFMEMORY;
+		}
+
+		EmulatedVideoFrame *frame = new EmulatedVideoFrame( this );
+		frame->Setup( buffer, info->width, info->height, mPattern.RowBytes(), pixelFormat, bmdFrameFlagDefault );
+		mFrameBuffers.push_back( buffer );
+		mFrames.push_back( frame );
+		mFreeFrames.push_back( frame );
+	}
+
+	mMode = info;
+	mPixelFormat = pixelFormat;
+	mVideoEnabled = true;
+	return S_OK;
+}
+
+HRESULT EmulatorInput::DisableVideoInput( void )
+{
+	if ( mRunning )
+	{
+		return E_ACCESSDENIED;
+	}
+	if ( mVideoEnabled )
+	{
+		ReleasePools();
+		mVideoEnabled = false;
+	}
+	return S_OK;
+}
+
+HRESULT EmulatorInput::EnableAudioInput( BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount )
+{
+	if ( mRunning )
+	{
+		return E_ACCESSDENIED;
+	}
+	if ( sampleRate != bmdAudioSampleRate48kHz || ( sampleType != bmdAudioSampleType16bitInteger && sampleType != bmdAudioSampleType32bitInteger ) || channelCount == 0 )
+	{
+		return E_INVALIDARG;
+	}
+
+	mAudioSampleType = sampleType;
+	mAudioChannels = channelCount;
+	mAudioEnabled = true;
+
+	// 1 kHz tone at -20 dBFS, one period is exactly 48 samples
+	mToneTable.resize( 48 );
+	double amplitude = ( sampleType == bmdAudioSampleType16bitInteger ? 32767.0 : 2147483647.0 ) * 0.1;
+	for ( size_t i = 0; i < mToneTable.size(); i++ )
+	{
+		mToneTable[i] = ( int32_t )( amplitude * sin( 2.0 * M_PI * i / mToneTable.size() ) );
+	}
+	return S_OK;
+}
+
+HRESULT EmulatorInput::DisableAudioInput( void )
+{
+	if ( mRunning )
+	{
+		return E_ACCESSDENIED;
+	}
+	mAudioEnabled = false;
+	return S_OK;
+}
+
+HRESULT EmulatorInput::StartStreams( void )
+{
+	if ( mRunning )
+	{
+		return E_ACCESSDENIED;
+	}
+	if ( !mVideoEnabled )
+	{
+		return E_FAIL;
+	}
+
+	if ( mAudioEnabled && mPackets.empty() )
+	{
+		// a frame never carries more than ceil(48000 * duration / scale) samples
+		long maxSamples = ( long )( ( AUDIO_SAMPLE_RATE * mMode->frameDuration + mMode->timeScale - 1 ) / mMode->timeScale );
+		mAudioPacketBytes = ( size_t )maxSamples * mAudioChannels * ( mAudioSampleType / 8 );
+		for ( size_t i = 0; i < mFrames.size(); i++ )
+		{
+			uint8_t *buffer = ( uint8_t * )calloc( 1, mAudioPacketBytes );
+			if ( !buffer )
+			{
+				fprintf( stderr, "DeckLink emulator: could not allocate audio packet buffer\n" );
+				return E_OUTOFMEMORY;
+			}
+			mPacketBuffers.push_back( buffer );
+			EmulatedAudioPacket *packet = new EmulatedAudioPacket( this );
+			mPackets.push_back( packet );
+			mFreePackets.push_back( packet );
+		}
+	}
+
+	mDelivered = 0;
+	mDropped = 0;
+	mRunning = true;
+	mStreamThread = std::thread( &EmulatorInput::StreamThreadFunction, this );
+	return S_OK;
+}
+
+HRESULT EmulatorInput::StopStreams( void )
+{
+	if ( !mRunning )
+	{
+		return S_OK;
+	}
+
+	mRunning = false;
+	mPoolCondition.notify_all();
+	if ( mStreamThread.joinable() )
+	{
+		mStreamThread.join();
+	}
+
+	fprintf( stderr, "DeckLink emulator (%d): %lu frames delivered, %lu dropped because the consumer was too slow\n",
+			 mDeviceIndex, ( unsigned long )mDelivered, ( unsigned long )mDropped );
+	return S_OK;
+}
+
+EmulatedVideoFrame *EmulatorInput::AcquireFrame( bool wait )
+{
+	std::unique_lock<std::mutex> locker( mPoolMutex );
+	if ( wait )
+	{
+		mPoolCondition.wait( locker, [this]() { return !mFreeFrames.empty() || !mRunning; } );
+	}
+	if ( mFreeFrames.empty() )
+	{
+		return nullptr;
+	}
+	EmulatedVideoFrame *frame = mFreeFrames.back();
+	mFreeFrames.pop_back();
+	return frame;
+}
+
+EmulatedAudioPacket *EmulatorInput::AcquirePacket()
+{
+	std::lock_guard<std::mutex> locker( mPoolMutex );
+	if ( mFreePackets.empty() )
+	{
+		return nullptr;
+	}
+	EmulatedAudioPacket *packet = mFreePackets.back();
+	mFreePackets.pop_back();
+	return packet;
+}
+
+void EmulatorInput::FillAudio( EmulatedAudioPacket *packet, int64_t frameIndex )
+{
+	// audio clock follows the video stream time so every frame carries the exact share of samples (e.g. 800/801 at 59.94)
+	int64_t firstSample = ( int64_t )( ( __int128 )frameIndex * mMode->frameDuration * AUDIO_SAMPLE_RATE / mMode->timeScale );
+	int64_t nextSample = ( int64_t )( ( __int128 )( frameIndex + 1 ) * mMode->frameDuration * AUDIO_SAMPLE_RATE / mMode->timeScale );
+	long sampleCount = ( long )( nextSample - firstSample );
+
+	size_t packetIndex = 0;
+	while ( mPackets[packetIndex] != packet )
+	{
+		packetIndex++;
+	}
+	uint8_t *bytes = mPacketBuffers[packetIndex];
+	for ( long i = 0; i < sampleCount; i++ )
+	{
+		int32_t sample = mToneTable[( firstSample + i ) % mToneTable.size()];
+		for ( uint32_t channel = 0; channel < mAudioChannels; channel++ )
+		{
+			if ( mAudioSampleType == bmdAudioSampleType16bitInteger )
+			{
+				( ( int16_t * )bytes )[i * mAudioChannels + channel] = ( int16_t )sample;
+			}
+			else
+			{
+				( ( int32_t * )bytes )[i * mAudioChannels + channel] = sample;
+			}
+		}
+	}
+	packet->Setup( bytes, sampleCount, firstSample, AUDIO_SAMPLE_RATE );
+}
+
+void EmulatorInput::StreamThreadFunction()
+{
+	const char *rate = getenv( "DECKLINK_EMULATOR_RATE" );
+	bool paced = !( rate && strcmp( rate, "max" ) == 0 );
+	double fps = ( rate && atof( rate ) > 0.0 ) ? atof( rate ) : ( double )mMode->timeScale / mMode->frameDuration;
+	uint64_t intervalNs = ( uint64_t )( 1e9 / fps );
+	long queueDepth = EnvironmentInt( "DECKLINK_EMULATOR_QUEUE", 2 );
+	long noSignalFrames = EnvironmentInt( "DECKLINK_EMULATOR_NO_SIGNAL_FRAMES", 0 );
+
+	uint64_t startNs = MonotonicNs();
+	int64_t index = 0;
+	while ( mRunning )
+	{
+		if ( paced )
+		{
+			std::this_thread::sleep_until( std::chrono::steady_clock::time_point( std::chrono::nanoseconds( startNs + index * intervalNs ) ) );
+
+			// the driver only queues a few frames for a late callback, older ones are lost
+			int64_t currentSlot = ( int64_t )( ( MonotonicNs() - startNs ) / intervalNs );
+			if ( currentSlot - index > queueDepth )
+			{
+				mDropped += currentSlot - queueDepth - index;
+				index = currentSlot - queueDepth;
+			}
+		}
+
+		EmulatedVideoFrame *frame = AcquireFrame( !paced );
+		if ( !frame )
+		{
+			if ( mRunning )
+			{
+				// consumer still holds every buffer
+				mDropped++;
+				index++;
+			}
+			continue;
+		}
+
+		void *bytes = frame->Bytes();
+		mPattern.Render( bytes, index );
+		frame->Setup( bytes, mMode->width, mMode->height, mPattern.RowBytes(), mPixelFormat,
+					  index < noSignalFrames ? bmdFrameHasNoInputSource : bmdFrameFlagDefault );
+		frame->SetTiming( index, mMode->frameDuration, mMode->timeScale, ( BMDTimeValue )MonotonicNs() );
+
+		EmulatedAudioPacket *packet = mAudioEnabled ? AcquirePacket() : nullptr;
+		if ( packet )
+		{
+			FillAudio( packet, index );
+		}
+
+		{
+			std::lock_guard<std::mutex> locker( mCallbackMutex );
+			if ( mCallback )
+			{
+				mCallback->VideoInputFrameArrived( frame, packet );
+			}
+		}
+
+		frame->Release();
+		if ( packet )
+		{
+			packet->Release();
+		}
+		mDelivered++;
+		index++;
+	}
+}
+
+void EmulatorInput::ReleasePools()
+{
+	// frames still referenced by the consumer are given a moment to come back before their memory goes away
+	std::unique_lock<std::mutex> locker( mPoolMutex );
+	mPoolCondition.wait_for( locker, std::chrono::seconds( 1 ), [this]() { return mFreeFrames.size() == mFrames.size(); } );
+
+	// the rest stays with the consumer and is deleted by its last release, the memory under it is leaked rather
+	// than freed under the consumer
+	size_t leakedFrames = 0;
+	for ( size_t i = 0; i < mFrames.size(); i++ )
+	{
+		EmulatedVideoFrame *frame = mFrames[i];
+		auto isFree = [this, frame]() { return std::find( mFreeFrames.begin(), mFreeFrames.end(), frame ) != mFreeFrames.end(); };
+		// a frame Detach finds released is on its way back to the pool, it is given as long as the others
+		if ( !isFree() && ( frame->Detach() || !mPoolCondition.wait_for( locker, std::chrono::seconds( 1 ), isFree ) ) )
+		{
+			leakedFrames++;
+			continue;
+		}
+		delete frame;
+		if ( mAllocator )
+		{
+			mAllocator->ReleaseBuffer( mFrameBuffers[i] );
+		}
+		else
+		{
+			free( mFrameBuffers[i] );
+		}
+	}
+	if ( mAllocator && !mFrameBuffers.empty() )
+	{
+		mAllocator->Decommit();
+	}
+
+	size_t leakedPackets = 0;
+	for ( size_t i = 0; i < mPackets.size(); i++ )
+	{
+		EmulatedAudioPacket *packet = mPackets[i];
+		auto isFree = [this, packet]() { return std::find( mFreePackets.begin(), mFreePackets.end(), packet ) != mFreePackets.end(); };
+		if ( !isFree() && ( packet->Detach() || !mPoolCondition.wait_for( locker, std::chrono::seconds( 1 ), isFree ) ) )
+		{
+			leakedPackets++;
+			continue;
+		}
+		delete packet;
+		free( mPacketBuffers[i] );
+	}
+
+	if ( leakedFrames > 0 || leakedPackets > 0 )
+	{
+		fprintf( stderr, "DeckLink emulator: %zu frames and %zu audio packets are still referenced by the consumer, their memory is leaked\n",
+				 leakedFrames, leakedPackets );
+	}
+	mFrames.clear();
+	mFreeFrames.clear();
+	mFrameBuffers.clear();
+	mPackets.clear();
+	mFreePackets.clear();
+	mPacketBuffers.clear();
+}
+
+class EmulatorDevice final : public IDeckLink
+{
+public:
+	explicit EmulatorDevice( int index )
+		: mIndex( index )
+	{
+		mRefCount = 1;
+		mInput = new EmulatorInput( index );
+		snprintf( mDisplayName, sizeof( mDisplayName ), "DeckLink Emulator (%d)", index + 1 );
+	}
+
+	~EmulatorDevice()
+	{
+		mInput->Release();
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override
+	{
+		if ( !ppv )
+		{
+			return E_POINTER;
+		}
+		if ( IsSameInterface( iid, IID_IDeckLinkInput ) )
+		{
+			return mInput->QueryInterface( iid, ppv );
+		}
+		if ( IsSameInterface( iid, IID_IUnknown ) || IsSameInterface( iid, IID_IDeckLink ) )
+		{
+			*ppv = static_cast<IDeckLink *>( this );
+			AddRef();
+			return S_OK;
+		}
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return ++mRefCount;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		ULONG refCount = --mRefCount;
+		if ( refCount == 0 )
+		{
+			delete this;
+		}
+		return refCount;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetModelName( const char **modelName ) override
+	{
+		if ( !modelName )
+		{
+			return E_POINTER;
+		}
+		*modelName = strdup( "DeckLink Emulator" );
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE GetDisplayName( const char **displayName ) override
+	{
+		if ( !displayName )
+		{
+			return E_POINTER;
+		}
+		*displayName = strdup( mDisplayName );
+		return S_OK;
+	}
+
+private:
+	int mIndex;
+	std::atomic<ULONG> mRefCount;
+	EmulatorInput *mInput;
+	char mDisplayName[64];
+};
+
+class EmulatorIterator final : public IDeckLinkIterator
+{
+public:
+	EmulatorIterator()
+	{
+		mRefCount = 1;
+		mDeviceCount = ( int )EnvironmentInt( "DECKLINK_EMULATOR_DEVICES", 1 );
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override
+	{
+		if ( !ppv )
+		{
+			return E_POINTER;
+		}
+		if ( IsSameInterface( iid, IID_IUnknown ) || IsSameInterface( iid, IID_IDeckLinkIterator ) )
+		{
+			*ppv = static_cast<IDeckLinkIterator *>( this );
+			AddRef();
+			return S_OK;
+		}
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return ++mRefCount;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		ULONG refCount = --mRefCount;
+		if ( refCount == 0 )
+		{
+			delete this;
+		}
+		return refCount;
+	}
+
+	HRESULT STDMETHODCALLTYPE Next( IDeckLink **deckLinkInstance ) override
+	{
+		if ( !deckLinkInstance )
+		{
+			return E_POINTER;
+		}
+		if ( mNextDevice >= mDeviceCount )
+		{
+			*deckLinkInstance = nullptr;
+			return S_FALSE;
+		}
+		*deckLinkInstance = new EmulatorDevice( mNextDevice++ );
+		return S_OK;
+	}
+
+private:
+	std::atomic<ULONG> mRefCount;
+	int mDeviceCount;
+	int mNextDevice = 0;
+};
+
+}
+
+///@endcond INTERNAL
+
+// entry points looked up by DeckLinkAPIDispatch.cpp
+extern "C" {
+
+BMD_PUBLIC IDeckLinkIterator *CreateDeckLinkIteratorInstance_0004( void )
+{
+	return new EmulatorIterator();
+}
+
+BMD_PUBLIC IDeckLinkAPIInformation *CreateDeckLinkAPIInformationInstance_0001( void )
+{
+	return nullptr;
+}
+
+BMD_PUBLIC IDeckLinkVideoConversion *CreateVideoConversionInstance_0001( void )
+{
+	return nullptr;
+}
+
+BMD_PUBLIC IDeckLinkDiscovery *CreateDeckLinkDiscoveryInstance_0003( void )
+{
+	return nullptr;
+}
+
+BMD_PUBLIC IDeckLinkVideoFrameAncillaryPackets *CreateVideoFrameAncillaryPacketsInstance_0001( void )
+{
+	return nullptr;
+}
+
+}
@@ -0,0 +1,65 @@
+#include "displaymodes.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+const DisplayModeInfo MODES[] =
+{
+	{ bmdModeHD720p50, "720p50", 1280, 720, 1000, 50000, bmdProgressiveFrame },
+	{ bmdModeHD720p5994, "720p59.94", 1280, 720, 1001, 60000, bmdProgressiveFrame },
+	{ bmdModeHD720p60, "720p60", 1280, 720, 1000, 60000, bmdProgressiveFrame },
+	{ bmdModeHD1080p2398, "1080p23.98", 1920, 1080, 1001, 24000, bmdProgressiveFrame },
+	{ bmdModeHD1080p24, "1080p24", 1920, 1080, 1000, 24000, bmdProgressiveFrame },
+	{ bmdModeHD1080p25, "1080p25", 1920, 1080, 1000, 25000, bmdProgressiveFrame },
+	{ bmdModeHD1080p2997, "1080p29.97", 1920, 1080, 1001, 30000, bmdProgressiveFrame },
+	{ bmdModeHD1080p30, "1080p30", 1920, 1080, 1000, 30000, bmdProgressiveFrame },
+	{ bmdModeHD1080i50, "1080i50", 1920, 1080, 1000, 25000, bmdUpperFieldFirst },
+	{ bmdModeHD1080i5994, "1080i59.94", 1920, 1080, 1001, 30000, bmdUpperFieldFirst },
+	{ bmdModeHD1080p50, "1080p50", 1920, 1080, 1000, 50000, bmdProgressiveFrame },
+	{ bmdModeHD1080p5994, "1080p59.94", 1920, 1080, 1001, 60000, bmdProgressiveFrame },
+	{ bmdModeHD1080p6000, "1080p60", 1920, 1080, 1000, 60000, bmdProgressiveFrame },
+	{ bmdMode4K2160p25, "2160p25", 3840, 2160, 1000, 25000, bmdProgressiveFrame },
+	{ bmdMode4K2160p2997, "2160p29.97", 3840, 2160, 1001, 30000, bmdProgressiveFrame },
+	{ bmdMode4K2160p30, "2160p30", 3840, 2160, 1000, 30000, bmdProgressiveFrame },
+	{ bmdMode4K2160p50, "2160p50", 3840, 2160, 1000, 50000, bmdProgressiveFrame },
+	{ bmdMode4K2160p5994, "2160p59.94", 3840, 2160, 1001, 60000, bmdProgressiveFrame },
+	{ bmdMode4K2160p60, "2160p60", 3840, 2160, 1000, 60000, bmdProgressiveFrame },
+};
+const size_t MODE_COUNT = sizeof( MODES ) / sizeof( MODES[0] );
+
+}
+
+///@endcond INTERNAL
+
+size_t DisplayModeCount()
+{
+	return MODE_COUNT;
+}
+
+const DisplayModeInfo *DisplayModeAt( size_t index )
+{
+	return index < MODE_COUNT ? &MODES[index] : nullptr;
+}
+
+const DisplayModeInfo *FindDisplayMode( BMDDisplayMode mode )
+{
+	for ( size_t i = 0; i < MODE_COUNT; i++ )
+	{
+		if ( MODES[i].mode == mode )
+		{
+			return &MODES[i];
+		}
+	}
+	return nullptr;
+}
+
+long RowBytesFor( long width, BMDPixelFormat pixelFormat )
+{
+	if ( pixelFormat == bmdFormat10BitYUV )
+	{
+		return ( ( width + 47 ) / 48 ) * 128;
+	}
+	return width * 2;
+}
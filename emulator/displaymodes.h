@@ -0,0 +1,27 @@
+#ifndef DISPLAYMODES_H
+#define DISPLAYMODES_H
+
+#include <stddef.h>
+
+#include "../decklink/DeckLinkAPI.h"
+
+// geometry and timing of the display modes the emulator and the replay source know about
+struct DisplayModeInfo
+{
+	BMDDisplayMode mode;
+	const char *name;
+	long width;
+	long height;
+	BMDTimeValue frameDuration;
+	BMDTimeScale timeScale;
+	BMDFieldDominance fieldDominance;
+};
+
+size_t DisplayModeCount();
+const DisplayModeInfo *DisplayModeAt( size_t index );
+const DisplayModeInfo *FindDisplayMode( BMDDisplayMode mode );
+
+// bytes per row as delivered by the card: UYVY, or v210 padded to 48 pixel groups
+long RowBytesFor( long width, BMDPixelFormat pixelFormat );
+
+#endif // DISPLAYMODES_H
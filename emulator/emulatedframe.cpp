@@ -0,0 +1,308 @@
+#include "emulatedframe.h"
+
+#include <stdio.h>
+
+///@cond INTERNAL
+
+namespace
+{
+
+BMDTimeValue Rescale( BMDTimeValue value, BMDTimeScale from, BMDTimeScale to )
+{
+	return ( BMDTimeValue )( ( __int128 )value * to / from );
+}
+
+// reference count bit of a detached frame or packet
+const ULONG DETACHED = 0x80000000u;
+
+// sets DETACHED unless the count has dropped to zero, in one step so that either the last release sees the bit or
+// Detach sees the zero
+bool SetDetached( std::atomic<ULONG> &refCount )
+{
+	ULONG count = refCount;
+	while ( count != 0 )
+	{
+		if ( refCount.compare_exchange_weak( count, count | DETACHED ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t ToBCD( uint8_t value )
+{
+	return ( ( value / 10 ) << 4 ) | ( value % 10 );
+}
+
+}
+
+///@endcond INTERNAL
+
+EmulatedVideoFrame::EmulatedVideoFrame( Owner *owner )
+	: mOwner( owner )
+{
+	mRefCount = 0;
+	mTimecode.mFrame = this;
+}
+
+void EmulatedVideoFrame::Setup( void *bytes, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags )
+{
+	mBytes = bytes;
+	mWidth = width;
+	mHeight = height;
+	mRowBytes = rowBytes;
+	mPixelFormat = pixelFormat;
+	mFlags = flags;
+	mRefCount = 1;
+}
+
+void EmulatedVideoFrame::SetTiming( int64_t frameIndex, BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDTimeValue hardwareTimeNs )
+{
+	mFrameIndex = frameIndex;
+	mFrameDuration = frameDuration;
+	mTimeScale = timeScale;
+	mHardwareTimeNs = hardwareTimeNs;
+
+	// non drop frame timecode counted from stream start, high frame rates use frame pairs with field mark like RP188
+	int64_t fps = ( timeScale + frameDuration / 2 ) / frameDuration;
+	int64_t timecodeFrame = frameIndex;
+	mTimecode.mFlags = bmdTimecodeFlagDefault;
+	if ( fps > 30 )
+	{
+		fps /= 2;
+		if ( timecodeFrame % 2 )
+		{
+			mTimecode.mFlags = bmdTimecodeFieldMark;
+		}
+		timecodeFrame /= 2;
+	}
+	int64_t seconds = timecodeFrame / fps;
+	mTimecode.mFrames = ( uint8_t )( timecodeFrame % fps );
+	mTimecode.mSeconds = ( uint8_t )( seconds % 60 );
+	mTimecode.mMinutes = ( uint8_t )( ( seconds / 60 ) % 60 );
+	mTimecode.mHours = ( uint8_t )( ( seconds / 3600 ) % 24 );
+	snprintf( mTimecode.mString, sizeof( mTimecode.mString ), "%02u:%02u:%02u:%02u",
+			  mTimecode.mHours, mTimecode.mMinutes, mTimecode.mSeconds, mTimecode.mFrames );
+}
+
+bool EmulatedVideoFrame::Detach()
+{
+	return SetDetached( mRefCount );
+}
+
+HRESULT EmulatedVideoFrame::QueryInterface( REFIID iid, LPVOID *ppv )
+{
+	if ( !ppv )
+	{
+		return E_POINTER;
+	}
+
+	if ( IsSameInterface( iid, IID_IUnknown )
+		 || IsSameInterface( iid, IID_IDeckLinkVideoFrame )
+		 || IsSameInterface( iid, IID_IDeckLinkVideoInputFrame ) )
+	{
+		*ppv = static_cast<IDeckLinkVideoInputFrame *>( this );
+		AddRef();
+		return S_OK;
+	}
+
+	*ppv = nullptr;
+	return E_NOINTERFACE;
+}
+
+ULONG EmulatedVideoFrame::AddRef( void )
+{
+	return ++mRefCount & ~DETACHED;
+}
+
+ULONG EmulatedVideoFrame::Release( void )
+{
+	ULONG refCount = --mRefCount;
+	if ( refCount == 0 && mOwner )
+	{
+		mOwner->FrameReleased( this );
+	}
+	else if ( refCount == 0 || refCount == DETACHED )
+	{
+		delete this;
+	}
+	return refCount & ~DETACHED;
+}
+
+HRESULT EmulatedVideoFrame::GetBytes( void **buffer )
+{
+	if ( !buffer )
+	{
+		return E_POINTER;
+	}
+	*buffer = mBytes;
+	return mBytes ? S_OK : E_FAIL;
+}
+
+HRESULT EmulatedVideoFrame::GetTimecode( BMDTimecodeFormat /*format*/, IDeckLinkTimecode **timecode )
+{
+	if ( !timecode )
+	{
+		return E_POINTER;
+	}
+	if ( mFrameDuration <= 0 )
+	{
+		*timecode = nullptr;
+		return S_FALSE;
+	}
+
+	AddRef();
+	*timecode = &mTimecode;
+	return S_OK;
+}
+
+HRESULT EmulatedVideoFrame::GetAncillaryData( IDeckLinkVideoFrameAncillary **ancillary )
+{
+	if ( ancillary )
+	{
+		*ancillary = nullptr;
+	}
+	return S_FALSE;
+}
+
+HRESULT EmulatedVideoFrame::GetStreamTime( BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale )
+{
+	if ( !frameTime || !frameDuration || timeScale <= 0 )
+	{
+		return E_INVALIDARG;
+	}
+
+	*frameTime = Rescale( mFrameIndex * mFrameDuration, mTimeScale, timeScale );
+	*frameDuration = Rescale( mFrameDuration, mTimeScale, timeScale );
+	return S_OK;
+}
+
+HRESULT EmulatedVideoFrame::GetHardwareReferenceTimestamp( BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration )
+{
+	if ( !frameTime || !frameDuration || timeScale <= 0 )
+	{
+		return E_INVALIDARG;
+	}
+
+	*frameTime = Rescale( mHardwareTimeNs, 1000000000, timeScale );
+	*frameDuration = Rescale( mFrameDuration, mTimeScale, timeScale );
+	return S_OK;
+}
+
+BMDTimecodeBCD EmulatedVideoFrame::Timecode::GetBCD( void )
+{
+	return ( ToBCD( mHours ) << 24 ) | ( ToBCD( mMinutes ) << 16 ) | ( ToBCD( mSeconds ) << 8 ) | ToBCD( mFrames );
+}
+
+HRESULT EmulatedVideoFrame::Timecode::GetComponents( uint8_t *hours, uint8_t *minutes, uint8_t *seconds, uint8_t *frames )
+{
+	if ( !hours || !minutes || !seconds || !frames )
+	{
+		return E_POINTER;
+	}
+	*hours = mHours;
+	*minutes = mMinutes;
+	*seconds = mSeconds;
+	*frames = mFrames;
+	return S_OK;
+}
+
+HRESULT EmulatedVideoFrame::Timecode::GetString( const char **timecode )
+{
+	if ( !timecode )
+	{
+		return E_POINTER;
+	}
+	// the SDK hands out a copy the caller frees, keep that contract
+	*timecode = strdup( mString );
+	return *timecode ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT EmulatedVideoFrame::Timecode::GetTimecodeUserBits( BMDTimecodeUserBits *userBits )
+{
+	if ( !userBits )
+	{
+		return E_POINTER;
+	}
+	*userBits = 0;
+	return S_OK;
+}
+
+EmulatedAudioPacket::EmulatedAudioPacket( Owner *owner )
+	: mOwner( owner )
+{
+	mRefCount = 0;
+}
+
+void EmulatedAudioPacket::Setup( void *bytes, long sampleFrameCount, BMDTimeValue packetTime, BMDTimeScale timeScale )
+{
+	mBytes = bytes;
+	mSampleFrameCount = sampleFrameCount;
+	mPacketTime = packetTime;
+	mTimeScale = timeScale;
+	mRefCount = 1;
+}
+
+bool EmulatedAudioPacket::Detach()
+{
+	return SetDetached( mRefCount );
+}
+
+HRESULT EmulatedAudioPacket::QueryInterface( REFIID iid, LPVOID *ppv )
+{
+	if ( !ppv )
+	{
+		return E_POINTER;
+	}
+
+	if ( IsSameInterface( iid, IID_IUnknown )
+		 || IsSameInterface( iid, IID_IDeckLinkAudioInputPacket ) )
+	{
+		*ppv = static_cast<IDeckLinkAudioInputPacket *>( this );
+		AddRef();
+		return S_OK;
+	}
+
+	*ppv = nullptr;
+	return E_NOINTERFACE;
+}
+
+ULONG EmulatedAudioPacket::AddRef( void )
+{
+	return ++mRefCount & ~DETACHED;
+}
+
+ULONG EmulatedAudioPacket::Release( void )
+{
+	ULONG refCount = --mRefCount;
+	if ( refCount == 0 && mOwner )
+	{
+		mOwner->PacketReleased( this );
+	}
+	else if ( refCount == 0 || refCount == DETACHED )
+	{
+		delete this;
+	}
+	return refCount & ~DETACHED;
+}
+
+HRESULT EmulatedAudioPacket::GetBytes( void **buffer )
+{
+	if ( !buffer )
+	{
+		return E_POINTER;
+	}
+	*buffer = mBytes;
+	return mBytes ? S_OK : E_FAIL;
+}
+
+HRESULT EmulatedAudioPacket::GetPacketTime( BMDTimeValue *packetTime, BMDTimeScale timeScale )
+{
+	if ( !packetTime || timeScale <= 0 )
+	{
+		return E_INVALIDARG;
+	}
+	*packetTime = Rescale( mPacketTime, mTimeScale, timeScale );
+	return S_OK;
+}
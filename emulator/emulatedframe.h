@@ -0,0 +1,146 @@
+#ifndef EMULATEDFRAME_H
+#define EMULATEDFRAME_H
+
+#include <atomic>
+#include <string.h>
+
+#include "../decklink/DeckLinkAPI.h"
+
+inline bool IsSameInterface( const REFIID &a, const REFIID &b )
+{
+	return memcmp( &a, &b, sizeof( REFIID ) ) == 0;
+}
+
+/*
+ * Caller-implemented DeckLink input frames over memory the producer owns (emulator pool, mmapped recording).
+ * Objects are meant to be preconstructed and recycled: when the last reference is released the frame is handed
+ * back to its owner instead of being deleted, so delivering a frame never touches the heap.
+ */
+
+class EmulatedVideoFrame : public IDeckLinkVideoInputFrame
+{
+public:
+	class Owner
+	{
+	public:
+		virtual ~Owner() {}
+		virtual void FrameReleased( EmulatedVideoFrame *frame ) = 0;
+	};
+
+	explicit EmulatedVideoFrame( Owner *owner );
+	virtual ~EmulatedVideoFrame() {}
+
+	// (re)arms a recycled frame, reference count becomes 1
+	void Setup( void *bytes, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags );
+	void SetTiming( int64_t frameIndex, BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDTimeValue hardwareTimeNs );
+
+	void *Bytes() const { return mBytes; }
+	int64_t FrameIndex() const { return mFrameIndex; }
+	// the last release deletes the frame instead of handing it back to the owner; false when no reference was
+	// left, the frame is then on its way back to the owner
+	bool Detach();
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override;
+	ULONG STDMETHODCALLTYPE AddRef( void ) override;
+	ULONG STDMETHODCALLTYPE Release( void ) override;
+
+	// IDeckLinkVideoFrame
+	long STDMETHODCALLTYPE GetWidth( void ) override { return mWidth; }
+	long STDMETHODCALLTYPE GetHeight( void ) override { return mHeight; }
+	long STDMETHODCALLTYPE GetRowBytes( void ) override { return mRowBytes; }
+	BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat( void ) override { return mPixelFormat; }
+	BMDFrameFlags STDMETHODCALLTYPE GetFlags( void ) override { return mFlags; }
+	HRESULT STDMETHODCALLTYPE GetBytes( void **buffer ) override;
+	HRESULT STDMETHODCALLTYPE GetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode **timecode ) override;
+	HRESULT STDMETHODCALLTYPE GetAncillaryData( IDeckLinkVideoFrameAncillary **ancillary ) override;
+
+	// IDeckLinkVideoInputFrame
+	HRESULT STDMETHODCALLTYPE GetStreamTime( BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale ) override;
+	HRESULT STDMETHODCALLTYPE GetHardwareReferenceTimestamp( BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration ) override;
+
+private:
+	// timecode is embedded in the frame and shares its reference count
+	class Timecode : public IDeckLinkTimecode
+	{
+	public:
+		EmulatedVideoFrame *mFrame = nullptr;
+		uint8_t mHours = 0;
+		uint8_t mMinutes = 0;
+		uint8_t mSeconds = 0;
+		uint8_t mFrames = 0;
+		BMDTimecodeFlags mFlags = bmdTimecodeFlagDefault;
+		char mString[16] = {0};
+
+		HRESULT STDMETHODCALLTYPE QueryInterface( REFIID, LPVOID * ) override { return E_NOINTERFACE; }
+		ULONG STDMETHODCALLTYPE AddRef( void ) override { return mFrame->AddRef(); }
+		ULONG STDMETHODCALLTYPE Release( void ) override { return mFrame->Release(); }
+
+		BMDTimecodeBCD STDMETHODCALLTYPE GetBCD( void ) override;
+		HRESULT STDMETHODCALLTYPE GetComponents( uint8_t *hours, uint8_t *minutes, uint8_t *seconds, uint8_t *frames ) override;
+		HRESULT STDMETHODCALLTYPE GetString( const char **timecode ) override;
+		BMDTimecodeFlags STDMETHODCALLTYPE GetFlags( void ) override { return mFlags; }
+		HRESULT STDMETHODCALLTYPE GetTimecodeUserBits( BMDTimecodeUserBits *userBits ) override;
+	};
+
+	Owner *mOwner;
+	// the high bit is set by Detach
+	std::atomic<ULONG> mRefCount;
+
+	void *mBytes = nullptr;
+	long mWidth = 0;
+	long mHeight = 0;
+	long mRowBytes = 0;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+	BMDFrameFlags mFlags = bmdFrameFlagDefault;
+
+	int64_t mFrameIndex = 0;
+	BMDTimeValue mFrameDuration = 0;
+	BMDTimeScale mTimeScale = 1;
+	BMDTimeValue mHardwareTimeNs = 0;
+
+	Timecode mTimecode;
+};
+
+class EmulatedAudioPacket : public IDeckLinkAudioInputPacket
+{
+public:
+	class Owner
+	{
+	public:
+		virtual ~Owner() {}
+		virtual void PacketReleased( EmulatedAudioPacket *packet ) = 0;
+	};
+
+	explicit EmulatedAudioPacket( Owner *owner );
+	virtual ~EmulatedAudioPacket() {}
+
+	// (re)arms a recycled packet, reference count becomes 1
+	void Setup( void *bytes, long sampleFrameCount, BMDTimeValue packetTime, BMDTimeScale timeScale );
+
+	void *Bytes() const { return mBytes; }
+	// see EmulatedVideoFrame::Detach
+	bool Detach();
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID *ppv ) override;
+	ULONG STDMETHODCALLTYPE AddRef( void ) override;
+	ULONG STDMETHODCALLTYPE Release( void ) override;
+
+	// IDeckLinkAudioInputPacket
+	long STDMETHODCALLTYPE GetSampleFrameCount( void ) override { return mSampleFrameCount; }
+	HRESULT STDMETHODCALLTYPE GetBytes( void **buffer ) override;
+	HRESULT STDMETHODCALLTYPE GetPacketTime( BMDTimeValue *packetTime, BMDTimeScale timeScale ) override;
+
+private:
+	Owner *mOwner;
+	// the high bit is set by Detach
+	std::atomic<ULONG> mRefCount;
+
+	void *mBytes = nullptr;
+	long mSampleFrameCount = 0;
+	BMDTimeValue mPacketTime = 0;
+	BMDTimeScale mTimeScale = 1;
+};
+
+#endif // EMULATEDFRAME_H
@@ -0,0 +1,19 @@
+# Stand-in for the Blackmagic driver library: builds an unversioned libDeckLinkAPI.so
+# which DeckLinkAPIDispatch.cpp picks up when its directory is on LD_LIBRARY_PATH.
+TEMPLATE = lib
+TARGET = DeckLinkAPI
+CONFIG += c++11 plugin
+CONFIG -= qt
+
+LIBS += -lpthread
+
+HEADERS += \
+	displaymodes.h \
+	emulatedframe.h \
+	patterngenerator.h
+
+SOURCES += \
+	decklinkemulator.cpp \
+	displaymodes.cpp \
+	emulatedframe.cpp \
+	patterngenerator.cpp
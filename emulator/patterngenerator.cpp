@@ -0,0 +1,180 @@
+#include "patterngenerator.h"
+#include "displaymodes.h"
+
+#include <string.h>
+#include <vector>
+
+///@cond INTERNAL
+
+namespace
+{
+
+// moving elements are drawn in whole v210 groups (48 pixels = 128 bytes v210 / 96 bytes UYVY) so both formats stay aligned
+const long BLOCK_PIXELS = 48;
+const long BOX_BLOCKS = 5;
+const long BOX_LINES = 240;
+
+struct YCbCr
+{
+	uint16_t y;
+	uint16_t cb;
+	uint16_t cr;
+};
+
+// BT.709 limited range, 10 bit
+YCbCr FromRGB( double r, double g, double b )
+{
+	double y = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+	YCbCr result;
+	result.y = ( uint16_t )( 64 + 876 * y + 0.5 );
+	result.cb = ( uint16_t )( 512 + 896 * ( b - y ) / 1.8556 + 0.5 );
+	result.cr = ( uint16_t )( 512 + 896 * ( r - y ) / 1.5748 + 0.5 );
+	return result;
+}
+
+// packs width pixels of 4:4:4 samples into one 4:2:2 row (chroma of even pixels is used)
+void PackRow( const YCbCr *pixels, long width, BMDPixelFormat pixelFormat, uint8_t *dst )
+{
+	if ( pixelFormat == bmdFormat10BitYUV )
+	{
+		uint32_t *words = ( uint32_t * )dst;
+		for ( long x = 0; x + 6 <= width; x += 6 )
+		{
+			const YCbCr *p = pixels + x;
+			*words++ = p[0].cb | ( p[0].y << 10 ) | ( ( uint32_t )p[0].cr << 20 );
+			*words++ = p[1].y | ( p[2].cb << 10 ) | ( ( uint32_t )p[2].y << 20 );
+			*words++ = p[2].cr | ( p[3].y << 10 ) | ( ( uint32_t )p[4].cb << 20 );
+			*words++ = p[4].y | ( p[4].cr << 10 ) | ( ( uint32_t )p[5].y << 20 );
+		}
+		return;
+	}
+
+	for ( long x = 0; x + 2 <= width; x += 2 )
+	{
+		*dst++ = pixels[x].cb >> 2;
+		*dst++ = pixels[x].y >> 2;
+		*dst++ = pixels[x].cr >> 2;
+		*dst++ = pixels[x + 1].y >> 2;
+	}
+}
+
+}
+
+class PatternGenerator::PrivateClass
+{
+public:
+	long mWidth = 0;
+	long mHeight = 0;
+	long mRowBytes = 0;
+	long mBlockBytes = 0;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+
+	std::vector<uint8_t> mBase;
+	std::vector<uint8_t> mBoxRow;
+	std::vector<uint8_t> mStripeRow;
+};
+
+///@endcond INTERNAL
+
+PatternGenerator::PatternGenerator()
+{
+	d = new PatternGenerator::PrivateClass();
+}
+
+PatternGenerator::~PatternGenerator()
+{
+	delete d;
+	d = nullptr;
+}
+
+bool PatternGenerator::Init( long width, long height, BMDPixelFormat pixelFormat )
+{
+	if ( width < BLOCK_PIXELS * BOX_BLOCKS || height < BOX_LINES )
+	{
+		return false;
+	}
+	if ( pixelFormat != bmdFormat8BitYUV && pixelFormat != bmdFormat10BitYUV )
+	{
+		return false;
+	}
+
+	d->mWidth = width;
+	d->mHeight = height;
+	d->mPixelFormat = pixelFormat;
+	d->mRowBytes = RowBytesFor( width, pixelFormat );
+	d->mBlockBytes = RowBytesFor( BLOCK_PIXELS, pixelFormat );
+	d->mBase.assign( ( size_t )d->mRowBytes * height, 0 );
+
+	const YCbCr bars[7] =
+	{
+		FromRGB( 0.75, 0.75, 0.75 ), FromRGB( 0.75, 0.75, 0.0 ), FromRGB( 0.0, 0.75, 0.75 ), FromRGB( 0.0, 0.75, 0.0 ),
+		FromRGB( 0.75, 0.0, 0.75 ), FromRGB( 0.75, 0.0, 0.0 ), FromRGB( 0.0, 0.0, 0.75 )
+	};
+
+	std::vector<YCbCr> row( width );
+	for ( long x = 0; x < width; x++ )
+	{
+		row[x] = bars[x * 7 / width];
+	}
+	long barsHeight = height * 2 / 3;
+	for ( long y = 0; y < barsHeight; y++ )
+	{
+		PackRow( row.data(), width, pixelFormat, d->mBase.data() + y * d->mRowBytes );
+	}
+
+	for ( long x = 0; x < width; x++ )
+	{
+		double level = ( double )x / ( width - 1 );
+		row[x] = FromRGB( level, level, level );
+	}
+	for ( long y = barsHeight; y < height; y++ )
+	{
+		PackRow( row.data(), width, pixelFormat, d->mBase.data() + y * d->mRowBytes );
+	}
+
+	std::vector<YCbCr> box( BLOCK_PIXELS * BOX_BLOCKS, FromRGB( 0.9, 0.45, 0.1 ) );
+	d->mBoxRow.assign( d->mBlockBytes * BOX_BLOCKS, 0 );
+	PackRow( box.data(), box.size(), pixelFormat, d->mBoxRow.data() );
+
+	std::vector<YCbCr> stripe( BLOCK_PIXELS, FromRGB( 1.0, 1.0, 1.0 ) );
+	d->mStripeRow.assign( d->mBlockBytes, 0 );
+	PackRow( stripe.data(), stripe.size(), pixelFormat, d->mStripeRow.data() );
+
+	return true;
+}
+
+long PatternGenerator::RowBytes() const
+{
+	return d->mRowBytes;
+}
+
+size_t PatternGenerator::FrameBytes() const
+{
+	return ( size_t )d->mRowBytes * d->mHeight;
+}
+
+void PatternGenerator::Render( void *buffer, int64_t frameIndex ) const
+{
+	uint8_t *frame = ( uint8_t * )buffer;
+	memcpy( frame, d->mBase.data(), d->mBase.size() );
+
+	// stripe scrolls one block per frame over the full height
+	long blocks = d->mWidth / BLOCK_PIXELS;
+	long stripeOffset = ( frameIndex % blocks ) * d->mBlockBytes;
+	for ( long y = 0; y < d->mHeight; y++ )
+	{
+		memcpy( frame + y * d->mRowBytes + stripeOffset, d->mStripeRow.data(), d->mStripeRow.size() );
+	}
+
+	// box bounces between the frame edges
+	long xRange = blocks - BOX_BLOCKS;
+	long yRange = d->mHeight - BOX_LINES;
+	long xStep = xRange > 0 ? frameIndex % ( 2 * xRange ) : 0;
+	long yStep = yRange > 0 ? ( frameIndex * 8 ) % ( 2 * yRange ) : 0;
+	long boxX = xStep < xRange ? xStep : 2 * xRange - xStep;
+	long boxY = yStep < yRange ? yStep : 2 * yRange - yStep;
+	for ( long y = boxY; y < boxY + BOX_LINES; y++ )
+	{
+		memcpy( frame + y * d->mRowBytes + boxX * d->mBlockBytes, d->mBoxRow.data(), d->mBoxRow.size() );
+	}
+}
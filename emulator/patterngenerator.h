@@ -0,0 +1,31 @@
+#ifndef PATTERNGENERATOR_H
+#define PATTERNGENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../decklink/DeckLinkAPI.h"
+
+// renders 75% colour bars over a luma ramp with a bouncing box and a scrolling stripe, packed as UYVY or v210
+class PatternGenerator
+{
+public:
+	PatternGenerator();
+	~PatternGenerator();
+
+	bool Init( long width, long height, BMDPixelFormat pixelFormat );
+
+	long RowBytes() const;
+	size_t FrameBytes() const;
+	void Render( void *buffer, int64_t frameIndex ) const;
+
+
+private:
+	PatternGenerator( const PatternGenerator & ) = delete;
+	PatternGenerator &operator=( const PatternGenerator & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // PATTERNGENERATOR_H
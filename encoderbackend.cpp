@@ -0,0 +1,264 @@
+#include "encoderbackend.h"
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+#include "deps/ffmpeg/include/libavutil/imgutils.h"
+#include "deps/ffmpeg/include/libavutil/opt.h"
+}
+
+#include "proresencoder.h"
+#include "recordersettings.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+class ProResBackend : public EncoderBackend
+{
+protected:
+	int mProfile;
+
+public:
+	explicit ProResBackend( int profile ) : mProfile( profile ) {}
+
+	QString Name() const override
+	{
+		static const char *names[] = { "prores_proxy", "prores_lt", "prores_422", "prores_hq" };
+		return names[mProfile];
+	}
+	AVCodecID CodecId( int ) const override
+	{
+		return AV_CODEC_ID_PRORES;
+	}
+	AVPixelFormat PixelFormat( int ) const override
+	{
+		return AV_PIX_FMT_YUV422P10LE;
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings & ) const override
+	{
+		context->profile = mProfile;
+		av_opt_set( context->priv_data, "profile", qUtf8Printable( QString::number( mProfile ) ), 0 );
+	}
+	uint64_t EstimatedFrameBytes( int width, int height, int ) const override
+	{
+		// published ProRes 422 data rates per pixel of a frame (proxy, LT, standard, HQ), with half again for detailed pictures
+		static const double bytesPerPixel[] = { 0.09, 0.2, 0.29, 0.44 };
+		return ( uint64_t )( ( uint64_t )width * height * bytesPerPixel[mProfile] * 1.5 );
+	}
+};
+
+// the same profiles from ProResEncoder, fed with the capture buffers instead of converted pictures
+class ProResNativeBackend : public ProResBackend
+{
+public:
+	explicit ProResNativeBackend( int profile ) : ProResBackend( profile ) {}
+
+	QString Name() const override
+	{
+		return ProResBackend::Name() + "_native";
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings &settings ) const override
+	{
+		ProResBackend::Configure( context, settings );
+		// what the encoder would have set when opened, it codes progressive pictures only
+		context->codec_tag = ProResEncoder::CodecTag( mProfile );
+		context->bits_per_raw_sample = 10;
+		context->field_order = AV_FIELD_PROGRESSIVE;
+	}
+	ProResEncoder *CreateNativeEncoder() const override
+	{
+		return new ProResEncoder( mProfile );
+	}
+};
+
+class DnxhrBackend : public EncoderBackend
+{
+	const char *mProfile;
+	bool mTenBit;
+	double mBytesPerPixel;
+
+public:
+	DnxhrBackend( const char *profile, bool tenBit, double bytesPerPixel )
+		: mProfile( profile )
+		, mTenBit( tenBit )
+		, mBytesPerPixel( bytesPerPixel )
+	{
+	}
+
+	QString Name() const override
+	{
+		return mProfile;
+	}
+	AVCodecID CodecId( int ) const override
+	{
+		return AV_CODEC_ID_DNXHD;
+	}
+	AVPixelFormat PixelFormat( int ) const override
+	{
+		return mTenBit ? AV_PIX_FMT_YUV422P10LE : AV_PIX_FMT_YUV422P;
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings & ) const override
+	{
+		// DNxHR picks its bit rate from the profile and the frame size, any resolution is allowed
+		av_opt_set( context->priv_data, "profile", mProfile, 0 );
+	}
+	uint64_t EstimatedFrameBytes( int width, int height, int ) const override
+	{
+		// constant bit rate codec, the frame size hardly varies
+		return ( uint64_t )( ( uint64_t )width * height * mBytesPerPixel * 1.1 );
+	}
+};
+
+class Ffv1Backend : public EncoderBackend
+{
+public:
+	QString Name() const override
+	{
+		return "ffv1";
+	}
+	AVCodecID CodecId( int ) const override
+	{
+		return AV_CODEC_ID_FFV1;
+	}
+	AVPixelFormat PixelFormat( int captureBitDepth ) const override
+	{
+		// lossless: the capture depth is kept, nothing is added
+		return captureBitDepth > 8 ? AV_PIX_FMT_YUV422P10LE : AV_PIX_FMT_YUV422P;
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings & ) const override
+	{
+		// version 3 splits every picture into independently coded slices with their own CRC, encoded on the
+		// slice threads of one frame; FFV1 has no frame threading
+		context->level = 3;
+		context->slices = 16;
+		context->gop_size = 1;
+		context->thread_type = FF_THREAD_SLICE;
+		context->thread_count = 8;
+		av_opt_set_int( context->priv_data, "slicecrc", 1, 0 );
+	}
+	uint64_t EstimatedFrameBytes( int width, int height, int captureBitDepth ) const override
+	{
+		// noisy camera pictures compress to about two thirds losslessly
+		uint64_t rawBytes = av_image_get_buffer_size( PixelFormat( captureBitDepth ), width, height, 1 );
+		return rawBytes * 2 / 3;
+	}
+};
+
+class X264Backend : public EncoderBackend
+{
+public:
+	QString Name() const override
+	{
+		return "x264";
+	}
+	AVCodecID CodecId( int ) const override
+	{
+		return AV_CODEC_ID_H264;
+	}
+	AVPixelFormat PixelFormat( int ) const override
+	{
+		return AV_PIX_FMT_YUV420P;
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings &settings ) const override
+	{
+		// long GOP with reordering; the packets keep the timestamps the encoder gives them
+		context->gop_size           = qMax( 1, settings.gopSize );
+		context->keyint_min         = qMin( context->gop_size, 25 );
+		context->max_b_frames       = qMax( 0, settings.bFrames );
+		context->profile            = FF_PROFILE_H264_HIGH;
+		// a picture forced to I (the first of a take) becomes an IDR, nothing after it references the warm-up
+		av_opt_set_int( context->priv_data, "forced-idr", 1, 0 );
+		if ( settings.lookahead >= 0 )
+		{
+			av_opt_set_int( context->priv_data, "rc-lookahead", settings.lookahead, 0 );
+		}
+	}
+	uint64_t EstimatedFrameBytes( int, int, int ) const override
+	{
+		return 0;
+	}
+};
+
+class RawBackend : public EncoderBackend
+{
+public:
+	QString Name() const override
+	{
+		return "raw";
+	}
+	AVCodecID CodecId( int captureBitDepth ) const override
+	{
+		// the capture layout itself: 2vuy, or v210 packed again from the planar 10 bit picture
+		return captureBitDepth > 8 ? AV_CODEC_ID_V210 : AV_CODEC_ID_RAWVIDEO;
+	}
+	AVPixelFormat PixelFormat( int captureBitDepth ) const override
+	{
+		return captureBitDepth > 8 ? AV_PIX_FMT_YUV422P10LE : AV_PIX_FMT_UYVY422;
+	}
+	void Configure( AVCodecContext *context, const RecorderSettings & ) const override
+	{
+		context->gop_size = 1;
+	}
+	uint64_t EstimatedFrameBytes( int width, int height, int captureBitDepth ) const override
+	{
+		if ( captureBitDepth > 8 )
+		{
+			// v210 rows of 48 pixel groups in 128 bytes
+			return ( uint64_t )( ( width + 47 ) / 48 ) * 128 * height;
+		}
+		return av_image_get_buffer_size( AV_PIX_FMT_UYVY422, width, height, 1 );
+	}
+};
+
+}
+
+///@endcond INTERNAL
+
+EncoderBackend *EncoderBackend::Create( const QString &profile )
+{
+	for ( int proresProfile = FF_PROFILE_PRORES_PROXY; proresProfile <= FF_PROFILE_PRORES_HQ; proresProfile++ )
+	{
+		if ( profile == ProResBackend( proresProfile ).Name() )
+		{
+			return new ProResBackend( proresProfile );
+		}
+		if ( profile == ProResNativeBackend( proresProfile ).Name() )
+		{
+			return new ProResNativeBackend( proresProfile );
+		}
+	}
+	// DNxHR data rates per pixel of a frame (SQ, HQ, HQX)
+	if ( profile == "dnxhr_sq" )
+	{
+		return new DnxhrBackend( "dnxhr_sq", false, 0.29 );
+	}
+	if ( profile == "dnxhr_hq" )
+	{
+		return new DnxhrBackend( "dnxhr_hq", false, 0.44 );
+	}
+	if ( profile == "dnxhr_hqx" )
+	{
+		return new DnxhrBackend( "dnxhr_hqx", true, 0.55 );
+	}
+	if ( profile == "ffv1" )
+	{
+		return new Ffv1Backend();
+	}
+	if ( profile == "x264" )
+	{
+		return new X264Backend();
+	}
+	if ( profile == "raw" )
+	{
+		return new RawBackend();
+	}
+	return nullptr;
+}
+
+QStringList EncoderBackend::Profiles()
+{
+	return QStringList() << "prores_proxy" << "prores_lt" << "prores_422" << "prores_hq"
+						 << "prores_proxy_native" << "prores_lt_native" << "prores_422_native" << "prores_hq_native"
+						 << "dnxhr_sq" << "dnxhr_hq" << "dnxhr_hqx" << "ffv1" << "x264" << "raw";
+}
@@ -0,0 +1,45 @@
+#ifndef ENCODERBACKEND_H
+#define ENCODERBACKEND_H
+
+#include <stdint.h>
+#include <QString>
+#include <QStringList>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/codec_id.h"
+#include "deps/ffmpeg/include/libavutil/pixfmt.h"
+}
+
+struct AVCodecContext;
+struct RecorderSettings;
+class ProResEncoder;
+
+// video codec profile a take is encoded with, chosen by name at runtime: which libavcodec encoder, the picture
+// format it is fed with (the conversion from the capture format is planned once from it at Init) and the options
+// of its context
+class EncoderBackend
+{
+public:
+	virtual ~EncoderBackend() {}
+
+	virtual QString Name() const = 0;
+	// the capture has 8 (UYVY) or 10 (v210) bits per sample
+	virtual AVCodecID CodecId( int captureBitDepth ) const = 0;
+	virtual AVPixelFormat PixelFormat( int captureBitDepth ) const = 0;
+	// called on the allocated context after size, time base, pixel format and frame threading are set, before it is opened
+	virtual void Configure( AVCodecContext *context, const RecorderSettings &settings ) const = 0;
+	// compressed size of a detailed frame for the memory budget, 0 when the encoder's rate control decides
+	virtual uint64_t EstimatedFrameBytes( int width, int height, int captureBitDepth ) const = 0;
+	// encoder of our own that takes the captured rows as they are, nullptr for the libavcodec encoders; the context
+	// of CodecId is then only configured, not opened, and describes the stream
+	virtual ProResEncoder *CreateNativeEncoder() const
+	{
+		return nullptr;
+	}
+
+	// nullptr for an unknown name
+	static EncoderBackend *Create( const QString &profile );
+	static QStringList Profiles();
+};
+
+#endif // ENCODERBACKEND_H
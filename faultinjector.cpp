@@ -0,0 +1,258 @@
+#include "faultinjector.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+///@cond INTERNAL
+
+namespace
+{
+
+enum Site
+{
+	SiteCapture = 0,
+	SiteEncode,
+	SiteWrite
+};
+
+void SleepUs( uint64_t us )
+{
+	if ( us > 0 )
+	{
+		std::this_thread::sleep_for( std::chrono::microseconds( us ) );
+	}
+}
+
+uint64_t MonotonicUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+}
+
+class FaultInjector::PrivateClass
+{
+public:
+	Settings mSettings;
+	IDeckLinkInputCallback *mDelegate = nullptr;
+
+	// one generator per site, each used by a single thread only
+	std::mt19937_64 mCaptureRandom;
+	std::mt19937_64 mEncodeRandom;
+	std::mt19937_64 mWriteRandom;
+
+	std::mutex mCaptureMutex;
+	std::vector<std::pair<IDeckLinkVideoInputFrame *, IDeckLinkAudioInputPacket *>> mHeldFrames;
+	int mBurstRemaining = 0;
+	bool mHolding = true;
+
+	// throughput cap: writes may not get ahead of the byte budget accumulated since the first write
+	uint64_t mThrottleStartUs = 0;
+	double mThrottleBytes = 0.0;
+
+	std::atomic<uint64_t> mDroppedFrames;
+	std::atomic<uint64_t> mBursts;
+	std::atomic<uint64_t> mJitterUs;
+	std::atomic<uint64_t> mEncodeDelays;
+	std::atomic<uint64_t> mEncodeDelayUs;
+	std::atomic<uint64_t> mWriteStalls;
+	std::atomic<uint64_t> mWriteDelayUs;
+	std::atomic<uint64_t> mThrottleUs;
+
+	explicit PrivateClass( const Settings &settings )
+		: mSettings( settings )
+		, mCaptureRandom( settings.seed * 3 + SiteCapture )
+		, mEncodeRandom( settings.seed * 3 + SiteEncode )
+		, mWriteRandom( settings.seed * 3 + SiteWrite )
+	{
+		mDroppedFrames = 0;
+		mBursts = 0;
+		mJitterUs = 0;
+		mEncodeDelays = 0;
+		mEncodeDelayUs = 0;
+		mWriteStalls = 0;
+		mWriteDelayUs = 0;
+		mThrottleUs = 0;
+	}
+
+	static bool Chance( std::mt19937_64 &random, double probability )
+	{
+		return probability > 0.0 && std::uniform_real_distribution<double>( 0.0, 1.0 )( random ) < probability;
+	}
+	static uint64_t UniformUs( std::mt19937_64 &random, uint64_t maxUs )
+	{
+		return maxUs > 0 ? std::uniform_int_distribution<uint64_t>( 0, maxUs )( random ) : 0;
+	}
+
+	void ReleaseHeldFrames( bool forward );
+};
+
+void FaultInjector::PrivateClass::ReleaseHeldFrames( bool forward )
+{
+	for ( auto &held : mHeldFrames )
+	{
+		if ( forward && mDelegate )
+		{
+			mDelegate->VideoInputFrameArrived( held.first, held.second );
+		}
+		if ( held.first )
+		{
+			held.first->Release();
+		}
+		if ( held.second )
+		{
+			held.second->Release();
+		}
+	}
+	mHeldFrames.clear();
+}
+
+///@endcond INTERNAL
+
+bool FaultInjector::Settings::HasCaptureFaults() const
+{
+	return captureJitterMs > 0 || ( captureBurstProbability > 0.0 && captureBurstFrames > 1 ) || captureDropProbability > 0.0;
+}
+
+bool FaultInjector::Settings::IsEnabled() const
+{
+	return HasCaptureFaults() || writeLatencyUs > 0 || ( writeStallProbability > 0.0 && writeStallMs > 0 ) || writeThroughputMBps > 0.0
+		   || ( encodeDelayProbability > 0.0 && encodeDelayMaxMs > 0 );
+}
+
+void FaultInjector::Stats::Print( FILE *stream ) const
+{
+	fprintf( stream, "Injected faults: %lu capture drops, %lu bursts, %.1f ms jitter, %lu encode delays (%.1f ms), %lu write stalls, %.1f ms write latency, %.1f ms throttled\n",
+			 droppedFrames, bursts, jitterUs / 1000.0, encodeDelays, encodeDelayUs / 1000.0, writeStalls, writeDelayUs / 1000.0, throttleUs / 1000.0 );
+}
+
+FaultInjector::FaultInjector( const Settings &settings )
+{
+	d = new FaultInjector::PrivateClass( settings );
+}
+
+FaultInjector::~FaultInjector()
+{
+	DropHeldFrames();
+	delete d;
+	d = nullptr;
+}
+
+void FaultInjector::SetDelegate( IDeckLinkInputCallback *delegate )
+{
+	d->mDelegate = delegate;
+}
+
+void FaultInjector::DropHeldFrames()
+{
+	std::lock_guard<std::mutex> locker( d->mCaptureMutex );
+	d->ReleaseHeldFrames( false );
+	d->mBurstRemaining = 0;
+	d->mHolding = false;
+}
+
+void FaultInjector::BeforeEncode()
+{
+	if ( PrivateClass::Chance( d->mEncodeRandom, d->mSettings.encodeDelayProbability ) )
+	{
+		uint64_t delayUs = PrivateClass::UniformUs( d->mEncodeRandom, ( uint64_t )d->mSettings.encodeDelayMaxMs * 1000 );
+		SleepUs( delayUs );
+		d->mEncodeDelays++;
+		d->mEncodeDelayUs += delayUs;
+	}
+}
+
+void FaultInjector::BeforeWrite( size_t bytes )
+{
+	uint64_t delayUs = d->mSettings.writeLatencyUs;
+	if ( PrivateClass::Chance( d->mWriteRandom, d->mSettings.writeStallProbability ) )
+	{
+		delayUs += ( uint64_t )d->mSettings.writeStallMs * 1000;
+		d->mWriteStalls++;
+	}
+	SleepUs( delayUs );
+	d->mWriteDelayUs += delayUs;
+
+	if ( d->mSettings.writeThroughputMBps > 0.0 )
+	{
+		uint64_t nowUs = MonotonicUs();
+		if ( d->mThrottleStartUs == 0 )
+		{
+			d->mThrottleStartUs = nowUs;
+		}
+		// the previous writes must have taken at least as long as the cap allows before this one may go
+		uint64_t earliestUs = d->mThrottleStartUs + ( uint64_t )( d->mThrottleBytes / d->mSettings.writeThroughputMBps );
+		if ( earliestUs > nowUs )
+		{
+			SleepUs( earliestUs - nowUs );
+			d->mThrottleUs += earliestUs - nowUs;
+		}
+		d->mThrottleBytes += bytes;
+	}
+}
+
+FaultInjector::Stats FaultInjector::GetStats() const
+{
+	Stats stats;
+	stats.droppedFrames = d->mDroppedFrames;
+	stats.bursts = d->mBursts;
+	stats.jitterUs = d->mJitterUs;
+	stats.encodeDelays = d->mEncodeDelays;
+	stats.encodeDelayUs = d->mEncodeDelayUs;
+	stats.writeStalls = d->mWriteStalls;
+	stats.writeDelayUs = d->mWriteDelayUs;
+	stats.throttleUs = d->mThrottleUs;
+	return stats;
+}
+
+HRESULT FaultInjector::VideoInputFormatChanged( BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode *mode, BMDDetectedVideoInputFormatFlags flags )
+{
+	return d->mDelegate ? d->mDelegate->VideoInputFormatChanged( events, mode, flags ) : S_OK;
+}
+
+HRESULT FaultInjector::VideoInputFrameArrived( IDeckLinkVideoInputFrame *videoFrame, IDeckLinkAudioInputPacket *audioPacket )
+{
+	std::lock_guard<std::mutex> locker( d->mCaptureMutex );
+	const Settings &settings = d->mSettings;
+
+	// a frame lost in the driver never reaches the callback, the recorder sees a gap in stream time
+	if ( PrivateClass::Chance( d->mCaptureRandom, settings.captureDropProbability ) )
+	{
+		d->mDroppedFrames++;
+		return S_OK;
+	}
+
+	uint64_t jitterUs = PrivateClass::UniformUs( d->mCaptureRandom, ( uint64_t )settings.captureJitterMs * 1000 );
+	SleepUs( jitterUs );
+	d->mJitterUs += jitterUs;
+
+	if ( d->mHolding && d->mBurstRemaining == 0 && settings.captureBurstFrames > 1 && PrivateClass::Chance( d->mCaptureRandom, settings.captureBurstProbability ) )
+	{
+		d->mBurstRemaining = settings.captureBurstFrames;
+		d->mBursts++;
+	}
+	if ( d->mBurstRemaining > 0 )
+	{
+		// hold the frame like a stalled driver thread would, the last one of the burst releases all of them at once
+		if ( videoFrame )
+		{
+			videoFrame->AddRef();
+		}
+		if ( audioPacket )
+		{
+			audioPacket->AddRef();
+		}
+		d->mHeldFrames.push_back( std::make_pair( videoFrame, audioPacket ) );
+		if ( --d->mBurstRemaining == 0 )
+		{
+			d->ReleaseHeldFrames( true );
+		}
+		return S_OK;
+	}
+
+	return d->mDelegate ? d->mDelegate->VideoInputFrameArrived( videoFrame, audioPacket ) : S_OK;
+}
@@ -0,0 +1,93 @@
+#ifndef FAULTINJECTOR_H
+#define FAULTINJECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decklink/DeckLinkAPI.h"
+
+// injects slow storage, encode spikes and irregular capture into the pipeline; every site draws from its own
+// generator seeded from the one seed, so a run is reproducible no matter how the threads interleave
+class FaultInjector : public IDeckLinkInputCallback
+{
+public:
+	struct Settings
+	{
+		uint64_t seed = 1;
+
+		// writer: fixed latency per packet, occasional stalls and a throughput cap
+		int writeLatencyUs = 0;
+		double writeStallProbability = 0.0;
+		int writeStallMs = 0;
+		double writeThroughputMBps = 0.0;
+
+		// encoder: random per-frame delay up to the maximum
+		double encodeDelayProbability = 0.0;
+		int encodeDelayMaxMs = 0;
+
+		// capture: delayed callbacks, frames held back and released in a burst, frames lost in the driver
+		int captureJitterMs = 0;
+		double captureBurstProbability = 0.0;
+		int captureBurstFrames = 0;
+		double captureDropProbability = 0.0;
+
+		bool HasCaptureFaults() const;
+		bool IsEnabled() const;
+	};
+
+	struct Stats
+	{
+		uint64_t droppedFrames = 0;
+		uint64_t bursts = 0;
+		uint64_t jitterUs = 0;
+		uint64_t encodeDelays = 0;
+		uint64_t encodeDelayUs = 0;
+		uint64_t writeStalls = 0;
+		uint64_t writeDelayUs = 0;
+		uint64_t throttleUs = 0;
+
+		void Print( FILE *stream ) const;
+	};
+
+	explicit FaultInjector( const Settings &settings );
+	~FaultInjector();
+
+	// capture faults are applied to frames on their way to the delegate
+	void SetDelegate( IDeckLinkInputCallback *delegate );
+	// releases frames held for a burst and holds no more, before the capture source stops
+	void DropHeldFrames();
+
+	// called by the encoder and the writer thread
+	void BeforeEncode();
+	void BeforeWrite( size_t bytes );
+
+	Stats GetStats() const;
+
+	// IUnknown, lifetime is owned by the application
+	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID, LPVOID * ) override
+	{
+		return E_NOINTERFACE;
+	}
+	ULONG STDMETHODCALLTYPE AddRef( void ) override
+	{
+		return 1;
+	}
+	ULONG STDMETHODCALLTYPE Release( void ) override
+	{
+		return 1;
+	}
+
+	// IDeckLinkInputCallback
+	HRESULT STDMETHODCALLTYPE VideoInputFormatChanged( BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode *mode, BMDDetectedVideoInputFormatFlags flags ) override;
+	HRESULT STDMETHODCALLTYPE VideoInputFrameArrived( IDeckLinkVideoInputFrame *videoFrame, IDeckLinkAudioInputPacket *audioPacket ) override;
+
+private:
+	FaultInjector( const FaultInjector & ) = delete;
+	FaultInjector &operator=( const FaultInjector & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // FAULTINJECTOR_H
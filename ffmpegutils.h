@@ -14,7 +14,7 @@ extern "C" {
 // #include "deps/ffmpeg/include/libswscale/swscale.h"
 }
 
-AVFrame *AllocateVideoFrame( AVPixelFormat pixelFormat, int width, int height  )
+inline AVFrame *AllocateVideoFrame( AVPixelFormat pixelFormat, int width, int height  )
 {
 	AVFrame *frame = av_frame_alloc();
 	if ( !frame )
@@ -0,0 +1,115 @@
+#include "latencyhistogram.h"
+
+uint64_t LatencyHistogram::Counts::Total() const
+{
+	uint64_t total = 0;
+	for ( int i = 0; i < BucketCount; i++ )
+	{
+		total += buckets[i];
+	}
+	return total;
+}
+
+uint64_t LatencyHistogram::Counts::Percentile( double quantile ) const
+{
+	uint64_t total = Total();
+	if ( total == 0 )
+	{
+		return 0;
+	}
+
+	uint64_t rank = ( uint64_t )( quantile * total );
+	if ( rank >= total )
+	{
+		rank = total - 1;
+	}
+	uint64_t seen = 0;
+	for ( int i = 0; i < BucketCount; i++ )
+	{
+		seen += buckets[i];
+		if ( seen > rank )
+		{
+			return BucketUpperBound( i );
+		}
+	}
+	return BucketUpperBound( BucketCount - 1 );
+}
+
+uint64_t LatencyHistogram::Counts::Max() const
+{
+	for ( int i = BucketCount - 1; i >= 0; i-- )
+	{
+		if ( buckets[i] > 0 )
+		{
+			return BucketUpperBound( i );
+		}
+	}
+	return 0;
+}
+
+LatencyHistogram::Counts LatencyHistogram::Counts::Difference( const Counts &earlier ) const
+{
+	Counts result;
+	for ( int i = 0; i < BucketCount; i++ )
+	{
+		result.buckets[i] = buckets[i] - earlier.buckets[i];
+	}
+	return result;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Add( uint64_t ns )
+{
+	mBuckets[BucketIndex( ns )].fetch_add( 1, std::memory_order_relaxed );
+}
+
+void LatencyHistogram::Reset()
+{
+	for ( int i = 0; i < BucketCount; i++ )
+	{
+		mBuckets[i] = 0;
+	}
+}
+
+LatencyHistogram::Counts LatencyHistogram::GetCounts() const
+{
+	Counts counts;
+	for ( int i = 0; i < BucketCount; i++ )
+	{
+		counts.buckets[i] = mBuckets[i].load( std::memory_order_relaxed );
+	}
+	return counts;
+}
+
+int LatencyHistogram::BucketIndex( uint64_t ns )
+{
+	if ( ns < SubBucketCount )
+	{
+		return ( int )ns;
+	}
+
+	// position of the leading one selects the power of two, the next bits the linear sub-bucket
+	int exponent = 63 - __builtin_clzll( ns );
+	if ( exponent > MaxExponent )
+	{
+		return BucketCount - 1;
+	}
+	int subBucket = ( int )( ( ns >> ( exponent - SubBucketBits ) ) & ( SubBucketCount - 1 ) );
+	return ( exponent - SubBucketBits + 1 ) * SubBucketCount + subBucket;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound( int index )
+{
+	if ( index < SubBucketCount )
+	{
+		return ( uint64_t )index;
+	}
+
+	int exponent = index / SubBucketCount + SubBucketBits - 1;
+	uint64_t subBucket = index % SubBucketCount;
+	return ( ( SubBucketCount + subBucket + 1 ) << ( exponent - SubBucketBits ) ) - 1;
+}
@@ -0,0 +1,38 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <stdint.h>
+
+// lock-free log-linear histogram of nanosecond latencies: 8 linear sub-buckets per power of two (<= 12.5% error)
+class LatencyHistogram
+{
+public:
+	enum { SubBucketBits = 3, SubBucketCount = 1 << SubBucketBits, MaxExponent = 47, BucketCount = ( MaxExponent - 2 ) * SubBucketCount + SubBucketCount };
+
+	// plain copy of the bucket counters, differences of two copies give the histogram of an interval
+	struct Counts
+	{
+		uint64_t buckets[BucketCount] = {0};
+
+		uint64_t Total() const;
+		// upper bound of the bucket holding the given quantile (0..1), 0 when empty
+		uint64_t Percentile( double quantile ) const;
+		uint64_t Max() const;
+		Counts Difference( const Counts &earlier ) const;
+	};
+
+	LatencyHistogram();
+
+	void Add( uint64_t ns );
+	void Reset();
+	Counts GetCounts() const;
+
+	static int BucketIndex( uint64_t ns );
+	static uint64_t BucketUpperBound( int index );
+
+private:
+	std::atomic<uint64_t> mBuckets[BucketCount];
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,24 @@
+# embeddable recorder: builds librecorder.so exporting the C API of recorderapi.h only
+QT -= gui
+CONFIG += c++11 hide_symbols
+
+TEMPLATE = lib
+TARGET = recorder
+VERSION = 1.0.0
+
+DEFINES += RECORDER_API_BUILD
+
+include( ../recorder.pri )
+
+# the allocator is interposed by the executables only, a library must not replace the one of its host (and
+# could not with hidden symbols)
+DEFINES -= __ALLOC_INSTRUMENTATION__=1
+
+HEADERS += \
+	../recorderapi.h
+
+SOURCES += \
+	../recorderapi.cpp
+
+# suppres gcc 9 Qt annoying warning QVariant deprecated copy
+QMAKE_CXXFLAGS += -Wno-deprecated-copy
@@ -1,93 +1,477 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QtConcurrent/QtConcurrent>
 
 #include <unistd.h>
 
 #include "decklink/DeckLinkAPI.h"
+#include "allocationtracker.h"
+#include "controlserver.h"
 #include "decklinkmanager.h"
+#include "encoderbackend.h"
+#include "emulator/displaymodes.h"
+#include "faultinjector.h"
+#include "outputverifier.h"
+#include "proxybranch.h"
 #include "recorder.h"
+#include "recordersettings.h"
+#include "recorderstats.h"
+#include "replaysource.h"
+#include "soakmonitor.h"
+#include "startupprofile.h"
 
 extern "C" {
 #include "libavutil/log.h"
 }
 
+struct CaptureOptions
+{
+	uint32_t displayMode = bmdModeHD1080p50;
+	uint32_t pixelFormat = bmdFormat8BitYUV;
+	// replay a raw recording instead of capturing from the card
+	QString replayFile;
+	bool replayRealtime = true;
+	bool replayLoop = false;
+};
+
 class MainApp
 {
-	DecklinkManager *mDecklinkManager = nullptr;
+	CaptureSource *mCaptureSource = nullptr;
 	Recorder *mRecorder = nullptr;
 
 public:
-	MainApp()
+	MainApp( const CaptureOptions &options, FaultInjector *faultInjector )
 	{
 		mRecorder = new Recorder();
 		mRecorder->AddRef();
-		mDecklinkManager = new DecklinkManager( mRecorder );
+		mRecorder->SetFaultInjector( faultInjector );
+
+		// capture faults are injected between the source and the recorder
+		IDeckLinkInputCallback *delegate = mRecorder;
+		if ( faultInjector )
+		{
+			faultInjector->SetDelegate( mRecorder );
+			delegate = faultInjector;
+		}
+		mFaultInjector = faultInjector;
+
+		if ( options.replayFile.isEmpty() )
+		{
+			mCaptureSource = new DecklinkManager( delegate );
+		}
+		else
+		{
+			ReplaySource *replaySource = new ReplaySource( delegate, qUtf8Printable( options.replayFile ) );
+			replaySource->SetRealtime( options.replayRealtime );
+			replaySource->SetLoop( options.replayLoop );
+			// end of file without looping ends the recording like closing the application would
+			replaySource->SetFinishedCallback( []()
+			{
+				qApp->quit();
+			} );
+			mCaptureSource = replaySource;
+		}
+		mCaptureSource->SetDisplayMode( options.displayMode );
+		mCaptureSource->SetPixelFormat( options.pixelFormat );
+		mPixelFormat = ( BMDPixelFormat )options.pixelFormat;
+		mDisplayMode = ( BMDDisplayMode )options.displayMode;
 	}
 	~MainApp()
 	{
 		delete mRecorder;
 		mRecorder = nullptr;
-		delete mDecklinkManager;
-		mDecklinkManager = nullptr;
+		delete mCaptureSource;
+		mCaptureSource = nullptr;
 	}
 
-	bool Init();
-	void Start();
+	bool Init( const RecorderSettings &settings );
+	// without a take only the source starts, takes are then started through the control socket
+	bool Start( bool startTake );
 	void Stop();
 	void CleanUp();
+	bool PrintStats();
+
+	Recorder *GetRecorder() const
+	{
+		return mRecorder;
+	}
 
 private:
+	BMDPixelFormat mPixelFormat;
+	BMDDisplayMode mDisplayMode;
+	FaultInjector *mFaultInjector = nullptr;
+
 	void _SetupDecklinkConnections();
 	bool _CheckDisplayMode();
 };
 
-bool MainApp::Init()
+bool MainApp::Init( const RecorderSettings &settings )
 {
-	mDecklinkManager->Init();
-	int num = 0, den = 1;
-	mDecklinkManager->GetTimeBase( num, den );
-	mRecorder->Init( num, den );
-	return true;
+	mRecorder->SetSettings( settings );
+	bool ok = true;
+	const DisplayModeInfo *mode = FindDisplayMode( mDisplayMode );
+	if ( mode )
+	{
+		// the geometry of a known mode does not need the device: open the codecs while the source comes up
+		QFuture<bool> sourceReady = QtConcurrent::run( [this]()
+		{
+			return mCaptureSource->Init();
+		} );
+		ok = mRecorder->Init( mode->frameDuration, mode->timeScale, mode->width, mode->height, mPixelFormat ) && mRecorder->Arm();
+		ok &= sourceReady.result();
+
+		int num = 0, den = 1;
+		int width = 0, height = 0;
+		if ( ok && ( !mCaptureSource->GetTimeBase( num, den ) || !mCaptureSource->GetVideoSize( width, height )
+					 || num != mode->frameDuration || den != mode->timeScale || width != mode->width || height != mode->height ) )
+		{
+			fprintf( stderr, "Source delivers %dx%d at %d/%d, expected %s\n", width, height, num, den, mode->name );
+			ok = false;
+		}
+	}
+	else
+	{
+		ok = mCaptureSource->Init();
+		int num = 0, den = 1;
+		int width = 0, height = 0;
+		ok = ok && mCaptureSource->GetTimeBase( num, den ) && mCaptureSource->GetVideoSize( width, height );
+		ok = ok && mRecorder->Init( num, den, width, height, mPixelFormat ) && mRecorder->Arm();
+	}
+	if ( ok )
+	{
+		// raw direct recording writes from the capture buffers, which have to be page aligned for it
+		mCaptureSource->SetFrameAllocator( mRecorder->FrameAllocator() );
+		StartupProfile::Print( stdout );
+	}
+	return ok;
 }
 
-void MainApp::Start()
+bool MainApp::Start( bool startTake )
 {
-	mDecklinkManager->Start();
-	mRecorder->Start();
+	// pipeline first, a replay at max rate would otherwise run ahead of it
+	if ( startTake && !mRecorder->Start() )
+	{
+		return false;
+	}
+	mCaptureSource->Start();
+	return true;
 }
 
 void MainApp::Stop()
 {
-	mDecklinkManager->Stop();
+	if ( mFaultInjector )
+	{
+		mFaultInjector->DropHeldFrames();
+	}
+	mCaptureSource->Stop();
 	mRecorder->Stop();
 }
 
 void MainApp::CleanUp()
 {
-	mDecklinkManager->CleanUp();
+	mCaptureSource->CleanUp();
 	mRecorder->CleanUp();
 }
 
+bool MainApp::PrintStats()
+{
+	RecorderStats stats;
+	mRecorder->GetStats( stats );
+	stats.Print( stdout );
+	return !stats.allocationsTracked || stats.IsAllocationFree();
+}
+
+// "<probability>:<amount>" as used by the fault injection options
+static bool ParseChance( const QString &value, double &probability, int &amount )
+{
+	QStringList parts = value.split( ':' );
+	bool probabilityOk = false;
+	bool amountOk = false;
+	if ( parts.size() == 2 )
+	{
+		probability = parts[0].toDouble( &probabilityOk );
+		amount = parts[1].toInt( &amountOk );
+	}
+	return probabilityOk && amountOk && probability >= 0.0 && probability <= 1.0 && amount >= 0;
+}
+
 int main( int argc, char *argv[] )
 {
 	//av_log_set_level( AV_LOG_DEBUG );
 
 	QCoreApplication a( argc, argv );
 
-	MainApp *mainApp = new MainApp();
+	QCommandLineParser parser;
+	parser.setApplicationDescription( "Records Blackmagic Decklink input into a video file" );
+	parser.addHelpOption();
+	QCommandLineOption traceOption( "trace", "Trace per-frame stage spans and write them as Chrome JSON trace to <file> when recording stops.", "file" );
+	parser.addOption( traceOption );
+	QCommandLineOption traceEventsOption( "trace-events", "Preallocated trace spans per thread (default 65536).", "count", "65536" );
+	parser.addOption( traceEventsOption );
+	QCommandLineOption allocCheckOption( "alloc-check", "Fail unless the steady state after <frames> warm-up frames is free of heap allocations and growth (alloc_instrumentation build).", "frames" );
+	parser.addOption( allocCheckOption );
+	QCommandLineOption displayModeOption( "display-mode", "Four character code of the BMDDisplayMode to capture, e.g. Hp50 (1080p50), hp50 (720p50), 4k50 (2160p50).", "fourcc", "Hp50" );
+	parser.addOption( displayModeOption );
+	QCommandLineOption pixelFormatOption( "pixel-format", "Capture pixel format: uyvy (8 bit, default) or v210 (10 bit).", "format", "uyvy" );
+	parser.addOption( pixelFormatOption );
+	QCommandLineOption replayOption( "replay", "Replay a raw UYVY/v210 recording of the display mode instead of capturing from the card.", "file" );
+	parser.addOption( replayOption );
+	QCommandLineOption replayRateOption( "replay-rate", "Replay pacing: realtime (default) or max.", "rate", "realtime" );
+	parser.addOption( replayRateOption );
+	QCommandLineOption replayLoopOption( "replay-loop", "Restart the replay at the first frame when the end of the file is reached." );
+	parser.addOption( replayLoopOption );
+	QCommandLineOption outputOption( "output", "Output file (default /tmp/testing.mov).", "file", "/tmp/testing.mov" );
+	parser.addOption( outputOption );
+	QCommandLineOption framesOption( "frames", "Stop after <count> captured frames, 0 records until stopped (default 500, unlimited with --soak).", "count", "500" );
+	parser.addOption( framesOption );
+	QCommandLineOption soakOption( "soak", "Soak test: record for <seconds> (0 = until the source ends), sample memory, queue depths, latency and file growth and fail on upward trends.", "seconds" );
+	parser.addOption( soakOption );
+	QCommandLineOption soakIntervalOption( "soak-interval", "Seconds between soak samples (default 5).", "seconds", "5" );
+	parser.addOption( soakIntervalOption );
+	QCommandLineOption soakWarmupOption( "soak-warmup", "Seconds at the start excluded from the trend analysis (default 60).", "seconds", "60" );
+	parser.addOption( soakWarmupOption );
+	QCommandLineOption soakThresholdOption( "soak-threshold", "Allowed growth of a metric over the run relative to its mean (default 0.1).", "fraction", "0.1" );
+	parser.addOption( soakThresholdOption );
+	QCommandLineOption soakReportOption( "soak-report", "Write the soak time series as CSV to <file>.", "file" );
+	parser.addOption( soakReportOption );
+	QCommandLineOption faultSeedOption( "fault-seed", "Seed of the injected faults, equal seeds reproduce a run (default 1).", "seed", "1" );
+	parser.addOption( faultSeedOption );
+	QCommandLineOption faultWriteLatencyOption( "fault-write-latency", "Delay every packet write by <us> microseconds.", "us" );
+	parser.addOption( faultWriteLatencyOption );
+	QCommandLineOption faultWriteStallOption( "fault-write-stall", "Stall a packet write with <probability> for <ms> milliseconds.", "probability:ms" );
+	parser.addOption( faultWriteStallOption );
+	QCommandLineOption faultWriteThroughputOption( "fault-write-throughput", "Cap the writer at <MB/s>.", "MB/s" );
+	parser.addOption( faultWriteThroughputOption );
+	QCommandLineOption faultEncodeDelayOption( "fault-encode-delay", "Delay a frame in the encoder with <probability> by up to <ms> milliseconds.", "probability:ms" );
+	parser.addOption( faultEncodeDelayOption );
+	QCommandLineOption faultCaptureJitterOption( "fault-capture-jitter", "Delay every capture callback by up to <ms> milliseconds.", "ms" );
+	parser.addOption( faultCaptureJitterOption );
+	QCommandLineOption faultCaptureBurstOption( "fault-capture-burst", "Hold back <frames> frames with <probability> and deliver them at once.", "probability:frames" );
+	parser.addOption( faultCaptureBurstOption );
+	QCommandLineOption faultCaptureDropOption( "fault-capture-drop", "Lose a frame in the driver with <probability>.", "probability" );
+	parser.addOption( faultCaptureDropOption );
+	QCommandLineOption armOption( "arm", "Warm decoder, conversion and encoder with <frames> dummy frames before the first take, 0 starts cold (default 8).", "frames", "8" );
+	parser.addOption( armOption );
+	QCommandLineOption startFrameOption( "start-frame", "Start recording with the first frame at or after device frame number <n>.", "n" );
+	parser.addOption( startFrameOption );
+	QCommandLineOption startTimecodeOption( "start-timecode", "Start recording with the first frame at or after timecode <HH:MM:SS:FF> (RP188 or VITC).", "timecode" );
+	parser.addOption( startTimecodeOption );
+	QCommandLineOption daemonOption( "daemon", "Keep the device streaming and the codecs open and record takes on commands (start [file], stop, status, quit) received on the local socket <path>.", "path" );
+	parser.addOption( daemonOption );
+	QCommandLineOption backlogThresholdOption( "backlog-threshold", "Decode queue depth counted as backlog when reporting recovery times (default 2).", "frames", "2" );
+	parser.addOption( backlogThresholdOption );
+	QCommandLineOption proxyOption( "proxy", "Also record every take as H.264 proxy into <output>_proxy.<ext>, encoded at lower priority; frames are skipped in the proxy when it falls behind, never in the master." );
+	parser.addOption( proxyOption );
+	QCommandLineOption proxyScaleOption( "proxy-scale", "Divisor of the proxy width and height (default 2).", "divisor", "2" );
+	parser.addOption( proxyScaleOption );
+	QCommandLineOption proxyBitrateOption( "proxy-bitrate", "Proxy bit rate in kbit/s (default 8000).", "kbps", "8000" );
+	parser.addOption( proxyBitrateOption );
+	QCommandLineOption thumbnailsOption( "thumbnails", "Write a JPEG thumbnail of every take each --thumbnail-interval seconds into <dir>, on an idle priority thread; a thumbnail due while the previous one is still being written is skipped.", "dir" );
+	parser.addOption( thumbnailsOption );
+	QCommandLineOption thumbnailIntervalOption( "thumbnail-interval", "Seconds between thumbnails (default 10).", "seconds", "10" );
+	parser.addOption( thumbnailIntervalOption );
+	QCommandLineOption thumbnailScaleOption( "thumbnail-scale", "Power of two the thumbnail width and height are divided by (default 8).", "divisor", "8" );
+	parser.addOption( thumbnailScaleOption );
+	QCommandLineOption codecOption( "codec", QString( "Video codec profile: %1 (default prores_lt)." ).arg( EncoderBackend::Profiles().join( ", " ) ), "profile", "prores_lt" );
+	parser.addOption( codecOption );
+	QCommandLineOption gopOption( "gop", "x264 only: frames from one key frame to the next, 1 records intra only (default 1).", "frames", "1" );
+	parser.addOption( gopOption );
+	QCommandLineOption bFramesOption( "bframes", "x264 only: B-frames between reference frames, requires --gop above 1 (default 0).", "count", "0" );
+	parser.addOption( bFramesOption );
+	QCommandLineOption lookaheadOption( "lookahead", "x264 only: frames of rate control lookahead, adds to the encoder latency (default: encoder preset).", "frames" );
+	parser.addOption( lookaheadOption );
+	QCommandLineOption rawDirectOption( "raw-direct", "Write the captured frames uncompressed as they arrive (UYVY or v210) with O_DIRECT into the output file, one page aligned slot per frame, with the byte offset of every frame in <output>.idx; nothing is decoded, converted or encoded." );
+	parser.addOption( rawDirectOption );
+	QCommandLineOption skipDuplicatesOption( "skip-duplicates", "Compare every captured picture with the one before it and, with an intra-only codec, write the previous packet again for an identical one instead of converting and encoding it." );
+	parser.addOption( skipDuplicatesOption );
+	QCommandLineOption verifyOutputOption( "verify-output", "Read the recorded file (and proxy) back after recording and fail unless every stream has strictly increasing dts and no pts before its dts." );
+	parser.addOption( verifyOutputOption );
+	QCommandLineOption memoryBudgetOption( "memory-budget", "Megabytes the captured, decoded and encoded frames of the pipeline may hold at once, split into a pool per stage; frames arriving while the capture pool is full are dropped (default 0 = unlimited).", "MB", "0" );
+	parser.addOption( memoryBudgetOption );
+	parser.process( a );
+
+	FaultInjector::Settings faults;
+	faults.seed = parser.value( faultSeedOption ).toULongLong();
+	faults.writeLatencyUs = parser.value( faultWriteLatencyOption ).toInt();
+	faults.writeThroughputMBps = parser.value( faultWriteThroughputOption ).toDouble();
+	faults.captureJitterMs = parser.value( faultCaptureJitterOption ).toInt();
+	faults.captureDropProbability = parser.value( faultCaptureDropOption ).toDouble();
+	if ( ( parser.isSet( faultWriteStallOption ) && !ParseChance( parser.value( faultWriteStallOption ), faults.writeStallProbability, faults.writeStallMs ) )
+			|| ( parser.isSet( faultEncodeDelayOption ) && !ParseChance( parser.value( faultEncodeDelayOption ), faults.encodeDelayProbability, faults.encodeDelayMaxMs ) )
+			|| ( parser.isSet( faultCaptureBurstOption ) && !ParseChance( parser.value( faultCaptureBurstOption ), faults.captureBurstProbability, faults.captureBurstFrames ) ) )
+	{
+		fprintf( stderr, "Fault options expect <probability>:<amount> with probability between 0 and 1\n" );
+		return 1;
+	}
+
+	CaptureOptions options;
+	QByteArray fourcc = parser.value( displayModeOption ).toLatin1();
+	if ( fourcc.size() != 4 )
+	{
+		fprintf( stderr, "--display-mode expects a four character code\n" );
+		return 1;
+	}
+	options.displayMode = ( ( uint8_t )fourcc[0] << 24 ) | ( ( uint8_t )fourcc[1] << 16 ) | ( ( uint8_t )fourcc[2] << 8 ) | ( uint8_t )fourcc[3];
+	QString pixelFormat = parser.value( pixelFormatOption );
+	if ( pixelFormat == "v210" )
+	{
+		options.pixelFormat = bmdFormat10BitYUV;
+	}
+	else if ( pixelFormat != "uyvy" )
+	{
+		fprintf( stderr, "--pixel-format expects uyvy or v210\n" );
+		return 1;
+	}
+	options.replayFile = parser.value( replayOption );
+	options.replayRealtime = parser.value( replayRateOption ) != "max";
+	options.replayLoop = parser.isSet( replayLoopOption );
+
+	RecorderSettings settings;
+	settings.traceFile = parser.value( traceOption );
+	settings.traceEventsPerThread = parser.value( traceEventsOption ).toInt();
+	settings.allocationWarmupFrames = parser.value( allocCheckOption ).toInt();
+	settings.outputFile = parser.value( outputOption );
+	settings.maxFrames = parser.value( framesOption ).toInt();
+	settings.armFrames = qMax( 0, parser.value( armOption ).toInt() );
+	settings.startFrame = parser.isSet( startFrameOption ) ? parser.value( startFrameOption ).toLongLong() : -1;
+	settings.startTimecode = parser.value( startTimecodeOption );
+	settings.backlogThreshold = qMax( 1, parser.value( backlogThresholdOption ).toInt() );
+	settings.memoryBudget = parser.value( memoryBudgetOption ).toULongLong() * 1048576ull;
+	settings.proxy = parser.isSet( proxyOption );
+	settings.proxyDivisor = qMax( 1, parser.value( proxyScaleOption ).toInt() );
+	settings.proxyBitrateKbps = qMax( 100, parser.value( proxyBitrateOption ).toInt() );
+	settings.thumbnailDirectory = parser.value( thumbnailsOption );
+	settings.thumbnailInterval = qMax( 1, parser.value( thumbnailIntervalOption ).toInt() );
+	settings.thumbnailDivisor = parser.value( thumbnailScaleOption ).toInt();
+	settings.videoCodec = parser.value( codecOption );
+	if ( !EncoderBackend::Profiles().contains( settings.videoCodec ) )
+	{
+		fprintf( stderr, "--codec expects one of %s\n", qUtf8Printable( EncoderBackend::Profiles().join( ", " ) ) );
+		return 1;
+	}
+	settings.rawDirect = parser.isSet( rawDirectOption );
+	settings.skipDuplicates = parser.isSet( skipDuplicatesOption );
+	if ( settings.rawDirect && ( settings.proxy || !settings.thumbnailDirectory.isEmpty() || parser.isSet( verifyOutputOption ) ) )
+	{
+		fprintf( stderr, "--raw-direct cannot be combined with --proxy, --thumbnails or --verify-output\n" );
+		return 1;
+	}
+	settings.gopSize = qMax( 1, parser.value( gopOption ).toInt() );
+	settings.bFrames = settings.gopSize > 1 ? qMax( 0, parser.value( bFramesOption ).toInt() ) : 0;
+	settings.lookahead = parser.isSet( lookaheadOption ) ? qMax( 0, parser.value( lookaheadOption ).toInt() ) : -1;
+	bool soak = parser.isSet( soakOption );
+	settings.daemon = parser.isSet( daemonOption );
+	if ( soak || settings.daemon )
+	{
+		// hours of per-frame log lines would dominate the run, a take records until stopped
+		settings.logFrames = false;
+		if ( !parser.isSet( framesOption ) )
+		{
+			settings.maxFrames = 0;
+		}
+	}
+	if ( settings.allocationWarmupFrames > 0 && !AllocationTracker::IsEnabled() )
+	{
+		fprintf( stderr, "--alloc-check requires build with CONFIG+=alloc_instrumentation\n" );
+		return 1;
+	}
+
+	FaultInjector *faultInjector = faults.IsEnabled() ? new FaultInjector( faults ) : nullptr;
+	MainApp *mainApp = new MainApp( options, faultInjector );
 
-	bool ok = mainApp->Init();
+	bool ok = mainApp->Init( settings );
 	if ( !ok )
 	{
 		mainApp->CleanUp();
 		return 1;
 	}
-	mainApp->Start();
+	SoakMonitor *soakMonitor = nullptr;
+	if ( soak )
+	{
+		soakMonitor = new SoakMonitor( mainApp->GetRecorder(), settings.outputFile );
+		soakMonitor->SetDuration( parser.value( soakOption ).toInt() );
+		soakMonitor->SetInterval( qMax( 1, parser.value( soakIntervalOption ).toInt() ) );
+		soakMonitor->SetWarmup( parser.value( soakWarmupOption ).toInt() );
+		soakMonitor->SetThreshold( parser.value( soakThresholdOption ).toDouble() );
+		if ( parser.isSet( soakReportOption ) && !soakMonitor->SetReportFile( parser.value( soakReportOption ) ) )
+		{
+			delete soakMonitor;
+			mainApp->CleanUp();
+			delete mainApp;
+			return 1;
+		}
+	}
+
+	ControlServer *controlServer = nullptr;
+	if ( settings.daemon )
+	{
+		controlServer = new ControlServer( mainApp->GetRecorder(), settings.outputFile );
+		if ( !controlServer->Listen( parser.value( daemonOption ) ) )
+		{
+			delete controlServer;
+			delete soakMonitor;
+			mainApp->CleanUp();
+			delete mainApp;
+			return 1;
+		}
+	}
+
+	if ( !mainApp->Start( !settings.daemon ) )
+	{
+		delete controlServer;
+		delete soakMonitor;
+		mainApp->CleanUp();
+		delete mainApp;
+		return 1;
+	}
+	if ( soakMonitor )
+	{
+		soakMonitor->Start();
+	}
 
 	a.exec();
 
+	if ( soakMonitor )
+	{
+		soakMonitor->Stop();
+	}
+	delete controlServer;
 	mainApp->Stop();
 	mainApp->CleanUp();
+	bool allocationFree = mainApp->PrintStats();
+	if ( faultInjector )
+	{
+		faultInjector->GetStats().Print( stdout );
+	}
+	bool soakOk = !soakMonitor || soakMonitor->Evaluate( stdout );
+	// takes of the daemon carry their own file names
+	bool outputOk = true;
+	if ( parser.isSet( verifyOutputOption ) && !settings.daemon )
+	{
+		outputOk = OutputVerifier::Verify( settings.outputFile, stdout );
+		if ( settings.proxy )
+		{
+			outputOk = OutputVerifier::Verify( ProxyBranch::FileName( settings.outputFile ), stdout ) && outputOk;
+		}
+	}
+	delete soakMonitor;
 	delete mainApp;
+	delete faultInjector;
 
+	if ( !allocationFree )
+	{
+		fprintf( stderr, "Steady state allocations or heap growth detected\n" );
+		return 2;
+	}
+	if ( !soakOk )
+	{
+		fprintf( stderr, "Soak test detected upward drift\n" );
+		return 3;
+	}
+	if ( !outputOk )
+	{
+		fprintf( stderr, "Recorded file has invalid timestamps\n" );
+		return 4;
+	}
 	return 0;
 }
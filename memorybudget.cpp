@@ -0,0 +1,146 @@
+#include "memorybudget.h"
+
+#include <condition_variable>
+#include <mutex>
+
+///@cond INTERNAL
+
+class MemoryBudget::PrivateClass
+{
+public:
+	struct PoolState
+	{
+		std::mutex mutex;
+		std::condition_variable released;
+		PoolStats stats;
+	};
+
+	PoolState mPools[PoolCount];
+
+	static bool Fits( const PoolStats &stats, uint64_t bytes )
+	{
+		return stats.capacity == 0 || stats.used + bytes <= stats.capacity || stats.used == 0;
+	}
+	static void Admit( PoolStats &stats, uint64_t bytes )
+	{
+		stats.used += bytes;
+		stats.acquisitions++;
+		if ( stats.used > stats.peak )
+		{
+			stats.peak = stats.used;
+		}
+	}
+};
+
+///@endcond INTERNAL
+
+MemoryBudget::MemoryBudget()
+{
+	d = new MemoryBudget::PrivateClass();
+}
+
+MemoryBudget::~MemoryBudget()
+{
+	delete d;
+	d = nullptr;
+}
+
+void MemoryBudget::SetCapacity( Pool pool, uint64_t bytes )
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::lock_guard<std::mutex> lock( state.mutex );
+	state.stats.capacity = bytes;
+	state.released.notify_all();
+}
+
+uint64_t MemoryBudget::Capacity( Pool pool ) const
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::lock_guard<std::mutex> lock( state.mutex );
+	return state.stats.capacity;
+}
+
+bool MemoryBudget::TryAcquire( Pool pool, uint64_t bytes )
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::lock_guard<std::mutex> lock( state.mutex );
+	if ( state.stats.capacity > 0 && state.stats.used + bytes > state.stats.capacity )
+	{
+		state.stats.rejections++;
+		return false;
+	}
+	PrivateClass::Admit( state.stats, bytes );
+	return true;
+}
+
+void MemoryBudget::Acquire( Pool pool, uint64_t bytes )
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::unique_lock<std::mutex> lock( state.mutex );
+	if ( !PrivateClass::Fits( state.stats, bytes ) )
+	{
+		state.stats.waits++;
+		state.released.wait( lock, [&state, bytes]()
+		{
+			return PrivateClass::Fits( state.stats, bytes );
+		} );
+	}
+	PrivateClass::Admit( state.stats, bytes );
+}
+
+void MemoryBudget::Release( Pool pool, uint64_t bytes )
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::lock_guard<std::mutex> lock( state.mutex );
+	state.stats.used = bytes < state.stats.used ? state.stats.used - bytes : 0;
+	state.released.notify_all();
+}
+
+MemoryBudget::PoolStats MemoryBudget::GetStats( Pool pool ) const
+{
+	PrivateClass::PoolState &state = d->mPools[pool];
+	std::lock_guard<std::mutex> lock( state.mutex );
+	return state.stats;
+}
+
+const char *MemoryBudget::PoolName( Pool pool )
+{
+	switch ( pool )
+	{
+		case PoolCapture:
+			return "capture";
+		case PoolFrame:
+			return "frame";
+		case PoolPacket:
+			return "packet";
+		case PoolPreroll:
+			return "pre-roll";
+		case PoolProxy:
+			return "proxy";
+		default:
+			return "unknown";
+	}
+}
+
+void MemoryBudget::PrintStats( const PoolStats *stats, FILE *stream )
+{
+	fprintf( stream, "%-12s %12s %12s %12s %8s %10s %8s\n", "pool", "capacity MB", "used MB", "peak MB", "peak %", "rejected", "waits" );
+	for ( int i = 0; i < PoolCount; i++ )
+	{
+		const PoolStats &s = stats[i];
+		if ( s.acquisitions == 0 && s.capacity == 0 )
+		{
+			continue;
+		}
+		if ( s.capacity > 0 )
+		{
+			fprintf( stream, "%-12s %12.1f %12.1f %12.1f %8.1f %10lu %8lu\n", PoolName( ( Pool )i ),
+					 s.capacity / 1048576.0, s.used / 1048576.0, s.peak / 1048576.0, 100.0 * s.peak / s.capacity, s.rejections, s.waits );
+		}
+		else
+		{
+			fprintf( stream, "%-12s %12s %12.1f %12.1f %8s %10lu %8lu\n", PoolName( ( Pool )i ),
+					 "unlimited", s.used / 1048576.0, s.peak / 1048576.0, "n/a", s.rejections, s.waits );
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// byte accounting of the buffers a recorder holds, carved from one budget into a pool per stage; a stage
+// acquires the bytes of a buffer before it allocates it and releases them after freeing it
+class MemoryBudget
+{
+public:
+	enum Pool
+	{
+		// captured pictures copied out of the device buffer, until decoded
+		PoolCapture = 0,
+		// decoded pictures, until encoded
+		PoolFrame,
+		// encoded packets, until written
+		PoolPacket,
+		// warm-up pictures run through the pipeline before a take
+		PoolPreroll,
+		// decoded pictures shared with the proxy branch, until it has encoded them
+		PoolProxy,
+		PoolCount
+	};
+
+	struct PoolStats
+	{
+		// 0 = unlimited
+		uint64_t capacity = 0;
+		uint64_t used = 0;
+		uint64_t peak = 0;
+		uint64_t acquisitions = 0;
+		// refused TryAcquire calls and Acquire calls that had to wait for a release
+		uint64_t rejections = 0;
+		uint64_t waits = 0;
+	};
+
+	MemoryBudget();
+	~MemoryBudget();
+
+	// capacity 0 only accounts
+	void SetCapacity( Pool pool, uint64_t bytes );
+	uint64_t Capacity( Pool pool ) const;
+
+	// fails instead of exceeding the capacity, for the capture callback which must not block
+	bool TryAcquire( Pool pool, uint64_t bytes );
+	// waits for releases while the capacity would be exceeded; a request larger than the capacity waits for an empty pool
+	void Acquire( Pool pool, uint64_t bytes );
+	void Release( Pool pool, uint64_t bytes );
+
+	PoolStats GetStats( Pool pool ) const;
+
+	static const char *PoolName( Pool pool );
+	static void PrintStats( const PoolStats *stats, FILE *stream );
+
+private:
+	MemoryBudget( const MemoryBudget & ) = delete;
+	MemoryBudget &operator=( const MemoryBudget & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // MEMORYBUDGET_H
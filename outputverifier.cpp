@@ -0,0 +1,94 @@
+#include "outputverifier.h"
+
+#include <stdint.h>
+#include <vector>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavformat/avformat.h"
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+}
+
+///@cond INTERNAL
+
+namespace
+{
+
+struct StreamCheck
+{
+	int64_t packets = 0;
+	int64_t keyPackets = 0;
+	int64_t reordered = 0;
+	int64_t lastDts = AV_NOPTS_VALUE;
+	int64_t errors = 0;
+	// a video stream that does not start on a key frame cannot be decoded up to its first one
+	bool startsOnKey = true;
+};
+
+}
+
+///@endcond INTERNAL
+
+bool OutputVerifier::Verify( const QString &file, FILE *stream )
+{
+	AVFormatContext *formatContext = nullptr;
+	if ( avformat_open_input( &formatContext, qUtf8Printable( file ), nullptr, nullptr ) < 0 )
+	{
+		fprintf( stderr, "Could not open '%s' for verification\n", qUtf8Printable( file ) );
+		return false;
+	}
+	if ( avformat_find_stream_info( formatContext, nullptr ) < 0 )
+	{
+		fprintf( stderr, "Could not read stream info of '%s'\n", qUtf8Printable( file ) );
+		avformat_close_input( &formatContext );
+		return false;
+	}
+
+	std::vector<StreamCheck> checks( formatContext->nb_streams );
+	AVPacket *packet = av_packet_alloc();
+	while ( packet && av_read_frame( formatContext, packet ) >= 0 )
+	{
+		StreamCheck &check = checks[packet->stream_index];
+		check.packets++;
+		if ( packet->flags & AV_PKT_FLAG_KEY )
+		{
+			check.keyPackets++;
+		}
+		else if ( check.packets == 1 && formatContext->streams[packet->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO )
+		{
+			check.startsOnKey = false;
+			fprintf( stream, "%s stream %d does not start on a key frame\n", qUtf8Printable( file ), packet->stream_index );
+		}
+		bool ok = packet->pts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE;
+		if ( ok )
+		{
+			ok = ( check.lastDts == AV_NOPTS_VALUE || packet->dts > check.lastDts ) && packet->pts >= packet->dts;
+			if ( packet->pts > packet->dts )
+			{
+				check.reordered++;
+			}
+			check.lastDts = packet->dts;
+		}
+		if ( !ok && check.errors++ == 0 )
+		{
+			// the first offence of a stream is enough to find it in the file
+			fprintf( stream, "%s stream %d packet %lld: pts %lld dts %lld\n", qUtf8Printable( file ), packet->stream_index,
+					 ( long long )check.packets - 1, ( long long )packet->pts, ( long long )packet->dts );
+		}
+		av_packet_unref( packet );
+	}
+	av_packet_free( &packet );
+
+	bool ok = true;
+	fprintf( stream, "Verified %s:\n", qUtf8Printable( file ) );
+	for ( unsigned int i = 0; i < formatContext->nb_streams; i++ )
+	{
+		const StreamCheck &check = checks[i];
+		const char *type = av_get_media_type_string( formatContext->streams[i]->codecpar->codec_type );
+		fprintf( stream, "  stream %u (%s): %lld packets, %lld key, %lld reordered, %lld timestamp errors\n", i,
+				 type ? type : "unknown", ( long long )check.packets, ( long long )check.keyPackets, ( long long )check.reordered,
+				 ( long long )check.errors );
+		ok = ok && check.errors == 0 && check.packets > 0 && check.startsOnKey;
+	}
+	avformat_close_input( &formatContext );
+	return ok;
+}
@@ -0,0 +1,18 @@
+#ifndef OUTPUTVERIFIER_H
+#define OUTPUTVERIFIER_H
+
+#include <stdio.h>
+
+#include <QString>
+
+// reads back every packet of a recorded file and checks the timestamps a player and an editor rely on: every
+// packet has pts and dts, dts strictly increases per stream, no picture is presented before it is decoded and a
+// video stream starts on a key frame.
+// Long GOP recordings with B-frames reorder pictures, which is where a wrong timestamp shows.
+class OutputVerifier
+{
+public:
+	static bool Verify( const QString &file, FILE *stream );
+};
+
+#endif // OUTPUTVERIFIER_H
@@ -0,0 +1,188 @@
+#include "packetbufferpool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+#include "deps/ffmpeg/include/libavutil/buffer.h"
+}
+
+///@cond INTERNAL
+
+namespace
+{
+
+// smallest class, below it a packet is not worth a pool of its own
+const uint64_t MIN_CLASS_BYTES = 4096;
+// the estimate follows the packet sizes over about this many packets
+const double ESTIMATE_WEIGHT = 16.0;
+// frame to frame variation a buffer of the estimated size still takes
+const double HEADROOM = 1.25;
+// a class not requested for this many packets gives its buffers back (longer than a GOP, whose key frames
+// may need a larger class than the frames between them)
+const uint64_t RETIRE_REQUESTS = 1024;
+
+uint64_t ClassBytes( int index )
+{
+	// quarter octaves: 4, 5, 6, 7, 8, 10, 12, 14, 16 ... KB
+	return ( MIN_CLASS_BYTES << ( index / 4 ) ) * ( 4 + index % 4 ) / 4;
+}
+
+int GetEncodeBuffer( AVCodecContext *context, AVPacket *packet, int )
+{
+	PacketBufferPool *pool = ( PacketBufferPool * )context->opaque;
+	return pool->Allocate( packet, packet->size ) ? 0 : AVERROR( ENOMEM );
+}
+
+}
+
+class PacketBufferPool::PrivateClass
+{
+public:
+	struct SizeClass
+	{
+		uint64_t bytes;
+		AVBufferPool *pool;
+		uint64_t lastRequest;
+	};
+
+	std::mutex mMutex;
+	std::vector<SizeClass> mClasses;
+	double mEstimate = 0.0;
+	Stats mStats;
+
+	// called by av_buffer_pool_get, under mMutex
+	static AVBufferRef *AllocBuffer( void *opaque, size_t size )
+	{
+		PrivateClass *d = ( PrivateClass * )opaque;
+		d->mStats.allocations++;
+		d->mStats.allocatedBytes += size;
+		return av_buffer_alloc( size );
+	}
+
+	SizeClass *Find( uint64_t bytes )
+	{
+		int index = 0;
+		while ( ClassBytes( index ) < bytes )
+		{
+			index++;
+		}
+		uint64_t classBytes = ClassBytes( index );
+		for ( SizeClass &sizeClass : mClasses )
+		{
+			if ( sizeClass.bytes == classBytes )
+			{
+				return &sizeClass;
+			}
+		}
+		AVBufferPool *pool = av_buffer_pool_init2( classBytes, this, AllocBuffer, nullptr );
+		if ( !pool )
+		{
+			return nullptr;
+		}
+		mClasses.push_back( SizeClass{ classBytes, pool, mStats.requests } );
+		return &mClasses.back();
+	}
+
+	void Retire()
+	{
+		for ( size_t i = 0; i < mClasses.size(); )
+		{
+			if ( mClasses[i].lastRequest + RETIRE_REQUESTS < mStats.requests )
+			{
+				// buffers still referenced are freed when they come back
+				av_buffer_pool_uninit( &mClasses[i].pool );
+				mClasses.erase( mClasses.begin() + i );
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+};
+
+///@endcond INTERNAL
+
+PacketBufferPool::PacketBufferPool()
+{
+	d = new PacketBufferPool::PrivateClass();
+}
+
+PacketBufferPool::~PacketBufferPool()
+{
+	for ( PrivateClass::SizeClass &sizeClass : d->mClasses )
+	{
+		av_buffer_pool_uninit( &sizeClass.pool );
+	}
+	delete d;
+	d = nullptr;
+}
+
+void PacketBufferPool::SetEstimate( uint64_t bytes )
+{
+	std::lock_guard<std::mutex> lock( d->mMutex );
+	if ( d->mStats.requests == 0 )
+	{
+		d->mEstimate = bytes;
+	}
+}
+
+bool PacketBufferPool::Allocate( AVPacket *packet, int size )
+{
+	if ( size < 0 )
+	{
+		return false;
+	}
+
+	uint64_t needed = ( uint64_t )size + AV_INPUT_BUFFER_PADDING_SIZE;
+	AVBufferRef *buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock( d->mMutex );
+		d->mStats.requests++;
+		d->mEstimate = d->mEstimate > 0.0 ? d->mEstimate + ( size - d->mEstimate ) / ESTIMATE_WEIGHT : size;
+		uint64_t wanted = std::max( needed, ( uint64_t )( d->mEstimate * HEADROOM ) + AV_INPUT_BUFFER_PADDING_SIZE );
+		PrivateClass::SizeClass *sizeClass = d->Find( wanted );
+		if ( sizeClass )
+		{
+			sizeClass->lastRequest = d->mStats.requests;
+			buffer = av_buffer_pool_get( sizeClass->pool );
+		}
+		d->Retire();
+	}
+	if ( !buffer )
+	{
+		fprintf( stderr, "Could not allocate a packet buffer of %d bytes\n", size );
+		return false;
+	}
+
+	packet->buf = buffer;
+	packet->data = buffer->data;
+	packet->size = size;
+	// a recycled buffer has the previous packet's data behind the new one
+	memset( packet->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE );
+	return true;
+}
+
+bool PacketBufferPool::Attach( AVCodecContext *context )
+{
+	if ( !context->codec || !( context->codec->capabilities & AV_CODEC_CAP_DR1 ) )
+	{
+		return false;
+	}
+	context->opaque = this;
+	context->get_encode_buffer = GetEncodeBuffer;
+	return true;
+}
+
+PacketBufferPool::Stats PacketBufferPool::GetStats() const
+{
+	std::lock_guard<std::mutex> lock( d->mMutex );
+	Stats stats = d->mStats;
+	stats.sizeClasses = d->mClasses.size();
+	return stats;
+}
@@ -0,0 +1,47 @@
+#ifndef PACKETBUFFERPOOL_H
+#define PACKETBUFFERPOOL_H
+
+#include <stdint.h>
+
+struct AVCodecContext;
+struct AVPacket;
+
+// recycled buffers for encoded packets, so the encoder does not allocate one per frame. Requests are served from
+// size classes a quarter octave apart, each an AVBufferPool; the class is picked from a running estimate of the
+// packet sizes with headroom, so packets of a steady stream share one class whatever their exact size. A buffer
+// returns to its class when the last reference to it goes, usually when the writer has written the packet.
+// Classes the estimate has moved away from are released after a while.
+class PacketBufferPool
+{
+public:
+	struct Stats
+	{
+		uint64_t requests = 0;
+		// requests no returned buffer was there for
+		uint64_t allocations = 0;
+		uint64_t allocatedBytes = 0;
+		int sizeClasses = 0;
+	};
+
+	PacketBufferPool();
+	~PacketBufferPool();
+
+	// first guess of the packet size, before any packet was requested
+	void SetEstimate( uint64_t bytes );
+	// packet gets a buffer of size bytes and zeroed input padding; thread safe
+	bool Allocate( AVPacket *packet, int size );
+	// makes the encoder of context take its packets from the pool, false for encoders that allocate their own
+	// (no AV_CODEC_CAP_DR1); before avcodec_open2
+	bool Attach( AVCodecContext *context );
+
+	Stats GetStats() const;
+
+private:
+	PacketBufferPool( const PacketBufferPool & ) = delete;
+	PacketBufferPool &operator=( const PacketBufferPool & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // PACKETBUFFERPOOL_H
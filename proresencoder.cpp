@@ -0,0 +1,1004 @@
+#include "proresencoder.h"
+
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+}
+
+#include "packetbufferpool.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+// a slice is 8 macroblocks of 16x16 luma, the rest of a row is covered by slices of 4, 2 and 1
+const int SLICE_MBS = 8;
+const int LOG2_SLICE_MBS = 3;
+const int SLICE_PIXELS = SLICE_MBS * 16;
+const int MAX_BLOCKS = SLICE_MBS * 4;
+// frame header with both quantization matrices, picture header and slice header
+const int FRAME_HEADER_BYTES = 148;
+const int PICTURE_HEADER_BYTES = 8;
+const int SLICE_HEADER_BYTES = 6;
+// a codeword is at most 36 bits; run, level and sign of a coefficient fit 10 bytes, the bit writer stores 8 at a time
+const int MAX_PLANE_BYTES = MAX_BLOCKS * 64 * 10 + 8;
+const int MAX_QUANT = 128;
+
+// data rate per macroblock of the profile for pictures of up to 1620, 2700, 6075 and more macroblocks (SD, 720p,
+// 1080p, larger), and the quantizers a slice may use
+struct ProfileInfo
+{
+	uint32_t tag;
+	int minQuant;
+	int maxQuant;
+	int bitsPerMb[4];
+	int lumaMatrix;
+	int chromaMatrix;
+};
+
+const int MB_LIMITS[3] = { 1620, 2700, 6075 };
+
+const ProfileInfo PROFILES[4] =
+{
+	{ MKTAG( 'a', 'p', 'c', 'o' ), 4, 8, { 300, 242, 220, 194 }, 0, 1 },
+	{ MKTAG( 'a', 'p', 'c', 's' ), 1, 9, { 720, 560, 490, 440 }, 2, 2 },
+	{ MKTAG( 'a', 'p', 'c', 'n' ), 1, 6, { 1050, 808, 710, 632 }, 3, 3 },
+	{ MKTAG( 'a', 'p', 'c', 'h' ), 1, 6, { 1566, 1216, 1070, 950 }, 4, 4 },
+};
+
+// quantization matrices in raster order, sent in the frame header
+const uint8_t MATRICES[5][64] =
+{
+	{
+		// proxy
+		4,  7,  9, 11, 13, 14, 15, 63,
+		7,  7, 11, 12, 14, 15, 63, 63,
+		9, 11, 13, 14, 15, 63, 63, 63,
+		11, 11, 13, 14, 63, 63, 63, 63,
+		11, 13, 14, 63, 63, 63, 63, 63,
+		13, 14, 63, 63, 63, 63, 63, 63,
+		13, 63, 63, 63, 63, 63, 63, 63,
+		63, 63, 63, 63, 63, 63, 63, 63,
+	},
+	{
+		// proxy chroma
+		4,  7,  9, 11, 13, 14, 63, 63,
+		7,  7, 11, 12, 14, 63, 63, 63,
+		9, 11, 13, 14, 63, 63, 63, 63,
+		11, 11, 13, 14, 63, 63, 63, 63,
+		11, 13, 14, 63, 63, 63, 63, 63,
+		13, 14, 63, 63, 63, 63, 63, 63,
+		13, 63, 63, 63, 63, 63, 63, 63,
+		63, 63, 63, 63, 63, 63, 63, 63,
+	},
+	{
+		// LT
+		4,  5,  6,  7,  9, 11, 13, 15,
+		5,  5,  7,  8, 11, 13, 15, 17,
+		6,  7,  9, 11, 13, 15, 15, 17,
+		7,  7,  9, 11, 13, 15, 17, 19,
+		7,  9, 11, 13, 14, 16, 19, 23,
+		9, 11, 13, 14, 16, 19, 23, 29,
+		9, 11, 13, 15, 17, 21, 28, 35,
+		11, 13, 16, 17, 21, 28, 35, 41,
+	},
+	{
+		// standard
+		4,  4,  5,  5,  6,  7,  7,  9,
+		4,  4,  5,  6,  7,  7,  9,  9,
+		5,  5,  6,  7,  7,  9,  9, 10,
+		5,  5,  6,  7,  7,  9,  9, 10,
+		5,  6,  7,  7,  8,  9, 10, 12,
+		6,  7,  7,  8,  9, 10, 12, 15,
+		6,  7,  7,  9, 10, 11, 14, 17,
+		7,  7,  9, 10, 11, 14, 17, 21,
+	},
+	{
+		// HQ
+		4,  4,  4,  4,  4,  4,  4,  4,
+		4,  4,  4,  4,  4,  4,  4,  4,
+		4,  4,  4,  4,  4,  4,  4,  4,
+		4,  4,  4,  4,  4,  4,  4,  5,
+		4,  4,  4,  4,  4,  4,  5,  5,
+		4,  4,  4,  4,  4,  5,  5,  6,
+		4,  4,  4,  4,  5,  5,  6,  7,
+		4,  4,  4,  4,  5,  6,  7,  7,
+	},
+};
+
+// coefficient order of progressive pictures
+const uint8_t PROGRESSIVE_SCAN[64] =
+{
+	0,  1,  8,  9,  2,  3, 10, 11,
+	16, 17, 24, 25, 18, 19, 26, 27,
+	4,  5, 12, 20, 13,  6,  7, 14,
+	21, 28, 29, 22, 15, 23, 30, 31,
+	32, 33, 40, 48, 41, 34, 35, 42,
+	49, 56, 57, 50, 43, 36, 37, 44,
+	51, 58, 59, 52, 45, 38, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// adaptive codebooks: rice order << 5 | exp-golomb order << 2 | prefix length at which exp-golomb takes over;
+// chosen by the previous DC code, run and level
+const uint8_t FIRST_DC_CODEBOOK = 0xB8;
+const uint8_t DC_CODEBOOKS[7] = { 0x04, 0x28, 0x28, 0x4D, 0x4D, 0x70, 0x70 };
+const uint8_t RUN_CODEBOOKS[16] = { 0x06, 0x06, 0x05, 0x05, 0x04, 0x29, 0x29, 0x29, 0x29, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x4C };
+const uint8_t LEVEL_CODEBOOKS[10] = { 0x04, 0x0A, 0x05, 0x06, 0x04, 0x28, 0x28, 0x28, 0x28, 0x4C };
+
+// AC levels are rounded towards zero by this much less than to nearest, which saves bits on noise
+const float AC_ROUNDING = 0.375f;
+// DC of a mid grey block, the transform is 4 times orthonormal on samples of 10 bit
+const float DC_OFFSET = 16384.0f;
+
+inline void WriteBe16( uint8_t *p, uint32_t value )
+{
+	p[0] = ( uint8_t )( value >> 8 );
+	p[1] = ( uint8_t )value;
+}
+
+inline void WriteBe32( uint8_t *p, uint32_t value )
+{
+	WriteBe16( p, value >> 16 );
+	WriteBe16( p + 2, value );
+}
+
+// MSB first into a buffer with room for 8 bytes more than is written
+class BitWriter
+{
+	uint8_t *mStart;
+	uint8_t *mOut;
+	uint64_t mBuffer = 0;
+	int mFree = 64;
+
+public:
+	explicit BitWriter( uint8_t *out ) : mStart( out ), mOut( out ) {}
+
+	// value < 2^count, count <= 32
+	inline void Put( uint32_t value, int count )
+	{
+		if ( count < mFree )
+		{
+			mBuffer = ( mBuffer << count ) | value;
+			mFree -= count;
+			return;
+		}
+		int rest = count - mFree;
+		mBuffer = ( mBuffer << mFree ) | ( value >> rest );
+		uint64_t bigEndian = __builtin_bswap64( mBuffer );
+		memcpy( mOut, &bigEndian, 8 );
+		mOut += 8;
+		// the bits above rest are shifted out before the next store
+		mBuffer = value;
+		mFree = 64 - rest;
+	}
+	// pads the last byte with zeros, bytes written
+	int Flush()
+	{
+		int used = 64 - mFree;
+		if ( used > 0 )
+		{
+			uint64_t bigEndian = __builtin_bswap64( mBuffer << mFree );
+			memcpy( mOut, &bigEndian, 8 );
+			mOut += ( used + 7 ) / 8;
+		}
+		mBuffer = 0;
+		mFree = 64;
+		return ( int )( mOut - mStart );
+	}
+};
+
+// rice code below the switch value, exp-golomb above it
+inline void PutCodeword( BitWriter &bits, uint32_t codebook, uint32_t value )
+{
+	uint32_t switchBits = ( codebook & 3 ) + 1;
+	uint32_t riceOrder = codebook >> 5;
+	uint32_t expOrder = ( codebook >> 2 ) & 7;
+	uint32_t switchValue = switchBits << riceOrder;
+	if ( value >= switchValue )
+	{
+		value -= switchValue - ( 1u << expOrder );
+		int exponent = 31 - __builtin_clz( value );
+		bits.Put( 0, exponent - expOrder + switchBits );
+		bits.Put( value, exponent + 1 );
+	}
+	else
+	{
+		// value >> riceOrder zeros and a one
+		bits.Put( 1, ( value >> riceOrder ) + 1 );
+		if ( riceOrder )
+		{
+			bits.Put( value & ( ( 1u << riceOrder ) - 1 ), riceOrder );
+		}
+	}
+}
+
+inline uint32_t SignedCode( int value )
+{
+	return ( uint32_t )( ( value * 2 ) ^ ( value >> 31 ) );
+}
+
+// the DC of every block as difference to the previous one, its sign relative to the sign of the previous difference
+void EncodeDc( BitWriter &bits, const int16_t *levels, int blocks )
+{
+	int previous = levels[0];
+	PutCodeword( bits, FIRST_DC_CODEBOOK, SignedCode( previous ) );
+	uint32_t code = 5;
+	int sign = 0;
+	for ( int block = 1; block < blocks; block++ )
+	{
+		int delta = levels[block] - previous;
+		int deltaSign = delta >> 31;
+		uint32_t codebook = DC_CODEBOOKS[code < 6 ? code : 6];
+		code = SignedCode( ( delta ^ sign ) - sign );
+		PutCodeword( bits, codebook, code );
+		sign = deltaSign;
+		previous = levels[block];
+	}
+}
+
+inline void PutAc( BitWriter &bits, int run, int level, int &previousRun, int &previousLevel )
+{
+	int absLevel = level < 0 ? -level : level;
+	PutCodeword( bits, RUN_CODEBOOKS[previousRun < 15 ? previousRun : 15], run );
+	PutCodeword( bits, LEVEL_CODEBOOKS[previousLevel < 9 ? previousLevel : 9], absLevel - 1 );
+	bits.Put( level < 0 ? 1 : 0, 1 );
+	previousRun = run;
+	previousLevel = absLevel;
+}
+
+// levels are in coding order, scan position major and block minor, so a run of zeros crosses blocks; trailing
+// zeros are not coded
+void EncodeAcC( BitWriter &bits, const int16_t *levels, int blocks )
+{
+	int previousRun = 4;
+	int previousLevel = 2;
+	int last = blocks - 1;
+	for ( int pos = blocks; pos < 64 * blocks; pos++ )
+	{
+		if ( levels[pos] )
+		{
+			PutAc( bits, pos - last - 1, levels[pos], previousRun, previousLevel );
+			last = pos;
+		}
+	}
+}
+
+// 2 * c(k) * cos( ( 2n + 1 ) k pi / 16 ): the two passes together scale the orthonormal transform by 4
+struct DctMatrix
+{
+	float c[8][8];
+	DctMatrix()
+	{
+		for ( int k = 0; k < 8; k++ )
+		{
+			for ( int n = 0; n < 8; n++ )
+			{
+				double scale = k == 0 ? sqrt( 1.0 / 8.0 ) : sqrt( 2.0 / 8.0 );
+				c[k][n] = ( float )( 2.0 * scale * cos( ( 2 * n + 1 ) * k * M_PI / 16.0 ) );
+			}
+		}
+	}
+};
+
+const DctMatrix &Dct()
+{
+	static const DctMatrix matrix;
+	return matrix;
+}
+
+// 8x8 samples stride apart into raster order coefficients
+void ForwardDctC( const float *src, int stride, float *dst )
+{
+	const DctMatrix &dct = Dct();
+	float columns[64];
+	for ( int k = 0; k < 8; k++ )
+	{
+		for ( int x = 0; x < 8; x++ )
+		{
+			float sum = 0.0f;
+			for ( int n = 0; n < 8; n++ )
+			{
+				sum += dct.c[k][n] * src[n * stride + x];
+			}
+			columns[k * 8 + x] = sum;
+		}
+	}
+	for ( int k = 0; k < 8; k++ )
+	{
+		for ( int j = 0; j < 8; j++ )
+		{
+			float sum = 0.0f;
+			for ( int n = 0; n < 8; n++ )
+			{
+				sum += dct.c[j][n] * columns[k * 8 + n];
+			}
+			dst[k * 8 + j] = sum;
+		}
+	}
+}
+
+// levels of the 64 coefficients (raster order), DC is done by the caller
+void QuantizeC( const float *coefficients, const float *reciprocals, int16_t *levels )
+{
+	for ( int n = 0; n < 64; n++ )
+	{
+		float scaled = coefficients[n] * reciprocals[n];
+		levels[n] = ( int16_t )( scaled < 0.0f ? -( int )( AC_ROUNDING - scaled ) : ( int )( scaled + AC_ROUNDING ) );
+	}
+}
+
+#if defined( __x86_64__ )
+
+__attribute__( ( target( "avx2,fma" ) ) )
+inline void Transpose8x8( __m256 *r )
+{
+	__m256 t0 = _mm256_unpacklo_ps( r[0], r[1] );
+	__m256 t1 = _mm256_unpackhi_ps( r[0], r[1] );
+	__m256 t2 = _mm256_unpacklo_ps( r[2], r[3] );
+	__m256 t3 = _mm256_unpackhi_ps( r[2], r[3] );
+	__m256 t4 = _mm256_unpacklo_ps( r[4], r[5] );
+	__m256 t5 = _mm256_unpackhi_ps( r[4], r[5] );
+	__m256 t6 = _mm256_unpacklo_ps( r[6], r[7] );
+	__m256 t7 = _mm256_unpackhi_ps( r[6], r[7] );
+	__m256 s0 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+	__m256 s1 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+	__m256 s2 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+	__m256 s3 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+	__m256 s4 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+	__m256 s5 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+	__m256 s6 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+	__m256 s7 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+	r[0] = _mm256_permute2f128_ps( s0, s4, 0x20 );
+	r[1] = _mm256_permute2f128_ps( s1, s5, 0x20 );
+	r[2] = _mm256_permute2f128_ps( s2, s6, 0x20 );
+	r[3] = _mm256_permute2f128_ps( s3, s7, 0x20 );
+	r[4] = _mm256_permute2f128_ps( s0, s4, 0x31 );
+	r[5] = _mm256_permute2f128_ps( s1, s5, 0x31 );
+	r[6] = _mm256_permute2f128_ps( s2, s6, 0x31 );
+	r[7] = _mm256_permute2f128_ps( s3, s7, 0x31 );
+}
+
+// a row of 8 samples per register: the vertical pass is a sum of rows, the horizontal one the same after a transpose
+__attribute__( ( target( "avx2,fma" ) ) )
+inline void DctPassAvx2( const __m256 *in, __m256 *out )
+{
+	const DctMatrix &dct = Dct();
+	for ( int k = 0; k < 8; k++ )
+	{
+		__m256 sum = _mm256_mul_ps( _mm256_broadcast_ss( &dct.c[k][0] ), in[0] );
+		for ( int n = 1; n < 8; n++ )
+		{
+			sum = _mm256_fmadd_ps( _mm256_broadcast_ss( &dct.c[k][n] ), in[n], sum );
+		}
+		out[k] = sum;
+	}
+}
+
+__attribute__( ( target( "avx2,fma" ) ) )
+void ForwardDctAvx2( const float *src, int stride, float *dst )
+{
+	__m256 rows[8];
+	__m256 columns[8];
+	for ( int n = 0; n < 8; n++ )
+	{
+		rows[n] = _mm256_loadu_ps( src + n * stride );
+	}
+	DctPassAvx2( rows, columns );
+	Transpose8x8( columns );
+	DctPassAvx2( columns, rows );
+	Transpose8x8( rows );
+	for ( int k = 0; k < 8; k++ )
+	{
+		_mm256_storeu_ps( dst + k * 8, rows[k] );
+	}
+}
+
+__attribute__( ( target( "avx2,fma" ) ) )
+void QuantizeAvx2( const float *coefficients, const float *reciprocals, int16_t *levels )
+{
+	const __m256 signBit = _mm256_set1_ps( -0.0f );
+	const __m256 rounding = _mm256_set1_ps( AC_ROUNDING );
+	for ( int n = 0; n < 64; n += 16 )
+	{
+		__m256 c0 = _mm256_loadu_ps( coefficients + n );
+		__m256 c1 = _mm256_loadu_ps( coefficients + n + 8 );
+		__m256i l0 = _mm256_cvttps_epi32( _mm256_fmadd_ps( _mm256_andnot_ps( signBit, c0 ), _mm256_loadu_ps( reciprocals + n ), rounding ) );
+		__m256i l1 = _mm256_cvttps_epi32( _mm256_fmadd_ps( _mm256_andnot_ps( signBit, c1 ), _mm256_loadu_ps( reciprocals + n + 8 ), rounding ) );
+		// the sign of the coefficient back, packing works per 128 bit lane
+		l0 = _mm256_sign_epi32( l0, _mm256_castps_si256( c0 ) );
+		l1 = _mm256_sign_epi32( l1, _mm256_castps_si256( c1 ) );
+		__m256i packed = _mm256_permute4x64_epi64( _mm256_packs_epi32( l0, l1 ), 0xD8 );
+		_mm256_storeu_si256( ( __m256i * )( levels + n ), packed );
+	}
+}
+
+// 16 levels at a time compared against zero, only the nonzero ones are visited
+__attribute__( ( target( "avx2,fma" ) ) )
+void EncodeAcAvx2( BitWriter &bits, const int16_t *levels, int blocks )
+{
+	int previousRun = 4;
+	int previousLevel = 2;
+	int last = blocks - 1;
+	const __m256i zero = _mm256_setzero_si256();
+	for ( int base = blocks & ~15; base < 64 * blocks; base += 16 )
+	{
+		__m256i values = _mm256_loadu_si256( ( const __m256i * )( levels + base ) );
+		// two mask bits per level
+		uint32_t nonzero = ~( uint32_t )_mm256_movemask_epi8( _mm256_cmpeq_epi16( values, zero ) );
+		if ( base < blocks )
+		{
+			nonzero &= ~0u << ( 2 * ( blocks - base ) );
+		}
+		while ( nonzero )
+		{
+			int bit = __builtin_ctz( nonzero );
+			nonzero &= ~( 3u << bit );
+			int pos = base + ( bit >> 1 );
+			PutAc( bits, pos - last - 1, levels[pos], previousRun, previousLevel );
+			last = pos;
+		}
+	}
+}
+
+#endif
+
+// samples of a row of the picture from x0 on in the 10 bit range, count of them; columns right of the picture
+// repeat its last one
+void UnpackUyvy( const uint8_t *row, int x0, int count, int width, float *luma, float *cb, float *cr )
+{
+	int valid = qMin( count, ( width - x0 + 1 ) & ~1 );
+	const uint8_t *p = row + 2 * x0;
+	for ( int x = 0; x < valid; x += 2, p += 4 )
+	{
+		cb[x / 2] = p[0] * 4.0f;
+		luma[x] = p[1] * 4.0f;
+		cr[x / 2] = p[2] * 4.0f;
+		luma[x + 1] = p[3] * 4.0f;
+	}
+	for ( int x = valid; x < count; x++ )
+	{
+		luma[x] = luma[valid - 1];
+	}
+	for ( int x = valid / 2; x < count / 2; x++ )
+	{
+		cb[x] = cb[valid / 2 - 1];
+		cr[x] = cr[valid / 2 - 1];
+	}
+}
+
+inline uint32_t ReadLe32( const uint8_t *p )
+{
+	return ( uint32_t )p[0] | ( uint32_t )p[1] << 8 | ( uint32_t )p[2] << 16 | ( uint32_t )p[3] << 24;
+}
+
+// groups of 6 pixels in 4 little endian words: Cb0 Y0 Cr0, Y1 Cb1 Y2, Cr1 Y3 Cb2, Y4 Cr2 Y5
+void UnpackV210( const uint8_t *row, int x0, int count, int width, float *luma, float *cb, float *cr )
+{
+	int valid = qMin( count, ( width - x0 + 1 ) & ~1 );
+	int first = x0 / 6;
+	int end = x0 + valid;
+	for ( int group = first; group * 6 < end; group++ )
+	{
+		const uint8_t *p = row + 16 * group;
+		uint32_t w0 = ReadLe32( p );
+		uint32_t w1 = ReadLe32( p + 4 );
+		uint32_t w2 = ReadLe32( p + 8 );
+		uint32_t w3 = ReadLe32( p + 12 );
+		const uint32_t y[6] = { w0 >> 10, w1, w1 >> 20, w2 >> 10, w3, w3 >> 20 };
+		const uint32_t u[3] = { w0, w1 >> 10, w2 >> 20 };
+		const uint32_t v[3] = { w0 >> 20, w2, w3 >> 10 };
+		int x = group * 6 - x0;
+		if ( x >= 0 && x + 6 <= valid )
+		{
+			for ( int k = 0; k < 6; k++ )
+			{
+				luma[x + k] = ( float )( y[k] & 0x3ff );
+			}
+			for ( int k = 0; k < 3; k++ )
+			{
+				cb[x / 2 + k] = ( float )( u[k] & 0x3ff );
+				cr[x / 2 + k] = ( float )( v[k] & 0x3ff );
+			}
+			continue;
+		}
+		// the groups at the ends of the slice
+		for ( int k = 0; k < 6; k += 2 )
+		{
+			if ( x + k >= 0 && x + k < valid )
+			{
+				luma[x + k] = ( float )( y[k] & 0x3ff );
+				luma[x + k + 1] = ( float )( y[k + 1] & 0x3ff );
+				cb[( x + k ) / 2] = ( float )( u[k / 2] & 0x3ff );
+				cr[( x + k ) / 2] = ( float )( v[k / 2] & 0x3ff );
+			}
+		}
+	}
+	for ( int x = valid; x < count; x++ )
+	{
+		luma[x] = luma[valid - 1];
+	}
+	for ( int x = valid / 2; x < count / 2; x++ )
+	{
+		cb[x] = cb[valid / 2 - 1];
+		cr[x] = cr[valid / 2 - 1];
+	}
+}
+
+// where a slice of a row starts and how many macroblocks it has
+struct SliceShape
+{
+	int mbX;
+	int mbs;
+};
+
+// working memory of one thread
+struct SliceScratch
+{
+	// unpacked samples of the slice, 16 rows
+	std::vector<float> luma;
+	std::vector<float> chroma[2];
+	// transform coefficients of every block in raster order, per plane
+	std::vector<float> coefficients[3];
+	// quantized levels in coding order
+	std::vector<int16_t> levels;
+	// encoded slice at two quantizers, the better one is kept
+	std::vector<uint8_t> output[2];
+
+	SliceScratch()
+		: luma( 16 * SLICE_PIXELS )
+		, levels( MAX_BLOCKS * 64 )
+	{
+		chroma[0].resize( 16 * SLICE_PIXELS / 2 );
+		chroma[1].resize( 16 * SLICE_PIXELS / 2 );
+		for ( int plane = 0; plane < 3; plane++ )
+		{
+			coefficients[plane].resize( MAX_BLOCKS * 64 );
+		}
+		output[0].resize( SLICE_HEADER_BYTES + 3 * MAX_PLANE_BYTES );
+		output[1].resize( SLICE_HEADER_BYTES + 3 * MAX_PLANE_BYTES );
+	}
+};
+
+// encoded slices of a macroblock row, back to back
+struct RowOutput
+{
+	std::vector<uint8_t> data;
+	size_t bytes = 0;
+};
+
+}
+
+class ProResEncoder::PrivateClass
+{
+public:
+	class Worker : public QRunnable
+	{
+	public:
+		PrivateClass *mEncoder;
+		int mIndex;
+
+		Worker( PrivateClass *encoder, int index ) : mEncoder( encoder ), mIndex( index )
+		{
+			// started again for every picture
+			setAutoDelete( false );
+		}
+		void run() override
+		{
+			mEncoder->EncodeRows( mIndex );
+			mEncoder->mWorkersDone.release();
+		}
+	};
+
+	int mProfile;
+	const ProfileInfo *mInfo;
+	int mWidth = 0;
+	int mHeight = 0;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+	int mMbWidth = 0;
+	int mMbHeight = 0;
+	int mBitsPerMb = 0;
+	std::vector<SliceShape> mRowSlices;
+
+	// 1 / ( matrix * quantizer ) per plane kind (luma, chroma), quantizer and coefficient
+	std::vector<float> mReciprocals[2];
+	void ( *mForwardDct )( const float *, int, float * ) = ForwardDctC;
+	void ( *mQuantize )( const float *, const float *, int16_t * ) = QuantizeC;
+	void ( *mEncodeAc )( BitWriter &, const int16_t *, int ) = EncodeAcC;
+	const char *mInstructionSet = "c";
+	PacketBufferPool *mBufferPool = nullptr;
+
+	// per slice of the picture, the quantizer carries over to the next picture
+	std::vector<uint16_t> mSliceBytes;
+	std::vector<uint8_t> mSliceQuant;
+	std::vector<RowOutput> mRows;
+
+	// the picture being encoded, its rows are taken by the threads in turn
+	const uint8_t *mPicture = nullptr;
+	int mRowBytes = 0;
+	std::atomic<int> mNextRow;
+
+	std::vector<SliceScratch> mScratch;
+	std::vector<Worker *> mWorkers;
+	QThreadPool mPool;
+	QSemaphore mWorkersDone;
+
+	explicit PrivateClass( int profile )
+		: mProfile( qBound( 0, profile, 3 ) )
+		, mInfo( &PROFILES[qBound( 0, profile, 3 )] )
+	{
+		mNextRow = 0;
+	}
+	~PrivateClass()
+	{
+		mPool.waitForDone();
+		for ( Worker *worker : mWorkers )
+		{
+			delete worker;
+		}
+	}
+
+	void EncodeRows( int thread );
+	void EncodeRow( int row, SliceScratch &scratch );
+	int EncodeSlice( SliceScratch &scratch, int mbs, int quant, uint8_t *out );
+	int EncodePlane( SliceScratch &scratch, int plane, int blocks, int quant, uint8_t *out );
+	int WriteFrameHeader( uint8_t *out ) const;
+};
+
+void ProResEncoder::PrivateClass::EncodeRows( int thread )
+{
+	SliceScratch &scratch = mScratch[thread];
+	for ( ;; )
+	{
+		int row = mNextRow++;
+		if ( row >= mMbHeight )
+		{
+			break;
+		}
+		EncodeRow( row, scratch );
+	}
+}
+
+void ProResEncoder::PrivateClass::EncodeRow( int row, SliceScratch &scratch )
+{
+	RowOutput &output = mRows[row];
+	output.bytes = 0;
+	bool tenBit = mPixelFormat == bmdFormat10BitYUV;
+	for ( size_t i = 0; i < mRowSlices.size(); i++ )
+	{
+		const SliceShape &shape = mRowSlices[i];
+		int x0 = shape.mbX * 16;
+		int count = shape.mbs * 16;
+
+		// the 16 rows of the slice into planar samples; rows below the picture repeat its last one
+		for ( int y = 0; y < 16; y++ )
+		{
+			int pictureRow = qMin( row * 16 + y, mHeight - 1 );
+			const uint8_t *src = mPicture + ( size_t )pictureRow * mRowBytes;
+			float *luma = scratch.luma.data() + y * SLICE_PIXELS;
+			float *cb = scratch.chroma[0].data() + y * SLICE_PIXELS / 2;
+			float *cr = scratch.chroma[1].data() + y * SLICE_PIXELS / 2;
+			if ( tenBit )
+			{
+				UnpackV210( src, x0, count, mWidth, luma, cb, cr );
+			}
+			else
+			{
+				UnpackUyvy( src, x0, count, mWidth, luma, cb, cr );
+			}
+		}
+
+		// luma blocks of a macroblock left to right, top to bottom; the two chroma blocks top and bottom
+		for ( int mb = 0; mb < shape.mbs; mb++ )
+		{
+			for ( int block = 0; block < 4; block++ )
+			{
+				const float *src = scratch.luma.data() + ( block >> 1 ) * 8 * SLICE_PIXELS + mb * 16 + ( block & 1 ) * 8;
+				mForwardDct( src, SLICE_PIXELS, scratch.coefficients[0].data() + ( mb * 4 + block ) * 64 );
+			}
+			for ( int plane = 1; plane < 3; plane++ )
+			{
+				for ( int block = 0; block < 2; block++ )
+				{
+					const float *src = scratch.chroma[plane - 1].data() + block * 8 * SLICE_PIXELS / 2 + mb * 8;
+					mForwardDct( src, SLICE_PIXELS / 2, scratch.coefficients[plane].data() + ( mb * 2 + block ) * 64 );
+				}
+			}
+		}
+
+		// the quantizer of this slice in the last picture first, then coarser while over the budget, or one
+		// finer if that still fits
+		int sliceIndex = row * ( int )mRowSlices.size() + ( int )i;
+		int budget = mBitsPerMb * shape.mbs / 8;
+		int quant = qBound( mInfo->minQuant, ( int )mSliceQuant[sliceIndex], mInfo->maxQuant );
+		int current = 0;
+		int bytes = EncodeSlice( scratch, shape.mbs, quant, scratch.output[current].data() );
+		if ( bytes > budget )
+		{
+			while ( bytes > budget && quant < mInfo->maxQuant )
+			{
+				// the size is about inversely proportional to the quantizer
+				quant = qMin( mInfo->maxQuant, qMax( quant + 1, quant * bytes / qMax( 1, budget ) ) );
+				bytes = EncodeSlice( scratch, shape.mbs, quant, scratch.output[current].data() );
+			}
+		}
+		else if ( quant > mInfo->minQuant )
+		{
+			int finer = EncodeSlice( scratch, shape.mbs, quant - 1, scratch.output[1 - current].data() );
+			if ( finer <= budget )
+			{
+				quant--;
+				bytes = finer;
+				current = 1 - current;
+			}
+		}
+		mSliceQuant[sliceIndex] = ( uint8_t )quant;
+		mSliceBytes[sliceIndex] = ( uint16_t )bytes;
+
+		// grows during the first pictures only
+		if ( output.data.size() < output.bytes + bytes )
+		{
+			output.data.resize( output.bytes + bytes );
+		}
+		memcpy( output.data.data() + output.bytes, scratch.output[current].data(), bytes );
+		output.bytes += bytes;
+	}
+}
+
+int ProResEncoder::PrivateClass::EncodeSlice( SliceScratch &scratch, int mbs, int quant, uint8_t *out )
+{
+	uint8_t *data = out + SLICE_HEADER_BYTES;
+	int lumaBytes = EncodePlane( scratch, 0, mbs * 4, quant, data );
+	int cbBytes = EncodePlane( scratch, 1, mbs * 2, quant, data + lumaBytes );
+	int crBytes = EncodePlane( scratch, 2, mbs * 2, quant, data + lumaBytes + cbBytes );
+	// header size in bits, quantizer, sizes of the luma and Cb data; Cr takes the rest
+	out[0] = SLICE_HEADER_BYTES << 3;
+	out[1] = ( uint8_t )quant;
+	WriteBe16( out + 2, lumaBytes );
+	WriteBe16( out + 4, cbBytes );
+	return SLICE_HEADER_BYTES + lumaBytes + cbBytes + crBytes;
+}
+
+int ProResEncoder::PrivateClass::EncodePlane( SliceScratch &scratch, int plane, int blocks, int quant, uint8_t *out )
+{
+	const float *reciprocals = mReciprocals[plane == 0 ? 0 : 1].data() + quant * 64;
+	const float *coefficients = scratch.coefficients[plane].data();
+	int16_t *levels = scratch.levels.data();
+	int16_t blockLevels[64];
+	for ( int block = 0; block < blocks; block++ )
+	{
+		const float *blockCoefficients = coefficients + block * 64;
+		mQuantize( blockCoefficients, reciprocals, blockLevels );
+		// DC rounded to nearest around mid grey
+		levels[block] = ( int16_t )lrintf( ( blockCoefficients[0] - DC_OFFSET ) * reciprocals[0] );
+		for ( int i = 1; i < 64; i++ )
+		{
+			levels[i * blocks + block] = blockLevels[PROGRESSIVE_SCAN[i]];
+		}
+	}
+
+	BitWriter bits( out );
+	EncodeDc( bits, levels, blocks );
+	mEncodeAc( bits, levels, blocks );
+	return bits.Flush();
+}
+
+int ProResEncoder::PrivateClass::WriteFrameHeader( uint8_t *out ) const
+{
+	memset( out, 0, FRAME_HEADER_BYTES );
+	WriteBe16( out, FRAME_HEADER_BYTES );
+	// version 0, vendor
+	memcpy( out + 4, "rcdr", 4 );
+	WriteBe16( out + 8, mWidth );
+	WriteBe16( out + 10, mHeight );
+	// 4:2:2, progressive
+	out[12] = 2 << 6;
+	// BT.709 primaries, transfer and matrix for HD and larger, unspecified for SD
+	uint8_t colour = mHeight >= 720 ? 1 : 2;
+	out[14] = colour;
+	out[15] = colour;
+	out[16] = colour;
+	// no alpha
+	out[17] = 0x40;
+	// both matrices follow
+	out[19] = 0x03;
+	memcpy( out + 20, MATRICES[mInfo->lumaMatrix], 64 );
+	memcpy( out + 84, MATRICES[mInfo->chromaMatrix], 64 );
+	return FRAME_HEADER_BYTES;
+}
+
+///@endcond INTERNAL
+
+ProResEncoder::ProResEncoder( int profile )
+{
+	d = new ProResEncoder::PrivateClass( profile );
+}
+
+ProResEncoder::~ProResEncoder()
+{
+	delete d;
+	d = nullptr;
+}
+
+bool ProResEncoder::Init( int width, int height, BMDPixelFormat pixelFormat, int threads )
+{
+	if ( width <= 0 || height <= 0 || width > 65535 || height > 65535 )
+	{
+		fprintf( stderr, "ProRes cannot encode %dx%d pictures\n", width, height );
+		return false;
+	}
+	if ( pixelFormat != bmdFormat8BitYUV && pixelFormat != bmdFormat10BitYUV )
+	{
+		fprintf( stderr, "ProRes encoder reads UYVY or v210 only\n" );
+		return false;
+	}
+	d->mWidth = width;
+	d->mHeight = height;
+	d->mPixelFormat = pixelFormat;
+	d->mMbWidth = ( width + 15 ) / 16;
+	d->mMbHeight = ( height + 15 ) / 16;
+
+	int mbs = d->mMbWidth * d->mMbHeight;
+	int sizeClass = 0;
+	while ( sizeClass < 3 && mbs > MB_LIMITS[sizeClass] )
+	{
+		sizeClass++;
+	}
+	d->mBitsPerMb = d->mInfo->bitsPerMb[sizeClass];
+
+	// slices of 8 macroblocks, the end of a row in halving ones
+	d->mRowSlices.clear();
+	int mbX = 0;
+	for ( int sliceMbs = SLICE_MBS; sliceMbs > 0; sliceMbs /= 2 )
+	{
+		while ( d->mMbWidth - mbX >= sliceMbs )
+		{
+			d->mRowSlices.push_back( SliceShape{ mbX, sliceMbs } );
+			mbX += sliceMbs;
+		}
+	}
+	size_t slices = d->mRowSlices.size() * d->mMbHeight;
+	d->mSliceBytes.assign( slices, 0 );
+	d->mSliceQuant.assign( slices, ( uint8_t )d->mInfo->minQuant );
+	d->mRows.resize( d->mMbHeight );
+
+	for ( int kind = 0; kind < 2; kind++ )
+	{
+		const uint8_t *matrix = MATRICES[kind == 0 ? d->mInfo->lumaMatrix : d->mInfo->chromaMatrix];
+		d->mReciprocals[kind].assign( ( MAX_QUANT + 1 ) * 64, 0.0f );
+		for ( int quant = 1; quant <= MAX_QUANT; quant++ )
+		{
+			for ( int n = 0; n < 64; n++ )
+			{
+				d->mReciprocals[kind][quant * 64 + n] = 1.0f / ( matrix[n] * quant );
+			}
+		}
+	}
+
+#if defined( __x86_64__ )
+	if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+	{
+		d->mForwardDct = ForwardDctAvx2;
+		d->mQuantize = QuantizeAvx2;
+		d->mEncodeAc = EncodeAcAvx2;
+		d->mInstructionSet = "avx2";
+	}
+#endif
+
+	threads = qBound( 1, threads, d->mMbHeight );
+	d->mScratch.resize( threads );
+	d->mPool.waitForDone();
+	for ( PrivateClass::Worker *worker : d->mWorkers )
+	{
+		delete worker;
+	}
+	d->mWorkers.clear();
+	for ( int i = 1; i < threads; i++ )
+	{
+		d->mWorkers.push_back( new PrivateClass::Worker( d, i ) );
+	}
+	// the calling thread is one of them
+	d->mPool.setMaxThreadCount( qMax( 1, threads - 1 ) );
+	d->mPool.setExpiryTimeout( -1 );
+	return true;
+}
+
+bool ProResEncoder::Encode( const uint8_t *picture, int rowBytes, AVPacket *packet )
+{
+	if ( d->mRows.empty() )
+	{
+		fprintf( stderr, "ProRes encoder is not initialized\n" );
+		return false;
+	}
+	d->mPicture = picture;
+	d->mRowBytes = rowBytes;
+	d->mNextRow = 0;
+	for ( PrivateClass::Worker *worker : d->mWorkers )
+	{
+		d->mPool.start( worker );
+	}
+	d->EncodeRows( 0 );
+	d->mWorkersDone.acquire( d->mWorkers.size() );
+
+	size_t sliceCount = d->mSliceBytes.size();
+	size_t sliceBytes = 0;
+	for ( const RowOutput &row : d->mRows )
+	{
+		sliceBytes += row.bytes;
+	}
+	size_t pictureBytes = PICTURE_HEADER_BYTES + 2 * sliceCount + sliceBytes;
+	size_t frameBytes = 8 + FRAME_HEADER_BYTES + pictureBytes;
+	bool allocated = d->mBufferPool ? d->mBufferPool->Allocate( packet, ( int )frameBytes ) : av_new_packet( packet, ( int )frameBytes ) >= 0;
+	if ( !allocated )
+	{
+		fprintf( stderr, "Could not allocate a ProRes packet of %zu bytes\n", frameBytes );
+		return false;
+	}
+
+	// frame size, frame identifier and header
+	uint8_t *out = packet->data;
+	WriteBe32( out, ( uint32_t )frameBytes );
+	memcpy( out + 4, "icpf", 4 );
+	out += 8;
+	out += d->WriteFrameHeader( out );
+
+	// picture header: its size in bits, the size of the picture, slice count, log2 of macroblocks per slice
+	out[0] = PICTURE_HEADER_BYTES << 3;
+	WriteBe32( out + 1, ( uint32_t )pictureBytes );
+	WriteBe16( out + 5, ( uint32_t )sliceCount );
+	out[7] = LOG2_SLICE_MBS << 4;
+	out += PICTURE_HEADER_BYTES;
+	for ( size_t i = 0; i < sliceCount; i++ )
+	{
+		WriteBe16( out + 2 * i, d->mSliceBytes[i] );
+	}
+	out += 2 * sliceCount;
+	for ( const RowOutput &row : d->mRows )
+	{
+		memcpy( out, row.data.data(), row.bytes );
+		out += row.bytes;
+	}
+	packet->flags |= AV_PKT_FLAG_KEY;
+	return true;
+}
+
+void ProResEncoder::SetBufferPool( PacketBufferPool *pool )
+{
+	d->mBufferPool = pool;
+}
+
+const char *ProResEncoder::InstructionSet() const
+{
+	return d->mInstructionSet;
+}
+
+double ProResEncoder::AverageQuantizer() const
+{
+	if ( d->mSliceQuant.empty() )
+	{
+		return 0.0;
+	}
+	double sum = 0.0;
+	for ( uint8_t quant : d->mSliceQuant )
+	{
+		sum += quant;
+	}
+	return sum / d->mSliceQuant.size();
+}
+
+uint32_t ProResEncoder::CodecTag( int profile )
+{
+	return PROFILES[qBound( 0, profile, 3 )].tag;
+}
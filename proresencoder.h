@@ -0,0 +1,48 @@
+#ifndef PRORESENCODER_H
+#define PRORESENCODER_H
+
+#include <stdint.h>
+
+#include "decklink/DeckLinkAPI.h"
+
+struct AVPacket;
+class PacketBufferPool;
+
+// ProRes 422 (proxy, LT, standard, HQ) encoder of our own that reads the captured UYVY or v210 rows as they are:
+// every slice of 8 macroblocks is unpacked, transformed, quantized and entropy coded while it is in cache, so
+// neither a decoder nor a conversion to planar 10 bit touches the whole picture. Transform, quantization and
+// the search for nonzero coefficients use AVX2 when the CPU has it. The rows of slices of a picture are shared
+// out to a pool of worker threads, the calling thread takes part. Each slice gets the coarsest quantizer of the
+// profile range that meets the profile's data rate, starting from the one it had in the previous picture.
+// Progressive pictures only.
+class ProResEncoder
+{
+public:
+	// FF_PROFILE_PRORES_PROXY to FF_PROFILE_PRORES_HQ
+	explicit ProResEncoder( int profile );
+	~ProResEncoder();
+
+	// 8 bit UYVY or 10 bit v210 input; threads includes the thread calling Encode
+	bool Init( int width, int height, BMDPixelFormat pixelFormat, int threads );
+	// one captured picture with rows rowBytes apart into packet, which gets a buffer of its own; not thread safe
+	bool Encode( const uint8_t *picture, int rowBytes, AVPacket *packet );
+	// packet buffers from pool instead of av_new_packet, nullptr for the latter
+	void SetBufferPool( PacketBufferPool *pool );
+
+	// "avx2" or "c"
+	const char *InstructionSet() const;
+	// mean slice quantizer of the last picture
+	double AverageQuantizer() const;
+
+	// MOV sample description tag of the profile
+	static uint32_t CodecTag( int profile );
+
+private:
+	ProResEncoder( const ProResEncoder & ) = delete;
+	ProResEncoder &operator=( const ProResEncoder & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // PRORESENCODER_H
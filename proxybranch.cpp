@@ -0,0 +1,326 @@
+#include "proxybranch.h"
+
+#include <atomic>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <QFileInfo>
+#include <QFuture>
+#include <QtConcurrent/QtConcurrent>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavformat/avformat.h"
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+#include "deps/ffmpeg/include/libavutil/opt.h"
+#include "deps/ffmpeg/include/libswscale/swscale.h"
+}
+
+#include "ffmpegutils.h"
+#include "memorybudget.h"
+#include "shellpool.h"
+#include "stagequeue.h"
+
+///@cond INTERNAL
+
+class ProxyBranch::PrivateClass
+{
+public:
+	Settings mSettings;
+	int mWidth = 0;
+	int mHeight = 0;
+	AVRational mTimeBase = {1, 1};
+	AVRational mSourceTimeBase = {1, 1};
+	MemoryBudget *mBudget = nullptr;
+	uint64_t mFrameBytes = 0;
+
+	// declared before the queue, whose handles return into it
+	FrameShellPool mFrameShells;
+	StageQueue<FrameHandle> mQueue;
+	QFuture<void> mThread;
+	QString mOutputFile;
+
+	AVCodecContext *mCodecContext = nullptr;
+	AVFormatContext *mFormatContext = nullptr;
+	AVStream *mStream = nullptr;
+	SwsContext *mSwScaleContext = nullptr;
+	AVFrame *mScaledFrame = nullptr;
+
+	std::atomic<uint64_t> mEncodedFrames;
+	std::atomic<uint64_t> mSkippedFrames;
+
+	PrivateClass( const Settings &settings )
+		: mSettings( settings )
+		, mFrameShells( 2 * settings.queueDepth )
+	{
+		mEncodedFrames = 0;
+		mSkippedFrames = 0;
+	}
+
+	bool Open();
+	void Encode( AVFrame *frame );
+	void Close();
+	void ThreadFunction();
+};
+
+bool ProxyBranch::PrivateClass::Open()
+{
+	int width = ( mWidth / qMax( 1, mSettings.divisor ) ) & ~1;
+	int height = ( mHeight / qMax( 1, mSettings.divisor ) ) & ~1;
+
+	avformat_alloc_output_context2( &mFormatContext, nullptr, nullptr, qUtf8Printable( mOutputFile ) );
+	if ( !mFormatContext )
+	{
+		fprintf( stderr, "Could not deduce proxy output format from '%s'\n", qUtf8Printable( mOutputFile ) );
+		return false;
+	}
+
+	const AVCodec *codec = avcodec_find_encoder_by_name( "libx264" );
+	if ( !codec )
+	{
+		codec = avcodec_find_encoder( AV_CODEC_ID_H264 );
+	}
+	mCodecContext = codec ? avcodec_alloc_context3( codec ) : nullptr;
+	if ( !mCodecContext )
+	{
+		fprintf( stderr, "Proxy video codec not found\n" );
+		return false;
+	}
+	mCodecContext->width = width;
+	mCodecContext->height = height;
+	mCodecContext->time_base = mTimeBase;
+	mCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+	mCodecContext->bit_rate = ( int64_t )mSettings.bitrateKbps * 1000;
+	// a key frame every two seconds keeps scrubbing in the editor cheap
+	mCodecContext->gop_size = qMax( 1, 2 * mTimeBase.den / qMax( 1, mTimeBase.num ) );
+	mCodecContext->max_b_frames = 0;
+	mCodecContext->profile = FF_PROFILE_H264_HIGH;
+	mCodecContext->thread_count = 2;
+	av_opt_set( mCodecContext->priv_data, "preset", "veryfast", 0 );
+	if ( mFormatContext->oformat->flags & AVFMT_GLOBALHEADER )
+	{
+		mCodecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+	if ( avcodec_open2( mCodecContext, codec, nullptr ) < 0 )
+	{
+		fprintf( stderr, "Could not open proxy video codec\n" );
+		return false;
+	}
+
+	mScaledFrame = AllocateVideoFrame( AV_PIX_FMT_YUV420P, width, height );
+	mStream = avformat_new_stream( mFormatContext, nullptr );
+	if ( !mScaledFrame || !mStream || avcodec_parameters_from_context( mStream->codecpar, mCodecContext ) < 0 )
+	{
+		fprintf( stderr, "Could not add the proxy stream\n" );
+		return false;
+	}
+	mStream->time_base = mTimeBase;
+
+	if ( !( mFormatContext->oformat->flags & AVFMT_NOFILE ) && avio_open( &mFormatContext->pb, mFormatContext->url, AVIO_FLAG_WRITE ) < 0 )
+	{
+		fprintf( stderr, "Could not open '%s'\n", mFormatContext->url );
+		return false;
+	}
+	int ret = avformat_write_header( mFormatContext, nullptr );
+	if ( ret < 0 )
+	{
+		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+		fprintf( stderr, "Failed to write proxy header '%s'\n", errorString );
+		return false;
+	}
+	return true;
+}
+
+void ProxyBranch::PrivateClass::Encode( AVFrame *frame )
+{
+	int ret = 0;
+	if ( frame )
+	{
+		// the shared picture is only read, the 4:2:0 result lands in the proxy's own frame
+		if ( !av_frame_is_writable( mScaledFrame ) && av_frame_make_writable( mScaledFrame ) < 0 )
+		{
+			return;
+		}
+		mSwScaleContext = sws_getCachedContext( mSwScaleContext,
+												frame->width, frame->height, ( AVPixelFormat )frame->format,
+												mScaledFrame->width, mScaledFrame->height, AV_PIX_FMT_YUV420P,
+												SWS_FAST_BILINEAR, nullptr, nullptr, nullptr );
+		if ( !mSwScaleContext )
+		{
+			fprintf( stderr, "Could not initialize the proxy conversion context\n" );
+			return;
+		}
+		sws_scale( mSwScaleContext, frame->data, frame->linesize, 0, frame->height, mScaledFrame->data, mScaledFrame->linesize );
+		mScaledFrame->pts = av_rescale_q( frame->pts, mSourceTimeBase, mTimeBase );
+		ret = avcodec_send_frame( mCodecContext, mScaledFrame );
+	}
+	else
+	{
+		ret = avcodec_send_frame( mCodecContext, nullptr );
+	}
+	if ( ret < 0 && ret != AVERROR_EOF )
+	{
+		fprintf( stderr, "Error sending proxy frame: %d\n", ret );
+		return;
+	}
+
+	AVPacket *packet = av_packet_alloc();
+	while ( avcodec_receive_packet( mCodecContext, packet ) == 0 )
+	{
+		packet->stream_index = mStream->index;
+		av_packet_rescale_ts( packet, mCodecContext->time_base, mStream->time_base );
+		// interleave write takes the packet's reference, the struct is reused for the next one
+		av_interleaved_write_frame( mFormatContext, packet );
+		mEncodedFrames++;
+	}
+	av_packet_free( &packet );
+}
+
+void ProxyBranch::PrivateClass::Close()
+{
+	if ( mFormatContext && mCodecContext && avcodec_is_open( mCodecContext ) && mStream )
+	{
+		Encode( nullptr );
+		if ( av_write_trailer( mFormatContext ) < 0 )
+		{
+			fprintf( stderr, "Error occured while writing trailer of %s\n", mFormatContext->url );
+		}
+	}
+	if ( mFormatContext && mFormatContext->pb && !( mFormatContext->oformat->flags & AVFMT_NOFILE ) )
+	{
+		avio_closep( &mFormatContext->pb );
+	}
+	avformat_free_context( mFormatContext );
+	mFormatContext = nullptr;
+	mStream = nullptr;
+	// x264 cannot be restarted after a flush, every take opens its own encoder
+	avcodec_free_context( &mCodecContext );
+	av_frame_free( &mScaledFrame );
+}
+
+void ProxyBranch::PrivateClass::ThreadFunction()
+{
+	// nice is per thread on Linux; encoder threads created below inherit it
+	pid_t tid = ( pid_t )syscall( SYS_gettid );
+	errno = 0;
+	int previousNice = getpriority( PRIO_PROCESS, tid );
+	bool reniced = errno == 0 && setpriority( PRIO_PROCESS, tid, 10 ) == 0;
+
+	bool ok = Open();
+	for ( ;; )
+	{
+		FrameHandle frame = mQueue.Pop();
+		if ( !frame )
+		{
+			break;
+		}
+		if ( ok )
+		{
+			Encode( frame.get() );
+		}
+		frame.reset();
+		if ( mBudget )
+		{
+			mBudget->Release( MemoryBudget::PoolProxy, mFrameBytes );
+		}
+	}
+	Close();
+
+	// the pool thread serves the master stages next
+	if ( reniced )
+	{
+		setpriority( PRIO_PROCESS, tid, previousNice );
+	}
+}
+
+///@endcond INTERNAL
+
+ProxyBranch::ProxyBranch( const Settings &settings )
+{
+	d = new ProxyBranch::PrivateClass( settings );
+}
+
+ProxyBranch::~ProxyBranch()
+{
+	WaitForFinished();
+	delete d;
+	d = nullptr;
+}
+
+void ProxyBranch::Init( int width, int height, int timeBaseNum, int timeBaseDen, MemoryBudget *budget, uint64_t frameBytes )
+{
+	d->mWidth = width;
+	d->mHeight = height;
+	d->mTimeBase = {timeBaseNum, timeBaseDen};
+	d->mBudget = budget;
+	d->mFrameBytes = frameBytes;
+	d->mFrameShells.Prefill( d->mSettings.queueDepth );
+}
+
+bool ProxyBranch::Start( const QString &outputFile, QThreadPool *pool, AVRational sourceTimeBase )
+{
+	if ( IsRunning() )
+	{
+		fprintf( stderr, "Proxy of the previous take is still being written\n" );
+		return false;
+	}
+	d->mOutputFile = outputFile;
+	d->mSourceTimeBase = sourceTimeBase;
+	d->mThread = QtConcurrent::run( pool, d, &ProxyBranch::PrivateClass::ThreadFunction );
+	return true;
+}
+
+void ProxyBranch::Offer( const AVFrame *frame )
+{
+	// single producer (the decoder or the encoder thread), so the depth cannot grow between the check and the push
+	if ( d->mQueue.Gauge().depth >= ( uint64_t )d->mSettings.queueDepth
+			|| ( d->mBudget && !d->mBudget->TryAcquire( MemoryBudget::PoolProxy, d->mFrameBytes ) ) )
+	{
+		d->mSkippedFrames++;
+		return;
+	}
+	FrameHandle shared = d->mFrameShells.Take();
+	if ( av_frame_ref( shared.get(), frame ) < 0 )
+	{
+		d->mSkippedFrames++;
+		if ( d->mBudget )
+		{
+			d->mBudget->Release( MemoryBudget::PoolProxy, d->mFrameBytes );
+		}
+		return;
+	}
+	d->mQueue.Push( std::move( shared ) );
+}
+
+void ProxyBranch::EndOfStream()
+{
+	d->mQueue.Push( FrameHandle() );
+}
+
+void ProxyBranch::WaitForFinished()
+{
+	d->mThread.waitForFinished();
+}
+
+bool ProxyBranch::IsRunning() const
+{
+	return d->mThread.isRunning();
+}
+
+uint64_t ProxyBranch::EncodedFrames() const
+{
+	return d->mEncodedFrames;
+}
+
+uint64_t ProxyBranch::SkippedFrames() const
+{
+	return d->mSkippedFrames;
+}
+
+QString ProxyBranch::FileName( const QString &masterFile )
+{
+	QFileInfo info( masterFile );
+	QString name = info.completeBaseName() + "_proxy." + info.suffix();
+	return info.path() == "." && !masterFile.startsWith( "./" ) ? name : info.path() + "/" + name;
+}
@@ -0,0 +1,58 @@
+#ifndef PROXYBRANCH_H
+#define PROXYBRANCH_H
+
+#include <stdint.h>
+#include <QString>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavutil/rational.h"
+}
+
+struct AVFrame;
+class MemoryBudget;
+class QThreadPool;
+
+// second rendition of a take: decoded pictures of the master are shared by reference, downscaled to 4:2:0 and
+// encoded to H.264 into a file of their own on a low priority thread. The branch never blocks the master, a
+// picture it has no room for is skipped.
+class ProxyBranch
+{
+public:
+	struct Settings
+	{
+		// proxy size is the master size divided by this
+		int divisor = 2;
+		int bitrateKbps = 8000;
+		// pictures waiting for the proxy encoder before further ones are skipped
+		int queueDepth = 8;
+	};
+
+	explicit ProxyBranch( const Settings &settings );
+	~ProxyBranch();
+
+	// master picture geometry and timing; the budget pool, when set, admits every shared picture
+	void Init( int width, int height, int timeBaseNum, int timeBaseDen, MemoryBudget *budget, uint64_t frameBytes );
+	// opens encoder and file of a take on a pool thread; the offered pictures carry timestamps in sourceTimeBase
+	bool Start( const QString &outputFile, QThreadPool *pool, AVRational sourceTimeBase );
+	// takes a new reference to the picture (no copy), or skips it when the branch is behind
+	void Offer( const AVFrame *frame );
+	// the branch drains what is queued and finishes the file on its own
+	void EndOfStream();
+	void WaitForFinished();
+	bool IsRunning() const;
+
+	uint64_t EncodedFrames() const;
+	uint64_t SkippedFrames() const;
+
+	// <base>_proxy.<ext> next to the master file
+	static QString FileName( const QString &masterFile );
+
+private:
+	ProxyBranch( const ProxyBranch & ) = delete;
+	ProxyBranch &operator=( const ProxyBranch & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // PROXYBRANCH_H
@@ -0,0 +1,414 @@
+#include "rawdiskwriter.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "alignedframeallocator.h"
+#include "emulator/displaymodes.h"
+#include "stagequeue.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+// a frame of the card, referenced until it is on disk
+struct RawFrame
+{
+	IDeckLinkVideoInputFrame *frame = nullptr;
+	int64_t pts = 0;
+	int64_t duration = 0;
+
+	RawFrame() {}
+	RawFrame( IDeckLinkVideoInputFrame *videoFrame, int64_t framePts, int64_t frameDuration )
+		: frame( videoFrame )
+		, pts( framePts )
+		, duration( frameDuration )
+	{
+	}
+	RawFrame( RawFrame &&other ) noexcept
+		: frame( other.frame )
+		, pts( other.pts )
+		, duration( other.duration )
+	{
+		other.frame = nullptr;
+	}
+	RawFrame &operator=( RawFrame &&other ) noexcept
+	{
+		if ( this != &other )
+		{
+			if ( frame )
+			{
+				frame->Release();
+			}
+			frame = other.frame;
+			pts = other.pts;
+			duration = other.duration;
+			other.frame = nullptr;
+		}
+		return *this;
+	}
+	~RawFrame()
+	{
+		if ( frame )
+		{
+			frame->Release();
+		}
+	}
+	explicit operator bool() const
+	{
+		return frame != nullptr;
+	}
+
+	RawFrame( const RawFrame & ) = delete;
+	RawFrame &operator=( const RawFrame & ) = delete;
+};
+
+}
+
+class RawDiskWriter::PrivateClass
+{
+public:
+	Settings mSettings;
+	int mWidth = 0;
+	int mHeight = 0;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+	long mRowBytes = 0;
+	uint64_t mFrameBytes = 0;
+	// a frame padded to whole pages, the unit of every write and offset
+	uint64_t mSlotBytes = 0;
+	int mTimeBaseNum = 1;
+	int mTimeBaseDen = 1;
+
+	AlignedFrameAllocator *mAllocator = nullptr;
+	StageQueue<RawFrame> mQueue;
+
+	// take, touched by the writer thread only once it runs
+	int mFd = -1;
+	bool mPreallocate = true;
+	bool mFailed = false;
+	FILE *mIndex = nullptr;
+	uint64_t mOffset = 0;
+	uint64_t mReservedEnd = 0;
+	int64_t mFrameNumber = 0;
+
+	// reused for every batch
+	std::vector<RawFrame> mBatch;
+	std::vector<struct iovec> mIov;
+	// page aligned copy of a frame the card did not deliver in a buffer of the allocator
+	uint8_t *mBounce = nullptr;
+
+	std::atomic<uint64_t> mWritten;
+	std::atomic<uint64_t> mCopied;
+	std::atomic<uint64_t> mDropped;
+
+	PrivateClass( const Settings &settings )
+		: mSettings( settings )
+	{
+		mWritten = 0;
+		mCopied = 0;
+		mDropped = 0;
+		mSettings.queueDepth = qMax( 1, mSettings.queueDepth );
+		mSettings.batchFrames = qBound( 1, mSettings.batchFrames, mSettings.queueDepth );
+		mAllocator = new AlignedFrameAllocator();
+	}
+	~PrivateClass()
+	{
+		Close();
+		free( mBounce );
+		mAllocator->Release();
+	}
+
+	void Reserve( uint64_t end );
+	bool WriteFully( uint64_t offset, uint64_t bytes );
+	void WriteBatch( const std::function<void( int64_t, int64_t, uint64_t )> &written );
+	void Close();
+};
+
+void RawDiskWriter::PrivateClass::Reserve( uint64_t end )
+{
+	if ( !mPreallocate || end <= mReservedEnd )
+	{
+		return;
+	}
+	uint64_t reserveEnd = end + mSettings.preallocateBytes;
+	// the size stays at the written end, the blocks beyond it are returned when the take is closed
+	if ( fallocate( mFd, FALLOC_FL_KEEP_SIZE, mReservedEnd, reserveEnd - mReservedEnd ) == 0 )
+	{
+		mReservedEnd = reserveEnd;
+	}
+	else
+	{
+		// not supported by the file system, the writes allocate as they go
+		mPreallocate = false;
+	}
+}
+
+bool RawDiskWriter::PrivateClass::WriteFully( uint64_t offset, uint64_t bytes )
+{
+	struct iovec *iov = mIov.data();
+	int count = ( int )mIov.size();
+	while ( bytes > 0 )
+	{
+		ssize_t done = pwritev( mFd, iov, qMin( count, IOV_MAX ), offset );
+		if ( done < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if ( done <= 0 )
+		{
+			fprintf( stderr, "Raw frame write at %lu failed: %s\n", offset, done < 0 ? strerror( errno ) : "no space" );
+			return false;
+		}
+		offset += done;
+		bytes -= done;
+		// a short write goes on behind its last byte, with O_DIRECT that is always a block boundary
+		while ( count > 0 && ( size_t )done >= iov->iov_len )
+		{
+			done -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if ( count > 0 )
+		{
+			iov->iov_base = ( uint8_t * )iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return true;
+}
+
+void RawDiskWriter::PrivateClass::WriteBatch( const std::function<void( int64_t, int64_t, uint64_t )> &written )
+{
+	if ( mFailed )
+	{
+		// the disk is gone or full, the frames go back to the card
+		mDropped += mBatch.size();
+		mBatch.clear();
+		return;
+	}
+
+	mIov.clear();
+	for ( size_t i = 0; i < mBatch.size(); i++ )
+	{
+		void *bytes = nullptr;
+		mBatch[i].frame->GetBytes( &bytes );
+		// a whole slot may be read from the card's buffer when it is ours, or when the frame needs no padding
+		bool direct = ( ( uintptr_t )bytes % AlignedFrameAllocator::PageBytes ) == 0
+					  && ( mFrameBytes == mSlotBytes || mAllocator->ReadableBytes( bytes ) >= mSlotBytes );
+		if ( !direct )
+		{
+			uint8_t *bounce = mBounce + i * mSlotBytes;
+			memcpy( bounce, bytes, mFrameBytes );
+			bytes = bounce;
+			mCopied++;
+		}
+		mIov.push_back( { bytes, ( size_t )mSlotBytes } );
+	}
+
+	uint64_t batchBytes = mBatch.size() * mSlotBytes;
+	Reserve( mOffset + batchBytes );
+	if ( !WriteFully( mOffset, batchBytes ) )
+	{
+		mFailed = true;
+		mDropped += mBatch.size();
+		mBatch.clear();
+		return;
+	}
+	for ( const RawFrame &frame : mBatch )
+	{
+		fprintf( mIndex, "%ld %ld %lu\n", mFrameNumber++, frame.pts, mOffset );
+		mOffset += mSlotBytes;
+		mWritten++;
+		written( frame.pts, frame.duration, mFrameBytes );
+	}
+	// the buffers return to the card
+	mBatch.clear();
+}
+
+void RawDiskWriter::PrivateClass::Close()
+{
+	if ( mFd >= 0 )
+	{
+		// the reservation beyond the last frame is given back, the data is on disk before the take counts as finished
+		if ( ftruncate( mFd, mOffset ) < 0 || fdatasync( mFd ) < 0 )
+		{
+			fprintf( stderr, "Could not finish raw file: %s\n", strerror( errno ) );
+		}
+		close( mFd );
+		mFd = -1;
+	}
+	if ( mIndex )
+	{
+		fclose( mIndex );
+		mIndex = nullptr;
+	}
+}
+
+///@endcond INTERNAL
+
+RawDiskWriter::RawDiskWriter( const Settings &settings )
+{
+	d = new RawDiskWriter::PrivateClass( settings );
+}
+
+RawDiskWriter::~RawDiskWriter()
+{
+	delete d;
+	d = nullptr;
+}
+
+bool RawDiskWriter::Init( int width, int height, BMDPixelFormat pixelFormat, int timeBaseNum, int timeBaseDen )
+{
+	if ( pixelFormat != bmdFormat8BitYUV && pixelFormat != bmdFormat10BitYUV )
+	{
+		fprintf( stderr, "Raw recording supports UYVY and v210 only\n" );
+		return false;
+	}
+	d->mWidth = width;
+	d->mHeight = height;
+	d->mPixelFormat = pixelFormat;
+	d->mRowBytes = RowBytesFor( width, pixelFormat );
+	d->mFrameBytes = ( uint64_t )d->mRowBytes * height;
+	d->mSlotBytes = AlignedFrameAllocator::PageAligned( d->mFrameBytes );
+	d->mTimeBaseNum = timeBaseNum;
+	d->mTimeBaseDen = timeBaseDen;
+
+	free( d->mBounce );
+	d->mBounce = nullptr;
+	if ( posix_memalign( ( void ** )&d->mBounce, AlignedFrameAllocator::PageBytes, d->mSettings.batchFrames * d->mSlotBytes ) != 0 )
+	{
+		fprintf( stderr, "Could not allocate raw bounce buffer\n" );
+		return false;
+	}
+	// the padding of a slot is written as zeros
+	memset( d->mBounce, 0, d->mSettings.batchFrames * d->mSlotBytes );
+	d->mBatch.reserve( d->mSettings.batchFrames );
+	d->mIov.reserve( d->mSettings.batchFrames );
+	return true;
+}
+
+IDeckLinkMemoryAllocator *RawDiskWriter::Allocator() const
+{
+	return d->mAllocator;
+}
+
+bool RawDiskWriter::Open( const QString &file )
+{
+	d->Close();
+	d->mFd = open( qUtf8Printable( file ), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644 );
+	if ( d->mFd < 0 && errno == EINVAL )
+	{
+		// tmpfs and some network file systems have no direct I/O
+		fprintf( stderr, "%s does not support O_DIRECT, writing through the page cache\n", qUtf8Printable( file ) );
+		d->mFd = open( qUtf8Printable( file ), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	}
+	if ( d->mFd < 0 )
+	{
+		fprintf( stderr, "Could not open '%s': %s\n", qUtf8Printable( file ), strerror( errno ) );
+		return false;
+	}
+	d->mIndex = fopen( qUtf8Printable( IndexFileName( file ) ), "w" );
+	if ( !d->mIndex )
+	{
+		fprintf( stderr, "Could not open '%s': %s\n", qUtf8Printable( IndexFileName( file ) ), strerror( errno ) );
+		d->Close();
+		return false;
+	}
+	fprintf( d->mIndex, "# raw video, every frame at the start of a slot of slot_bytes\n" );
+	fprintf( d->mIndex, "format %s\n", d->mPixelFormat == bmdFormat10BitYUV ? "v210" : "uyvy" );
+	fprintf( d->mIndex, "width %d\nheight %d\nrow_bytes %ld\n", d->mWidth, d->mHeight, d->mRowBytes );
+	fprintf( d->mIndex, "frame_bytes %lu\nslot_bytes %lu\n", d->mFrameBytes, d->mSlotBytes );
+	fprintf( d->mIndex, "time_base %d/%d\n", d->mTimeBaseNum, d->mTimeBaseDen );
+	fprintf( d->mIndex, "# frame pts offset\n" );
+
+	d->mOffset = 0;
+	d->mReservedEnd = 0;
+	d->mPreallocate = d->mSettings.preallocateBytes > 0;
+	d->mFailed = false;
+	d->mFrameNumber = 0;
+	return true;
+}
+
+bool RawDiskWriter::Offer( IDeckLinkVideoInputFrame *frame, int64_t pts, int64_t duration )
+{
+	// single producer (the capture callback), so the depth cannot grow between the check and the push
+	if ( d->mQueue.Gauge().depth >= ( uint64_t )d->mSettings.queueDepth
+			|| ( uint64_t )frame->GetRowBytes() * frame->GetHeight() != d->mFrameBytes )
+	{
+		d->mDropped++;
+		return false;
+	}
+	frame->AddRef();
+	d->mQueue.Push( RawFrame( frame, pts, duration ) );
+	return true;
+}
+
+void RawDiskWriter::EndOfStream()
+{
+	d->mQueue.Push( RawFrame() );
+}
+
+void RawDiskWriter::Run( const std::function<void( int64_t pts, int64_t duration, uint64_t bytes )> &written )
+{
+	bool end = false;
+	while ( !end )
+	{
+		RawFrame frame = d->mQueue.Pop();
+		if ( !frame )
+		{
+			break;
+		}
+		d->mBatch.push_back( std::move( frame ) );
+		// frames that queued up meanwhile go along in the same call
+		while ( ( int )d->mBatch.size() < d->mSettings.batchFrames )
+		{
+			RawFrame next;
+			if ( !d->mQueue.TryPop( next ) )
+			{
+				break;
+			}
+			if ( !next )
+			{
+				end = true;
+				break;
+			}
+			d->mBatch.push_back( std::move( next ) );
+		}
+		d->WriteBatch( written );
+	}
+	d->Close();
+}
+
+uint64_t RawDiskWriter::QueuedFrames() const
+{
+	return d->mQueue.Gauge().depth;
+}
+
+uint64_t RawDiskWriter::WrittenFrames() const
+{
+	return d->mWritten;
+}
+
+uint64_t RawDiskWriter::CopiedFrames() const
+{
+	return d->mCopied;
+}
+
+uint64_t RawDiskWriter::DroppedFrames() const
+{
+	return d->mDropped;
+}
+
+QString RawDiskWriter::IndexFileName( const QString &file )
+{
+	return file + ".idx";
+}
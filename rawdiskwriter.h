@@ -0,0 +1,59 @@
+#ifndef RAWDISKWRITER_H
+#define RAWDISKWRITER_H
+
+#include <functional>
+#include <stdint.h>
+#include <QString>
+
+#include "decklink/DeckLinkAPI.h"
+
+// uncompressed takes straight from the capture buffers: every frame is written as the card delivered it (UYVY
+// or v210) into its own page aligned slot of a raw file opened with O_DIRECT, so neither a copy, decoder,
+// conversion, encoder nor the page cache is involved. A frame stays referenced at the card until it is on disk;
+// when more than the queue depth are waiting the new frame is dropped. The sidecar <file>.idx lists the format
+// and the pts and byte offset of every frame.
+class RawDiskWriter
+{
+public:
+	struct Settings
+	{
+		// frames held back from the card at once
+		int queueDepth = 8;
+		// frames queued behind each other go to disk in one pwritev
+		int batchFrames = 4;
+		// the file is reserved this far ahead of the written end, so extending it does not stall a write
+		uint64_t preallocateBytes = 1ull << 30;
+	};
+
+	explicit RawDiskWriter( const Settings &settings );
+	~RawDiskWriter();
+
+	// capture geometry, and the time base of the timestamps handed to Offer
+	bool Init( int width, int height, BMDPixelFormat pixelFormat, int timeBaseNum, int timeBaseDen );
+	// capture buffers the writer can pass to disk without a copy; hand it to the input before it is enabled
+	IDeckLinkMemoryAllocator *Allocator() const;
+
+	bool Open( const QString &file );
+	// capture callback: takes a reference to the frame, false when it was dropped
+	bool Offer( IDeckLinkVideoInputFrame *frame, int64_t pts, int64_t duration );
+	void EndOfStream();
+	// writes the queued frames until the end of stream and closes the take; written is called for every frame on disk
+	void Run( const std::function<void( int64_t pts, int64_t duration, uint64_t bytes )> &written );
+
+	uint64_t QueuedFrames() const;
+	uint64_t WrittenFrames() const;
+	// frames that were not in a buffer of the allocator and went through a bounce buffer
+	uint64_t CopiedFrames() const;
+	uint64_t DroppedFrames() const;
+
+	static QString IndexFileName( const QString &file );
+
+private:
+	RawDiskWriter( const RawDiskWriter & ) = delete;
+	RawDiskWriter &operator=( const RawDiskWriter & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // RAWDISKWRITER_H
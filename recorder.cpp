@@ -1,103 +1,18 @@
 #include "recorder.h"
+#include "recorder_p.h"
 
-#include <stdio.h>
-#include <QQueue>
-#include <QThreadPool>
-#include <QFuture>
-#include <QtConcurrent/QtConcurrent>
-
-extern "C" {
-#include "deps/ffmpeg/include/libavformat/avformat.h"
-#include "deps/ffmpeg/include/libavcodec/avcodec.h"
-#include "deps/ffmpeg/include/libavcodec/codec.h"
-#include "deps/ffmpeg/include/libavcodec/packet.h"
-#include "deps/ffmpeg/include/libavutil/avutil.h"
-#include "deps/ffmpeg/include/libavutil/frame.h"
-#include "deps/ffmpeg/include/libavutil/samplefmt.h"
-#include "deps/ffmpeg/include/libavutil/opt.h"
-#include "deps/ffmpeg/include/libavutil/imgutils.h"
-#include "deps/ffmpeg/include/libswscale/swscale.h"
-}
+#include <algorithm>
+#include <vector>
+#include <QSemaphore>
 
+#include "emulator/displaymodes.h"
+#include "faultinjector.h"
 #include "ffmpegutils.h"
+#include "recorderstats.h"
+#include "startupprofile.h"
 
 ///@cond INTERNAL
 
-static const char *VIDEO_OUTPUT_FILE = "/tmp/testing.mov";
-
-#define __RECORD_WITH_PRORES__ 1
-#define __RECORD_WITH_X264__ 0
-#define __BMD_TO_AVFRAME__ 0
-#define __BMD_TO_PACKET__ 1
-
-class Recorder::PrivateClass
-{
-public:
-	uint64_t mFrameCount = 0;
-
-	uint16_t mVideoWidth = 1920;
-	uint16_t mVideoHeight = 1080;
-	AVCodecID mInputVideoCodec = AV_CODEC_ID_RAWVIDEO;
-	AVPixelFormat mInputPixelFormat = AV_PIX_FMT_UYVY422;
-#if __RECORD_WITH_PRORES__
-	AVPixelFormat mPixelFormat = AV_PIX_FMT_YUV422P10LE;
-	AVCodecID mVideoCodec = AV_CODEC_ID_PRORES;
-#elif __RECORD_WITH_X264__
-	AVPixelFormat mPixelFormat = AV_PIX_FMT_YUV420P;
-	AVCodecID mVideoCodec = AV_CODEC_ID_H264;
-#endif
-	AVCodecID mAudioCodec = AV_CODEC_ID_PCM_S16LE;
-	AVRational mTimeBase = {1, 1};
-
-	const AVOutputFormat *mOutputFormat = nullptr;
-	AVFormatContext *mFormatContext = nullptr;
-	AVStream *mAudioStream = nullptr;
-	AVStream *mVideoStream = nullptr;
-	AVCodecContext *mVideoDecodingContext = nullptr;
-	AVCodecContext *mAudioCodecContext = nullptr;
-	AVCodecContext *mVideoCodecContext = nullptr;
-	AVFrame *mVideoEncodingFrame = nullptr;
-	SwsContext *mSwScaleContext = nullptr;
-
-	std::atomic_bool mCaptureActive;
-	QThreadPool mThreadPool;
-	QFuture<void> mDecodingThread;
-	QFuture<void> mEncodingThread;
-	QFuture<void> mFileWritingThread;
-
-	QMutex mDecodePacketQueueMutex;
-	QQueue<AVPacket *> mDecodePacketQueue;
-	QMutex mFrameQueueMutex;
-	QQueue<AVFrame *> mFrameQueue;
-	QMutex mPacketQueueMutex;
-	QQueue<AVPacket *> mPacketQueue;
-
-	Recorder *mOwner;
-	PrivateClass( Recorder *recorder )
-	{
-		mCaptureActive = false;
-		mOwner = recorder;
-	}
-
-	void HandleVideoFrame( IDeckLinkVideoInputFrame *videoFrame );
-	void HandleAudioFrame( IDeckLinkAudioInputPacket *audioFrame );
-	void FillVideoFrame( AVFrame *src );
-
-	bool InitVideoDecoder( AVCodecID inputCodecID, AVPixelFormat inputPixelFormat );
-	bool AddAudioStream( AVCodecID codec_id );
-	bool AddVideoStream( AVCodecID codec_id );
-	bool DecodeAndEnqueue( AVPacket *pkt );
-	bool EncodeAndEnqueueFrame( AVFrame *frame );
-	void Flush( AVCodecContext *codecContext, int streamIndex );
-	int InterleaveFrameIntoFile( AVPacket *packet );
-	void DecodingThreadFunction();
-	void EncodingThreadFunction();
-	void PacketWritingThreadFunction();
-
-	bool ShouldEncoderKeepRunning() const;
-	bool ShouldWriterKeepRunning() const;
-};
-
 void Recorder::PrivateClass::HandleVideoFrame( IDeckLinkVideoInputFrame *videoFrame )
 {
 	if ( !videoFrame )
@@ -110,15 +25,33 @@ void Recorder::PrivateClass::HandleVideoFrame( IDeckLinkVideoInputFrame *videoFr
 		fprintf( stdout, "Frame received (#%lu) - No input signal detected\n", mFrameCount );
 		return;
 	}
-	else
+	else if ( mSettings.logFrames )
 	{
 		fprintf( stdout, "Frame received (#%lu)\n", mFrameCount );
 	}
 
+	uint64_t arrivalNs = MonotonicNs();
+	StageProfiler::Scope profile( &mProfiler, StageProfiler::StageCapture );
+
 	// get frame timing info (PTS & duration)
+	AVRational timeBase = mCaptureTimeBase;
 	BMDTimeValue frameTime;
 	BMDTimeValue frameDuration;
-	videoFrame->GetStreamTime( &frameTime, &frameDuration, mVideoStream->time_base.den );
+	videoFrame->GetStreamTime( &frameTime, &frameDuration, timeBase.den );
+	int64_t pts = frameTime / timeBase.num;
+	if ( mTakeStartPts == AV_NOPTS_VALUE )
+	{
+		mTakeStartPts = pts;
+	}
+	pts -= mTakeStartPts;
+	if ( mLastCapturePts != AV_NOPTS_VALUE && frameDuration > 0 && pts > mLastCapturePts + frameDuration )
+	{
+		mDroppedFrames += ( pts - mLastCapturePts ) / frameDuration - 1;
+	}
+	mLastCapturePts = pts;
+	mCaptureTimes[( uint64_t )FrameId( pts, frameDuration ) % CaptureTimeSlots].store( arrivalNs, std::memory_order_relaxed );
+
+	Tracer::Scope trace( &mTracer, Tracer::SpanCallback, FrameId( pts, frameDuration ), pts );
 
 	// get frame size & data
 	long height = videoFrame->GetHeight();
@@ -128,6 +61,18 @@ void Recorder::PrivateClass::HandleVideoFrame( IDeckLinkVideoInputFrame *videoFr
 	void *frameBytes = nullptr;
 	videoFrame->GetBytes( &frameBytes );
 
+	if ( mRawWriter )
+	{
+		// the card's buffer itself is queued for the disk and goes back to the card once written; under the queue
+		// lock like a captured packet, so nothing is queued behind the end of stream
+		QMutexLocker locker( &mDecodePacketQueue.Mutex() );
+		if ( mCaptureActive )
+		{
+			mRawWriter->Offer( videoFrame, pts, frameDuration );
+		}
+		return;
+	}
+
 #if __BMD_TO_AVFRAME__
 	AVFrame *frame = AllocateVideoFrame( AV_PIX_FMT_UYVY422, width, height );
 	int ret = av_image_fill_arrays( frame->data, frame->linesize, ( const uint8_t * ) frameBytes, ( AVPixelFormat )frame->format, width, height, 32 );
@@ -138,30 +83,77 @@ void Recorder::PrivateClass::HandleVideoFrame( IDeckLinkVideoInputFrame *videoFr
 		fprintf( stderr, "Failed to fill frame arrays (%s)\n", errorString );
 	}
 
-	frame->pts = frame->pkt_dts = frameTime / mVideoStream->time_base.num;
+	frame->pts = frame->pkt_dts = pts;
 	frame->pkt_duration = frameDuration;
 
 	//fprintf( stdout, "Enqueue frame (%p), pts: %ld, duration %ld\n", ( void * )frame, frame->pts, frame->pkt_duration );
-	mFrameQueueMutex.lock();
-	mFrameQueue.enqueue( frame );
-	mFrameQueueMutex.unlock();
+	mFrameQueue.Push( FrameHandle( frame ) );
 #elif __BMD_TO_PACKET__
-	AVPacket *pkt = av_packet_alloc();
-	// set data info
-	av_new_packet( pkt, videoFrame->GetRowBytes() * videoFrame->GetHeight() );
-	memcpy( pkt->data, ( uint8_t * )frameBytes, pkt->size );
+	// the callback must not block, a frame the capture pool has no room for is dropped before anything is allocated
+	int packetSize = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+	if ( !mMemoryBudget.TryAcquire( MemoryBudget::PoolCapture, packetSize ) )
+	{
+		mBudgetDroppedFrames++;
+		TrackBacklog( arrivalNs );
+		return;
+	}
+	PacketHandle pkt = mPacketShells.Take();
+	{
+		Tracer::Scope trace( &mTracer, Tracer::SpanPacketCopy, FrameId( pts, frameDuration ), pts );
+		// set data info
+		if ( mCaptureBufferPool && ( uint64_t )packetSize == mCaptureFrameBytes )
+		{
+			pkt->buf = av_buffer_pool_get( mCaptureBufferPool );
+		}
+		if ( pkt->buf )
+		{
+			pkt->data = pkt->buf->data;
+			pkt->size = packetSize;
+		}
+		else
+		{
+			av_new_packet( pkt.get(), packetSize );
+		}
+		memcpy( pkt->data, ( uint8_t * )frameBytes, pkt->size );
+	}
 	// set timing
-	pkt->dts = pkt->pts = frameTime / mVideoStream->time_base.num;
+	pkt->dts = pkt->pts = pts;
 	pkt->duration = frameDuration;
 	// other packet settings
 	pkt->flags |= AV_PKT_FLAG_KEY;
-	pkt->stream_index = mVideoStream->index;
+	pkt->stream_index = mCaptureStreamIndex;
 
 	//fprintf(stdout, "Enqueue packet %p with dts %ld, pts %ld duration %ld\n", (void*)pkt, pkt->dts, pkt->pts, pkt->duration);
-	mDecodePacketQueueMutex.lock();
-	mDecodePacketQueue.enqueue( pkt );
-	mDecodePacketQueueMutex.unlock();
+	{
+		QMutexLocker locker( &mDecodePacketQueue.Mutex() );
+		if ( mCaptureActive )
+		{
+			mDecodePacketQueue.PushLocked( std::move( pkt ) );
+		}
+		else
+		{
+			// capture ended while the frame was copied, the end of stream is already queued; pkt goes back to its pool
+			mMemoryBudget.Release( MemoryBudget::PoolCapture, packetSize );
+		}
+	}
 #endif
+
+	TrackBacklog( arrivalNs );
+}
+
+void Recorder::PrivateClass::TrackBacklog( uint64_t nowNs )
+{
+	uint64_t inFlight = mDecodePacketQueue.Gauge().depth + mFrameQueue.Gauge().depth + mPacketQueue.Gauge().depth;
+	if ( mBacklogStartNs == 0 && inFlight > ( uint64_t )mSettings.backlogThreshold )
+	{
+		mBacklogStartNs = nowNs;
+		mBacklogEpisodes++;
+	}
+	else if ( mBacklogStartNs != 0 && inFlight <= ( uint64_t )mSettings.backlogThreshold )
+	{
+		mBacklogRecovery.Add( nowNs - mBacklogStartNs );
+		mBacklogStartNs = 0;
+	}
 }
 
 void Recorder::PrivateClass::HandleAudioFrame( IDeckLinkAudioInputPacket */*audioFrame*/ )
@@ -181,6 +173,12 @@ void Recorder::PrivateClass::FillVideoFrame( AVFrame *src )
 		return;
 	}
 
+	// a frame threaded encoder may still reference the previous picture, it must not be overwritten in place
+	if ( !av_frame_is_writable( mVideoEncodingFrame ) && !AcquireEncodingPicture() )
+	{
+		return;
+	}
+
 	/* as we get AV_PIX_FMT_UYVY422 picture, we must convert it to the codec pixel format if needed */
 	mSwScaleContext = sws_getCachedContext( mSwScaleContext,
 											src->width, src->height, ( AVPixelFormat )src->format,
@@ -201,10 +199,70 @@ void Recorder::PrivateClass::FillVideoFrame( AVFrame *src )
 		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
 		fprintf( stderr, "Failed to convert frame. sws_scale error: %s'n", errorString );
 	}
+	else if ( mPyramid )
+	{
+		// the smaller renditions are made from the converted picture while it is still warm
+		mPyramid->Process( mVideoEncodingFrame, src->pts, src->pkt_duration );
+	}
 
 	av_frame_copy_props( mVideoEncodingFrame, src );
 }
 
+bool Recorder::PrivateClass::InitEncodingPools()
+{
+	// the first picture has the layout av_frame_get_buffer chose, the pooled ones repeat it
+	ptrdiff_t lineSizes[4] = {};
+	size_t planeSizes[4] = {};
+	for ( int plane = 0; plane < 4; plane++ )
+	{
+		lineSizes[plane] = mVideoEncodingFrame->linesize[plane];
+	}
+	if ( av_image_fill_plane_sizes( planeSizes, ( AVPixelFormat )mVideoEncodingFrame->format, mVideoEncodingFrame->height, lineSizes ) < 0 )
+	{
+		fprintf( stderr, "Could not size the encoding picture planes\n" );
+		return false;
+	}
+	for ( int plane = 0; plane < 4 && planeSizes[plane] > 0; plane++ )
+	{
+		av_buffer_pool_uninit( &mEncodingPools[plane] );
+		mEncodingPools[plane] = av_buffer_pool_init( planeSizes[plane] + AV_INPUT_BUFFER_PADDING_SIZE, nullptr );
+		if ( !mEncodingPools[plane] )
+		{
+			fprintf( stderr, "Could not allocate encoding picture pool\n" );
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Recorder::PrivateClass::AcquireEncodingPicture()
+{
+	AVFrame *frame = mVideoEncodingFrame;
+	AVPixelFormat format = ( AVPixelFormat )frame->format;
+	int width = frame->width;
+	int height = frame->height;
+	int lineSizes[4] = {};
+	memcpy( lineSizes, frame->linesize, sizeof( lineSizes ) );
+	// the previous picture stays with the encoder until it has coded it, then returns to its pool
+	av_frame_unref( frame );
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	for ( int plane = 0; plane < 4 && mEncodingPools[plane]; plane++ )
+	{
+		frame->buf[plane] = av_buffer_pool_get( mEncodingPools[plane] );
+		if ( !frame->buf[plane] )
+		{
+			fprintf( stderr, "Could not allocate encoding frame data\n" );
+			av_frame_unref( frame );
+			return false;
+		}
+		frame->data[plane] = frame->buf[plane]->data;
+		frame->linesize[plane] = lineSizes[plane];
+	}
+	return true;
+}
+
 bool Recorder::PrivateClass::InitVideoDecoder( AVCodecID inputCodecId, AVPixelFormat inputPixelFormat )
 {
 	const AVCodec *codec = avcodec_find_decoder( inputCodecId );
@@ -242,7 +300,7 @@ bool Recorder::PrivateClass::InitVideoDecoder( AVCodecID inputCodecId, AVPixelFo
 	return true;
 }
 
-bool Recorder::PrivateClass::AddAudioStream( AVCodecID codec_id )
+bool Recorder::PrivateClass::OpenAudioEncoder( AVCodecID codec_id )
 {
 	const AVCodec *codec = avcodec_find_encoder( codec_id );
 	if ( !codec )
@@ -265,41 +323,26 @@ bool Recorder::PrivateClass::AddAudioStream( AVCodecID codec_id )
 	mAudioCodecContext->sample_rate = 48000;
 	mAudioCodecContext->channels = 2;
 	// some formats want stream headers to be separate
-	if ( mFormatContext->oformat->flags & AVFMT_GLOBALHEADER )
+	if ( mOutputFormat->flags & AVFMT_GLOBALHEADER )
 	{
 		mAudioCodecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 	}
 
-	mAudioStream = avformat_new_stream( mFormatContext, NULL );
-	if ( !mAudioStream )
-	{
-		fprintf( stderr, "Could not alloc audio stream\n" );
-		return false;
-	}
-	mAudioStream->id = mFormatContext->nb_streams - 1;
-
 	if ( avcodec_open2( mAudioCodecContext, codec, NULL ) < 0 )
 	{
 		fprintf( stderr, "could not open audio codec\n" );
 		return false;
 	}
 
-	int ret = avcodec_parameters_from_context( mAudioStream->codecpar, mAudioCodecContext );
-	if ( ret < 0 )
-	{
-		fprintf( stderr, "Could not copy the audio stream parameters\n" );
-		return false;
-	}
-
 	return true;
 }
 
-bool Recorder::PrivateClass::AddVideoStream( AVCodecID codec_id )
+bool Recorder::PrivateClass::OpenVideoEncoder( AVCodecID codec_id )
 {
 	const AVCodec *codec = avcodec_find_encoder( codec_id );
 	if ( !codec )
 	{
-		fprintf( stderr, "Video codec not found\n" );
+		fprintf( stderr, "Video codec %s not found\n", avcodec_get_name( codec_id ) );
 		return false;
 	}
 
@@ -317,38 +360,24 @@ bool Recorder::PrivateClass::AddVideoStream( AVCodecID codec_id )
 	mVideoCodecContext->height = mVideoHeight;
 	mVideoCodecContext->time_base = mTimeBase;
 	mVideoCodecContext->pix_fmt = mPixelFormat;
-
-	if ( mVideoCodecContext->codec_id == AV_CODEC_ID_PRORES )
-	{
-		mVideoCodecContext->profile            = FF_PROFILE_PRORES_LT;
-	}
-	else if ( mVideoCodecContext->codec_id == AV_CODEC_ID_H264 )
-	{
-		mVideoCodecContext->gop_size           = 1;
-		mVideoCodecContext->keyint_min         = 1;
-		mVideoCodecContext->profile            = FF_PROFILE_H264_HIGH;
-	}
-	if ( mVideoCodecContext->codec_id == AV_CODEC_ID_PRORES )
-	{
-		av_opt_set( mVideoCodecContext->priv_data, "profile", qUtf8Printable( QString::number( mVideoCodecContext->profile ) ), 0 );
-	}
 	mVideoCodecContext->thread_type = FF_THREAD_FRAME;
 	mVideoCodecContext->thread_count = 4;
+	// profile, GOP and threading of the codec
+	mBackend->Configure( mVideoCodecContext, mSettings );
 
 	// some formats want stream headers to be separate
-	if ( mFormatContext->oformat->flags & AVFMT_GLOBALHEADER )
+	if ( mOutputFormat->flags & AVFMT_GLOBALHEADER )
 	{
 		mVideoCodecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 	}
 
-	// create stream
-	mVideoStream = avformat_new_stream( mFormatContext, NULL );
-	if ( !mVideoStream )
+	if ( mNativeEncoder )
 	{
-		fprintf( stderr, "Could not alloc video stream\n" );
-		return false;
+		// the pictures never reach the context, it only describes the stream to the muxer
+		return true;
 	}
-	mVideoStream->id = mFormatContext->nb_streams - 1;
+	// encoders without AV_CODEC_CAP_DR1 keep allocating their packets themselves
+	mPacketBuffers.Attach( mVideoCodecContext );
 
 	// open the codec
 	if ( avcodec_open2( mVideoCodecContext, codec, nullptr /*dict*/ ) < 0 )
@@ -357,325 +386,965 @@ bool Recorder::PrivateClass::AddVideoStream( AVCodecID codec_id )
 		return false;
 	}
 
-	// copy codec params to stream
-	int ret = avcodec_parameters_from_context( mVideoStream->codecpar, mVideoCodecContext );
-	if ( ret < 0 )
-	{
-		fprintf( stderr, "Could not copy the video stream parameters\n" );
-		return false;
-	}
-
-	// allocate frame for encoding
-	mVideoEncodingFrame = AllocateVideoFrame( mPixelFormat, mVideoWidth, mVideoHeight );
-
 	return true;
 }
 
-bool Recorder::PrivateClass::DecodeAndEnqueue( AVPacket *pkt )
+bool Recorder::PrivateClass::ResetEncoders()
 {
-	//fprintf(stdout, "Decoding packet %p with dts %ld, pts %ld\n", (void*)pkt, pkt->dts, pkt->pts);
-	int ret = avcodec_send_packet( mVideoDecodingContext, av_packet_clone( pkt ) );
-	if ( ret < 0 )
+	// flushing leaves an encoder at end of stream, the next take needs it back at the start
+	bool ok = true;
+	if ( mNativeEncoder )
 	{
-		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-		fprintf( stderr, "Error send packet for decoding: %s\n", errorString );
-		return false;
+		// holds nothing back between pictures
 	}
-
-	AVFrame *frame = av_frame_alloc();
-	while ( ret >= 0 )
+	else if ( mVideoCodecContext->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH )
 	{
-		ret = avcodec_receive_frame( mVideoDecodingContext, frame );
-		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
-		{
-			av_frame_free( &frame );
-			return true;
-		}
-		else if ( ret < 0 )
-		{
-			char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-			av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-			fprintf( stderr, "Error during decoding: %s\n", errorString );
-			av_frame_free( &frame );
-			return false;
-		}
-
-		//fprintf(stdout, "Decoded frame pts %ld dts %ld width %d height %d\n", frame->pts, frame->pkt_dts, frame->width, frame->height);
-		mFrameQueueMutex.lock();
-		mFrameQueue.enqueue( av_frame_clone( frame ) );
-		mFrameQueueMutex.unlock();
+		avcodec_flush_buffers( mVideoCodecContext );
 	}
-
-	// maybe this is missing
-	// if (ret == AVERROR_EOF) {
-	// 	avcodec_flush_buffers( mVideoDecodingContext );
-	// }
-
-	return true;
+	else
+	{
+		avcodec_free_context( &mVideoCodecContext );
+		ok &= OpenVideoEncoder( mVideoCodec );
+	}
+	if ( mAudioCodecContext->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH )
+	{
+		avcodec_flush_buffers( mAudioCodecContext );
+	}
+	else
+	{
+		avcodec_free_context( &mAudioCodecContext );
+		ok &= OpenAudioEncoder( mAudioCodec );
+	}
+	return ok;
 }
 
-bool Recorder::PrivateClass::EncodeAndEnqueueFrame( AVFrame *frame )
+bool Recorder::PrivateClass::WarmUp( int frames )
 {
-	int streamIndex = -1;
-	AVCodecContext *codecContext = nullptr;
-	AVFrame *encodingFrame = nullptr;
-	if ( frame->width > 0 && frame->height > 0 )
+	// capture sized input packets held at once like a full decode queue: faults the pages in and raises the
+	// malloc mmap threshold, so the capture copies of the take reuse touched heap instead of fresh mappings
+	int inputSize = RowBytesFor( mVideoWidth, mCapturePixelFormat ) * mVideoHeight;
+	std::vector<PacketHandle> inputs;
+	inputs.reserve( frames );
+	int admitted = 0;
+	for ( int i = 0; i < frames; i++ )
 	{
-		streamIndex = mVideoStream->index;
-		codecContext = mVideoCodecContext;
-		encodingFrame = mVideoEncodingFrame;
-		FillVideoFrame( frame );
-
-		//	if ( mVideoCodecContext->flags & ( AV_CODEC_FLAG_INTERLACED_DCT | AV_CODEC_FLAG_INTERLACED_ME ) )
-		//	{
-		//		mVideoEncodingFrame->top_field_first = 0; // !!ost->top_field_first;
-		//	}
-		if ( mVideoEncodingFrame->interlaced_frame )
+		if ( !mMemoryBudget.TryAcquire( MemoryBudget::PoolPreroll, inputSize ) )
 		{
-			if ( mVideoCodecContext->codec->id == AV_CODEC_ID_MJPEG )
-			{
-				mVideoStream->codecpar->field_order = mVideoEncodingFrame->top_field_first ? AV_FIELD_TT : AV_FIELD_BB;
-			}
-			else
-			{
-				mVideoStream->codecpar->field_order = mVideoEncodingFrame->top_field_first ? AV_FIELD_TB : AV_FIELD_BT;
-			}
+			// the pre-roll pool limits the warm-up, not the other way round
+			break;
 		}
-		else
+		admitted++;
+		inputs.push_back( mPacketShells.Take() );
+		if ( av_new_packet( inputs[i].get(), inputSize ) < 0 )
 		{
-			mVideoStream->codecpar->field_order = AV_FIELD_PROGRESSIVE;
+			fprintf( stderr, "Could not allocate warm-up packet\n" );
+			inputs.pop_back();
+			break;
 		}
-		mVideoEncodingFrame->quality = mVideoCodecContext->global_quality;
-		mVideoEncodingFrame->pict_type = AV_PICTURE_TYPE_NONE;
-		mVideoEncodingFrame->time_base = mVideoCodecContext->time_base;
-	}
-	if ( frame->sample_rate > 0 )
-	{
-		streamIndex = mAudioStream->index;
-		codecContext = mAudioCodecContext;
+		memset( inputs[i]->data, 0x80, inputs[i]->size );
+		// negative timestamps mark warm-up output, the encoder stage discards it
+		inputs[i]->pts = inputs[i]->dts = i - frames;
+		inputs[i]->duration = 1;
+		inputs[i]->flags |= AV_PKT_FLAG_KEY;
 	}
 
-	//fprintf( stdout, "Encode frame pts: %ld dts: %ld, duration: %ld\n", encodingFrame->pts, encodingFrame->pkt_dts, encodingFrame->pkt_duration );
-	int ret = avcodec_send_frame( codecContext, av_frame_clone( encodingFrame ) );
-	if ( ret < 0 )
+	// decoder, conversion (creates the scale context) and encoder see the same calls as during a take
+	bool ok = true;
+	FrameHandle decoded = mFrameShells.Take();
+	PacketHandle encoded = mPacketShells.Take();
+	for ( size_t i = 0; i < inputs.size() && ok && mNativeEncoder; i++ )
 	{
-		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-		fprintf( stderr, "Error send frame for encoding: %s\n", errorString );
-		return false;
+		// the native encoder reads the captured rows, its slice buffers and threads are what warms up
+		ok = mNativeEncoder->Encode( inputs[i]->data, RowBytesFor( mVideoWidth, mCapturePixelFormat ), encoded.get() );
+		av_packet_unref( encoded.get() );
 	}
-
-	AVPacket *pkt = av_packet_alloc();
-	//deprecated: av_init_packet( pkt );
-	while ( ret >= 0 )
+	for ( size_t i = 0; i < inputs.size() && ok && !mNativeEncoder; i++ )
 	{
-		ret = avcodec_receive_packet( mVideoCodecContext, pkt );
-		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
-		{
-			av_packet_free( &pkt );
-			return true;
-		}
-		else if ( ret < 0 )
+		ok = avcodec_send_packet( mVideoDecodingContext, inputs[i].get() ) >= 0;
+		while ( ok && avcodec_receive_frame( mVideoDecodingContext, decoded.get() ) == 0 )
 		{
-			char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-			av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-			fprintf( stderr, "Error during encoding: %s\n", errorString );
-			av_packet_free( &pkt );
-			return false;
+			FillVideoFrame( decoded.get() );
+			// negative in codec units too, a reordering encoder hands the warm-up packets out during the take
+			mVideoEncodingFrame->pts = decoded->pts;
+			mVideoEncodingFrame->time_base = mVideoCodecContext->time_base;
+			ok = avcodec_send_frame( mVideoCodecContext, mVideoEncodingFrame ) >= 0;
+			while ( ok && avcodec_receive_packet( mVideoCodecContext, encoded.get() ) == 0 )
+			{
+				av_packet_unref( encoded.get() );
+			}
+			av_frame_unref( decoded.get() );
 		}
-
-		pkt->stream_index = streamIndex;
-		pkt->dts = pkt->pts = frame->pts;
-		pkt->duration = frame->pkt_duration;
-
-		//fprintf( stdout, "Enqueue packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )pkt, pkt->pts, pkt->dts, ( void * )pkt->buf );
-		mPacketQueueMutex.lock();
-		mPacketQueue.enqueue( av_packet_clone( pkt ) );
-		mPacketQueueMutex.unlock();
 	}
+	inputs.clear();
+	mMemoryBudget.Release( MemoryBudget::PoolPreroll, ( uint64_t )admitted * inputSize );
 
-	return true;
+	if ( !ok )
+	{
+		fprintf( stderr, "Warm-up frames could not be encoded\n" );
+	}
+	return ok;
 }
 
-void Recorder::PrivateClass::Flush( AVCodecContext *codecContext, int streamIndex )
+uint64_t Recorder::PrivateClass::EstimatedEncodedFrameBytes() const
 {
-	AVPacket *encodedPacket = av_packet_alloc();
-	// deprecated: av_init_packet( encodedPacket );
-	encodedPacket->data = nullptr;
-	encodedPacket->size = 0;
-
-	int ret = avcodec_send_frame( codecContext, nullptr );
-	if ( ret != 0 )
+	uint64_t frameBytes = mBackend->EstimatedFrameBytes( mVideoWidth, mVideoHeight, CaptureBitDepth() );
+	if ( frameBytes > 0 )
 	{
-		fprintf( stderr, "avcode_send_frame failed with NULL frame: %d\n", ret );
+		return frameBytes;
 	}
-	while ( ret >= 0 )
+	// rate controlled encoders, twice the average for the larger key frames
+	if ( mVideoCodecContext && mVideoCodecContext->bit_rate > 0 && mTimeBase.den > 0 )
 	{
-		ret = avcodec_receive_packet( codecContext, encodedPacket );
-		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
-		{
-			break;
-		}
-		if ( ret == 0 || ret == 1 )
-		{
-			encodedPacket->stream_index = streamIndex;
-			encodedPacket->dts = encodedPacket->pts;
-			//fprintf( stdout, "Enqueue flushing packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )encodedPacket, encodedPacket->pts, encodedPacket->dts, ( void * )encodedPacket->buf );
-			mPacketQueueMutex.lock();
-			mPacketQueue.enqueue( av_packet_clone( encodedPacket ) );
-			mPacketQueueMutex.unlock();
-		}
+		return 2 * mVideoCodecContext->bit_rate / 8 * mTimeBase.num / mTimeBase.den;
 	}
-	// one time memory leak: av_packet_free( &encodedPacket );
+	return mEncodeReserveBytes / 4;
 }
 
-int Recorder::PrivateClass::InterleaveFrameIntoFile( AVPacket *packet )
+bool Recorder::PrivateClass::ConfigureMemoryBudget()
 {
-	if ( packet == nullptr || mFormatContext == nullptr )
+	mCaptureFrameBytes = ( uint64_t )RowBytesFor( mVideoWidth, mCapturePixelFormat ) * mVideoHeight;
+	// the native encoder has no decoded pictures and no conversion target
+	mDecodedFrameBytes = mNativeEncoder ? 0 : av_image_get_buffer_size( mInputPixelFormat, mVideoWidth, mVideoHeight, 32 );
+	mEncodeReserveBytes = av_image_get_buffer_size( mPixelFormat, mVideoWidth, mVideoHeight, 1 );
+	uint64_t prerollBytes = ( uint64_t )qMax( 0, mSettings.armFrames ) * mCaptureFrameBytes;
+	uint64_t budget = mSettings.memoryBudget;
+	if ( budget == 0 )
 	{
-		return -1;
+		// pools only account
+		return true;
 	}
 
-	return av_interleaved_write_frame( mFormatContext, packet );
+	uint64_t proxyBytes = mSettings.proxy ? ( uint64_t )ProxyBranch::Settings().queueDepth * mDecodedFrameBytes : 0;
+	uint64_t pyramidBytes = mPyramid ? mPyramid->FrameBytes() : 0;
+	// one decoded picture waiting for the thumbnail lane and one being encoded there
+	uint64_t thumbnailBytes = mSettings.thumbnailDirectory.isEmpty() ? 0 : 2 * mDecodedFrameBytes;
+	// the conversion target, its pyramid and the pre-roll are held for the whole run, the encoder reservation for every picture
+	uint64_t conversionBytes = mNativeEncoder ? 0 : av_image_get_buffer_size( mPixelFormat, mVideoWidth, mVideoHeight, 32 );
+	// the capture held for the duplicate comparison
+	uint64_t previousCaptureBytes = mSkipDuplicates ? mCaptureFrameBytes : 0;
+	uint64_t fixedBytes = conversionBytes + pyramidBytes + prerollBytes + mEncodeReserveBytes + proxyBytes + thumbnailBytes + previousCaptureBytes;
+	uint64_t encodedFrameBytes = EstimatedEncodedFrameBytes();
+	uint64_t frameBytes = mCaptureFrameBytes + mDecodedFrameBytes + encodedFrameBytes;
+	uint64_t depth = budget > fixedBytes ? ( budget - fixedBytes ) / frameBytes : 0;
+	// a frame being worked on by the stage and one waiting for it
+	if ( depth < 2 )
+	{
+		fprintf( stderr, "Memory budget of %.0f MB is too small, %dx%d needs at least %.0f MB\n",
+				 budget / 1048576.0, mVideoWidth, mVideoHeight, ( fixedBytes + 2 * frameBytes ) / 1048576.0 );
+		return false;
+	}
+
+	mStageDepth = depth;
+	mMemoryBudget.SetCapacity( MemoryBudget::PoolCapture, depth * mCaptureFrameBytes );
+	mMemoryBudget.SetCapacity( MemoryBudget::PoolFrame, depth * mDecodedFrameBytes );
+	mMemoryBudget.SetCapacity( MemoryBudget::PoolPacket, depth * encodedFrameBytes + mEncodeReserveBytes );
+	mMemoryBudget.SetCapacity( MemoryBudget::PoolPreroll, prerollBytes );
+	mMemoryBudget.SetCapacity( MemoryBudget::PoolProxy, proxyBytes );
+	fprintf( stdout, "Memory budget %.0f MB: %lu frames per stage\n", budget / 1048576.0, depth );
+	return true;
 }
 
-void Recorder::PrivateClass::DecodingThreadFunction()
+bool Recorder::PrivateClass::IsStartFrame( IDeckLinkVideoInputFrame *videoFrame ) const
 {
-	bool empty = true;
-	AVPacket *pkt;
-	for ( ;; )
+	if ( !videoFrame || ( videoFrame->GetFlags() & bmdFrameHasNoInputSource ) )
 	{
-		pkt = nullptr;
-		{
-			QMutexLocker locker( &mDecodePacketQueueMutex );
-			empty = mDecodePacketQueue.isEmpty();
-			if ( !empty )
-			{
-				pkt = mDecodePacketQueue.dequeue();
-			}
-		}
+		return false;
+	}
 
-		if ( empty )
+	if ( mStartFrame >= 0 )
+	{
+		BMDTimeValue frameTime = 0;
+		BMDTimeValue frameDuration = 0;
+		if ( videoFrame->GetStreamTime( &frameTime, &frameDuration, mTimeBase.den ) != S_OK || frameDuration <= 0 )
 		{
-			if ( !mCaptureActive )
-			{
-				break;
-			}
-			QThread::msleep( 20 );
-			continue;
+			return false;
 		}
+		return frameTime / frameDuration >= mStartFrame;
+	}
 
-		if ( pkt != nullptr )
+	IDeckLinkTimecode *timecode = nullptr;
+	if ( videoFrame->GetTimecode( bmdTimecodeRP188Any, &timecode ) != S_OK || !timecode )
+	{
+		if ( videoFrame->GetTimecode( bmdTimecodeVITC, &timecode ) != S_OK || !timecode )
 		{
-			DecodeAndEnqueue( pkt );
-			av_packet_free( &pkt );
+			return false;
 		}
 	}
-}
-
-void Recorder::PrivateClass::EncodingThreadFunction()
+	uint8_t hours = 0;
+	uint8_t minutes = 0;
+	uint8_t seconds = 0;
+	uint8_t frames = 0;
+	HRESULT result = timecode->GetComponents( &hours, &minutes, &seconds, &frames );
+	timecode->Release();
+	if ( result != S_OK )
+	{
+		return false;
+	}
+
+	// at or after rather than equal, a dropped start frame must not keep the take waiting for a day
+	int current[4] = { hours, minutes, seconds, frames };
+	return !std::lexicographical_compare( current, current + 4, mStartTimecode, mStartTimecode + 4 );
+}
+
+bool Recorder::PrivateClass::AddAudioStream()
+{
+	mAudioStream = avformat_new_stream( mFormatContext, NULL );
+	if ( !mAudioStream )
+	{
+		fprintf( stderr, "Could not alloc audio stream\n" );
+		return false;
+	}
+	mAudioStream->id = mFormatContext->nb_streams - 1;
+
+	int ret = avcodec_parameters_from_context( mAudioStream->codecpar, mAudioCodecContext );
+	if ( ret < 0 )
+	{
+		fprintf( stderr, "Could not copy the audio stream parameters\n" );
+		return false;
+	}
+
+	return true;
+}
+
+bool Recorder::PrivateClass::AddVideoStream()
+{
+	// create stream
+	mVideoStream = avformat_new_stream( mFormatContext, NULL );
+	if ( !mVideoStream )
+	{
+		fprintf( stderr, "Could not alloc video stream\n" );
+		return false;
+	}
+	mVideoStream->id = mFormatContext->nb_streams - 1;
+
+	// copy codec params to stream
+	int ret = avcodec_parameters_from_context( mVideoStream->codecpar, mVideoCodecContext );
+	if ( ret < 0 )
+	{
+		fprintf( stderr, "Could not copy the video stream parameters\n" );
+		return false;
+	}
+
+	return true;
+}
+
+bool Recorder::PrivateClass::OpenOutput( const QString &outputFile )
+{
+	QMutexLocker locker( &mOutputMutex );
+	if ( mFormatContext )
+	{
+		fprintf( stderr, "Output '%s' is still open\n", mFormatContext->url );
+		return false;
+	}
+
+	avformat_alloc_output_context2( &mFormatContext, mOutputFormat, nullptr, qUtf8Printable( outputFile ) );
+	if ( !mFormatContext )
+	{
+		printf( "Could not deduce output format from file extension.\n" );
+		return false;
+	}
+
+	if ( !AddVideoStream() || !AddAudioStream() )
+	{
+		fprintf( stderr, "Failed to add streams\n" );
+		avformat_free_context( mFormatContext );
+		mFormatContext = nullptr;
+		return false;
+	}
+
+	if ( !( mOutputFormat->flags & AVFMT_NOFILE ) )
+	{
+		if ( avio_open( &mFormatContext->pb, mFormatContext->url, AVIO_FLAG_WRITE ) < 0 )
+		{
+			fprintf( stderr, "Could not open '%s'\n", mFormatContext->url );
+			avformat_free_context( mFormatContext );
+			mFormatContext = nullptr;
+			return false;
+		}
+	}
+
+	int ret = avformat_init_output( mFormatContext, nullptr );
+	if ( ret < 0 )
+	{
+		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+		fprintf( stderr, "Failed to init output '%s'\n", errorString );
+	}
+	ret = avformat_write_header( mFormatContext, nullptr );
+	if ( ret < 0 )
+	{
+		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+		fprintf( stderr, "Failed to write header'%s'\n", errorString );
+	}
+
+	return true;
+}
+
+void Recorder::PrivateClass::CloseOutput()
+{
+	QMutexLocker locker( &mOutputMutex );
+	if ( mFormatContext == nullptr )
+	{
+		return;
+	}
+
+	int ret = av_write_trailer( mFormatContext );
+	if ( ret < 0 )
+	{
+		fprintf( stderr, "Error occured while writing trailer of %s. Errno: %d\n", mFormatContext->url, ret );
+	}
+
+	if ( mOutputFormat != nullptr  && !( mOutputFormat->flags & AVFMT_NOFILE ) )
+	{
+		/* close the output file */
+		avio_close( mFormatContext->pb );
+	}
+
+	/* free the stream */
+	avformat_free_context( mFormatContext );
+	mFormatContext = nullptr;
+	mVideoStream = nullptr;
+	mAudioStream = nullptr;
+}
+
+bool Recorder::PrivateClass::DecodeAndEnqueue( AVPacket *pkt, bool duplicate )
+{
+	StageProfiler::Scope profile( &mProfiler, StageProfiler::StageDecode );
+	Tracer::Scope trace( &mTracer, Tracer::SpanDecode, FrameId( pkt->pts, pkt->duration ), pkt->pts );
+
+	//fprintf(stdout, "Decoding packet %p with dts %ld, pts %ld\n", (void*)pkt, pkt->dts, pkt->pts);
+	// send_packet takes its own reference, caller keeps (and frees) pkt
+	int ret = avcodec_send_packet( mVideoDecodingContext, pkt );
+	if ( ret < 0 )
+	{
+		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+		fprintf( stderr, "Error send packet for decoding: %s\n", errorString );
+		return false;
+	}
+
+	while ( ret >= 0 )
+	{
+		// the decoder allocates the picture in receive_frame, wait until the encoder stage has room for it
+		mMemoryBudget.Acquire( MemoryBudget::PoolFrame, mDecodedFrameBytes );
+		FrameHandle frame = mFrameShells.Take();
+		ret = avcodec_receive_frame( mVideoDecodingContext, frame.get() );
+		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
+		{
+			mMemoryBudget.Release( MemoryBudget::PoolFrame, mDecodedFrameBytes );
+			return true;
+		}
+		else if ( ret < 0 )
+		{
+			char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+			av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+			fprintf( stderr, "Error during decoding: %s\n", errorString );
+			mMemoryBudget.Release( MemoryBudget::PoolFrame, mDecodedFrameBytes );
+			return false;
+		}
+		if ( duplicate )
+		{
+			// observers, proxy and thumbnails still see every picture
+			frame->opaque = DuplicatePicture();
+		}
+
+		//fprintf(stdout, "Decoded frame pts %ld dts %ld width %d height %d\n", frame->pts, frame->pkt_dts, frame->width, frame->height);
+		{
+			QMutexLocker locker( &mObserverMutex );
+			for ( RecorderObserver *observer : mObservers )
+			{
+				observer->FrameDecoded( frame.get() );
+			}
+		}
+		if ( mProxyActive && mProxyLevel == 0 )
+		{
+			mProxy->Offer( frame.get() );
+		}
+		if ( mThumbnailsActive )
+		{
+			mThumbnails->Offer( frame.get() );
+		}
+		// the struct itself moves into the queue, the encoder stage returns it to the pool
+		mFrameQueue.Push( std::move( frame ) );
+	}
+
+	// maybe this is missing
+	// if (ret == AVERROR_EOF) {
+	// 	avcodec_flush_buffers( mVideoDecodingContext );
+	// }
+
+	return true;
+}
+
+bool Recorder::PrivateClass::EncodeAndEnqueueFrame( AVFrame *frame )
+{
+	int streamIndex = -1;
+	AVCodecContext *codecContext = nullptr;
+	AVFrame *encodingFrame = nullptr;
+	if ( frame->opaque == DuplicatePicture() && mLastSentPts != AV_NOPTS_VALUE )
+	{
+		AVFrame *proxyPicture = mProxyLevel > 0 ? mPyramid->Level( mProxyLevel ) : nullptr;
+		if ( mProxyActive && proxyPicture && proxyPicture->buf[0] && frame->pts >= 0 )
+		{
+			// the level still holds the same picture
+			proxyPicture->pts = frame->pts;
+			proxyPicture->pkt_duration = frame->pkt_duration;
+			mProxy->Offer( proxyPicture );
+		}
+		RepeatLastPicture( frame->pts, frame->pkt_duration );
+		return true;
+	}
+	if ( frame->width > 0 && frame->height > 0 )
+	{
+		streamIndex = mVideoStream->index;
+		codecContext = mVideoCodecContext;
+		encodingFrame = mVideoEncodingFrame;
+		{
+			StageProfiler::Scope profile( &mProfiler, StageProfiler::StageConversion );
+			Tracer::Scope trace( &mTracer, Tracer::SpanConversion, FrameId( frame->pts, frame->pkt_duration ), frame->pts );
+			FillVideoFrame( frame );
+		}
+		AVFrame *proxyPicture = mProxyLevel > 0 ? mPyramid->Level( mProxyLevel ) : nullptr;
+		// a picture the conversion failed on has no level of its own
+		if ( mProxyActive && proxyPicture && proxyPicture->buf[0] && proxyPicture->pts == frame->pts && frame->pts >= 0 )
+		{
+			// already at proxy size, the branch only converts it to 4:2:0
+			mProxy->Offer( proxyPicture );
+		}
+
+		//	if ( mVideoCodecContext->flags & ( AV_CODEC_FLAG_INTERLACED_DCT | AV_CODEC_FLAG_INTERLACED_ME ) )
+		//	{
+		//		mVideoEncodingFrame->top_field_first = 0; // !!ost->top_field_first;
+		//	}
+		if ( mVideoEncodingFrame->interlaced_frame )
+		{
+			if ( mVideoCodecContext->codec->id == AV_CODEC_ID_MJPEG )
+			{
+				mVideoStream->codecpar->field_order = mVideoEncodingFrame->top_field_first ? AV_FIELD_TT : AV_FIELD_BB;
+			}
+			else
+			{
+				mVideoStream->codecpar->field_order = mVideoEncodingFrame->top_field_first ? AV_FIELD_TB : AV_FIELD_BT;
+			}
+		}
+		else
+		{
+			mVideoStream->codecpar->field_order = AV_FIELD_PROGRESSIVE;
+		}
+		mVideoEncodingFrame->quality = mVideoCodecContext->global_quality;
+		// the GOP of a long GOP encoder began on the discarded warm-up pictures, a take starts on a picture of its own
+		mVideoEncodingFrame->pict_type = mKeyFrameDue ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+		mKeyFrameDue = false;
+		mVideoEncodingFrame->time_base = mVideoCodecContext->time_base;
+		// captured timestamps are in stream units, the encoder counts frames
+		mVideoEncodingFrame->pts = av_rescale_q( frame->pts, mVideoStream->time_base, mVideoCodecContext->time_base );
+		mLastSentPts = mVideoEncodingFrame->pts;
+	}
+	if ( frame->sample_rate > 0 )
+	{
+		streamIndex = mAudioStream->index;
+		codecContext = mAudioCodecContext;
+	}
+
+	StageProfiler::Scope profile( &mProfiler, StageProfiler::StageEncode );
+
+	//fprintf( stdout, "Encode frame pts: %ld dts: %ld, duration: %ld\n", encodingFrame->pts, encodingFrame->pkt_dts, encodingFrame->pkt_duration );
+	// reserved before the encoder allocates the packets of the picture, what they do not use is given back at the end
+	uint64_t reservedBytes = mEncodeReserveBytes;
+	mMemoryBudget.Acquire( MemoryBudget::PoolPacket, reservedBytes );
+	int ret = 0;
+	{
+		Tracer::Scope trace( &mTracer, Tracer::SpanSendFrame, FrameId( frame->pts, frame->pkt_duration ), frame->pts );
+		if ( mFaultInjector )
+		{
+			mFaultInjector->BeforeEncode();
+		}
+		// send_frame references the frame data itself, a clone would only leak
+		ret = avcodec_send_frame( codecContext, encodingFrame );
+	}
+	if ( ret < 0 )
+	{
+		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+		fprintf( stderr, "Error send frame for encoding: %s\n", errorString );
+		mMemoryBudget.Release( MemoryBudget::PoolPacket, reservedBytes );
+		return false;
+	}
+
+	PacketHandle pkt = mPacketShells.Take();
+	while ( ret >= 0 )
+	{
+		{
+			Tracer::Scope trace( &mTracer, Tracer::SpanReceivePacket, FrameId( frame->pts, frame->pkt_duration ), frame->pts );
+			ret = avcodec_receive_packet( codecContext, pkt.get() );
+		}
+		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
+		{
+			mMemoryBudget.Release( MemoryBudget::PoolPacket, reservedBytes );
+			return true;
+		}
+		else if ( ret < 0 )
+		{
+			char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
+			av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
+			fprintf( stderr, "Error during encoding: %s\n", errorString );
+			mMemoryBudget.Release( MemoryBudget::PoolPacket, reservedBytes );
+			return false;
+		}
+		if ( pkt->pts < 0 )
+		{
+			// warm-up frame still in the encoder pipeline
+			av_packet_unref( pkt.get() );
+			continue;
+		}
+
+		pkt->stream_index = streamIndex;
+		int64_t encoderPts = pkt->pts;
+		if ( codecContext == mVideoCodecContext )
+		{
+			// a packet may belong to an earlier frame (reordering, frame threads), its own pts and dts are kept
+			RescalePacketTimestamps( pkt.get(), codecContext, mVideoStream );
+		}
+		else
+		{
+			pkt->dts = pkt->pts = frame->pts;
+			pkt->duration = frame->pkt_duration;
+		}
+		// the queued packet keeps its share of the reservation until written
+		if ( ( uint64_t )pkt->size <= reservedBytes )
+		{
+			reservedBytes -= pkt->size;
+		}
+		else
+		{
+			mMemoryBudget.Acquire( MemoryBudget::PoolPacket, pkt->size - reservedBytes );
+			reservedBytes = 0;
+		}
+
+		//fprintf( stdout, "Enqueue packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )pkt, pkt->pts, pkt->dts, ( void * )pkt->buf );
+		// the filled struct moves into the queue, the writer returns it to the pool
+		if ( codecContext == mVideoCodecContext )
+		{
+			PushVideoPacket( pkt, encoderPts );
+		}
+		else
+		{
+			mPacketQueue.Push( std::move( pkt ) );
+		}
+		pkt = mPacketShells.Take();
+	}
+
+	return true;
+}
+
+bool Recorder::PrivateClass::EncodeAndEnqueueCaptured( AVPacket *captured )
+{
+	StageProfiler::Scope profile( &mProfiler, StageProfiler::StageEncode );
+
+	int rowBytes = RowBytesFor( mVideoWidth, mCapturePixelFormat );
+	if ( captured->size < rowBytes * mVideoHeight )
+	{
+		fprintf( stderr, "Captured frame of %d bytes is too small for %dx%d\n", captured->size, mVideoWidth, mVideoHeight );
+		return false;
+	}
+	uint64_t reservedBytes = mEncodeReserveBytes;
+	mMemoryBudget.Acquire( MemoryBudget::PoolPacket, reservedBytes );
+	PacketHandle pkt = mPacketShells.Take();
+	bool ok = false;
+	{
+		Tracer::Scope trace( &mTracer, Tracer::SpanSendFrame, FrameId( captured->pts, captured->duration ), captured->pts );
+		if ( mFaultInjector )
+		{
+			mFaultInjector->BeforeEncode();
+		}
+		ok = mNativeEncoder->Encode( captured->data, rowBytes, pkt.get() );
+	}
+	if ( !ok )
+	{
+		fprintf( stderr, "Error during native encoding\n" );
+		mMemoryBudget.Release( MemoryBudget::PoolPacket, reservedBytes );
+		return false;
+	}
+	mLastSentPts = captured->pts;
+
+	// intra only and in capture order, the captured timestamps are already in stream units
+	pkt->pts = pkt->dts = captured->pts;
+	pkt->duration = captured->duration;
+	pkt->stream_index = mVideoStream->index;
+	// the queued packet keeps its share of the reservation until written
+	if ( ( uint64_t )pkt->size <= reservedBytes )
+	{
+		mMemoryBudget.Release( MemoryBudget::PoolPacket, reservedBytes - pkt->size );
+	}
+	else
+	{
+		mMemoryBudget.Acquire( MemoryBudget::PoolPacket, pkt->size - reservedBytes );
+	}
+	PushVideoPacket( pkt, captured->pts );
+	return true;
+}
+
+void Recorder::PrivateClass::RescalePacketTimestamps( AVPacket *packet, AVCodecContext *codecContext, AVStream *stream )
+{
+	if ( packet->dts == AV_NOPTS_VALUE )
+	{
+		// encoders without reordering may leave it to the caller
+		packet->dts = packet->pts;
+	}
+	if ( packet->duration <= 0 )
+	{
+		packet->duration = 1;
+	}
+	av_packet_rescale_ts( packet, codecContext->time_base, stream->time_base );
+}
+
+void Recorder::PrivateClass::Flush( AVCodecContext *codecContext, int streamIndex )
+{
+	PacketHandle encodedPacket = mPacketShells.Take();
+
+	int ret = avcodec_send_frame( codecContext, nullptr );
+	if ( ret != 0 )
+	{
+		fprintf( stderr, "avcode_send_frame failed with NULL frame: %d\n", ret );
+	}
+	while ( ret >= 0 )
+	{
+		ret = avcodec_receive_packet( codecContext, encodedPacket.get() );
+		if ( ret == AVERROR( EAGAIN ) || ret == AVERROR_EOF )
+		{
+			break;
+		}
+		if ( ( ret == 0 || ret == 1 ) && encodedPacket->pts < 0 )
+		{
+			av_packet_unref( encodedPacket.get() );
+		}
+		else if ( ret == 0 || ret == 1 )
+		{
+			encodedPacket->stream_index = streamIndex;
+			int64_t encoderPts = encodedPacket->pts;
+			if ( codecContext == mVideoCodecContext )
+			{
+				RescalePacketTimestamps( encodedPacket.get(), codecContext, mVideoStream );
+			}
+			else
+			{
+				encodedPacket->dts = encodedPacket->pts;
+			}
+			mMemoryBudget.Acquire( MemoryBudget::PoolPacket, encodedPacket->size );
+			//fprintf( stdout, "Enqueue flushing packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )encodedPacket.get(), encodedPacket->pts, encodedPacket->dts, ( void * )encodedPacket->buf );
+			if ( codecContext == mVideoCodecContext )
+			{
+				PushVideoPacket( encodedPacket, encoderPts );
+			}
+			else
+			{
+				mPacketQueue.Push( std::move( encodedPacket ) );
+			}
+			encodedPacket = mPacketShells.Take();
+		}
+	}
+}
+
+bool Recorder::PrivateClass::IsDuplicateCapture( const AVPacket *pkt ) const
+{
+	// exits at the first difference, which live pictures have within their first rows; glibc compares with the
+	// widest vectors of the CPU, and unlike a hash a match is certain
+	return mPreviousCapture && mPreviousCapture->size == pkt->size && memcmp( mPreviousCapture->data, pkt->data, pkt->size ) == 0;
+}
+
+void Recorder::PrivateClass::PushVideoPacket( PacketHandle &pkt, int64_t encoderPts )
+{
+	if ( mSkipDuplicates )
+	{
+		if ( !mLastVideoPacket )
+		{
+			mLastVideoPacket = mPacketShells.Take();
+		}
+		av_packet_unref( mLastVideoPacket.get() );
+		av_packet_ref( mLastVideoPacket.get(), pkt.get() );
+		mLastVideoPacketPts = encoderPts;
+	}
+	mPacketQueue.Push( std::move( pkt ) );
+	PushRepeats();
+}
+
+void Recorder::PrivateClass::RepeatLastPicture( int64_t pts, int64_t duration )
+{
+	mRepeats.PushBack( Repeat{ mLastSentPts, pts, duration } );
+	mDuplicateFrames++;
+	// the encoder may still hold the picture (frame threads), its repeats wait for its packet
+	PushRepeats();
+}
+
+void Recorder::PrivateClass::PushRepeats()
+{
+	while ( !mRepeats.Empty() && mLastVideoPacket && mRepeats.Front().sourcePts <= mLastVideoPacketPts )
+	{
+		Repeat repeat = mRepeats.PopFront();
+		if ( repeat.sourcePts < mLastVideoPacketPts )
+		{
+			// the packet of the picture never came out (failed encode), a later one would be the wrong picture
+			continue;
+		}
+		// shares the buffer of the packet, nothing is copied and nothing is charged to the budget; the tag tells
+		// the writer not to release it either
+		PacketHandle pkt = mPacketShells.Take();
+		av_packet_ref( pkt.get(), mLastVideoPacket.get() );
+		pkt->pts = pkt->dts = repeat.pts;
+		pkt->duration = repeat.duration;
+		pkt->opaque = DuplicatePicture();
+		mPacketQueue.Push( std::move( pkt ) );
+	}
+}
+
+void Recorder::PrivateClass::ResetDuplicates()
 {
-	bool empty = true;
-	AVFrame *frame = nullptr;
-	for ( ;; )
+	mPreviousCapture.reset();
+	mLastVideoPacket.reset();
+	mLastVideoPacketPts = AV_NOPTS_VALUE;
+	mLastSentPts = AV_NOPTS_VALUE;
+	mRepeats.Clear();
+}
+
+int Recorder::PrivateClass::InterleaveFrameIntoFile( AVPacket *packet )
+{
+	if ( packet == nullptr || mFormatContext == nullptr )
+	{
+		return -1;
+	}
+
+	return av_interleaved_write_frame( mFormatContext, packet );
+}
+
+void Recorder::PrivateClass::EndCapture()
+{
+	// under the queue lock, so no captured packet can be queued behind the end of stream
+	QMutexLocker locker( &mDecodePacketQueue.Mutex() );
+	if ( mCaptureActive.exchange( false ) )
 	{
-		frame = nullptr;
+		mStopRequestNs = MonotonicNs();
+		mStopQueuedFrames = mDecodePacketQueue.Gauge().depth + mFrameQueue.Gauge().depth + mPacketQueue.Gauge().depth;
+		if ( mRawWriter )
 		{
-			QMutexLocker locker( &mFrameQueueMutex );
-			empty = mFrameQueue.isEmpty();
-			if ( !empty )
-			{
-				frame = mFrameQueue.dequeue();
-			}
+			mStopQueuedFrames += mRawWriter->QueuedFrames();
+			mRawWriter->EndOfStream();
+			return;
 		}
+		mDecodePacketQueue.PushLocked( PacketHandle() );
+	}
+}
 
-		if ( empty )
+void Recorder::PrivateClass::DecodingThreadFunction()
+{
+	for ( ;; )
+	{
+		PacketHandle pkt = mDecodePacketQueue.Pop();
+		if ( !pkt )
 		{
-			if ( !ShouldEncoderKeepRunning() )
-			{
-				break;
-			}
-			QThread::msleep( 20 );
-			continue;
+			// end of stream, pass it on
+			break;
+		}
+		bool duplicate = mSkipDuplicates && IsDuplicateCapture( pkt.get() );
+		DecodeAndEnqueue( pkt.get(), duplicate );
+		int packetBytes = pkt->size;
+		if ( mSkipDuplicates )
+		{
+			// set aside in the budget at Init
+			mPreviousCapture = std::move( pkt );
 		}
+		pkt.reset();
+		mMemoryBudget.Release( MemoryBudget::PoolCapture, packetBytes );
+	}
+
+	mFrameQueue.Push( FrameHandle() );
+	if ( mProxyActive && mProxyLevel == 0 )
+	{
+		mProxy->EndOfStream();
+	}
+	if ( mThumbnailsActive )
+	{
+		mThumbnails->EndOfStream();
+	}
+}
 
-		if ( frame )
+void Recorder::PrivateClass::EncodingThreadFunction()
+{
+	for ( ;; )
+	{
+		FrameHandle frame = mFrameQueue.Pop();
+		if ( !frame )
 		{
-			EncodeAndEnqueueFrame( frame );
-			av_frame_free( &frame );
+			break;
 		}
+		EncodeAndEnqueueFrame( frame.get() );
+		frame.reset();
+		mMemoryBudget.Release( MemoryBudget::PoolFrame, mDecodedFrameBytes );
+	}
+	if ( mProxyActive && mProxyLevel > 0 )
+	{
+		mProxy->EndOfStream();
 	}
 
+	// the encoders drain independently, the audio one on a pool thread
+	QFuture<void> audioFlush = QtConcurrent::run( &mThreadPool, [this]()
+	{
+		Flush( mAudioCodecContext, mAudioStream->index );
+	} );
 	Flush( mVideoCodecContext, mVideoStream->index );
+	audioFlush.waitForFinished();
+	ResetDuplicates();
+
+	mPacketQueue.Push( PacketHandle() );
+
+	// done here rather than on the next start, which should only pay for its muxer
+	if ( mSettings.daemon && ( !ResetEncoders() || ( mSettings.armFrames > 0 && !WarmUp( mSettings.armFrames ) ) ) )
+	{
+		fprintf( stderr, "Failed to reset the encoders for the next take\n" );
+	}
+}
+
+void Recorder::PrivateClass::NativeEncodingThreadFunction()
+{
+	// takes the place of decoder and encoder stages
+	for ( ;; )
+	{
+		PacketHandle pkt = mDecodePacketQueue.Pop();
+		if ( !pkt )
+		{
+			break;
+		}
+		if ( mSkipDuplicates && mLastSentPts != AV_NOPTS_VALUE && IsDuplicateCapture( pkt.get() ) )
+		{
+			RepeatLastPicture( pkt->pts, pkt->duration );
+		}
+		else
+		{
+			EncodeAndEnqueueCaptured( pkt.get() );
+		}
+		int packetBytes = pkt->size;
+		if ( mSkipDuplicates )
+		{
+			mPreviousCapture = std::move( pkt );
+		}
+		pkt.reset();
+		mMemoryBudget.Release( MemoryBudget::PoolCapture, packetBytes );
+	}
+
+	// the native encoder holds nothing back, only the audio encoder drains
 	Flush( mAudioCodecContext, mAudioStream->index );
+	ResetDuplicates();
+	mPacketQueue.Push( PacketHandle() );
+
+	if ( mSettings.daemon && ( !ResetEncoders() || ( mSettings.armFrames > 0 && !WarmUp( mSettings.armFrames ) ) ) )
+	{
+		fprintf( stderr, "Failed to reset the encoders for the next take\n" );
+	}
 }
 
 void Recorder::PrivateClass::PacketWritingThreadFunction()
 {
-	AVPacket *packet = nullptr;
+	bool firstVideoPacket = true;
 
-	while ( true )
+	for ( ;; )
 	{
-		// mRunPacketWritingThread is not sufficient because when recording was stopped it's still necessary to write all queued frames
-		if ( !ShouldWriterKeepRunning() )
+		PacketHandle packet = mPacketQueue.Pop();
+		if ( !packet )
 		{
-			bool empty = true;
-
-			mPacketQueueMutex.lock();
-			empty = mPacketQueue.isEmpty();
-			mPacketQueueMutex.unlock();
+			// every stage in front has drained
+			break;
+		}
 
-			if ( empty )
+		if ( mSettings.logFrames )
+		{
+			fprintf( stdout, "Write packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )packet.get(), packet->pts, packet->dts, ( void * )packet->buf );
+		}
+		bool video = packet->stream_index == mVideoStream->index;
+		int64_t frameId = FrameId( packet->pts, packet->duration );
+		int packetBytes = packet->size;
+		int budgetBytes = packet->opaque == DuplicatePicture() ? 0 : packetBytes;
+		mWrittenBytes += packetBytes;
+		{
+			// the muxer takes the packet data, observers see it before
+			QMutexLocker locker( &mObserverMutex );
+			for ( RecorderObserver *observer : mObservers )
 			{
-				// empty buffers => feel free to end
-				break;
+				observer->PacketEncoded( packet.get() );
 			}
 		}
-
-		mPacketQueueMutex.lock();
-		if ( mPacketQueue.isEmpty() == false )
 		{
-			packet = mPacketQueue.dequeue();
+			StageProfiler::Scope profile( &mProfiler, StageProfiler::StageWrite );
+			Tracer::Scope trace( &mTracer, Tracer::SpanWrite, frameId, packet->pts );
+			if ( mFaultInjector )
+			{
+				mFaultInjector->BeforeWrite( packet->size );
+			}
+			// interleave write takes the packet's reference only, the (now blank) struct goes back to the pool
+			InterleaveFrameIntoFile( packet.get() );
+			packet.reset();
 		}
-		mPacketQueueMutex.unlock();
+		mMemoryBudget.Release( MemoryBudget::PoolPacket, budgetBytes );
+		mWrittenPackets++;
 
-		if ( packet )
+		uint64_t captureNs = mCaptureTimes[( uint64_t )frameId % CaptureTimeSlots].load( std::memory_order_relaxed );
+		if ( video && captureNs > 0 )
+		{
+			mEndToEndLatency.Add( MonotonicNs() - captureNs );
+		}
+		if ( video && firstVideoPacket )
 		{
-			fprintf( stdout, "Write packet %p pts: %ld dts: %ld with buffer %p\n", ( void * )packet, packet->pts, packet->dts, ( void * )packet->buf );
-			InterleaveFrameIntoFile( packet );
-			packet = nullptr; // interleave write takes ownership of packet
+			firstVideoPacket = false;
+			uint64_t nowNs = MonotonicNs();
+			mLastStartLatencyNs = nowNs - mTakeStartNs;
+			mStartLatency.Add( mLastStartLatencyNs );
+			mFirstFrameLatencyNs = captureNs > 0 ? nowNs - captureNs : 0;
 		}
 	}
 
-	mOwner->CleanUp();
-	qApp->quit();
+	// everything is drained, whatever is still allocated compared to warm-up has leaked
+	if ( mAllocationWarmupFrame > 0 )
+	{
+		mAllocationFinal = AllocationTracker::TakeSnapshot();
+	}
+
+	// the writer is the only one finishing the file of a take
+	CloseOutput();
+	FinishTake();
 }
 
-bool Recorder::PrivateClass::ShouldEncoderKeepRunning() const
+void Recorder::PrivateClass::RawWritingThreadFunction()
 {
-	if ( mCaptureActive )
-	{
-		return true;
-	}
-	if ( mDecodingThread.isRunning() )
+	bool firstFrame = true;
+	mRawWriter->Run( [this, &firstFrame]( int64_t pts, int64_t duration, uint64_t bytes )
 	{
-		return true;
-	}
-	return false;
+		mWrittenBytes += bytes;
+		mWrittenPackets++;
+		uint64_t nowNs = MonotonicNs();
+		uint64_t captureNs = mCaptureTimes[( uint64_t )FrameId( pts, duration ) % CaptureTimeSlots].load( std::memory_order_relaxed );
+		if ( captureNs > 0 )
+		{
+			mEndToEndLatency.Add( nowNs - captureNs );
+		}
+		if ( firstFrame )
+		{
+			firstFrame = false;
+			mLastStartLatencyNs = nowNs - mTakeStartNs;
+			mStartLatency.Add( mLastStartLatencyNs );
+			mFirstFrameLatencyNs = captureNs > 0 ? nowNs - captureNs : 0;
+		}
+	} );
+	FinishTake();
 }
 
-bool Recorder::PrivateClass::ShouldWriterKeepRunning() const
+void Recorder::PrivateClass::FinishTake()
 {
-	if ( mCaptureActive )
-	{
-		return true;
-	}
-	if ( mEncodingThread.isRunning() )
+	mLastStopLatencyNs = MonotonicNs() - mStopRequestNs;
+	mLastStopQueuedFrames = mStopQueuedFrames;
+	mStopLatency.Add( mLastStopLatencyNs );
+	if ( !mSettings.daemon )
 	{
-		return true;
+		qApp->quit();
 	}
-	return false;
 }
 
 ///@endcond INTERNAL
@@ -695,9 +1364,29 @@ HRESULT Recorder::VideoInputFrameArrived( IDeckLinkVideoInputFrame *videoFrame,
 {
 	d->mFrameCount++;
 
-	if ( d->mFrameCount > 500 )
+	if ( d->mSettings.allocationWarmupFrames > 0 && d->mFrameCount == ( uint64_t )d->mSettings.allocationWarmupFrames )
+	{
+		d->mAllocationWarmup = AllocationTracker::TakeSnapshot();
+		d->mAllocationWarmupFrame = d->mFrameCount;
+	}
+
+	if ( d->mCaptureActive && d->mWaitingForStart )
+	{
+		if ( !d->IsStartFrame( videoFrame ) )
+		{
+			return S_OK;
+		}
+		// the take starts with this frame, not with the call that armed the trigger
+		d->mTakeStartNs = PrivateClass::MonotonicNs();
+		d->mWaitingForStart = false;
+		// a trigger is good for one take, takes started later over the control socket start at once
+		d->mStartFrame = -1;
+		d->mStartTimecode[0] = -1;
+	}
+
+	if ( d->mCaptureActive && d->mSettings.maxFrames > 0 && d->mTakeFrames++ >= ( uint64_t )d->mSettings.maxFrames )
 	{
-		d->mCaptureActive = false;
+		d->EndCapture();
 	}
 
 	if ( d->mCaptureActive )
@@ -713,13 +1402,82 @@ HRESULT Recorder::VideoInputFrameArrived( IDeckLinkVideoInputFrame *videoFrame,
 }
 
 
-bool Recorder::Init( int timeBaseNum, int timeBaseDen )
+bool Recorder::Init( int timeBaseNum, int timeBaseDen, int width, int height, BMDPixelFormat pixelFormat )
 {
 	d->mTimeBase = {timeBaseNum, timeBaseDen};
+	d->mCaptureTimeBase = {1, timeBaseDen};
+	d->mVideoWidth = width;
+	d->mVideoHeight = height;
+	d->mCapturePixelFormat = pixelFormat;
+	if ( pixelFormat == bmdFormat10BitYUV )
+	{
+		// v210 is unpacked by its own decoder
+		d->mInputVideoCodec = AV_CODEC_ID_V210;
+		d->mInputPixelFormat = AV_PIX_FMT_YUV422P10LE;
+	}
+	else
+	{
+		d->mInputVideoCodec = AV_CODEC_ID_RAWVIDEO;
+		d->mInputPixelFormat = AV_PIX_FMT_UYVY422;
+	}
+
+	if ( d->mSettings.rawDirect )
+	{
+		// nothing to open but the file of a take
+		if ( !d->mRawWriter )
+		{
+			d->mRawWriter = new RawDiskWriter( RawDiskWriter::Settings() );
+		}
+		if ( !d->mRawWriter->Init( width, height, pixelFormat, 1, timeBaseDen ) )
+		{
+			return false;
+		}
+		if ( d->mSettings.daemon )
+		{
+			d->mThreadPool.setExpiryTimeout( -1 );
+		}
+		return true;
+	}
+
+	if ( !d->mBackend )
+	{
+		d->mBackend = EncoderBackend::Create( d->mSettings.videoCodec );
+		if ( !d->mBackend )
+		{
+			fprintf( stderr, "Unknown video codec '%s', expected one of %s\n", qUtf8Printable( d->mSettings.videoCodec ),
+					 qUtf8Printable( EncoderBackend::Profiles().join( ", " ) ) );
+			return false;
+		}
+		d->mNativeEncoder = d->mBackend->CreateNativeEncoder();
+		if ( d->mNativeEncoder && ( d->mSettings.proxy || !d->mSettings.thumbnailDirectory.isEmpty() ) )
+		{
+			fprintf( stderr, "%s has no decoded pictures for a proxy or thumbnails\n", qUtf8Printable( d->mSettings.videoCodec ) );
+			return false;
+		}
+		// the encoder's slice threads are its own, next to the stage threads of the pool
+		if ( d->mNativeEncoder && !d->mNativeEncoder->Init( width, height, pixelFormat, QThread::idealThreadCount() ) )
+		{
+			return false;
+		}
+		if ( d->mNativeEncoder )
+		{
+			d->mNativeEncoder->SetBufferPool( &d->mPacketBuffers );
+		}
+	}
+	// the conversion target is planned once, from the capture depth and what the codec is fed with
+	d->mVideoCodec = d->mBackend->CodecId( d->CaptureBitDepth() );
+	d->mPixelFormat = d->mBackend->PixelFormat( d->CaptureBitDepth() );
+	// a packet can only stand for another picture when it depends on no other
+	const AVCodecDescriptor *descriptor = avcodec_descriptor_get( d->mVideoCodec );
+	d->mSkipDuplicates = d->mSettings.skipDuplicates && descriptor && ( descriptor->props & AV_CODEC_PROP_INTRA_ONLY );
+	if ( d->mSettings.skipDuplicates && !d->mSkipDuplicates )
+	{
+		fprintf( stderr, "%s is not intra-only, duplicate pictures are encoded\n", qUtf8Printable( d->mSettings.videoCodec ) );
+	}
 
 	if ( !d->mOutputFormat )
 	{
-		d->mOutputFormat = av_guess_format( nullptr, VIDEO_OUTPUT_FILE, nullptr );
+		d->mOutputFormat = av_guess_format( nullptr, qUtf8Printable( d->mSettings.outputFile ), nullptr );
 		if ( !d->mOutputFormat )
 		{
 			fprintf( stderr, "Unable to guess output format\n" );
@@ -727,85 +1485,348 @@ bool Recorder::Init( int timeBaseNum, int timeBaseDen )
 		}
 	}
 
-	avformat_alloc_output_context2( &d->mFormatContext, d->mOutputFormat, nullptr, VIDEO_OUTPUT_FILE );
-	if ( !d->mFormatContext )
+	// the codecs do not depend on each other, decoder and audio encoder open on the pool meanwhile
+	QFuture<bool> decoderOpened = QtConcurrent::run( &d->mThreadPool, [this]()
 	{
-		printf( "Could not deduce output format from file extension.\n" );
+		StartupProfile::Step step( "decoder open" );
+		return d->mNativeEncoder || d->InitVideoDecoder( d->mInputVideoCodec, d->mInputPixelFormat );
+	} );
+	QFuture<bool> audioEncoderOpened = QtConcurrent::run( &d->mThreadPool, [this]()
+	{
+		StartupProfile::Step step( "audio encoder open" );
+		return d->OpenAudioEncoder( d->mAudioCodec );
+	} );
+	bool ok = true;
+	{
+		StartupProfile::Step step( "video encoder open" );
+		ok &= d->OpenVideoEncoder( d->mVideoCodec );
+	}
+	ok &= decoderOpened.result();
+	ok &= audioEncoderOpened.result();
+	if ( !ok )
+	{
+		fprintf( stderr, "Failed to open codecs\n" );
 		return false;
 	}
 
-	bool ok = true;
-	ok &= d->InitVideoDecoder( d->mInputVideoCodec, d->mInputPixelFormat );
-	ok &= d->AddVideoStream( d->mVideoCodec );
-	ok &= d->AddAudioStream( d->mAudioCodec );
-	if ( !ok )
+	// allocate frame for encoding
+	if ( !d->mNativeEncoder )
+	{
+		d->mVideoEncodingFrame = AllocateVideoFrame( d->mPixelFormat, d->mVideoWidth, d->mVideoHeight );
+		if ( !d->mVideoEncodingFrame || !d->InitEncodingPools() )
+		{
+			return false;
+		}
+	}
+	// a power of two proxy is taken from the pyramid, other divisors are scaled by the proxy from the decoded picture
+	int proxyLevel = d->mSettings.proxy ? DownscalePyramid::LevelForDivisor( d->mSettings.proxyDivisor ) : 0;
+	if ( proxyLevel > 0 && !d->mPyramid )
+	{
+		d->mPyramid = new DownscalePyramid();
+		if ( d->mPyramid->Init( d->mPixelFormat, d->mVideoWidth, d->mVideoHeight, proxyLevel ) && d->mPyramid->Levels() == proxyLevel )
+		{
+			d->mProxyLevel = proxyLevel;
+		}
+		else
+		{
+			delete d->mPyramid;
+			d->mPyramid = nullptr;
+		}
+	}
+	if ( !d->ConfigureMemoryBudget() )
 	{
-		fprintf( stderr, "Failed to add streams\n" );
 		return false;
 	}
+	// the first packets already get a buffer class of about their size
+	d->mPacketBuffers.SetEstimate( d->EstimatedEncodedFrameBytes() );
+	// capture copies keep the input padding of av_new_packet, zeroed once when the pool creates the buffer
+	d->mCaptureBufferPool = av_buffer_pool_init( d->mCaptureFrameBytes + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_allocz );
+	// enough structs and queue slots for a backlog, both grow on demand beyond that
+	size_t queueCapacity = qMax<uint64_t>( d->mStageDepth, 2 * qMax( 8, d->mSettings.backlogThreshold ) ) + 1;
+	d->mDecodePacketQueue.Reserve( queueCapacity );
+	d->mFrameQueue.Reserve( queueCapacity );
+	d->mPacketQueue.Reserve( queueCapacity );
+	d->mRepeats.Reserve( queueCapacity );
+	d->mPacketShells.Prefill( 2 * qMax( 8, d->mSettings.backlogThreshold ) );
+	d->mFrameShells.Prefill( qMax( 8, d->mSettings.backlogThreshold ) );
+
+	if ( d->mSettings.proxy && !d->mProxy )
+	{
+		ProxyBranch::Settings proxySettings;
+		proxySettings.divisor = d->mSettings.proxyDivisor;
+		proxySettings.bitrateKbps = d->mSettings.proxyBitrateKbps;
+		d->mProxy = new ProxyBranch( proxySettings );
+		d->mProxy->Init( width, height, timeBaseNum, timeBaseDen, d->mSettings.memoryBudget > 0 ? &d->mMemoryBudget : nullptr, d->mDecodedFrameBytes );
+	}
 
-	if ( !( d->mOutputFormat->flags & AVFMT_NOFILE ) )
+	if ( !d->mSettings.thumbnailDirectory.isEmpty() && !d->mThumbnails )
 	{
-		if ( avio_open( &d->mFormatContext->pb, d->mFormatContext->url, AVIO_FLAG_WRITE ) < 0 )
+		ThumbnailLane::Settings thumbnailSettings;
+		thumbnailSettings.directory = d->mSettings.thumbnailDirectory;
+		thumbnailSettings.intervalSeconds = d->mSettings.thumbnailInterval;
+		thumbnailSettings.divisor = d->mSettings.thumbnailDivisor;
+		d->mThumbnails = new ThumbnailLane( thumbnailSettings );
+		if ( !d->mThumbnails->Init( d->mInputPixelFormat, width, height ) )
 		{
-			fprintf( stderr, "Could not open '%s'\n", d->mFormatContext->url );
 			return false;
 		}
 	}
 
-	int ret = avformat_init_output( d->mFormatContext, nullptr );
-	if ( ret < 0 )
+	if ( d->mSettings.daemon )
 	{
-		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-		fprintf( stderr, "Failed to init output '%s'\n", errorString );
+		// keep the stage threads alive between takes
+		d->mThreadPool.setExpiryTimeout( -1 );
 	}
-	ret = avformat_write_header( d->mFormatContext, nullptr );
-	if ( ret < 0 )
+	else
 	{
-		char errorString[AV_ERROR_MAX_STRING_SIZE] = {0};
-		av_make_error_string( errorString, AV_ERROR_MAX_STRING_SIZE, ret );
-		fprintf( stderr, "Failed to write header'%s'\n", errorString );
+		// the streams need the opened encoders, the file and header are written before the first frame arrives
+		StartupProfile::Step step( "output open" );
+		if ( !d->OpenOutput( d->mSettings.outputFile ) )
+		{
+			return false;
+		}
+		d->mPreparedOutputFile = d->mSettings.outputFile;
 	}
 
 	return true;
 }
 
-void Recorder::Start()
+void Recorder::SetSettings( const RecorderSettings &settings )
+{
+	d->mSettings = settings;
+}
+
+void Recorder::SetFaultInjector( FaultInjector *faultInjector )
+{
+	d->mFaultInjector = faultInjector;
+}
+
+void Recorder::AddObserver( RecorderObserver *observer )
+{
+	QMutexLocker locker( &d->mObserverMutex );
+	if ( !d->mObservers.contains( observer ) )
+	{
+		d->mObservers.append( observer );
+	}
+}
+
+void Recorder::RemoveObserver( RecorderObserver *observer )
+{
+	// once this returns no callback into the observer is running any more
+	QMutexLocker locker( &d->mObserverMutex );
+	d->mObservers.removeAll( observer );
+}
+
+bool Recorder::Arm()
+{
+	// the pool creates threads on demand; make it create all stage threads now and keep them
+	d->mThreadPool.setExpiryTimeout( -1 );
+	QSemaphore running;
+	QSemaphore release;
+	for ( int i = 0; i < 3; i++ )
+	{
+		QtConcurrent::run( &d->mThreadPool, [&running, &release]()
+		{
+			running.release();
+			release.acquire();
+		} );
+	}
+	running.acquire( 3 );
+	release.release( 3 );
+	d->mThreadPool.waitForDone();
+
+	StartupProfile::Step step( "arm" );
+	// the raw mode has no codecs to warm up
+	return d->mSettings.armFrames <= 0 || d->mRawWriter || d->WarmUp( d->mSettings.armFrames );
+}
+
+bool Recorder::Start()
+{
+	d->mStartFrame = d->mSettings.startFrame;
+	d->mStartTimecode[0] = -1;
+	if ( !d->mSettings.startTimecode.isEmpty() )
+	{
+		int *tc = d->mStartTimecode;
+		if ( sscanf( qUtf8Printable( d->mSettings.startTimecode ), "%d%*[:;.]%d%*[:;.]%d%*[:;.]%d", &tc[0], &tc[1], &tc[2], &tc[3] ) != 4 )
+		{
+			fprintf( stderr, "Start timecode '%s' is not HH:MM:SS:FF\n", qUtf8Printable( d->mSettings.startTimecode ) );
+			return false;
+		}
+	}
+	return StartTake( d->mSettings.outputFile );
+}
+
+bool Recorder::StartTake( const QString &outputFile )
 {
+	if ( IsRecording() )
+	{
+		fprintf( stderr, "A take is still being recorded\n" );
+		return false;
+	}
+
+	d->mTakeStartNs = PrivateClass::MonotonicNs();
+	if ( d->mRawWriter )
+	{
+		if ( !d->mRawWriter->Open( outputFile ) )
+		{
+			return false;
+		}
+		// the raw mode has no stream and counts in the capture time scale
+		d->mCaptureTimeBase = {1, d->mTimeBase.den};
+		d->mCaptureStreamIndex = 0;
+	}
+	else
+	{
+		if ( !d->mPreparedOutputFile.isEmpty() && d->mPreparedOutputFile != outputFile )
+		{
+			// prepared for another file, nothing has been written to it yet
+			d->CloseOutput();
+		}
+		if ( d->mPreparedOutputFile != outputFile && !d->OpenOutput( outputFile ) )
+		{
+			d->mPreparedOutputFile.clear();
+			return false;
+		}
+		d->mPreparedOutputFile.clear();
+		d->mCaptureTimeBase = d->mVideoStream->time_base;
+		d->mCaptureStreamIndex = d->mVideoStream->index;
+		// the proxy opens its encoder and file on its own thread, a failure there leaves the master alone
+		// captured timestamps are in units of the master video stream
+		d->mProxyActive = d->mProxy && d->mProxy->Start( ProxyBranch::FileName( outputFile ), &d->mThreadPool, d->mCaptureTimeBase );
+		d->mThumbnailsActive = d->mThumbnails && d->mThumbnails->Start( outputFile, d->mCaptureTimeBase );
+	}
+
+	if ( !d->mSettings.traceFile.isEmpty() && !d->mTracer.IsEnabled() )
+	{
+		d->mTracer.Start( d->mSettings.traceEventsPerThread );
+	}
+	d->mTakes++;
+	d->mWaitingForStart = d->mStartFrame >= 0 || d->mStartTimecode[0] >= 0;
+	d->mTakeFrames = 0;
+	d->mTakeStartPts = AV_NOPTS_VALUE;
+	d->mKeyFrameDue = true;
+	d->mLastCapturePts = AV_NOPTS_VALUE;
 	d->mCaptureActive = true;
+	if ( d->mRawWriter )
+	{
+		d->mFileWritingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::RawWritingThreadFunction );
+		return true;
+	}
+	if ( d->mNativeEncoder )
+	{
+		d->mEncodingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::NativeEncodingThreadFunction );
+		d->mFileWritingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::PacketWritingThreadFunction );
+		return true;
+	}
 	d->mDecodingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::DecodingThreadFunction );
 	d->mEncodingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::EncodingThreadFunction );
 	d->mFileWritingThread = QtConcurrent::run( &d->mThreadPool, d, &Recorder::PrivateClass::PacketWritingThreadFunction );
+	return true;
+}
+
+bool Recorder::IsRecording() const
+{
+	return d->mCaptureActive || d->mDecodingThread.isRunning() || d->mEncodingThread.isRunning() || d->mFileWritingThread.isRunning()
+		   || ( d->mProxy && d->mProxy->IsRunning() ) || ( d->mThumbnails && d->mThumbnails->IsRunning() );
 }
 
 void Recorder::Stop()
 {
-	d->mCaptureActive = false;
-	while ( d->mEncodingThread.isRunning() || d->mFileWritingThread.isRunning() )
+	// the end of stream marker drains decoder, encoder and writer in turn, the writer finishes the file
+	d->EndCapture();
+	d->mDecodingThread.waitForFinished();
+	d->mEncodingThread.waitForFinished();
+	d->mFileWritingThread.waitForFinished();
+	if ( d->mProxy )
+	{
+		// the low priority branch may still be catching up
+		d->mProxy->WaitForFinished();
+	}
+	d->mProxyActive = false;
+	if ( d->mThumbnails )
 	{
-		QThread::msleep( 50 );
+		d->mThumbnails->WaitForFinished();
 	}
+	d->mThumbnailsActive = false;
+	// a take stopped before its trigger arrived must not leave it to the next take
+	d->mWaitingForStart = false;
+	d->mStartFrame = -1;
+	d->mStartTimecode[0] = -1;
 }
 
-void Recorder::CleanUp()
+void Recorder::GetStats( RecorderStats &stats ) const
 {
-	if ( d->mFormatContext != nullptr )
+	stats.capturedFrames = d->mProfiler.GetStageStats( StageProfiler::StageCapture ).frames;
+	stats.writtenPackets = d->mWrittenPackets;
+	stats.droppedFrames = d->mDroppedFrames;
+	stats.writtenBytes = d->mWrittenBytes;
+	stats.decodeQueueDepth = d->mDecodePacketQueue.Gauge().depth;
+	stats.frameQueueDepth = d->mFrameQueue.Gauge().depth;
+	stats.packetQueueDepth = d->mPacketQueue.Gauge().depth;
+	stats.decodeQueuePeak = d->mDecodePacketQueue.Gauge().peak;
+	stats.frameQueuePeak = d->mFrameQueue.Gauge().peak;
+	stats.packetQueuePeak = d->mPacketQueue.Gauge().peak;
+	stats.backlogEpisodes = d->mBacklogEpisodes;
+	stats.memoryBudget = d->mSettings.memoryBudget;
+	stats.budgetDroppedFrames = d->mBudgetDroppedFrames;
+	stats.proxyFrames = d->mProxy ? d->mProxy->EncodedFrames() : 0;
+	stats.proxySkippedFrames = d->mProxy ? d->mProxy->SkippedFrames() : 0;
+	stats.thumbnails = d->mThumbnails ? d->mThumbnails->WrittenThumbnails() : 0;
+	stats.skippedThumbnails = d->mThumbnails ? d->mThumbnails->SkippedThumbnails() : 0;
+	stats.rawFrames = d->mRawWriter ? d->mRawWriter->WrittenFrames() : 0;
+	stats.rawCopiedFrames = d->mRawWriter ? d->mRawWriter->CopiedFrames() : 0;
+	stats.rawDroppedFrames = d->mRawWriter ? d->mRawWriter->DroppedFrames() : 0;
+	stats.packetBuffers = d->mPacketBuffers.GetStats();
+	stats.duplicateFrames = d->mDuplicateFrames;
+	for ( int i = 0; i < MemoryBudget::PoolCount; i++ )
 	{
-		int ret = av_write_trailer( d->mFormatContext );
-		if ( ret < 0 )
-		{
-			fprintf( stderr, "Error occured while writing trailer of %s. Errno: %d\n", d->mFormatContext->url, ret );
-		}
+		stats.memoryPools[i] = d->mMemoryBudget.GetStats( ( MemoryBudget::Pool )i );
+	}
+	stats.backlogRecovery = d->mBacklogRecovery.GetCounts();
+	stats.endToEndLatency = d->mEndToEndLatency.GetCounts();
+	stats.takes = d->mTakes;
+	stats.lastStartLatencyNs = d->mLastStartLatencyNs;
+	stats.startLatency = d->mStartLatency.GetCounts();
+	stats.firstFrameLatencyNs = d->mFirstFrameLatencyNs;
+	stats.lastStopLatencyNs = d->mLastStopLatencyNs;
+	stats.lastStopQueuedFrames = d->mLastStopQueuedFrames;
+	stats.stopLatency = d->mStopLatency.GetCounts();
+	for ( int i = 0; i < StageProfiler::StageCount; i++ )
+	{
+		stats.stages[i] = d->mProfiler.GetStageStats( ( StageProfiler::Stage )i );
+		stats.stageLatency[i] = d->mProfiler.GetStageLatency( ( StageProfiler::Stage )i );
+	}
 
-		if ( d->mOutputFormat != nullptr  && !( d->mOutputFormat->flags & AVFMT_NOFILE ) )
+	if ( AllocationTracker::IsEnabled() && d->mAllocationWarmupFrame > 0 && stats.capturedFrames > d->mAllocationWarmupFrame )
+	{
+		stats.allocationsTracked = true;
+		stats.steadyStateFrames = stats.capturedFrames - d->mAllocationWarmupFrame;
+		for ( int i = 0; i < AllocationTracker::SlotCount; i++ )
 		{
-			/* close the output file */
-			avio_close( d->mFormatContext->pb );
+			stats.steadyStateAllocations[i] = AllocationTracker::Difference( d->mAllocationFinal.slots[i], d->mAllocationWarmup.slots[i] );
 		}
-
-		/* free the stream */
-		avformat_free_context( d->mFormatContext );
-		d->mFormatContext = nullptr;
+		stats.steadyStateNetGrowth = d->mAllocationFinal.liveBytes - d->mAllocationWarmup.liveBytes;
 	}
 }
+
+IDeckLinkMemoryAllocator *Recorder::FrameAllocator() const
+{
+	return d->mRawWriter ? d->mRawWriter->Allocator() : nullptr;
+}
+
+void Recorder::CleanUp()
+{
+	if ( d->mTracer.IsEnabled() )
+	{
+		d->mTracer.Stop();
+		d->mTracer.WriteChromeTrace( qUtf8Printable( d->mSettings.traceFile ) );
+	}
+
+	d->CloseOutput();
+	// buffers still referenced stay valid, the pool goes once the last of them is returned
+	av_buffer_pool_uninit( &d->mCaptureBufferPool );
+	for ( int plane = 0; plane < 4; plane++ )
+	{
+		av_buffer_pool_uninit( &d->mEncodingPools[plane] );
+	}
+}
\ No newline at end of file
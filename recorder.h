@@ -2,19 +2,57 @@
 #define RECORDER_H
 
 #include <pthread.h>
+#include <QString>
 #include "decklink/DeckLinkAPI.h"
 
+struct AVFrame;
+struct AVPacket;
+class FaultInjector;
+struct RecorderSettings;
+struct RecorderStats;
+
+// sees the pipeline data by reference on the pipeline threads, without copies: a callback must return quickly
+// and take its own reference (av_frame_ref / av_packet_ref) to keep the data beyond the call
+class RecorderObserver
+{
+public:
+	virtual ~RecorderObserver() {}
+	// decoder thread, every decoded picture of a take
+	virtual void FrameDecoded( const AVFrame * /*frame*/ ) {}
+	// writer thread, every encoded packet right before it goes into the file
+	virtual void PacketEncoded( const AVPacket * /*packet*/ ) {}
+};
+
 class Recorder : public IDeckLinkInputCallback
 {
 public:
 	Recorder();
 	~Recorder();
 
-	bool Init( int timeBaseNum, int timeBaseDen );
-	void Start();
+	void SetSettings( const RecorderSettings &settings );
+	// encoder and writer call into the injector when set, must outlive the recording
+	void SetFaultInjector( FaultInjector *faultInjector );
+	// observers must not add or remove observers from their callbacks
+	void AddObserver( RecorderObserver *observer );
+	void RemoveObserver( RecorderObserver *observer );
+	// opens decoder and encoders, they stay open for all takes
+	bool Init( int timeBaseNum, int timeBaseDen, int width, int height, BMDPixelFormat pixelFormat );
+	// spawns the stage threads and runs dummy frames through decoder, conversion and encoder so the first take starts warm
+	bool Arm();
+	// records a take into the settings output file
+	bool Start();
+	// records a take into its own file, only the muxer is opened
+	bool StartTake( const QString &outputFile );
+	// stops the take and returns once its file is finished
 	void Stop();
+	bool IsRecording() const;
 	void CleanUp();
 
+	void GetStats( RecorderStats &stats ) const;
+	// page aligned capture buffers the raw direct mode writes without a copy, nullptr in the other modes; to be set
+	// on the input before it is enabled
+	IDeckLinkMemoryAllocator *FrameAllocator() const;
+
 public:
 	HRESULT STDMETHODCALLTYPE QueryInterface( REFIID /*iid*/, LPVOID */*ppv*/ ) override
 	{
@@ -49,6 +87,8 @@ public:
 	HRESULT STDMETHODCALLTYPE VideoInputFrameArrived( IDeckLinkVideoInputFrame *, IDeckLinkAudioInputPacket * ) override;
 
 private:
+	friend class RecorderBenchmark;
+
 	ULONG mRefCount;
 	pthread_mutex_t mMutex;
 
@@ -0,0 +1,81 @@
+# recorder pipeline sources shared by the application and the benchmark
+
+INCLUDEPATH += \
+	$${PWD}/deps/ffmpeg/include \
+	$${PWD}/deps/x264/include 
+
+LIBS += \
+	-L$${PWD}/deps/ffmpeg/lib \
+	-L$${PWD}/deps/x264/lib \
+	-lavcodec \
+	-lavdevice \
+	-lavfilter \
+	-lavformat \
+	-lavutil \
+	-lswresample \
+	-lswscale \
+	-lx264 \
+	-ldl
+
+HEADERS += \
+	$${PWD}/alignedframeallocator.h \
+	$${PWD}/allocationtracker.h \
+	$${PWD}/capturesource.h \
+	$${PWD}/decklink/DeckLinkAPI.h \
+	$${PWD}/emulator/displaymodes.h \
+	$${PWD}/emulator/emulatedframe.h \
+	$${PWD}/ffmpegutils.h \
+	$${PWD}/decklinkmanager.h \
+	$${PWD}/downscalepyramid.h \
+	$${PWD}/encoderbackend.h \
+	$${PWD}/faultinjector.h \
+	$${PWD}/latencyhistogram.h \
+	$${PWD}/memorybudget.h \
+	$${PWD}/outputverifier.h \
+	$${PWD}/packetbufferpool.h \
+	$${PWD}/proresencoder.h \
+	$${PWD}/proxybranch.h \
+	$${PWD}/rawdiskwriter.h \
+	$${PWD}/recorder.h \
+	$${PWD}/recorder_p.h \
+	$${PWD}/recordersettings.h \
+	$${PWD}/recorderstats.h \
+	$${PWD}/replaysource.h \
+	$${PWD}/shellpool.h \
+	$${PWD}/soakmonitor.h \
+	$${PWD}/stageprofiler.h \
+	$${PWD}/stagequeue.h \
+	$${PWD}/startupprofile.h \
+	$${PWD}/thumbnaillane.h \
+	$${PWD}/tracer.h
+
+SOURCES += \
+	$${PWD}/alignedframeallocator.cpp \
+	$${PWD}/allocationtracker.cpp \
+	$${PWD}/decklink/DeckLinkAPIDispatch.cpp \
+	$${PWD}/decklinkmanager.cpp \
+	$${PWD}/downscalepyramid.cpp \
+	$${PWD}/emulator/displaymodes.cpp \
+	$${PWD}/emulator/emulatedframe.cpp \
+	$${PWD}/encoderbackend.cpp \
+	$${PWD}/faultinjector.cpp \
+	$${PWD}/latencyhistogram.cpp \
+	$${PWD}/memorybudget.cpp \
+	$${PWD}/outputverifier.cpp \
+	$${PWD}/packetbufferpool.cpp \
+	$${PWD}/proresencoder.cpp \
+	$${PWD}/proxybranch.cpp \
+	$${PWD}/rawdiskwriter.cpp \
+	$${PWD}/recorder.cpp \
+	$${PWD}/recorderstats.cpp \
+	$${PWD}/replaysource.cpp \
+	$${PWD}/soakmonitor.cpp \
+	$${PWD}/stageprofiler.cpp \
+	$${PWD}/startupprofile.cpp \
+	$${PWD}/thumbnaillane.cpp \
+	$${PWD}/tracer.cpp
+
+# heap accounting build: qmake CONFIG+=alloc_instrumentation
+alloc_instrumentation {
+	DEFINES += __ALLOC_INSTRUMENTATION__=1
+}
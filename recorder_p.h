@@ -0,0 +1,310 @@
+#ifndef RECORDER_P_H
+#define RECORDER_P_H
+
+// private part of Recorder, shared with the benchmark which drives the stage functions directly
+
+#include <chrono>
+#include <stdio.h>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <QFuture>
+#include <QtConcurrent/QtConcurrent>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavformat/avformat.h"
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+#include "deps/ffmpeg/include/libavcodec/codec.h"
+#include "deps/ffmpeg/include/libavcodec/packet.h"
+#include "deps/ffmpeg/include/libavutil/avutil.h"
+#include "deps/ffmpeg/include/libavutil/frame.h"
+#include "deps/ffmpeg/include/libavutil/samplefmt.h"
+#include "deps/ffmpeg/include/libavutil/opt.h"
+#include "deps/ffmpeg/include/libavutil/imgutils.h"
+#include "deps/ffmpeg/include/libswscale/swscale.h"
+}
+
+#include "allocationtracker.h"
+#include "downscalepyramid.h"
+#include "encoderbackend.h"
+#include "latencyhistogram.h"
+#include "memorybudget.h"
+#include "packetbufferpool.h"
+#include "proresencoder.h"
+#include "proxybranch.h"
+#include "rawdiskwriter.h"
+#include "recorder.h"
+#include "recordersettings.h"
+#include "shellpool.h"
+#include "stageprofiler.h"
+#include "stagequeue.h"
+#include "thumbnaillane.h"
+#include "tracer.h"
+
+#define __BMD_TO_AVFRAME__ 0
+#define __BMD_TO_PACKET__ 1
+
+///@cond INTERNAL
+
+class FaultInjector;
+
+class Recorder::PrivateClass
+{
+public:
+	uint64_t mFrameCount = 0;
+	std::atomic<uint64_t> mWrittenPackets;
+	// frames the device dropped before they reached us, seen as gaps in stream time
+	std::atomic<uint64_t> mDroppedFrames;
+	int64_t mLastCapturePts = AV_NOPTS_VALUE;
+
+	uint16_t mVideoWidth = 1920;
+	uint16_t mVideoHeight = 1080;
+	BMDPixelFormat mCapturePixelFormat = bmdFormat8BitYUV;
+	AVCodecID mInputVideoCodec = AV_CODEC_ID_RAWVIDEO;
+	AVPixelFormat mInputPixelFormat = AV_PIX_FMT_UYVY422;
+	// chosen at Init from the codec profile of the settings and the capture bit depth
+	EncoderBackend *mBackend = nullptr;
+	// set by native backends: the captured packets are encoded as they are, without decoder and conversion
+	ProResEncoder *mNativeEncoder = nullptr;
+	AVPixelFormat mPixelFormat = AV_PIX_FMT_YUV422P10LE;
+	AVCodecID mVideoCodec = AV_CODEC_ID_PRORES;
+	AVCodecID mAudioCodec = AV_CODEC_ID_PCM_S16LE;
+	AVRational mTimeBase = {1, 1};
+
+	const AVOutputFormat *mOutputFormat = nullptr;
+	AVFormatContext *mFormatContext = nullptr;
+	AVStream *mAudioStream = nullptr;
+	AVStream *mVideoStream = nullptr;
+	AVCodecContext *mVideoDecodingContext = nullptr;
+	AVCodecContext *mAudioCodecContext = nullptr;
+	AVCodecContext *mVideoCodecContext = nullptr;
+	AVFrame *mVideoEncodingFrame = nullptr;
+	// planes of the conversion target, a picture the encoder still holds is replaced by one from here
+	AVBufferPool *mEncodingPools[4] = {};
+	// the first picture of a take is encoded as a key frame, set before the stages start
+	bool mKeyFrameDue = true;
+	SwsContext *mSwScaleContext = nullptr;
+
+	std::atomic_bool mCaptureActive;
+	// what the capture thread needs of the video stream, copied at the start of a take: the stream itself goes
+	// away when the output closes while frames still arrive
+	AVRational mCaptureTimeBase = {1, 1};
+	int mCaptureStreamIndex = 0;
+	QThreadPool mThreadPool;
+	QFuture<void> mDecodingThread;
+	QFuture<void> mEncodingThread;
+	QFuture<void> mFileWritingThread;
+
+	// packet and frame structs are taken from and returned to these instead of allocated per frame, the
+	// capture copies come from a buffer pool; declared before the queues, whose handles return into them
+	PacketShellPool mPacketShells;
+	FrameShellPool mFrameShells;
+	AVBufferPool *mCaptureBufferPool = nullptr;
+	// encoded packet buffers, for the encoders that let us allocate them and the native encoder
+	PacketBufferPool mPacketBuffers;
+
+	// an empty handle in a queue marks the end of the take's stream, every stage passes it on after draining
+	StageQueue<PacketHandle> mDecodePacketQueue;
+	StageQueue<FrameHandle> mFrameQueue;
+	StageQueue<PacketHandle> mPacketQueue;
+
+	// --skip-duplicates with an intra-only codec: a picture identical to the one captured before it is neither
+	// converted nor encoded, the packet of that one goes to the writer again by reference with the new timestamps
+	bool mSkipDuplicates = false;
+	std::atomic<uint64_t> mDuplicateFrames;
+	// kept by the stage in front of the encoder for the comparison with the next capture
+	PacketHandle mPreviousCapture;
+	// encoder stage: encoder pts of the last picture sent, the last video packet with its encoder pts, and the
+	// repeats waiting for the packet of their picture to come out of the encoder
+	struct Repeat
+	{
+		int64_t sourcePts;
+		int64_t pts;
+		int64_t duration;
+	};
+	int64_t mLastSentPts = AV_NOPTS_VALUE;
+	PacketHandle mLastVideoPacket;
+	int64_t mLastVideoPacketPts = AV_NOPTS_VALUE;
+	Ring<Repeat> mRepeats;
+
+	// from the end of capture until the file of the take is finished
+	uint64_t mStopRequestNs = 0;
+	uint64_t mStopQueuedFrames = 0;
+	std::atomic<uint64_t> mLastStopLatencyNs;
+	std::atomic<uint64_t> mLastStopQueuedFrames;
+	LatencyHistogram mStopLatency;
+
+	// a backlog episode lasts from the frames in flight exceeding the threshold until they are back below it
+	uint64_t mBacklogStartNs = 0;
+	std::atomic<uint64_t> mBacklogEpisodes;
+	LatencyHistogram mBacklogRecovery;
+
+	// every captured, decoded and encoded buffer is admitted by its pool before it is allocated
+	MemoryBudget mMemoryBudget;
+	uint64_t mCaptureFrameBytes = 0;
+	uint64_t mDecodedFrameBytes = 0;
+	// held by the encoder stage while a picture is encoded, no packet is larger than the uncompressed picture
+	uint64_t mEncodeReserveBytes = 0;
+	// frames per stage the budget allows (0 = no budget)
+	uint64_t mStageDepth = 0;
+	// captured frames not queued because the capture pool was full
+	std::atomic<uint64_t> mBudgetDroppedFrames;
+
+	// half, quarter, ... size copies of every converted picture, for consumers of smaller renditions
+	DownscalePyramid *mPyramid = nullptr;
+	// second rendition of every take, fed with the decoded pictures by reference, or with a pyramid level
+	ProxyBranch *mProxy = nullptr;
+	bool mProxyActive = false;
+	int mProxyLevel = 0;
+	// periodic thumbnails for the asset manager, on an idle priority thread of their own
+	ThumbnailLane *mThumbnails = nullptr;
+	bool mThumbnailsActive = false;
+	// raw direct mode: the capture buffers go to disk as they are, decoder, encoders and muxer are not used
+	RawDiskWriter *mRawWriter = nullptr;
+
+	FaultInjector *mFaultInjector = nullptr;
+	QMutex mObserverMutex;
+	QVector<RecorderObserver *> mObservers;
+
+	// a take opens its own muxer, decoder and encoders stay open from Init until CleanUp
+	QMutex mOutputMutex;
+	// output opened by Init ahead of the first take, so starting it does not wait for the file and header
+	QString mPreparedOutputFile;
+	std::atomic<uint64_t> mTakes;
+	uint64_t mTakeFrames = 0;
+	// the device keeps streaming between takes, the first frame of a take becomes pts 0
+	int64_t mTakeStartPts = AV_NOPTS_VALUE;
+	uint64_t mTakeStartNs = 0;
+	std::atomic<uint64_t> mLastStartLatencyNs;
+	// from the start of a take to its first packet in the file
+	LatencyHistogram mStartLatency;
+	// end-to-end latency of the first frame of the last take, compared against the steady state
+	std::atomic<uint64_t> mFirstFrameLatencyNs;
+	// a started take records from the first frame at or after this device frame number or timecode
+	std::atomic_bool mWaitingForStart;
+	int64_t mStartFrame = -1;
+	int mStartTimecode[4] = { -1, -1, -1, -1 };
+
+	RecorderSettings mSettings;
+	StageProfiler mProfiler;
+	Tracer mTracer;
+	// capture time of recent frames by frame id, the writer turns them into end-to-end latency
+	enum { CaptureTimeSlots = 4096 };
+	std::atomic<uint64_t> mCaptureTimes[CaptureTimeSlots];
+	LatencyHistogram mEndToEndLatency;
+	std::atomic<uint64_t> mWrittenBytes;
+	// heap snapshots bracketing the steady state (instrumentation builds only)
+	uint64_t mAllocationWarmupFrame = 0;
+	AllocationTracker::Snapshot mAllocationWarmup;
+	AllocationTracker::Snapshot mAllocationFinal;
+
+	Recorder *mOwner;
+	PrivateClass( Recorder *recorder )
+	{
+		mCaptureActive = false;
+		mWrittenPackets = 0;
+		mDroppedFrames = 0;
+		mWrittenBytes = 0;
+		mBacklogEpisodes = 0;
+		mBudgetDroppedFrames = 0;
+		mDuplicateFrames = 0;
+		mTakes = 0;
+		mLastStartLatencyNs = 0;
+		mFirstFrameLatencyNs = 0;
+		mLastStopLatencyNs = 0;
+		mLastStopQueuedFrames = 0;
+		mWaitingForStart = false;
+		for ( int i = 0; i < CaptureTimeSlots; i++ )
+		{
+			mCaptureTimes[i] = 0;
+		}
+		mOwner = recorder;
+		// decoder, encoder, writer and proxy block on their queues for a whole take, the audio flush needs one more
+		mThreadPool.setMaxThreadCount( qMax( mThreadPool.maxThreadCount(), 5 ) );
+	}
+	~PrivateClass()
+	{
+		delete mThumbnails;
+		mThumbnails = nullptr;
+		delete mProxy;
+		mProxy = nullptr;
+		delete mPyramid;
+		mPyramid = nullptr;
+		delete mNativeEncoder;
+		mNativeEncoder = nullptr;
+		delete mBackend;
+		mBackend = nullptr;
+		delete mRawWriter;
+		mRawWriter = nullptr;
+	}
+
+	void HandleVideoFrame( IDeckLinkVideoInputFrame *videoFrame );
+	void HandleAudioFrame( IDeckLinkAudioInputPacket *audioFrame );
+	void TrackBacklog( uint64_t nowNs );
+	void FillVideoFrame( AVFrame *src );
+	bool InitEncodingPools();
+	bool AcquireEncodingPicture();
+
+	bool InitVideoDecoder( AVCodecID inputCodecID, AVPixelFormat inputPixelFormat );
+	bool OpenAudioEncoder( AVCodecID codec_id );
+	bool OpenVideoEncoder( AVCodecID codec_id );
+	bool ResetEncoders();
+	bool ConfigureMemoryBudget();
+	uint64_t EstimatedEncodedFrameBytes() const;
+	int CaptureBitDepth() const
+	{
+		return mCapturePixelFormat == bmdFormat10BitYUV ? 10 : 8;
+	}
+	bool WarmUp( int frames );
+	bool IsStartFrame( IDeckLinkVideoInputFrame *videoFrame ) const;
+	bool AddAudioStream();
+	bool AddVideoStream();
+	bool OpenOutput( const QString &outputFile );
+	void CloseOutput();
+	// duplicate: pkt is identical to the capture before it, its pictures skip conversion and encoder
+	bool DecodeAndEnqueue( AVPacket *pkt, bool duplicate = false );
+	bool EncodeAndEnqueueFrame( AVFrame *frame );
+	// native encoder mode: one captured packet straight into an encoded one
+	bool EncodeAndEnqueueCaptured( AVPacket *captured );
+	// encoder timestamps (codec time base, frames) into the time base of the stream
+	static void RescalePacketTimestamps( AVPacket *packet, AVCodecContext *codecContext, AVStream *stream );
+	void Flush( AVCodecContext *codecContext, int streamIndex );
+	bool IsDuplicateCapture( const AVPacket *pkt ) const;
+	// queues an encoded video packet, keeps it for repeats of its picture and queues those that waited for it
+	void PushVideoPacket( PacketHandle &pkt, int64_t encoderPts );
+	// the last picture sent to the encoder once more, at pts
+	void RepeatLastPicture( int64_t pts, int64_t duration );
+	void PushRepeats();
+	// forgets pictures and packets of the take for the comparisons of the next one
+	void ResetDuplicates();
+	int InterleaveFrameIntoFile( AVPacket *packet );
+	void DecodingThreadFunction();
+	void EncodingThreadFunction();
+	void NativeEncodingThreadFunction();
+	void PacketWritingThreadFunction();
+	void RawWritingThreadFunction();
+	// the take's file is finished: stop latency, and the application ends after its only take
+	void FinishTake();
+
+	// ends capture of the take and queues the end of stream, only the first call does
+	void EndCapture();
+
+	// opaque of a decoded picture that repeats the previous one, and of the packet queued for it
+	static void *DuplicatePicture()
+	{
+		static char marker;
+		return &marker;
+	}
+	static int64_t FrameId( int64_t pts, int64_t duration )
+	{
+		return duration > 0 ? pts / duration : pts;
+	}
+	static uint64_t MonotonicNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+	}
+};
+
+///@endcond INTERNAL
+
+#endif // RECORDER_P_H
@@ -0,0 +1,367 @@
+#include "recorderapi.h"
+
+#include <string.h>
+#include <QMutex>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/packet.h"
+#include "deps/ffmpeg/include/libavutil/frame.h"
+#include "deps/ffmpeg/include/libavutil/pixfmt.h"
+}
+
+#include "decklink/DeckLinkAPI.h"
+#include "decklinkmanager.h"
+#include "recorder.h"
+#include "recordersettings.h"
+#include "recorderstats.h"
+#include "replaysource.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+// RecorderFrame and RecorderPacket are the AVFrame and AVPacket themselves, handing them out costs nothing
+const AVFrame *ToFrame( const RecorderFrame *frame )
+{
+	return reinterpret_cast<const AVFrame *>( frame );
+}
+
+const AVPacket *ToPacket( const RecorderPacket *packet )
+{
+	return reinterpret_cast<const AVPacket *>( packet );
+}
+
+int64_t FrameIndex( int64_t pts, int64_t duration )
+{
+	return duration > 0 ? pts / duration : pts;
+}
+
+// forwards the observer calls to the callbacks of the host
+class CallbackObserver : public RecorderObserver
+{
+public:
+	QMutex mMutex;
+	RecorderFrameCallback mFrameCallback = nullptr;
+	void *mFrameUser = nullptr;
+	RecorderPacketCallback mPacketCallback = nullptr;
+	void *mPacketUser = nullptr;
+
+	void FrameDecoded( const AVFrame *frame ) override
+	{
+		QMutexLocker locker( &mMutex );
+		if ( mFrameCallback )
+		{
+			mFrameCallback( reinterpret_cast<const RecorderFrame *>( frame ), mFrameUser );
+		}
+	}
+	void PacketEncoded( const AVPacket *packet ) override
+	{
+		QMutexLocker locker( &mMutex );
+		if ( mPacketCallback )
+		{
+			mPacketCallback( reinterpret_cast<const RecorderPacket *>( packet ), mPacketUser );
+		}
+	}
+};
+
+}
+
+struct RecorderHandle
+{
+	Recorder *mRecorder = nullptr;
+	CaptureSource *mCaptureSource = nullptr;
+	CallbackObserver mObserver;
+};
+
+///@endcond INTERNAL
+
+int recorder_api_version( void )
+{
+	return RECORDER_API_VERSION;
+}
+
+void recorder_open_options_init( RecorderOpenOptions *options )
+{
+	if ( !options )
+	{
+		return;
+	}
+	memset( options, 0, sizeof( RecorderOpenOptions ) );
+	options->struct_size = sizeof( RecorderOpenOptions );
+	options->display_mode = bmdModeHD1080p50;
+	options->pixel_format = bmdFormat8BitYUV;
+	options->prores_profile = 1;
+	options->arm_frames = 8;
+	options->replay_realtime = 1;
+}
+
+RecorderHandle *recorder_open( const RecorderOpenOptions *options )
+{
+	// fields the host does not know about keep their defaults
+	RecorderOpenOptions opts;
+	recorder_open_options_init( &opts );
+	if ( options )
+	{
+		memcpy( &opts, options, qMin( ( size_t )options->struct_size, sizeof( RecorderOpenOptions ) ) );
+		opts.struct_size = sizeof( RecorderOpenOptions );
+	}
+	if ( opts.display_mode == 0 )
+	{
+		opts.display_mode = bmdModeHD1080p50;
+	}
+	if ( opts.pixel_format == 0 )
+	{
+		opts.pixel_format = bmdFormat8BitYUV;
+	}
+
+	RecorderHandle *handle = new RecorderHandle();
+	handle->mRecorder = new Recorder();
+	handle->mRecorder->AddRef();
+
+	RecorderSettings settings;
+	// the library records takes on request and never touches the event loop of the host
+	settings.daemon = true;
+	settings.logFrames = false;
+	settings.maxFrames = 0;
+	static const char *proresProfiles[] = { "prores_proxy", "prores_lt", "prores_422", "prores_hq" };
+	settings.videoCodec = opts.codec ? opts.codec : proresProfiles[qBound( 0, opts.prores_profile, 3 )];
+	settings.armFrames = opts.arm_frames;
+	settings.memoryBudget = opts.memory_budget_mb * 1048576ull;
+	// takes get their own names, this one only selects the container
+	settings.outputFile = QString( "take.%1" ).arg( opts.container ? opts.container : "mov" );
+	handle->mRecorder->SetSettings( settings );
+	handle->mRecorder->AddObserver( &handle->mObserver );
+
+	if ( opts.replay_file )
+	{
+		ReplaySource *replaySource = new ReplaySource( handle->mRecorder, opts.replay_file );
+		replaySource->SetRealtime( opts.replay_realtime != 0 );
+		replaySource->SetLoop( opts.replay_loop != 0 );
+		handle->mCaptureSource = replaySource;
+	}
+	else
+	{
+		handle->mCaptureSource = new DecklinkManager( handle->mRecorder );
+	}
+	handle->mCaptureSource->SetDisplayMode( opts.display_mode );
+	handle->mCaptureSource->SetPixelFormat( opts.pixel_format );
+
+	int num = 0, den = 1;
+	int width = 0, height = 0;
+	bool ok = handle->mCaptureSource->Init()
+			  && handle->mCaptureSource->GetTimeBase( num, den )
+			  && handle->mCaptureSource->GetVideoSize( width, height )
+			  && handle->mRecorder->Init( num, den, width, height, ( BMDPixelFormat )opts.pixel_format )
+			  && handle->mRecorder->Arm()
+			  && handle->mCaptureSource->Start();
+	if ( !ok )
+	{
+		fprintf( stderr, "Could not open the recorder input\n" );
+		recorder_close( handle );
+		return nullptr;
+	}
+	return handle;
+}
+
+void recorder_close( RecorderHandle *recorder )
+{
+	if ( !recorder )
+	{
+		return;
+	}
+
+	recorder->mCaptureSource->Stop();
+	recorder->mRecorder->Stop();
+	recorder->mRecorder->RemoveObserver( &recorder->mObserver );
+	recorder->mCaptureSource->CleanUp();
+	recorder->mRecorder->CleanUp();
+	delete recorder->mCaptureSource;
+	recorder->mCaptureSource = nullptr;
+	delete recorder->mRecorder;
+	recorder->mRecorder = nullptr;
+	delete recorder;
+}
+
+int recorder_start_take( RecorderHandle *recorder, const char *output_file )
+{
+	if ( !recorder || !output_file )
+	{
+		return -1;
+	}
+	return recorder->mRecorder->StartTake( QString::fromUtf8( output_file ) ) ? 0 : -1;
+}
+
+int recorder_stop_take( RecorderHandle *recorder )
+{
+	if ( !recorder )
+	{
+		return -1;
+	}
+	recorder->mRecorder->Stop();
+	return 0;
+}
+
+int recorder_is_recording( RecorderHandle *recorder )
+{
+	return recorder && recorder->mRecorder->IsRecording() ? 1 : 0;
+}
+
+int recorder_get_statistics( RecorderHandle *recorder, RecorderStatistics *statistics )
+{
+	if ( !recorder || !statistics || statistics->struct_size == 0 )
+	{
+		return -1;
+	}
+
+	RecorderStats stats;
+	recorder->mRecorder->GetStats( stats );
+
+	RecorderStatistics result;
+	memset( &result, 0, sizeof( result ) );
+	result.struct_size = sizeof( RecorderStatistics );
+	result.recording = recorder->mRecorder->IsRecording() ? 1 : 0;
+	result.takes = stats.takes;
+	result.captured_frames = stats.capturedFrames;
+	result.dropped_frames = stats.droppedFrames;
+	result.written_packets = stats.writtenPackets;
+	result.written_bytes = stats.writtenBytes;
+	result.decode_queue_depth = stats.decodeQueueDepth;
+	result.frame_queue_depth = stats.frameQueueDepth;
+	result.packet_queue_depth = stats.packetQueueDepth;
+	result.end_to_end_p50_ns = stats.endToEndLatency.Percentile( 0.5 );
+	result.end_to_end_p99_ns = stats.endToEndLatency.Percentile( 0.99 );
+	result.start_latency_ns = stats.lastStartLatencyNs;
+	result.stop_latency_ns = stats.lastStopLatencyNs;
+	for ( int i = 0; i < MemoryBudget::PoolCount; i++ )
+	{
+		result.memory_used_bytes += stats.memoryPools[i].used;
+		// peaks of different pools need not coincide, their sum is an upper bound
+		result.memory_peak_bytes += stats.memoryPools[i].peak;
+	}
+	result.budget_dropped_frames = stats.budgetDroppedFrames;
+
+	// an older host gets the fields it knows
+	uint32_t size = qMin( statistics->struct_size, ( uint32_t )sizeof( RecorderStatistics ) );
+	memcpy( statistics, &result, size );
+	statistics->struct_size = size;
+	return 0;
+}
+
+int recorder_set_frame_callback( RecorderHandle *recorder, RecorderFrameCallback callback, void *user )
+{
+	if ( !recorder )
+	{
+		return -1;
+	}
+	QMutexLocker locker( &recorder->mObserver.mMutex );
+	recorder->mObserver.mFrameCallback = callback;
+	recorder->mObserver.mFrameUser = user;
+	return 0;
+}
+
+int recorder_set_packet_callback( RecorderHandle *recorder, RecorderPacketCallback callback, void *user )
+{
+	if ( !recorder )
+	{
+		return -1;
+	}
+	QMutexLocker locker( &recorder->mObserver.mMutex );
+	recorder->mObserver.mPacketCallback = callback;
+	recorder->mObserver.mPacketUser = user;
+	return 0;
+}
+
+RecorderFrame *recorder_frame_ref( const RecorderFrame *frame )
+{
+	// a new reference to the same buffers, the picture is not copied
+	return frame ? reinterpret_cast<RecorderFrame *>( av_frame_clone( ToFrame( frame ) ) ) : nullptr;
+}
+
+void recorder_frame_release( RecorderFrame *frame )
+{
+	AVFrame *avFrame = reinterpret_cast<AVFrame *>( frame );
+	av_frame_free( &avFrame );
+}
+
+int recorder_frame_width( const RecorderFrame *frame )
+{
+	return frame ? ToFrame( frame )->width : 0;
+}
+
+int recorder_frame_height( const RecorderFrame *frame )
+{
+	return frame ? ToFrame( frame )->height : 0;
+}
+
+RecorderPixelFormat recorder_frame_format( const RecorderFrame *frame )
+{
+	if ( !frame )
+	{
+		return RECORDER_PIXEL_FORMAT_UNKNOWN;
+	}
+	switch ( ToFrame( frame )->format )
+	{
+		case AV_PIX_FMT_UYVY422:
+			return RECORDER_PIXEL_FORMAT_UYVY;
+		case AV_PIX_FMT_YUV422P10LE:
+			return RECORDER_PIXEL_FORMAT_YUV422P10;
+		default:
+			return RECORDER_PIXEL_FORMAT_UNKNOWN;
+	}
+}
+
+int64_t recorder_frame_index( const RecorderFrame *frame )
+{
+	return frame ? FrameIndex( ToFrame( frame )->pts, ToFrame( frame )->pkt_duration ) : -1;
+}
+
+int recorder_frame_plane( const RecorderFrame *frame, int plane, const uint8_t **data, int *line_size )
+{
+	if ( !frame || plane < 0 || plane >= AV_NUM_DATA_POINTERS || !data || !line_size || !ToFrame( frame )->data[plane] )
+	{
+		return -1;
+	}
+	*data = ToFrame( frame )->data[plane];
+	*line_size = ToFrame( frame )->linesize[plane];
+	return 0;
+}
+
+RecorderPacket *recorder_packet_ref( const RecorderPacket *packet )
+{
+	// encoded packets are reference counted, the clone shares their buffer
+	return packet ? reinterpret_cast<RecorderPacket *>( av_packet_clone( ToPacket( packet ) ) ) : nullptr;
+}
+
+void recorder_packet_release( RecorderPacket *packet )
+{
+	AVPacket *avPacket = reinterpret_cast<AVPacket *>( packet );
+	av_packet_free( &avPacket );
+}
+
+int recorder_packet_is_video( const RecorderPacket *packet )
+{
+	// the video stream is the first stream of every take
+	return packet && ToPacket( packet )->stream_index == 0 ? 1 : 0;
+}
+
+int recorder_packet_is_keyframe( const RecorderPacket *packet )
+{
+	return packet && ( ToPacket( packet )->flags & AV_PKT_FLAG_KEY ) ? 1 : 0;
+}
+
+int64_t recorder_packet_index( const RecorderPacket *packet )
+{
+	return packet ? FrameIndex( ToPacket( packet )->pts, ToPacket( packet )->duration ) : -1;
+}
+
+int recorder_packet_data( const RecorderPacket *packet, const uint8_t **data, int *size )
+{
+	if ( !packet || !data || !size )
+	{
+		return -1;
+	}
+	*data = ToPacket( packet )->data;
+	*size = ToPacket( packet )->size;
+	return 0;
+}
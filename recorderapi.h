@@ -0,0 +1,136 @@
+#ifndef RECORDERAPI_H
+#define RECORDERAPI_H
+
+/*
+ * C interface of librecorder for host applications.
+ *
+ * A recorder keeps its input streaming and its codecs open from recorder_open until recorder_close and records
+ * takes into files between recorder_start_take and recorder_stop_take. Structs passed in and out start with
+ * struct_size, set it to sizeof of the struct: fields added in later versions are appended, so a host built
+ * against an older header keeps working.
+ *
+ * Functions returning int return 0 on success and a negative value on failure.
+ */
+
+#include <stdint.h>
+
+#if defined( RECORDER_API_BUILD )
+#define RECORDER_API __attribute__( ( visibility( "default" ) ) )
+#else
+#define RECORDER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RECORDER_API_VERSION 1
+
+typedef struct RecorderHandle RecorderHandle;
+typedef struct RecorderFrame RecorderFrame;
+typedef struct RecorderPacket RecorderPacket;
+
+typedef enum RecorderPixelFormat
+{
+	RECORDER_PIXEL_FORMAT_UNKNOWN = 0,
+	// packed 8 bit 4:2:2, one plane
+	RECORDER_PIXEL_FORMAT_UYVY = 1,
+	// planar 10 bit 4:2:2 in 16 bit little endian words, three planes
+	RECORDER_PIXEL_FORMAT_YUV422P10 = 2
+} RecorderPixelFormat;
+
+typedef struct RecorderOpenOptions
+{
+	uint32_t struct_size;
+	// NULL captures from the first DeckLink device, otherwise a raw UYVY/v210 recording is replayed
+	const char *replay_file;
+	// BMDDisplayMode four character code, 0 = 'Hp50' (1080p50)
+	uint32_t display_mode;
+	// BMDPixelFormat, 0 = '2vuy' (8 bit UYVY), 'v210' for 10 bit
+	uint32_t pixel_format;
+	// 0 proxy, 1 LT, 2 standard, 3 HQ; used when codec is NULL
+	int prores_profile;
+	// container of the takes, by file extension, NULL = "mov"
+	const char *container;
+	// dummy frames run through the pipeline before the first take
+	int arm_frames;
+	// replay only: pace at the display mode rate (1) or as fast as possible (0), restart at end of file (1)
+	int replay_realtime;
+	int replay_loop;
+	// megabytes the buffers of the pipeline may hold at once, 0 = unlimited
+	uint64_t memory_budget_mb;
+	// video codec profile: prores_proxy, prores_lt, prores_422, prores_hq, dnxhr_sq, dnxhr_hq, dnxhr_hqx, ffv1, x264
+	// or raw; NULL = the ProRes profile above
+	const char *codec;
+} RecorderOpenOptions;
+
+typedef struct RecorderStatistics
+{
+	uint32_t struct_size;
+	int recording;
+	uint64_t takes;
+	uint64_t captured_frames;
+	uint64_t dropped_frames;
+	uint64_t written_packets;
+	uint64_t written_bytes;
+	uint64_t decode_queue_depth;
+	uint64_t frame_queue_depth;
+	uint64_t packet_queue_depth;
+	// capture callback to written packet
+	uint64_t end_to_end_p50_ns;
+	uint64_t end_to_end_p99_ns;
+	// of the last take: start to its first packet in the file, end of capture to the finished file
+	uint64_t start_latency_ns;
+	uint64_t stop_latency_ns;
+	// bytes held by captured, decoded and encoded frames, and frames refused because the budget was used up
+	uint64_t memory_used_bytes;
+	uint64_t memory_peak_bytes;
+	uint64_t budget_dropped_frames;
+} RecorderStatistics;
+
+/*
+ * Observers run on the pipeline threads for every decoded frame and every encoded packet of a take. The frame or
+ * packet is only valid during the call; a callback that needs it longer takes a reference (no data is copied) and
+ * releases it later from any thread. Callbacks must return quickly, the pipeline waits for them, and must not
+ * call recorder_set_frame_callback or recorder_set_packet_callback.
+ */
+typedef void ( *RecorderFrameCallback )( const RecorderFrame *frame, void *user );
+typedef void ( *RecorderPacketCallback )( const RecorderPacket *packet, void *user );
+
+RECORDER_API int recorder_api_version( void );
+RECORDER_API void recorder_open_options_init( RecorderOpenOptions *options );
+
+RECORDER_API RecorderHandle *recorder_open( const RecorderOpenOptions *options );
+RECORDER_API void recorder_close( RecorderHandle *recorder );
+
+RECORDER_API int recorder_start_take( RecorderHandle *recorder, const char *output_file );
+// returns once the file of the take is finished
+RECORDER_API int recorder_stop_take( RecorderHandle *recorder );
+RECORDER_API int recorder_is_recording( RecorderHandle *recorder );
+RECORDER_API int recorder_get_statistics( RecorderHandle *recorder, RecorderStatistics *statistics );
+
+// NULL callback removes the observer; replacing or removing waits for a running callback to return
+RECORDER_API int recorder_set_frame_callback( RecorderHandle *recorder, RecorderFrameCallback callback, void *user );
+RECORDER_API int recorder_set_packet_callback( RecorderHandle *recorder, RecorderPacketCallback callback, void *user );
+
+RECORDER_API RecorderFrame *recorder_frame_ref( const RecorderFrame *frame );
+RECORDER_API void recorder_frame_release( RecorderFrame *frame );
+RECORDER_API int recorder_frame_width( const RecorderFrame *frame );
+RECORDER_API int recorder_frame_height( const RecorderFrame *frame );
+RECORDER_API RecorderPixelFormat recorder_frame_format( const RecorderFrame *frame );
+// presentation time in units of the frame duration since the start of the take
+RECORDER_API int64_t recorder_frame_index( const RecorderFrame *frame );
+RECORDER_API int recorder_frame_plane( const RecorderFrame *frame, int plane, const uint8_t **data, int *line_size );
+
+RECORDER_API RecorderPacket *recorder_packet_ref( const RecorderPacket *packet );
+RECORDER_API void recorder_packet_release( RecorderPacket *packet );
+RECORDER_API int recorder_packet_is_video( const RecorderPacket *packet );
+RECORDER_API int recorder_packet_is_keyframe( const RecorderPacket *packet );
+RECORDER_API int64_t recorder_packet_index( const RecorderPacket *packet );
+RECORDER_API int recorder_packet_data( const RecorderPacket *packet, const uint8_t **data, int *size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORDERAPI_H
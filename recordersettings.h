@@ -0,0 +1,53 @@
+#ifndef RECORDERSETTINGS_H
+#define RECORDERSETTINGS_H
+
+#include <stdint.h>
+#include <QString>
+
+struct RecorderSettings
+{
+	QString outputFile = "/tmp/testing.mov";
+	// video codec profile, one of EncoderBackend::Profiles()
+	QString videoCodec = "prores_lt";
+	// print a line for every received frame and written packet
+	bool logFrames = true;
+	// capture of a take stops after this many frames, 0 records until stopped
+	int maxFrames = 500;
+	// long running process recording takes on request, encoders are reset between takes instead of the process ending
+	bool daemon = false;
+	// dummy frames run through the pipeline by Arm (0 = cold start)
+	int armFrames = 8;
+	// Start waits for this device frame number or timecode (HH:MM:SS:FF) before recording
+	int64_t startFrame = -1;
+	QString startTimecode;
+	// frames queued between the stages above which the pipeline counts as backlogged
+	int backlogThreshold = 2;
+	// x264 only: frames per GOP, B-frames between references, frames of rate control lookahead (-1 = encoder default)
+	int gopSize = 1;
+	int bFrames = 0;
+	int lookahead = -1;
+	// H.264 proxy next to every take, downscaled by the divisor, encoded on a low priority thread
+	bool proxy = false;
+	int proxyDivisor = 2;
+	int proxyBitrateKbps = 8000;
+	// JPEG thumbnail every interval into the directory, at 1/divisor size (power of two), empty = none
+	QString thumbnailDirectory;
+	int thumbnailInterval = 10;
+	int thumbnailDivisor = 8;
+	// capture buffers written as they are (UYVY/v210) with O_DIRECT into the output file and a sidecar index, nothing
+	// is decoded or encoded
+	bool rawDirect = false;
+	// intra-only codecs: a picture identical to the one captured before it is written as that one's packet again
+	bool skipDuplicates = false;
+	// bytes the buffers of the pipeline may hold at once, split into a pool per stage at Init (0 = unlimited)
+	uint64_t memoryBudget = 0;
+
+	// when set, per-frame stage spans are traced and written as Chrome JSON trace at stop
+	QString traceFile;
+	int traceEventsPerThread = 65536;
+
+	// heap accounting of the steady state starts at this frame (0 = off, needs the alloc_instrumentation build)
+	int allocationWarmupFrames = 0;
+};
+
+#endif // RECORDERSETTINGS_H
@@ -0,0 +1,113 @@
+#include "recorderstats.h"
+
+bool RecorderStats::IsAllocationFree() const
+{
+	if ( !allocationsTracked )
+	{
+		return false;
+	}
+
+	for ( int i = 0; i < AllocationTracker::SlotCount; i++ )
+	{
+		if ( steadyStateAllocations[i].allocations > 0 || steadyStateAllocations[i].bufferAllocations > 0 )
+		{
+			return false;
+		}
+	}
+	return steadyStateNetGrowth <= 0;
+}
+
+void RecorderStats::Print( FILE *stream ) const
+{
+	fprintf( stream, "Captured frames: %lu, dropped frames: %lu, written packets: %lu\n", capturedFrames, droppedFrames, writtenPackets );
+	fprintf( stream, "Queue peaks: decode %lu, encode %lu, write %lu\n", decodeQueuePeak, frameQueuePeak, packetQueuePeak );
+	if ( backlogEpisodes > 0 )
+	{
+		fprintf( stream, "Backlog episodes: %lu, recovered %lu, recovery p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+				 backlogEpisodes, backlogRecovery.Total(), backlogRecovery.Percentile( 0.5 ) / 1e6, backlogRecovery.Percentile( 0.99 ) / 1e6,
+				 backlogRecovery.Max() / 1e6 );
+	}
+	if ( takes > 1 )
+	{
+		fprintf( stream, "Takes: %lu, start to first frame p50 %.1f ms, max %.1f ms\n",
+				 takes, startLatency.Percentile( 0.5 ) / 1e6, startLatency.Max() / 1e6 );
+	}
+	else if ( startLatency.Total() > 0 )
+	{
+		fprintf( stream, "Start to first frame: %.1f ms\n", lastStartLatencyNs / 1e6 );
+	}
+	if ( firstFrameLatencyNs > 0 && endToEndLatency.Total() > 0 )
+	{
+		double steadyNs = endToEndLatency.Percentile( 0.5 );
+		fprintf( stream, "First frame end-to-end: %.2f ms, steady state p50 %.2f ms (%+.1f%%)\n",
+				 firstFrameLatencyNs / 1e6, steadyNs / 1e6, steadyNs > 0 ? 100.0 * ( firstFrameLatencyNs - steadyNs ) / steadyNs : 0.0 );
+	}
+	if ( stopLatency.Total() > 0 )
+	{
+		// worst case every queued frame passes all stages one after the other
+		double frameNs = 0.0;
+		for ( int i = 0; i < StageProfiler::StageCount; i++ )
+		{
+			frameNs += stages[i].frames > 0 ? ( double )stages[i].wallNs / stages[i].frames : 0.0;
+		}
+		fprintf( stream, "Stop: drained %lu queued frames in %.1f ms (bound %.1f ms), max over %lu takes %.1f ms\n",
+				 lastStopQueuedFrames, lastStopLatencyNs / 1e6, ( lastStopQueuedFrames + 1 ) * frameNs / 1e6, stopLatency.Total(), stopLatency.Max() / 1e6 );
+	}
+	if ( proxyFrames > 0 || proxySkippedFrames > 0 )
+	{
+		fprintf( stream, "Proxy: %lu frames encoded, %lu skipped while the proxy encoder was behind\n", proxyFrames, proxySkippedFrames );
+	}
+	if ( thumbnails > 0 || skippedThumbnails > 0 )
+	{
+		fprintf( stream, "Thumbnails: %lu written, %lu skipped while the lane was busy\n", thumbnails, skippedThumbnails );
+	}
+	if ( duplicateFrames > 0 )
+	{
+		fprintf( stream, "Duplicates: %lu of %lu frames (%.1f%%) repeated the previous packet instead of being encoded\n",
+				 duplicateFrames, capturedFrames, capturedFrames > 0 ? 100.0 * duplicateFrames / capturedFrames : 0.0 );
+	}
+	if ( rawFrames > 0 || rawDroppedFrames > 0 )
+	{
+		fprintf( stream, "Raw: %lu frames written, %lu of them through a bounce copy, %lu dropped while the disk was behind\n",
+				 rawFrames, rawCopiedFrames, rawDroppedFrames );
+	}
+	StageProfiler::PrintStats( stages, stream );
+
+	if ( memoryBudget > 0 )
+	{
+		fprintf( stream, "Memory budget: %.0f MB, frames refused at capture: %lu\n", memoryBudget / 1048576.0, budgetDroppedFrames );
+	}
+	MemoryBudget::PrintStats( memoryPools, stream );
+	if ( packetBuffers.requests > 0 )
+	{
+		fprintf( stream, "Packet buffers: %lu requests, %lu allocated (%.1f MB), %d size classes\n", packetBuffers.requests,
+				 packetBuffers.allocations, packetBuffers.allocatedBytes / 1048576.0, packetBuffers.sizeClasses );
+	}
+
+	fprintf( stream, "%-12s %10s %10s %10s %10s\n", "latency", "p50 us", "p99 us", "p99.9 us", "max us" );
+	for ( int i = 0; i <= StageProfiler::StageCount; i++ )
+	{
+		const LatencyHistogram::Counts &latency = i < StageProfiler::StageCount ? stageLatency[i] : endToEndLatency;
+		if ( latency.Total() == 0 )
+		{
+			continue;
+		}
+		fprintf( stream, "%-12s %10.1f %10.1f %10.1f %10.1f\n",
+				 i < StageProfiler::StageCount ? StageProfiler::StageName( ( StageProfiler::Stage )i ) : "end-to-end",
+				 latency.Percentile( 0.5 ) / 1000.0, latency.Percentile( 0.99 ) / 1000.0, latency.Percentile( 0.999 ) / 1000.0, latency.Max() / 1000.0 );
+	}
+
+	if ( allocationsTracked )
+	{
+		fprintf( stream, "Steady state heap traffic over %lu frames:\n", steadyStateFrames );
+		fprintf( stream, "%-12s %12s %12s %14s %12s\n", "stage", "allocs/fr", "frees/fr", "bytes/fr", "AVBuffer/fr" );
+		for ( int i = 0; i < AllocationTracker::SlotCount; i++ )
+		{
+			const AllocationTracker::Counters &c = steadyStateAllocations[i];
+			fprintf( stream, "%-12s %12.2f %12.2f %14.0f %12.2f\n", AllocationTracker::SlotName( i ),
+					 ( double )c.allocations / steadyStateFrames, ( double )c.frees / steadyStateFrames,
+					 ( double )c.allocatedBytes / steadyStateFrames, ( double )c.bufferAllocations / steadyStateFrames );
+		}
+		fprintf( stream, "Net heap growth: %ld bytes (%.1f bytes/frame)\n", steadyStateNetGrowth, ( double )steadyStateNetGrowth / steadyStateFrames );
+	}
+}
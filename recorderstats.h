@@ -0,0 +1,77 @@
+#ifndef RECORDERSTATS_H
+#define RECORDERSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "allocationtracker.h"
+#include "latencyhistogram.h"
+#include "memorybudget.h"
+#include "packetbufferpool.h"
+#include "stageprofiler.h"
+
+struct RecorderStats
+{
+	uint64_t capturedFrames = 0;
+	uint64_t writtenPackets = 0;
+	uint64_t droppedFrames = 0;
+	uint64_t writtenBytes = 0;
+
+	// frames waiting in front of decoder, encoder and writer when the stats were taken
+	uint64_t decodeQueueDepth = 0;
+	uint64_t frameQueueDepth = 0;
+	uint64_t packetQueueDepth = 0;
+	uint64_t decodeQueuePeak = 0;
+	uint64_t frameQueuePeak = 0;
+	uint64_t packetQueuePeak = 0;
+
+	// how often the queues backed up beyond the threshold and how long they took to drain again
+	uint64_t backlogEpisodes = 0;
+	LatencyHistogram::Counts backlogRecovery;
+
+	StageProfiler::StageStats stages[StageProfiler::StageCount];
+	LatencyHistogram::Counts stageLatency[StageProfiler::StageCount];
+	// from the capture callback to the packet written into the file
+	LatencyHistogram::Counts endToEndLatency;
+
+	// takes recorded and the time from their start to the first packet in the file
+	uint64_t takes = 0;
+	uint64_t lastStartLatencyNs = 0;
+	LatencyHistogram::Counts startLatency;
+	uint64_t firstFrameLatencyNs = 0;
+	// from the end of capture until the file was finished, with the frames that were queued at that moment
+	uint64_t lastStopLatencyNs = 0;
+	uint64_t lastStopQueuedFrames = 0;
+	LatencyHistogram::Counts stopLatency;
+
+	// pictures the proxy branch encoded and skipped because it was behind
+	uint64_t proxyFrames = 0;
+	uint64_t proxySkippedFrames = 0;
+	// thumbnails written and skipped because the lane was still busy with the previous one
+	uint64_t thumbnails = 0;
+	uint64_t skippedThumbnails = 0;
+	// raw direct mode: frames on disk, those that needed a bounce copy, and those dropped with the writer behind
+	uint64_t rawFrames = 0;
+	uint64_t rawCopiedFrames = 0;
+	uint64_t rawDroppedFrames = 0;
+
+	// memory budget (0 = unlimited), usage of its pools and the frames refused because the capture pool was full
+	uint64_t memoryBudget = 0;
+	uint64_t budgetDroppedFrames = 0;
+	MemoryBudget::PoolStats memoryPools[MemoryBudget::PoolCount];
+	// pictures written as the previous packet again instead of being encoded (--skip-duplicates)
+	uint64_t duplicateFrames = 0;
+	// encoded packet buffers handed out and those that had to be allocated
+	PacketBufferPool::Stats packetBuffers;
+
+	// heap traffic between warm-up and drained end of recording
+	bool allocationsTracked = false;
+	uint64_t steadyStateFrames = 0;
+	AllocationTracker::Counters steadyStateAllocations[AllocationTracker::SlotCount];
+	int64_t steadyStateNetGrowth = 0;
+
+	bool IsAllocationFree() const;
+	void Print( FILE *stream ) const;
+};
+
+#endif // RECORDERSTATS_H
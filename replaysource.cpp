@@ -0,0 +1,320 @@
+#include "replaysource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <QByteArray>
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include "decklink/DeckLinkAPI.h"
+#include "emulator/displaymodes.h"
+#include "emulator/emulatedframe.h"
+
+///@cond INTERNAL
+
+// frames in flight, the callback normally releases a frame before it returns
+static const int FRAME_POOL_SIZE = 4;
+// frames asked to be paged in ahead of the one being delivered
+static const int READ_AHEAD_FRAMES = 8;
+
+class ReplaySource::PrivateClass : public EmulatedVideoFrame::Owner
+{
+public:
+	IDeckLinkInputCallback *mDelegate;
+	QByteArray mPath;
+	bool mRealtime = true;
+	bool mLoop = false;
+	std::function<void()> mFinished;
+
+	BMDDisplayMode mDisplayMode = bmdModeHD1080p50;
+	BMDPixelFormat mPixelFormat = bmdFormat8BitYUV;
+	const DisplayModeInfo *mMode = nullptr;
+	long mRowBytes = 0;
+	size_t mFrameBytes = 0;
+
+	int mFd = -1;
+	uint8_t *mData = nullptr;
+	size_t mSize = 0;
+	int64_t mFrameCount = 0;
+
+	std::mutex mPoolMutex;
+	std::condition_variable mPoolCondition;
+	std::vector<EmulatedVideoFrame *> mFrames;
+	std::vector<EmulatedVideoFrame *> mFreeFrames;
+
+	std::atomic_bool mRunning;
+	QThreadPool mThreadPool;
+	QFuture<void> mDeliveryThread;
+	uint64_t mDelivered = 0;
+	uint64_t mDropped = 0;
+
+	PrivateClass( IDeckLinkInputCallback *delegate, const char *path )
+		: mDelegate( delegate )
+		, mPath( path )
+	{
+		mRunning = false;
+	}
+
+	void FrameReleased( EmulatedVideoFrame *frame ) override
+	{
+		{
+			std::lock_guard<std::mutex> locker( mPoolMutex );
+			mFreeFrames.push_back( frame );
+		}
+		mPoolCondition.notify_one();
+	}
+
+	EmulatedVideoFrame *AcquireFrame( bool wait );
+	void DeliveryThreadFunction();
+};
+
+EmulatedVideoFrame *ReplaySource::PrivateClass::AcquireFrame( bool wait )
+{
+	std::unique_lock<std::mutex> locker( mPoolMutex );
+	if ( wait )
+	{
+		mPoolCondition.wait( locker, [this]() { return !mFreeFrames.empty() || !mRunning; } );
+	}
+	if ( mFreeFrames.empty() )
+	{
+		return nullptr;
+	}
+	EmulatedVideoFrame *frame = mFreeFrames.back();
+	mFreeFrames.pop_back();
+	return frame;
+}
+
+void ReplaySource::PrivateClass::DeliveryThreadFunction()
+{
+	const std::chrono::nanoseconds interval( mMode->frameDuration * 1000000000ll / mMode->timeScale );
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// index counts delivery slots (stream time), position the frame within the file
+	int64_t index = 0;
+	int64_t position = 0;
+	while ( mRunning )
+	{
+		if ( position >= mFrameCount )
+		{
+			if ( !mLoop )
+			{
+				break;
+			}
+			position = 0;
+		}
+
+		if ( mRealtime )
+		{
+			std::this_thread::sleep_until( start + index * interval );
+		}
+
+		EmulatedVideoFrame *frame = AcquireFrame( !mRealtime );
+		if ( !frame )
+		{
+			// the consumer still holds every frame, a card would drop this one as well
+			if ( mRunning )
+			{
+				mDropped++;
+				index++;
+				position++;
+			}
+			continue;
+		}
+
+		uint8_t *bytes = mData + position * mFrameBytes;
+		size_t readAhead = std::min( ( int64_t )READ_AHEAD_FRAMES, mFrameCount - position - 1 ) * mFrameBytes;
+		if ( readAhead > 0 )
+		{
+			madvise( bytes + mFrameBytes, readAhead, MADV_WILLNEED );
+		}
+
+		frame->Setup( bytes, mMode->width, mMode->height, mRowBytes, mPixelFormat, bmdFrameFlagDefault );
+		frame->SetTiming( index, mMode->frameDuration, mMode->timeScale,
+						  std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+		mDelegate->VideoInputFrameArrived( frame, nullptr );
+		frame->Release();
+
+		mDelivered++;
+		index++;
+		position++;
+	}
+
+	fprintf( stderr, "Replay finished: %lu frames delivered, %lu dropped\n", mDelivered, mDropped );
+
+	if ( mRunning && mFinished )
+	{
+		mFinished();
+	}
+}
+
+///@endcond INTERNAL
+
+ReplaySource::ReplaySource( IDeckLinkInputCallback *delegate, const char *path )
+{
+	d = new ReplaySource::PrivateClass( delegate, path );
+}
+
+ReplaySource::~ReplaySource()
+{
+	Stop();
+	CleanUp();
+	delete d;
+	d = nullptr;
+}
+
+void ReplaySource::SetRealtime( bool realtime )
+{
+	d->mRealtime = realtime;
+}
+
+void ReplaySource::SetLoop( bool loop )
+{
+	d->mLoop = loop;
+}
+
+void ReplaySource::SetFinishedCallback( const std::function<void()> &finished )
+{
+	d->mFinished = finished;
+}
+
+void ReplaySource::SetDisplayMode( uint32_t displayMode )
+{
+	d->mDisplayMode = ( BMDDisplayMode )displayMode;
+}
+
+void ReplaySource::SetPixelFormat( uint32_t pixelFormat )
+{
+	d->mPixelFormat = ( BMDPixelFormat )pixelFormat;
+}
+
+bool ReplaySource::Init()
+{
+	d->mMode = FindDisplayMode( d->mDisplayMode );
+	if ( !d->mMode )
+	{
+		fprintf( stderr, "Display mode %08x is not supported for replay\n", d->mDisplayMode );
+		return false;
+	}
+	if ( d->mPixelFormat != bmdFormat8BitYUV && d->mPixelFormat != bmdFormat10BitYUV )
+	{
+		fprintf( stderr, "Pixel format %08x is not supported for replay\n", d->mPixelFormat );
+		return false;
+	}
+	d->mRowBytes = RowBytesFor( d->mMode->width, d->mPixelFormat );
+	d->mFrameBytes = ( size_t )d->mRowBytes * d->mMode->height;
+
+	d->mFd = open( d->mPath.constData(), O_RDONLY );
+	if ( d->mFd < 0 )
+	{
+		fprintf( stderr, "Could not open replay file '%s'\n", d->mPath.constData() );
+		return false;
+	}
+
+	struct stat st;
+	if ( fstat( d->mFd, &st ) != 0 || ( size_t )st.st_size < d->mFrameBytes )
+	{
+		fprintf( stderr, "Replay file '%s' does not hold a single %s frame\n", d->mPath.constData(), d->mMode->name );
+		return false;
+	}
+	d->mSize = st.st_size;
+	d->mFrameCount = d->mSize / d->mFrameBytes;
+	if ( d->mSize % d->mFrameBytes != 0 )
+	{
+		fprintf( stderr, "Replay file size is not a multiple of %zu bytes, trailing partial frame ignored\n", d->mFrameBytes );
+	}
+
+	// frames are handed to the callback straight from the page cache
+	void *data = mmap( nullptr, d->mSize, PROT_READ, MAP_SHARED, d->mFd, 0 );
+	if ( data == MAP_FAILED )
+	{
+		fprintf( stderr, "Could not map replay file '%s'\n", d->mPath.constData() );
+		return false;
+	}
+	d->mData = ( uint8_t * )data;
+	madvise( d->mData, d->mSize, MADV_SEQUENTIAL );
+
+	for ( int i = 0; i < FRAME_POOL_SIZE; i++ )
+	{
+		EmulatedVideoFrame *frame = new EmulatedVideoFrame( d );
+		d->mFrames.push_back( frame );
+		d->mFreeFrames.push_back( frame );
+	}
+
+	fprintf( stdout, "Replaying %ld %s frames from '%s'\n", d->mFrameCount, d->mMode->name, d->mPath.constData() );
+	return true;
+}
+
+bool ReplaySource::Start()
+{
+	if ( !d->mData || d->mRunning )
+	{
+		return false;
+	}
+
+	d->mRunning = true;
+	d->mThreadPool.setMaxThreadCount( 1 );
+	d->mDeliveryThread = QtConcurrent::run( &d->mThreadPool, d, &ReplaySource::PrivateClass::DeliveryThreadFunction );
+	return true;
+}
+
+bool ReplaySource::Stop()
+{
+	d->mRunning = false;
+	d->mPoolCondition.notify_all();
+	d->mDeliveryThread.waitForFinished();
+	return true;
+}
+
+void ReplaySource::CleanUp()
+{
+	for ( EmulatedVideoFrame *frame : d->mFrames )
+	{
+		delete frame;
+	}
+	d->mFrames.clear();
+	d->mFreeFrames.clear();
+
+	if ( d->mData )
+	{
+		munmap( d->mData, d->mSize );
+		d->mData = nullptr;
+	}
+	if ( d->mFd >= 0 )
+	{
+		close( d->mFd );
+		d->mFd = -1;
+	}
+}
+
+bool ReplaySource::GetTimeBase( int &num, int &den )
+{
+	if ( !d->mMode )
+	{
+		return false;
+	}
+	num = d->mMode->frameDuration;
+	den = d->mMode->timeScale;
+	return true;
+}
+
+bool ReplaySource::GetVideoSize( int &width, int &height )
+{
+	if ( !d->mMode )
+	{
+		return false;
+	}
+	width = d->mMode->width;
+	height = d->mMode->height;
+	return true;
+}
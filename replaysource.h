@@ -0,0 +1,40 @@
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include <functional>
+
+#include "capturesource.h"
+
+class IDeckLinkInputCallback;
+
+// replays a raw UYVY/v210 recording (frames back to back, no header) through the DeckLink input callback
+class ReplaySource : public CaptureSource
+{
+public:
+	ReplaySource( IDeckLinkInputCallback *delegate, const char *path );
+	~ReplaySource();
+
+	// realtime delivers at the display mode rate, otherwise as fast as the callback returns
+	void SetRealtime( bool realtime );
+	// restart at the first frame when the end of the file is reached
+	void SetLoop( bool loop );
+	// called on the delivery thread when the end of the file is reached without looping, set before Start
+	void SetFinishedCallback( const std::function<void()> &finished );
+
+	void SetDisplayMode( uint32_t displayMode ) override;
+	void SetPixelFormat( uint32_t pixelFormat ) override;
+
+	bool Init() override;
+	bool Start() override;
+	bool Stop() override;
+	void CleanUp() override;
+
+	bool GetTimeBase( int &num, int &den ) override;
+	bool GetVideoSize( int &width, int &height ) override;
+
+private:
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // REPLAYSOURCE_H
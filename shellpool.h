@@ -0,0 +1,241 @@
+#ifndef SHELLPOOL_H
+#define SHELLPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/packet.h"
+#include "deps/ffmpeg/include/libavutil/frame.h"
+}
+
+// free-list of unreferenced AVPacket/AVFrame structs, so the stages do not allocate a new struct per frame.
+// Get and Put are lock-free (bounded ring of Vyukov, no ABA) and may be called from any thread; a Put into a
+// full pool frees the struct, a Get from an empty pool allocates one.
+template <typename T, typename Traits>
+class ShellPool
+{
+public:
+	// returns the struct to the pool it was taken from, or frees it when it has none
+	class Deleter
+	{
+	public:
+		Deleter( ShellPool *pool = nullptr )
+			: mPool( pool )
+		{
+		}
+		void operator()( T *item ) const
+		{
+			if ( mPool )
+			{
+				mPool->Put( item );
+			}
+			else
+			{
+				Traits::Free( item );
+			}
+		}
+
+	private:
+		ShellPool *mPool;
+	};
+
+	// sole owner of a struct: moving it hands the struct to the next stage, copying does not compile
+	typedef std::unique_ptr<T, Deleter> Handle;
+
+	explicit ShellPool( size_t capacity = 64 )
+	{
+		size_t size = 2;
+		while ( size < capacity )
+		{
+			size <<= 1;
+		}
+		mMask = size - 1;
+		mCells = new Cell[size];
+		for ( size_t i = 0; i < size; i++ )
+		{
+			mCells[i].sequence.store( i, std::memory_order_relaxed );
+			mCells[i].item = nullptr;
+		}
+		mEnqueuePos.store( 0, std::memory_order_relaxed );
+		mDequeuePos.store( 0, std::memory_order_relaxed );
+		mMisses.store( 0, std::memory_order_relaxed );
+	}
+	~ShellPool()
+	{
+		T *item = nullptr;
+		while ( Pop( item ) )
+		{
+			Traits::Free( item );
+		}
+		delete[] mCells;
+	}
+
+	// allocates the structs up front, outside of the frame loop
+	void Prefill( size_t count )
+	{
+		for ( size_t i = 0; i < count; i++ )
+		{
+			T *item = Traits::Alloc();
+			if ( !item || !Push( item ) )
+			{
+				Traits::Free( item );
+				return;
+			}
+		}
+	}
+
+	T *Get()
+	{
+		T *item = nullptr;
+		if ( Pop( item ) )
+		{
+			return item;
+		}
+		mMisses.fetch_add( 1, std::memory_order_relaxed );
+		return Traits::Alloc();
+	}
+
+	Handle Take()
+	{
+		return Handle( Get(), Deleter( this ) );
+	}
+
+	// drops the references the struct still holds (buffers, side data) and keeps the struct itself
+	void Put( T *item )
+	{
+		if ( !item )
+		{
+			return;
+		}
+		Traits::Reset( item );
+		if ( !Push( item ) )
+		{
+			Traits::Free( item );
+		}
+	}
+
+	// Get calls that had to allocate
+	uint64_t Misses() const
+	{
+		return mMisses.load( std::memory_order_relaxed );
+	}
+
+private:
+	ShellPool( const ShellPool & ) = delete;
+	ShellPool &operator=( const ShellPool & ) = delete;
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T *item;
+	};
+
+	bool Push( T *item )
+	{
+		size_t pos = mEnqueuePos.load( std::memory_order_relaxed );
+		for ( ;; )
+		{
+			Cell &cell = mCells[pos & mMask];
+			intptr_t diff = ( intptr_t )cell.sequence.load( std::memory_order_acquire ) - ( intptr_t )pos;
+			if ( diff == 0 )
+			{
+				if ( mEnqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					cell.item = item;
+					cell.sequence.store( pos + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if ( diff < 0 )
+			{
+				// full
+				return false;
+			}
+			else
+			{
+				pos = mEnqueuePos.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	bool Pop( T *&item )
+	{
+		size_t pos = mDequeuePos.load( std::memory_order_relaxed );
+		for ( ;; )
+		{
+			Cell &cell = mCells[pos & mMask];
+			intptr_t diff = ( intptr_t )cell.sequence.load( std::memory_order_acquire ) - ( intptr_t )( pos + 1 );
+			if ( diff == 0 )
+			{
+				if ( mDequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					item = cell.item;
+					cell.sequence.store( pos + mMask + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if ( diff < 0 )
+			{
+				// empty
+				return false;
+			}
+			else
+			{
+				pos = mDequeuePos.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	Cell *mCells = nullptr;
+	size_t mMask = 0;
+	// producers and consumers touch different cache lines
+	alignas( 64 ) std::atomic<size_t> mEnqueuePos;
+	alignas( 64 ) std::atomic<size_t> mDequeuePos;
+	std::atomic<uint64_t> mMisses;
+};
+
+///@cond INTERNAL
+
+struct PacketShellTraits
+{
+	static AVPacket *Alloc()
+	{
+		return av_packet_alloc();
+	}
+	static void Reset( AVPacket *packet )
+	{
+		av_packet_unref( packet );
+	}
+	static void Free( AVPacket *packet )
+	{
+		av_packet_free( &packet );
+	}
+};
+
+struct FrameShellTraits
+{
+	static AVFrame *Alloc()
+	{
+		return av_frame_alloc();
+	}
+	static void Reset( AVFrame *frame )
+	{
+		av_frame_unref( frame );
+	}
+	static void Free( AVFrame *frame )
+	{
+		av_frame_free( &frame );
+	}
+};
+
+///@endcond INTERNAL
+
+typedef ShellPool<AVPacket, PacketShellTraits> PacketShellPool;
+typedef ShellPool<AVFrame, FrameShellTraits> FrameShellPool;
+typedef PacketShellPool::Handle PacketHandle;
+typedef FrameShellPool::Handle FrameHandle;
+
+#endif // SHELLPOOL_H
@@ -0,0 +1,284 @@
+#include "soakmonitor.h"
+
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTimer>
+
+#include "recorder.h"
+#include "recorderstats.h"
+
+///@cond INTERNAL
+
+namespace
+{
+
+uint64_t ResidentBytes()
+{
+	FILE *statm = fopen( "/proc/self/statm", "r" );
+	if ( !statm )
+	{
+		return 0;
+	}
+	unsigned long size = 0;
+	unsigned long resident = 0;
+	if ( fscanf( statm, "%lu %lu", &size, &resident ) != 2 )
+	{
+		resident = 0;
+	}
+	fclose( statm );
+	return ( uint64_t )resident * sysconf( _SC_PAGESIZE );
+}
+
+// metrics checked for drift; growth below the floor is noise whatever the relative change
+enum Metric
+{
+	MetricRss = 0,
+	MetricDecodeQueue,
+	MetricFrameQueue,
+	MetricPacketQueue,
+	MetricFileRate,
+	MetricCaptureP99,
+	MetricDecodeP99,
+	MetricConversionP99,
+	MetricEncodeP99,
+	MetricWriteP99,
+	MetricEndToEndP99,
+	MetricCount
+};
+
+struct MetricInfo
+{
+	const char *name;
+	const char *unit;
+	double floor;
+};
+
+const MetricInfo METRICS[MetricCount] =
+{
+	{ "rss", "MB", 16.0 },
+	{ "decode_queue", "frames", 2.0 },
+	{ "frame_queue", "frames", 2.0 },
+	{ "packet_queue", "packets", 2.0 },
+	{ "file_rate", "MB/s", 1.0 },
+	{ "capture_p99", "ms", 1.0 },
+	{ "decode_p99", "ms", 1.0 },
+	{ "conversion_p99", "ms", 1.0 },
+	{ "encode_p99", "ms", 1.0 },
+	{ "write_p99", "ms", 1.0 },
+	{ "end_to_end_p99", "ms", 5.0 },
+};
+
+struct Sample
+{
+	double elapsed = 0.0;
+	uint64_t capturedFrames = 0;
+	uint64_t droppedFrames = 0;
+	uint64_t writtenPackets = 0;
+	double fileMegabytes = 0.0;
+	double values[MetricCount] = {0};
+};
+
+}
+
+class SoakMonitor::PrivateClass
+{
+public:
+	Recorder *mRecorder;
+	QString mOutputFile;
+	int mIntervalSeconds = 5;
+	int mDurationSeconds = 0;
+	int mWarmupSeconds = 60;
+	double mThreshold = 0.1;
+	FILE *mReport = nullptr;
+
+	QTimer mTimer;
+	QElapsedTimer mElapsed;
+	std::vector<Sample> mSamples;
+	// counters of the previous sample, percentiles are taken over the interval only
+	RecorderStats mPrevious;
+	double mPreviousFileMegabytes = 0.0;
+
+	PrivateClass( Recorder *recorder, const QString &outputFile )
+		: mRecorder( recorder )
+		, mOutputFile( outputFile )
+	{
+	}
+
+	void TakeSample();
+};
+
+void SoakMonitor::PrivateClass::TakeSample()
+{
+	RecorderStats stats;
+	mRecorder->GetStats( stats );
+
+	Sample sample;
+	sample.elapsed = mElapsed.elapsed() / 1000.0;
+	sample.capturedFrames = stats.capturedFrames;
+	sample.droppedFrames = stats.droppedFrames;
+	sample.writtenPackets = stats.writtenPackets;
+	sample.fileMegabytes = QFileInfo( mOutputFile ).size() / 1048576.0;
+
+	double interval = mSamples.empty() ? sample.elapsed : sample.elapsed - mSamples.back().elapsed;
+	sample.values[MetricRss] = ResidentBytes() / 1048576.0;
+	sample.values[MetricDecodeQueue] = stats.decodeQueueDepth;
+	sample.values[MetricFrameQueue] = stats.frameQueueDepth;
+	sample.values[MetricPacketQueue] = stats.packetQueueDepth;
+	sample.values[MetricFileRate] = interval > 0.0 ? ( sample.fileMegabytes - mPreviousFileMegabytes ) / interval : 0.0;
+	for ( int i = 0; i < StageProfiler::StageCount; i++ )
+	{
+		sample.values[MetricCaptureP99 + i] = stats.stageLatency[i].Difference( mPrevious.stageLatency[i] ).Percentile( 0.99 ) / 1e6;
+	}
+	sample.values[MetricEndToEndP99] = stats.endToEndLatency.Difference( mPrevious.endToEndLatency ).Percentile( 0.99 ) / 1e6;
+
+	mPrevious = stats;
+	mPreviousFileMegabytes = sample.fileMegabytes;
+	mSamples.push_back( sample );
+
+	fprintf( stderr, "soak %8.0fs: %lu frames, %lu dropped, rss %.1f MB, queues %.0f/%.0f/%.0f, file %.1f MB/s, end-to-end p99 %.1f ms\n",
+			 sample.elapsed, sample.capturedFrames, sample.droppedFrames, sample.values[MetricRss],
+			 sample.values[MetricDecodeQueue], sample.values[MetricFrameQueue], sample.values[MetricPacketQueue],
+			 sample.values[MetricFileRate], sample.values[MetricEndToEndP99] );
+
+	if ( mReport )
+	{
+		fprintf( mReport, "%.3f,%lu,%lu,%lu,%.3f", sample.elapsed, sample.capturedFrames, sample.droppedFrames, sample.writtenPackets, sample.fileMegabytes );
+		for ( int i = 0; i < MetricCount; i++ )
+		{
+			fprintf( mReport, ",%.3f", sample.values[i] );
+		}
+		fprintf( mReport, "\n" );
+		fflush( mReport );
+	}
+
+	if ( mDurationSeconds > 0 && sample.elapsed >= mDurationSeconds )
+	{
+		// main stops the pipeline and drains the queues once the event loop returns
+		mTimer.stop();
+		qApp->quit();
+	}
+}
+
+///@endcond INTERNAL
+
+SoakMonitor::SoakMonitor( Recorder *recorder, const QString &outputFile )
+{
+	d = new SoakMonitor::PrivateClass( recorder, outputFile );
+	QObject::connect( &d->mTimer, &QTimer::timeout, [this]()
+	{
+		d->TakeSample();
+	} );
+}
+
+SoakMonitor::~SoakMonitor()
+{
+	Stop();
+	if ( d->mReport )
+	{
+		fclose( d->mReport );
+	}
+	delete d;
+	d = nullptr;
+}
+
+void SoakMonitor::SetInterval( int seconds )
+{
+	d->mIntervalSeconds = seconds;
+}
+
+void SoakMonitor::SetDuration( int seconds )
+{
+	d->mDurationSeconds = seconds;
+}
+
+void SoakMonitor::SetWarmup( int seconds )
+{
+	d->mWarmupSeconds = seconds;
+}
+
+void SoakMonitor::SetThreshold( double relativeGrowth )
+{
+	d->mThreshold = relativeGrowth;
+}
+
+bool SoakMonitor::SetReportFile( const QString &path )
+{
+	d->mReport = fopen( qUtf8Printable( path ), "w" );
+	if ( !d->mReport )
+	{
+		fprintf( stderr, "Could not open soak report '%s'\n", qUtf8Printable( path ) );
+		return false;
+	}
+
+	fprintf( d->mReport, "elapsed_s,captured_frames,dropped_frames,written_packets,file_mb" );
+	for ( int i = 0; i < MetricCount; i++ )
+	{
+		fprintf( d->mReport, ",%s_%s", METRICS[i].name, METRICS[i].unit );
+	}
+	fprintf( d->mReport, "\n" );
+	return true;
+}
+
+void SoakMonitor::Start()
+{
+	d->mElapsed.start();
+	d->mTimer.start( d->mIntervalSeconds * 1000 );
+}
+
+void SoakMonitor::Stop()
+{
+	d->mTimer.stop();
+}
+
+bool SoakMonitor::Evaluate( FILE *stream ) const
+{
+	std::vector<const Sample *> samples;
+	for ( const Sample &sample : d->mSamples )
+	{
+		if ( sample.elapsed >= d->mWarmupSeconds )
+		{
+			samples.push_back( &sample );
+		}
+	}
+	if ( samples.size() < 3 )
+	{
+		fprintf( stream, "Soak run too short for trend analysis (%zu samples after %d s warm-up)\n", samples.size(), d->mWarmupSeconds );
+		return true;
+	}
+
+	fprintf( stream, "Soak trend over %.0f s (%zu samples, threshold %.0f%% of mean):\n",
+			 samples.back()->elapsed - samples.front()->elapsed, samples.size(), d->mThreshold * 100.0 );
+	fprintf( stream, "%-16s %-8s %12s %12s %12s %s\n", "metric", "unit", "mean", "growth", "max", "" );
+
+	bool ok = true;
+	for ( int m = 0; m < MetricCount; m++ )
+	{
+		// least squares line through the samples, growth is its rise over the analysed window
+		double n = samples.size();
+		double sumT = 0.0, sumV = 0.0, sumTT = 0.0, sumTV = 0.0, maxV = 0.0;
+		for ( const Sample *sample : samples )
+		{
+			double t = sample->elapsed;
+			double v = sample->values[m];
+			sumT += t;
+			sumV += v;
+			sumTT += t * t;
+			sumTV += t * v;
+			maxV = fmax( maxV, v );
+		}
+		double denominator = n * sumTT - sumT * sumT;
+		double slope = denominator != 0.0 ? ( n * sumTV - sumT * sumV ) / denominator : 0.0;
+		double mean = sumV / n;
+		double growth = slope * ( samples.back()->elapsed - samples.front()->elapsed );
+
+		bool drifting = growth > METRICS[m].floor && growth > d->mThreshold * fabs( mean );
+		ok &= !drifting;
+		fprintf( stream, "%-16s %-8s %12.2f %12.2f %12.2f %s\n", METRICS[m].name, METRICS[m].unit, mean, growth, maxV, drifting ? "DRIFT" : "ok" );
+	}
+	return ok;
+}
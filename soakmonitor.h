@@ -0,0 +1,41 @@
+#ifndef SOAKMONITOR_H
+#define SOAKMONITOR_H
+
+#include <stdio.h>
+
+#include <QString>
+
+class Recorder;
+
+// samples memory, queue depths, latency percentiles and file growth of a running recording into a time series
+// and checks every metric for an upward trend once the recording is over
+class SoakMonitor
+{
+public:
+	SoakMonitor( Recorder *recorder, const QString &outputFile );
+	~SoakMonitor();
+
+	void SetInterval( int seconds );
+	// recording is stopped after this long, 0 keeps it running until the source ends
+	void SetDuration( int seconds );
+	// samples taken before are not part of the trend (buffers and caches filling up)
+	void SetWarmup( int seconds );
+	// allowed growth of a metric over the run, relative to its mean
+	void SetThreshold( double relativeGrowth );
+	// time series as CSV, one row per sample
+	bool SetReportFile( const QString &path );
+
+	void Start();
+	void Stop();
+
+	bool Evaluate( FILE *stream ) const;
+
+private:
+	SoakMonitor( const SoakMonitor & ) = delete;
+	SoakMonitor &operator=( const SoakMonitor & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // SOAKMONITOR_H
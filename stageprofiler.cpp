@@ -0,0 +1,298 @@
+#include "stageprofiler.h"
+#include "allocationtracker.h"
+
+#include <atomic>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+///@cond INTERNAL
+
+namespace
+{
+
+uint64_t ReadClock( clockid_t clock )
+{
+	struct timespec ts;
+	clock_gettime( clock, &ts );
+	return ( uint64_t )ts.tv_sec * 1000000000ull + ( uint64_t )ts.tv_nsec;
+}
+
+int OpenCounter( uint32_t type, uint64_t config, int groupFd )
+{
+	struct perf_event_attr attr;
+	memset( &attr, 0, sizeof( attr ) );
+	attr.size = sizeof( attr );
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = ( groupFd == -1 ) ? 1 : 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	// pid 0 & cpu -1 => count the calling thread on whatever cpu it runs
+	return ( int )syscall( __NR_perf_event_open, &attr, 0, -1, groupFd, 0 );
+}
+
+// counters are per thread, so every stage thread lazily opens its own group on first use
+class ThreadCounters
+{
+public:
+	enum { CounterCycles = 0, CounterInstructions, CounterLlcMisses, CounterCount };
+
+	int mFds[CounterCount] = { -1, -1, -1 };
+	bool mOpened = false;
+
+	~ThreadCounters()
+	{
+		for ( int i = CounterCount - 1; i >= 0; i-- )
+		{
+			if ( mFds[i] >= 0 )
+			{
+				close( mFds[i] );
+			}
+		}
+	}
+
+	bool Open()
+	{
+		if ( mOpened )
+		{
+			return mFds[CounterCycles] >= 0;
+		}
+		mOpened = true;
+
+		mFds[CounterCycles] = OpenCounter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1 );
+		if ( mFds[CounterCycles] < 0 )
+		{
+			static std::atomic_bool warned( false );
+			if ( !warned.exchange( true ) )
+			{
+				fprintf( stderr, "perf_event_open not permitted (see /proc/sys/kernel/perf_event_paranoid), hardware counters disabled\n" );
+			}
+			return false;
+		}
+		mFds[CounterInstructions] = OpenCounter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, mFds[CounterCycles] );
+		mFds[CounterLlcMisses] = OpenCounter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, mFds[CounterCycles] );
+		if ( mFds[CounterInstructions] < 0 || mFds[CounterLlcMisses] < 0 )
+		{
+			for ( int i = CounterCount - 1; i >= 0; i-- )
+			{
+				if ( mFds[i] >= 0 )
+				{
+					close( mFds[i] );
+					mFds[i] = -1;
+				}
+			}
+			return false;
+		}
+
+		ioctl( mFds[CounterCycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+		ioctl( mFds[CounterCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+		return true;
+	}
+
+	bool Read( StageProfiler::Sample &sample )
+	{
+		if ( !Open() )
+		{
+			return false;
+		}
+
+		// PERF_FORMAT_GROUP layout: { nr, values[nr] }
+		uint64_t values[1 + CounterCount] = {0};
+		if ( read( mFds[CounterCycles], values, sizeof( values ) ) != ( ssize_t )sizeof( values ) || values[0] != CounterCount )
+		{
+			return false;
+		}
+
+		sample.cycles = values[1 + CounterCycles];
+		sample.instructions = values[1 + CounterInstructions];
+		sample.llcMisses = values[1 + CounterLlcMisses];
+		return true;
+	}
+};
+
+thread_local ThreadCounters tThreadCounters;
+
+}
+
+class StageProfiler::PrivateClass
+{
+public:
+	struct AtomicStats
+	{
+		std::atomic<uint64_t> frames;
+		std::atomic<uint64_t> wallNs;
+		std::atomic<uint64_t> cpuNs;
+		std::atomic<uint64_t> counterFrames;
+		std::atomic<uint64_t> cycles;
+		std::atomic<uint64_t> instructions;
+		std::atomic<uint64_t> llcMisses;
+	};
+
+	AtomicStats mStats[StageCount];
+	LatencyHistogram mLatency[StageCount];
+};
+
+///@endcond INTERNAL
+
+StageProfiler::Scope::Scope( StageProfiler *profiler, Stage stage )
+	: mProfiler( profiler )
+	, mStage( stage )
+{
+	mPreviousAllocationStage = AllocationTracker::EnterStage( stage );
+	if ( mProfiler )
+	{
+		mBegin = StageProfiler::TakeSample();
+	}
+}
+
+StageProfiler::Scope::~Scope()
+{
+	if ( mProfiler )
+	{
+		mProfiler->Accumulate( mStage, mBegin, StageProfiler::TakeSample() );
+	}
+	AllocationTracker::LeaveStage( mPreviousAllocationStage );
+}
+
+StageProfiler::StageProfiler()
+{
+	d = new StageProfiler::PrivateClass();
+	Reset();
+}
+
+StageProfiler::~StageProfiler()
+{
+	delete d;
+	d = nullptr;
+}
+
+void StageProfiler::Reset()
+{
+	for ( int i = 0; i < StageCount; i++ )
+	{
+		PrivateClass::AtomicStats &stats = d->mStats[i];
+		stats.frames = 0;
+		stats.wallNs = 0;
+		stats.cpuNs = 0;
+		stats.counterFrames = 0;
+		stats.cycles = 0;
+		stats.instructions = 0;
+		stats.llcMisses = 0;
+		d->mLatency[i].Reset();
+	}
+}
+
+StageProfiler::StageStats StageProfiler::GetStageStats( Stage stage ) const
+{
+	StageStats result;
+	const PrivateClass::AtomicStats &stats = d->mStats[stage];
+	result.frames = stats.frames;
+	result.wallNs = stats.wallNs;
+	result.cpuNs = stats.cpuNs;
+	result.counterFrames = stats.counterFrames;
+	result.cycles = stats.cycles;
+	result.instructions = stats.instructions;
+	result.llcMisses = stats.llcMisses;
+	return result;
+}
+
+LatencyHistogram::Counts StageProfiler::GetStageLatency( Stage stage ) const
+{
+	return d->mLatency[stage].GetCounts();
+}
+
+const char *StageProfiler::StageName( Stage stage )
+{
+	switch ( stage )
+	{
+		case StageCapture:
+			return "capture";
+		case StageDecode:
+			return "decode";
+		case StageConversion:
+			return "conversion";
+		case StageEncode:
+			return "encode";
+		case StageWrite:
+			return "write";
+		default:
+			return "unknown";
+	}
+}
+
+void StageProfiler::PrintStats( const StageStats *stats, FILE *stream )
+{
+	fprintf( stream, "%-12s %8s %12s %12s %6s %6s %14s %12s\n",
+			 "stage", "frames", "wall us/fr", "cpu us/fr", "cpu%", "IPC", "cycles/fr", "LLC miss/fr" );
+
+	uint64_t totalWallNs = 0;
+	uint64_t totalCpuNs = 0;
+	uint64_t frames = 0;
+	for ( int i = 0; i < StageCount; i++ )
+	{
+		const StageStats &s = stats[i];
+		if ( s.frames == 0 )
+		{
+			continue;
+		}
+
+		double wallUs = s.wallNs / 1000.0 / s.frames;
+		double cpuUs = s.cpuNs / 1000.0 / s.frames;
+		double utilization = s.wallNs ? 100.0 * s.cpuNs / s.wallNs : 0.0;
+		if ( s.counterFrames > 0 )
+		{
+			double ipc = s.cycles ? ( double )s.instructions / s.cycles : 0.0;
+			fprintf( stream, "%-12s %8lu %12.1f %12.1f %6.1f %6.2f %14.0f %12.0f\n",
+					 StageName( ( Stage )i ), s.frames, wallUs, cpuUs, utilization, ipc,
+					 ( double )s.cycles / s.counterFrames, ( double )s.llcMisses / s.counterFrames );
+		}
+		else
+		{
+			fprintf( stream, "%-12s %8lu %12.1f %12.1f %6.1f %6s %14s %12s\n",
+					 StageName( ( Stage )i ), s.frames, wallUs, cpuUs, utilization, "n/a", "n/a", "n/a" );
+		}
+
+		totalWallNs += s.wallNs / s.frames;
+		totalCpuNs += s.cpuNs / s.frames;
+		if ( s.frames > frames )
+		{
+			frames = s.frames;
+		}
+	}
+
+	if ( frames > 0 )
+	{
+		fprintf( stream, "%-12s %8lu %12.1f %12.1f\n", "per frame", frames, totalWallNs / 1000.0, totalCpuNs / 1000.0 );
+	}
+}
+
+StageProfiler::Sample StageProfiler::TakeSample()
+{
+	Sample sample;
+	sample.hasCounters = tThreadCounters.Read( sample );
+	sample.cpuNs = ReadClock( CLOCK_THREAD_CPUTIME_ID );
+	sample.wallNs = ReadClock( CLOCK_MONOTONIC );
+	return sample;
+}
+
+void StageProfiler::Accumulate( Stage stage, const Sample &begin, const Sample &end )
+{
+	PrivateClass::AtomicStats &stats = d->mStats[stage];
+	stats.frames.fetch_add( 1, std::memory_order_relaxed );
+	stats.wallNs.fetch_add( end.wallNs - begin.wallNs, std::memory_order_relaxed );
+	d->mLatency[stage].Add( end.wallNs - begin.wallNs );
+	stats.cpuNs.fetch_add( end.cpuNs - begin.cpuNs, std::memory_order_relaxed );
+	if ( begin.hasCounters && end.hasCounters )
+	{
+		stats.counterFrames.fetch_add( 1, std::memory_order_relaxed );
+		stats.cycles.fetch_add( end.cycles - begin.cycles, std::memory_order_relaxed );
+		stats.instructions.fetch_add( end.instructions - begin.instructions, std::memory_order_relaxed );
+		stats.llcMisses.fetch_add( end.llcMisses - begin.llcMisses, std::memory_order_relaxed );
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latencyhistogram.h"
+
+class StageProfiler
+{
+public:
+	enum Stage
+	{
+		StageCapture = 0,
+		StageDecode,
+		StageConversion,
+		StageEncode,
+		StageWrite,
+		StageCount
+	};
+
+	struct StageStats
+	{
+		uint64_t frames = 0;
+		uint64_t wallNs = 0;
+		uint64_t cpuNs = 0;
+		// hardware counters are only valid when counted frames > 0 (perf_event_open may be denied)
+		uint64_t counterFrames = 0;
+		uint64_t cycles = 0;
+		uint64_t instructions = 0;
+		uint64_t llcMisses = 0;
+	};
+
+	struct Sample
+	{
+		uint64_t wallNs = 0;
+		uint64_t cpuNs = 0;
+		uint64_t cycles = 0;
+		uint64_t instructions = 0;
+		uint64_t llcMisses = 0;
+		bool hasCounters = false;
+	};
+
+	// measures the enclosing block on the calling thread and accounts it as one frame of the stage
+	class Scope
+	{
+	public:
+		Scope( StageProfiler *profiler, Stage stage );
+		~Scope();
+
+	private:
+		Scope( const Scope & ) = delete;
+		Scope &operator=( const Scope & ) = delete;
+
+		StageProfiler *mProfiler;
+		Stage mStage;
+		Sample mBegin;
+		int mPreviousAllocationStage;
+	};
+
+	StageProfiler();
+	~StageProfiler();
+
+	void Reset();
+	StageStats GetStageStats( Stage stage ) const;
+	// distribution of the per-frame wall time of a stage
+	LatencyHistogram::Counts GetStageLatency( Stage stage ) const;
+
+	static const char *StageName( Stage stage );
+	static void PrintStats( const StageStats *stats, FILE *stream );
+	static Sample TakeSample();
+
+private:
+	void Accumulate( Stage stage, const Sample &begin, const Sample &end );
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // STAGEPROFILER_H
@@ -0,0 +1,193 @@
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include <QMutex>
+#include <QWaitCondition>
+
+///@cond INTERNAL
+
+// depth and high-water mark of a stage queue, updated next to the queue operations
+struct QueueGauge
+{
+	std::atomic<uint64_t> depth;
+	std::atomic<uint64_t> peak;
+
+	QueueGauge()
+	{
+		depth = 0;
+		peak = 0;
+	}
+	void Pushed()
+	{
+		uint64_t current = ++depth;
+		uint64_t highest = peak.load( std::memory_order_relaxed );
+		while ( current > highest && !peak.compare_exchange_weak( highest, current ) )
+		{
+		}
+	}
+	void Popped()
+	{
+		--depth;
+	}
+};
+
+// FIFO in a ring of slots allocated up front, so pushing and popping do not touch the heap; a push into a full
+// ring doubles it (a backlog beyond what Reserve planned for), which is the only allocation after Reserve
+template <typename T>
+class Ring
+{
+public:
+	explicit Ring( size_t capacity = 16 )
+	{
+		Reserve( capacity );
+	}
+
+	void Reserve( size_t capacity )
+	{
+		if ( capacity <= mSlots.size() )
+		{
+			return;
+		}
+		std::vector<T> slots( capacity );
+		for ( size_t i = 0; i < mCount; i++ )
+		{
+			slots[i] = std::move( mSlots[( mHead + i ) % mSlots.size()] );
+		}
+		mSlots.swap( slots );
+		mHead = 0;
+	}
+
+	void PushBack( T item )
+	{
+		if ( mCount == mSlots.size() )
+		{
+			Reserve( 2 * mSlots.size() );
+		}
+		mSlots[( mHead + mCount ) % mSlots.size()] = std::move( item );
+		mCount++;
+	}
+	T &Front()
+	{
+		return mSlots[mHead];
+	}
+	// the slot keeps a moved-from item
+	T PopFront()
+	{
+		T item = std::move( mSlots[mHead] );
+		mHead = ( mHead + 1 ) % mSlots.size();
+		mCount--;
+		return item;
+	}
+	void Clear()
+	{
+		while ( mCount > 0 )
+		{
+			PopFront();
+		}
+	}
+
+	bool Empty() const
+	{
+		return mCount == 0;
+	}
+	size_t Size() const
+	{
+		return mCount;
+	}
+	size_t Capacity() const
+	{
+		return mSlots.size();
+	}
+
+private:
+	std::vector<T> mSlots;
+	size_t mHead = 0;
+	size_t mCount = 0;
+};
+
+// queue between two stage threads holding move-only handles; pushing moves the handle in, popping moves it out,
+// so a frame has exactly one owner at any time. An empty handle marks the end of the stream of a take.
+template <typename Handle>
+class StageQueue
+{
+public:
+	// slots for the deepest backlog expected, before the stage threads start
+	void Reserve( size_t capacity )
+	{
+		QMutexLocker locker( &mMutex );
+		mItems.Reserve( capacity );
+	}
+
+	void Push( Handle item )
+	{
+		QMutexLocker locker( &mMutex );
+		PushLocked( std::move( item ) );
+	}
+
+	// for callers deciding under Mutex() whether to push at all
+	void PushLocked( Handle item )
+	{
+		if ( item )
+		{
+			mGauge.Pushed();
+		}
+		mItems.PushBack( std::move( item ) );
+		mCondition.wakeOne();
+	}
+
+	// waits for the next handle
+	Handle Pop()
+	{
+		QMutexLocker locker( &mMutex );
+		while ( mItems.Empty() )
+		{
+			mCondition.wait( &mMutex );
+		}
+		return PopLocked();
+	}
+
+	bool TryPop( Handle &item )
+	{
+		QMutexLocker locker( &mMutex );
+		if ( mItems.Empty() )
+		{
+			return false;
+		}
+		item = PopLocked();
+		return true;
+	}
+
+	QMutex &Mutex()
+	{
+		return mMutex;
+	}
+	const QueueGauge &Gauge() const
+	{
+		return mGauge;
+	}
+
+private:
+	Handle PopLocked()
+	{
+		Handle item = mItems.PopFront();
+		if ( item )
+		{
+			mGauge.Popped();
+		}
+		return item;
+	}
+
+	QMutex mMutex;
+	QWaitCondition mCondition;
+	Ring<Handle> mItems;
+	QueueGauge mGauge;
+};
+
+///@endcond INTERNAL
+
+#endif // STAGEQUEUE_H
@@ -0,0 +1,79 @@
+#include "startupprofile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+///@cond INTERNAL
+
+namespace
+{
+
+struct StepTime
+{
+	const char *name;
+	uint64_t beginNs;
+	uint64_t endNs;
+};
+
+std::mutex gMutex;
+std::vector<StepTime> gSteps;
+
+uint64_t NowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// offsets are printed relative to static initialization, close enough to process start
+const uint64_t gOriginNs = NowNs();
+
+}
+
+///@endcond INTERNAL
+
+StartupProfile::Step::Step( const char *name )
+	: mName( name )
+	, mBeginNs( NowNs() )
+{
+}
+
+StartupProfile::Step::~Step()
+{
+	StartupProfile::Add( mName, mBeginNs, NowNs() );
+}
+
+void StartupProfile::Add( const char *name, uint64_t beginNs, uint64_t endNs )
+{
+	std::lock_guard<std::mutex> lock( gMutex );
+	gSteps.push_back( { name, beginNs, endNs } );
+}
+
+void StartupProfile::Print( FILE *stream )
+{
+	std::vector<StepTime> steps;
+	{
+		std::lock_guard<std::mutex> lock( gMutex );
+		steps = gSteps;
+	}
+	if ( steps.empty() )
+	{
+		return;
+	}
+	std::sort( steps.begin(), steps.end(), []( const StepTime &a, const StepTime &b )
+	{
+		return a.beginNs < b.beginNs;
+	} );
+
+	fprintf( stream, "%-20s %10s %10s\n", "startup step", "at ms", "took ms" );
+	uint64_t endNs = gOriginNs;
+	for ( const StepTime &step : steps )
+	{
+		fprintf( stream, "%-20s %10.2f %10.2f\n", step.name, ( step.beginNs - gOriginNs ) / 1e6, ( step.endNs - step.beginNs ) / 1e6 );
+		if ( step.endNs > endNs )
+		{
+			endNs = step.endNs;
+		}
+	}
+	fprintf( stream, "%-20s %10s %10.2f\n", "total", "", ( endNs - gOriginNs ) / 1e6 );
+}
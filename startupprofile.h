@@ -0,0 +1,31 @@
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// wall time of the steps between process start and the first captured frame; steps may run on several
+// threads at once, they are printed with their start offset so the overlap is visible
+class StartupProfile
+{
+public:
+	// measures the enclosing block as one step
+	class Step
+	{
+	public:
+		explicit Step( const char *name );
+		~Step();
+
+	private:
+		Step( const Step & ) = delete;
+		Step &operator=( const Step & ) = delete;
+
+		const char *mName;
+		uint64_t mBeginNs;
+	};
+
+	static void Add( const char *name, uint64_t beginNs, uint64_t endNs );
+	static void Print( FILE *stream );
+};
+
+#endif // STARTUPPROFILE_H
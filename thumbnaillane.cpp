@@ -0,0 +1,264 @@
+#include "thumbnaillane.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavcodec/avcodec.h"
+#include "deps/ffmpeg/include/libswscale/swscale.h"
+}
+
+#include "downscalepyramid.h"
+#include "ffmpegutils.h"
+#include "shellpool.h"
+#include "stagequeue.h"
+
+///@cond INTERNAL
+
+class ThumbnailLane::PrivateClass
+{
+public:
+	Settings mSettings;
+	int mLevel = 0;
+	int64_t mIntervalPts = 1;
+	// written by the decoder thread only
+	int64_t mNextPts = 0;
+
+	DownscalePyramid mPyramid;
+	// declared before the queue, whose handles return into it
+	FrameShellPool mFrameShells;
+	StageQueue<FrameHandle> mQueue;
+	// a thread of its own: it runs at idle priority, which an unprivileged thread cannot give back
+	QThreadPool mThreadPool;
+	QFuture<void> mThread;
+	QString mBaseName;
+
+	AVCodecContext *mCodecContext = nullptr;
+	SwsContext *mSwScaleContext = nullptr;
+	AVFrame *mJpegFrame = nullptr;
+	AVPacket *mPacket = nullptr;
+
+	std::atomic<uint64_t> mWritten;
+	std::atomic<uint64_t> mSkipped;
+
+	PrivateClass( const Settings &settings )
+		: mSettings( settings )
+		, mFrameShells( 4 )
+	{
+		mWritten = 0;
+		mSkipped = 0;
+		mThreadPool.setMaxThreadCount( 1 );
+		mThreadPool.setExpiryTimeout( -1 );
+	}
+	~PrivateClass()
+	{
+		avcodec_free_context( &mCodecContext );
+		sws_freeContext( mSwScaleContext );
+		av_frame_free( &mJpegFrame );
+		av_packet_free( &mPacket );
+	}
+
+	bool OpenEncoder( int width, int height );
+	void Write( const AVFrame *frame );
+	void ThreadFunction();
+};
+
+bool ThumbnailLane::PrivateClass::OpenEncoder( int width, int height )
+{
+	const AVCodec *codec = avcodec_find_encoder( AV_CODEC_ID_MJPEG );
+	mCodecContext = codec ? avcodec_alloc_context3( codec ) : nullptr;
+	if ( !mCodecContext )
+	{
+		fprintf( stderr, "JPEG encoder not found\n" );
+		return false;
+	}
+	mCodecContext->width = width;
+	mCodecContext->height = height;
+	mCodecContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
+	mCodecContext->color_range = AVCOL_RANGE_JPEG;
+	mCodecContext->time_base = {1, 25};
+	mCodecContext->thread_count = 1;
+	mCodecContext->flags |= AV_CODEC_FLAG_QSCALE;
+	mCodecContext->global_quality = FF_QP2LAMBDA * mSettings.quality;
+	if ( avcodec_open2( mCodecContext, codec, nullptr ) < 0 )
+	{
+		fprintf( stderr, "Could not open JPEG encoder\n" );
+		avcodec_free_context( &mCodecContext );
+		return false;
+	}
+	mJpegFrame = AllocateVideoFrame( AV_PIX_FMT_YUVJ420P, width, height );
+	mPacket = av_packet_alloc();
+	return mJpegFrame && mPacket;
+}
+
+void ThumbnailLane::PrivateClass::Write( const AVFrame *frame )
+{
+	if ( !mPyramid.Process( frame, frame->pts, frame->pkt_duration ) )
+	{
+		return;
+	}
+	AVFrame *small = mPyramid.Level( mLevel );
+	// opened on first use, on this thread rather than during the startup of the recorder
+	if ( !mCodecContext && !OpenEncoder( small->width, small->height ) )
+	{
+		return;
+	}
+
+	// the pyramid did the scaling, only the pixel format changes here
+	if ( !av_frame_is_writable( mJpegFrame ) && av_frame_make_writable( mJpegFrame ) < 0 )
+	{
+		return;
+	}
+	mSwScaleContext = sws_getCachedContext( mSwScaleContext,
+											small->width, small->height, ( AVPixelFormat )small->format,
+											mJpegFrame->width, mJpegFrame->height, AV_PIX_FMT_YUVJ420P,
+											SWS_POINT, nullptr, nullptr, nullptr );
+	if ( !mSwScaleContext )
+	{
+		fprintf( stderr, "Could not initialize the thumbnail conversion context\n" );
+		return;
+	}
+	sws_scale( mSwScaleContext, small->data, small->linesize, 0, small->height, mJpegFrame->data, mJpegFrame->linesize );
+	mJpegFrame->pts = frame->pts;
+	mJpegFrame->quality = mCodecContext->global_quality;
+
+	if ( avcodec_send_frame( mCodecContext, mJpegFrame ) < 0 || avcodec_receive_packet( mCodecContext, mPacket ) < 0 )
+	{
+		fprintf( stderr, "Could not encode thumbnail\n" );
+		return;
+	}
+	int64_t frameIndex = frame->pkt_duration > 0 ? frame->pts / frame->pkt_duration : frame->pts;
+	QString fileName = QString( "%1/%2_%3.jpg" ).arg( mSettings.directory ).arg( mBaseName ).arg( frameIndex, 6, 10, QChar( '0' ) );
+	QFile file( fileName );
+	if ( file.open( QIODevice::WriteOnly ) && file.write( ( const char * )mPacket->data, mPacket->size ) == mPacket->size )
+	{
+		mWritten++;
+	}
+	else
+	{
+		fprintf( stderr, "Could not write thumbnail %s\n", qUtf8Printable( fileName ) );
+	}
+	av_packet_unref( mPacket );
+}
+
+void ThumbnailLane::PrivateClass::ThreadFunction()
+{
+	// only runs when no other thread of the machine wants the CPU
+	sched_param param;
+	param.sched_priority = 0;
+	pthread_setschedparam( pthread_self(), SCHED_IDLE, &param );
+
+	for ( ;; )
+	{
+		FrameHandle frame = mQueue.Pop();
+		if ( !frame )
+		{
+			break;
+		}
+		Write( frame.get() );
+	}
+}
+
+///@endcond INTERNAL
+
+ThumbnailLane::ThumbnailLane( const Settings &settings )
+{
+	d = new ThumbnailLane::PrivateClass( settings );
+}
+
+ThumbnailLane::~ThumbnailLane()
+{
+	WaitForFinished();
+	delete d;
+	d = nullptr;
+}
+
+bool ThumbnailLane::Init( AVPixelFormat format, int width, int height )
+{
+	d->mLevel = DownscalePyramid::LevelForDivisor( d->mSettings.divisor );
+	if ( d->mLevel == 0 || !d->mPyramid.Init( format, width, height, d->mLevel ) || d->mPyramid.Levels() != d->mLevel )
+	{
+		fprintf( stderr, "Thumbnails cannot be made at 1/%d size\n", d->mSettings.divisor );
+		return false;
+	}
+	d->mFrameShells.Prefill( 2 );
+	return true;
+}
+
+bool ThumbnailLane::Start( const QString &takeFile, AVRational timeBase )
+{
+	if ( IsRunning() )
+	{
+		fprintf( stderr, "Thumbnails of the previous take are still being written\n" );
+		return false;
+	}
+	if ( !QDir().mkpath( d->mSettings.directory ) )
+	{
+		fprintf( stderr, "Could not create thumbnail directory %s\n", qUtf8Printable( d->mSettings.directory ) );
+		return false;
+	}
+	d->mBaseName = QFileInfo( takeFile ).completeBaseName();
+	d->mIntervalPts = qMax<int64_t>( 1, ( int64_t )d->mSettings.intervalSeconds * timeBase.den / qMax( 1, timeBase.num ) );
+	// every take starts at timestamp zero with a thumbnail
+	d->mNextPts = 0;
+	d->mThread = QtConcurrent::run( &d->mThreadPool, d, &ThumbnailLane::PrivateClass::ThreadFunction );
+	return true;
+}
+
+void ThumbnailLane::Offer( const AVFrame *frame )
+{
+	if ( frame->pts < d->mNextPts )
+	{
+		return;
+	}
+	// the grid of due timestamps stays put, a thumbnail missed while busy is not made up later
+	while ( d->mNextPts <= frame->pts )
+	{
+		d->mNextPts += d->mIntervalPts;
+	}
+	// single producer (the decoder thread), so the depth cannot grow between the check and the push
+	if ( d->mQueue.Gauge().depth >= 1 )
+	{
+		d->mSkipped++;
+		return;
+	}
+	FrameHandle shared = d->mFrameShells.Take();
+	if ( av_frame_ref( shared.get(), frame ) < 0 )
+	{
+		d->mSkipped++;
+		return;
+	}
+	d->mQueue.Push( std::move( shared ) );
+}
+
+void ThumbnailLane::EndOfStream()
+{
+	d->mQueue.Push( FrameHandle() );
+}
+
+void ThumbnailLane::WaitForFinished()
+{
+	d->mThread.waitForFinished();
+}
+
+bool ThumbnailLane::IsRunning() const
+{
+	return d->mThread.isRunning();
+}
+
+uint64_t ThumbnailLane::WrittenThumbnails() const
+{
+	return d->mWritten;
+}
+
+uint64_t ThumbnailLane::SkippedThumbnails() const
+{
+	return d->mSkipped;
+}
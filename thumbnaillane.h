@@ -0,0 +1,55 @@
+#ifndef THUMBNAILLANE_H
+#define THUMBNAILLANE_H
+
+#include <stdint.h>
+#include <QString>
+
+extern "C" {
+#include "deps/ffmpeg/include/libavutil/pixfmt.h"
+#include "deps/ffmpeg/include/libavutil/rational.h"
+}
+
+struct AVFrame;
+
+// JPEG thumbnail of a take every interval for the asset manager: the decoded picture is shared by reference,
+// downscaled by the pyramid and encoded on an idle priority thread. One picture waits at most, a due picture
+// arriving while the lane is busy is skipped, so the lane never holds up the recording.
+class ThumbnailLane
+{
+public:
+	struct Settings
+	{
+		QString directory;
+		int intervalSeconds = 10;
+		// power of two the picture size is divided by
+		int divisor = 8;
+		// JPEG quantizer, 2 (best) to 31
+		int quality = 4;
+	};
+
+	explicit ThumbnailLane( const Settings &settings );
+	~ThumbnailLane();
+
+	// decoded picture format and size
+	bool Init( AVPixelFormat format, int width, int height );
+	// thumbnails of the take are named after its file, <directory>/<base>_<frame>.jpg; the offered pictures carry
+	// timestamps in timeBase
+	bool Start( const QString &takeFile, AVRational timeBase );
+	// takes a reference to the picture (no copy) when a thumbnail is due and the lane is idle
+	void Offer( const AVFrame *frame );
+	void EndOfStream();
+	void WaitForFinished();
+	bool IsRunning() const;
+
+	uint64_t WrittenThumbnails() const;
+	uint64_t SkippedThumbnails() const;
+
+private:
+	ThumbnailLane( const ThumbnailLane & ) = delete;
+	ThumbnailLane &operator=( const ThumbnailLane & ) = delete;
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // THUMBNAILLANE_H
@@ -0,0 +1,303 @@
+#include "tracer.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+
+///@cond INTERNAL
+
+namespace
+{
+
+uint64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ( uint64_t )ts.tv_sec * 1000000000ull + ( uint64_t )ts.tv_nsec;
+}
+
+struct TraceEvent
+{
+	uint64_t beginNs;
+	uint64_t endNs;
+	int64_t frameId;
+	int64_t pts;
+	int span;
+};
+
+// single writer (owning thread), events are published through mCount so the buffer can be read at stop without locking
+struct ThreadBuffer
+{
+	long mThreadId = 0;
+	std::vector<TraceEvent> mEvents;
+	std::atomic<size_t> mCount;
+	std::atomic<uint64_t> mDropped;
+
+	explicit ThreadBuffer( size_t capacity )
+		: mEvents( capacity )
+	{
+		mCount = 0;
+		mDropped = 0;
+	}
+};
+
+// buffers allocated at start, one for each of the capture, decoder, encoder and writer threads
+const int PREALLOCATED_BUFFERS = 4;
+
+// every stage thread runs a single kind of work, so tracks are named after the stage that opened them
+const char *ThreadName( int span )
+{
+	switch ( span )
+	{
+		case Tracer::SpanCallback:
+		case Tracer::SpanPacketCopy:
+			return "capture";
+		case Tracer::SpanDecode:
+			return "decoder";
+		case Tracer::SpanWrite:
+			return "writer";
+		default:
+			return "encoder";
+	}
+}
+
+std::atomic<uint64_t> gNextSession( 1 );
+
+thread_local uint64_t tSession = 0;
+thread_local ThreadBuffer *tBuffer = nullptr;
+
+}
+
+class Tracer::PrivateClass
+{
+public:
+	std::atomic_bool mEnabled;
+	std::atomic<uint64_t> mSession;
+	size_t mEventsPerThread = 0;
+	uint64_t mStartNs = 0;
+
+	std::mutex mBuffersMutex;
+	std::vector<ThreadBuffer *> mBuffers;
+	// allocated at start and handed to threads on their first span, which so does not allocate
+	std::vector<ThreadBuffer *> mSpareBuffers;
+	// buffers of previous sessions are kept until destruction as a late span may still touch them
+	std::vector<ThreadBuffer *> mRetiredBuffers;
+
+	PrivateClass()
+	{
+		mEnabled = false;
+		mSession = 0;
+	}
+
+	ThreadBuffer *ThreadLocalBuffer();
+};
+
+ThreadBuffer *Tracer::PrivateClass::ThreadLocalBuffer()
+{
+	uint64_t session = mSession.load( std::memory_order_acquire );
+	if ( tSession == session && tBuffer != nullptr )
+	{
+		return tBuffer;
+	}
+
+	ThreadBuffer *buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> locker( mBuffersMutex );
+		if ( !mSpareBuffers.empty() )
+		{
+			buffer = mSpareBuffers.back();
+			mSpareBuffers.pop_back();
+		}
+		else
+		{
+			// more threads than expected
+			buffer = new ThreadBuffer( mEventsPerThread );
+		}
+		mBuffers.push_back( buffer );
+	}
+	buffer->mThreadId = syscall( SYS_gettid );
+	tSession = session;
+	tBuffer = buffer;
+	return buffer;
+}
+
+///@endcond INTERNAL
+
+Tracer::Scope::Scope( Tracer *tracer, Span span, int64_t frameId, int64_t pts )
+	: mTracer( tracer )
+	, mSpan( span )
+	, mFrameId( frameId )
+	, mPts( pts )
+	, mBeginNs( 0 )
+{
+	if ( mTracer && mTracer->IsEnabled() )
+	{
+		mBeginNs = NowNs();
+	}
+}
+
+Tracer::Scope::~Scope()
+{
+	if ( mBeginNs != 0 && mTracer->IsEnabled() )
+	{
+		mTracer->Record( mSpan, mFrameId, mPts, mBeginNs, NowNs() );
+	}
+}
+
+Tracer::Tracer()
+{
+	d = new Tracer::PrivateClass();
+}
+
+Tracer::~Tracer()
+{
+	Stop();
+	for ( ThreadBuffer *buffer : d->mBuffers )
+	{
+		delete buffer;
+	}
+	for ( ThreadBuffer *buffer : d->mRetiredBuffers )
+	{
+		delete buffer;
+	}
+	for ( ThreadBuffer *buffer : d->mSpareBuffers )
+	{
+		delete buffer;
+	}
+	delete d;
+	d = nullptr;
+}
+
+bool Tracer::Start( size_t eventsPerThread )
+{
+	if ( eventsPerThread == 0 )
+	{
+		return false;
+	}
+
+	Stop();
+	{
+		std::lock_guard<std::mutex> locker( d->mBuffersMutex );
+		d->mRetiredBuffers.insert( d->mRetiredBuffers.end(), d->mBuffers.begin(), d->mBuffers.end() );
+		d->mBuffers.clear();
+		// no thread has seen the spare buffers of the previous session
+		for ( ThreadBuffer *buffer : d->mSpareBuffers )
+		{
+			delete buffer;
+		}
+		d->mSpareBuffers.clear();
+		for ( int i = 0; i < PREALLOCATED_BUFFERS; i++ )
+		{
+			d->mSpareBuffers.push_back( new ThreadBuffer( eventsPerThread ) );
+		}
+	}
+	d->mEventsPerThread = eventsPerThread;
+	d->mStartNs = NowNs();
+	d->mSession.store( gNextSession.fetch_add( 1 ), std::memory_order_release );
+	d->mEnabled = true;
+	return true;
+}
+
+void Tracer::Stop()
+{
+	d->mEnabled = false;
+}
+
+bool Tracer::IsEnabled() const
+{
+	return d->mEnabled.load( std::memory_order_relaxed );
+}
+
+void Tracer::Record( Span span, int64_t frameId, int64_t pts, uint64_t beginNs, uint64_t endNs )
+{
+	ThreadBuffer *buffer = d->ThreadLocalBuffer();
+	size_t index = buffer->mCount.load( std::memory_order_relaxed );
+	if ( index >= buffer->mEvents.size() )
+	{
+		buffer->mDropped.fetch_add( 1, std::memory_order_relaxed );
+		return;
+	}
+
+	TraceEvent &event = buffer->mEvents[index];
+	event.beginNs = beginNs;
+	event.endNs = endNs;
+	event.frameId = frameId;
+	event.pts = pts;
+	event.span = span;
+	buffer->mCount.store( index + 1, std::memory_order_release );
+}
+
+bool Tracer::WriteChromeTrace( const char *path ) const
+{
+	FILE *file = fopen( path, "w" );
+	if ( !file )
+	{
+		fprintf( stderr, "Could not open trace file '%s'\n", path );
+		return false;
+	}
+
+	std::lock_guard<std::mutex> locker( d->mBuffersMutex );
+
+	long pid = getpid();
+	uint64_t dropped = 0;
+	bool first = true;
+	fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	for ( const ThreadBuffer *buffer : d->mBuffers )
+	{
+		size_t count = buffer->mCount.load( std::memory_order_acquire );
+		dropped += buffer->mDropped;
+		if ( count == 0 )
+		{
+			continue;
+		}
+
+		fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+				 first ? "" : ",\n", pid, buffer->mThreadId, ThreadName( buffer->mEvents[0].span ) );
+		first = false;
+
+		for ( size_t i = 0; i < count; i++ )
+		{
+			const TraceEvent &event = buffer->mEvents[i];
+			uint64_t beginNs = event.beginNs > d->mStartNs ? event.beginNs - d->mStartNs : 0;
+			fprintf( file, ",\n{\"name\":\"%s\",\"cat\":\"recorder\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%ld,\"pts\":%ld}}",
+					 SpanName( ( Span )event.span ), pid, buffer->mThreadId,
+					 beginNs / 1000.0, ( event.endNs - event.beginNs ) / 1000.0, event.frameId, event.pts );
+		}
+	}
+	fprintf( file, "\n]}\n" );
+	fclose( file );
+
+	if ( dropped > 0 )
+	{
+		fprintf( stderr, "Trace buffers overflowed, %lu spans were dropped\n", dropped );
+	}
+	fprintf( stdout, "Trace written to %s\n", path );
+	return true;
+}
+
+const char *Tracer::SpanName( Span span )
+{
+	switch ( span )
+	{
+		case SpanCallback:
+			return "callback";
+		case SpanPacketCopy:
+			return "packet copy";
+		case SpanDecode:
+			return "decode";
+		case SpanConversion:
+			return "conversion";
+		case SpanSendFrame:
+			return "send_frame";
+		case SpanReceivePacket:
+			return "receive_packet";
+		case SpanWrite:
+			return "interleaved write";
+		default:
+			return "unknown";
+	}
+}
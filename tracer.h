@@ -0,0 +1,59 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Tracer
+{
+public:
+	enum Span
+	{
+		SpanCallback = 0,
+		SpanPacketCopy,
+		SpanDecode,
+		SpanConversion,
+		SpanSendFrame,
+		SpanReceivePacket,
+		SpanWrite,
+		SpanCount
+	};
+
+	// records one complete span of the enclosing block into the calling thread's buffer
+	class Scope
+	{
+	public:
+		Scope( Tracer *tracer, Span span, int64_t frameId, int64_t pts );
+		~Scope();
+
+	private:
+		Scope( const Scope & ) = delete;
+		Scope &operator=( const Scope & ) = delete;
+
+		Tracer *mTracer;
+		Span mSpan;
+		int64_t mFrameId;
+		int64_t mPts;
+		uint64_t mBeginNs;
+	};
+
+	Tracer();
+	~Tracer();
+
+	bool Start( size_t eventsPerThread );
+	void Stop();
+	bool IsEnabled() const;
+
+	// writes all recorded spans as Chrome JSON trace (loadable by ui.perfetto.dev and chrome://tracing)
+	bool WriteChromeTrace( const char *path ) const;
+
+	static const char *SpanName( Span span );
+
+private:
+	void Record( Span span, int64_t frameId, int64_t pts, uint64_t beginNs, uint64_t endNs );
+
+	class PrivateClass;
+	PrivateClass *d;
+};
+
+#endif // TRACER_H